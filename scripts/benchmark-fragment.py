@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#coding: utf-8
+#file   : benchmark-fragment.py
+#
+# Throughput of the multi-key redis commands that nutcracker fragments
+# across servers, per command and number of keys:
+#
+#   $ ./benchmark-fragment.py [host] [port]
+
+import socket
+import sys
+import time
+
+commands = ['mget', 'mset', 'exists', 'touch', 'del', 'unlink']
+key_counts = [10, 100, 1000]
+total_keys = 200 * 1000
+pipeline = 16
+
+def encode(args):
+    out = [b'*%d\r\n' % len(args)]
+    for a in args:
+        out.append(b'$%d\r\n%s\r\n' % (len(a), a))
+    return b''.join(out)
+
+def request(cmd, nkey):
+    keys = [b'kf:%d' % i for i in range(nkey)]
+    if cmd == 'mset':
+        args = [b'mset']
+        for k in keys:
+            args += [k, b'v']
+        return encode(args)
+    return encode([cmd.encode()] + keys)
+
+def read_replies(sock, buf, n):
+    # every fragmented reply ends in a line, count the top level ones
+    done = 0
+    while done < n:
+        data = sock.recv(1 << 20)
+        if not data:
+            raise IOError('connection closed')
+        buf += data
+        while done < n:
+            rest = skip_reply(buf, 0)
+            if rest < 0:
+                break
+            buf = buf[rest:]
+            done += 1
+    return buf
+
+def skip_reply(buf, pos):
+    end = buf.find(b'\r\n', pos)
+    if end < 0:
+        return -1
+    kind = buf[pos:pos + 1]
+    if kind in (b'+', b'-', b':'):
+        return end + 2
+    if kind == b'$':
+        n = int(buf[pos + 1:end])
+        if n < 0:
+            return end + 2
+        if len(buf) < end + 2 + n + 2:
+            return -1
+        return end + 2 + n + 2
+    if kind == b'*':
+        n = int(buf[pos + 1:end])
+        pos = end + 2
+        for _ in range(max(n, 0)):
+            pos = skip_reply(buf, pos)
+            if pos < 0:
+                return -1
+        return pos
+    raise IOError('bad reply %r' % buf[pos:pos + 32])
+
+def benchmark(host, port, cmd, nkey):
+    sock = socket.create_connection((host, port))
+    req = request(cmd, nkey)
+    nreq = max(total_keys // nkey, pipeline)
+    buf = b''
+    start = time.time()
+    sent = 0
+    while sent < nreq:
+        batch = min(pipeline, nreq - sent)
+        sock.sendall(req * batch)
+        buf = read_replies(sock, buf, batch)
+        sent += batch
+    elapsed = time.time() - start
+    sock.close()
+    return nreq / elapsed, nreq * nkey / elapsed
+
+def main():
+    host = sys.argv[1] if len(sys.argv) > 1 else '127.0.0.1'
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 22121
+    for cmd in commands:
+        for nkey in key_counts:
+            rps, kps = benchmark(host, port, cmd, nkey)
+            print('%-7s keys=%-5d %10.0f req/s %12.0f keys/s' % (cmd, nkey, rps, kps))
+
+if __name__ == '__main__':
+    main()
@@ -40,35 +40,227 @@ ketama_hash(const char *key, size_t key_length, uint32_t alignment)
         | (results[0 + alignment * 4] & 0xFF);
 }
 
+/*
+ * Order points by value, and points of the same value by server and point
+ * index, so that a patched continuum is the same as a rebuilt one
+ */
 static int
 ketama_item_cmp(const void *t1, const void *t2)
 {
     const struct continuum *ct1 = t1, *ct2 = t2;
 
-    if (ct1->value == ct2->value) {
-        return 0;
-    } else if (ct1->value > ct2->value) {
-        return 1;
-    } else {
-        return -1;
+    if (ct1->value != ct2->value) {
+        return ct1->value > ct2->value ? 1 : -1;
+    }
+
+    if (ct1->index != ct2->index) {
+        return ct1->index > ct2->index ? 1 : -1;
+    }
+
+    if (ct1->pindex != ct2->pindex) {
+        return ct1->pindex > ct2->pindex ? 1 : -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Number of points a live server owns on the continuum, proportional to
+ * its share of the total live weight
+ */
+static uint32_t
+ketama_npoint(struct server *server, uint32_t total_weight,
+              uint32_t nlive_server)
+{
+    float pct;
+
+    pct = (float)server->weight / (float)total_weight;
+
+    return (uint32_t) ((floorf((float) (pct * KETAMA_POINTS_PER_SERVER / 4 * (float)nlive_server + 0.0000000001))) * 4);
+}
+
+/*
+ * Cache the first npoint points of a server. The points of a server only
+ * depend on its name, so md5 is computed once per point for the lifetime
+ * of the server rather than on every rebuild.
+ */
+static rstatus_t
+ketama_point_cache(struct server *server, uint32_t npoint)
+{
+    uint32_t *point;
+    uint32_t pointer_index, pointer_per_hash, x;
+
+    if (npoint <= server->npoint) {
+        return NC_OK;
+    }
+
+    point = nc_realloc(server->point, sizeof(*point) * npoint);
+    if (point == NULL) {
+        return NC_ENOMEM;
+    }
+    server->point = point;
+
+    pointer_per_hash = 4;
+    for (pointer_index = server->npoint / pointer_per_hash + 1;
+         pointer_index <= npoint / pointer_per_hash;
+         pointer_index++) {
+
+        char host[KETAMA_MAX_HOSTLEN]= "";
+        size_t hostlen;
+
+        hostlen = snprintf(host, KETAMA_MAX_HOSTLEN, "%.*s-%u",
+                           server->name.len, server->name.data,
+                           pointer_index - 1);
+        if (hostlen > KETAMA_MAX_HOSTLEN) {
+            hostlen = KETAMA_MAX_HOSTLEN;
+        }
+
+        for (x = 0; x < pointer_per_hash; x++) {
+            point[(pointer_index - 1) * pointer_per_hash + x] =
+                ketama_hash(host, hostlen, x);
+        }
+    }
+    server->npoint = npoint;
+
+    return NC_OK;
+}
+
+/*
+ * Rebuild the whole continuum from the cached points of the live servers
+ */
+static void
+ketama_rebuild(struct server_pool *pool, uint32_t total_weight, int64_t now)
+{
+    uint32_t nserver, server_index, continuum_index, npoint, i;
+
+    nserver = array_n(&pool->server);
+    continuum_index = 0;
+    for (server_index = 0; server_index < nserver; server_index++) {
+        struct server *server = array_get(&pool->server, server_index);
+
+        if (pool->auto_eject_hosts && server->next_retry > now) {
+            server->ncontinuum = 0;
+            continue;
+        }
+
+        npoint = ketama_npoint(server, total_weight, pool->nlive_server);
+
+        log_debug(LOG_VERB, "%.*s weight %"PRIu32" of %"PRIu32" "
+                  "points per server %"PRIu32"", server->name.len,
+                  server->name.data, server->weight, total_weight, npoint);
+
+        for (i = 0; i < npoint; i++) {
+            pool->continuum[continuum_index].index = server_index;
+            pool->continuum[continuum_index].pindex = i;
+            pool->continuum[continuum_index++].value = server->point[i];
+        }
+        server->ncontinuum = npoint;
+    }
+
+    pool->ncontinuum = continuum_index;
+    qsort(pool->continuum, pool->ncontinuum, sizeof(*pool->continuum),
+          ketama_item_cmp);
+}
+
+
+/*
+ * Patch the continuum in place: remove the points of ejected servers and
+ * the points other servers lose, then merge in the points of readmitted
+ * servers and the points other servers gain, keeping it sorted. Only the
+ * changed points are sorted; the rest is linear in the continuum.
+ */
+static rstatus_t
+ketama_patch(struct server_pool *pool, uint32_t total_weight, int64_t now,
+             uint32_t nadd)
+{
+    struct continuum *add, *dst, *a, *b;
+    uint32_t nserver, server_index, nadd_index, npoint, i, j;
+
+    nserver = array_n(&pool->server);
+
+    add = NULL;
+    if (nadd > 0) {
+        add = nc_alloc(sizeof(*add) * nadd);
+        if (add == NULL) {
+            return NC_ENOMEM;
+        }
+    }
+
+    nadd_index = 0;
+    for (server_index = 0; server_index < nserver; server_index++) {
+        struct server *server = array_get(&pool->server, server_index);
+        bool live = !pool->auto_eject_hosts || server->next_retry <= now;
+
+        /* marks the points of the server beyond npoint for removal below */
+        npoint = live ? ketama_npoint(server, total_weight,
+                                      pool->nlive_server) : 0;
+        for (i = server->ncontinuum; i < npoint; i++) {
+            add[nadd_index].index = server_index;
+            add[nadd_index].pindex = i;
+            add[nadd_index++].value = server->point[i];
+        }
+        server->ncontinuum = npoint;
+    }
+    ASSERT(nadd_index == nadd);
+
+    /* drops the points of each server from its new npoint on */
+    for (i = 0, j = 0; i < pool->ncontinuum; i++) {
+        struct server *server;
+
+        server = array_get(&pool->server, pool->continuum[i].index);
+        if (pool->continuum[i].pindex >= server->ncontinuum) {
+            continue;
+        }
+        pool->continuum[j++] = pool->continuum[i];
+    }
+
+    if (nadd == 0) {
+        pool->ncontinuum = j;
+        return NC_OK;
     }
+
+    qsort(add, nadd, sizeof(*add), ketama_item_cmp);
+
+    /* merge from the back so that no unread point is overwritten */
+    a = pool->continuum + j;
+    b = add + nadd;
+    dst = pool->continuum + j + nadd;
+    while (b > add) {
+        if (a > pool->continuum && ketama_item_cmp(a - 1, b - 1) > 0) {
+            *--dst = *--a;
+        } else {
+            *--dst = *--b;
+        }
+    }
+    pool->ncontinuum = j + nadd;
+
+    nc_free(add);
+
+    return NC_OK;
 }
 
+/*
+ * Update the continuum on start and whenever a server is ejected or
+ * readmitted. The continuum is built once and then patched in place with
+ * the points that changed, which gives the same continuum as a rebuild
+ * from scratch without its md5 and sort of every point.
+ */
 rstatus_t
 ketama_update(struct server_pool *pool)
 {
     uint32_t nserver;             /* # server - live and dead */
     uint32_t nlive_server;        /* # live server */
-    uint32_t pointer_per_server;  /* pointers per server proportional to weight */
-    uint32_t pointer_per_hash;    /* pointers per hash */
-    uint32_t pointer_counter;     /* # pointers on continuum */
-    uint32_t pointer_index;       /* pointer index */
     uint32_t points_per_server;   /* points per server */
-    uint32_t continuum_index;     /* continuum index */
     uint32_t continuum_addition;  /* extra space in the continuum */
     uint32_t server_index;        /* server index */
-    uint32_t value;               /* continuum value */
+    uint32_t pointer_index;       /* pointer index */
     uint32_t total_weight;        /* total live server weight */
+    uint32_t npoint;              /* # points of a live server */
+    uint32_t ntotal;              /* # points of all live servers */
+    uint32_t nadd;                /* # points of readmitted servers */
+    uint32_t nremove;             /* # points of ejected servers */
+    bool patch;                   /* patch the continuum in place? */
+    rstatus_t status;             /* return status */
     int64_t now;                  /* current timestamp in usec */
 
     ASSERT(array_n(&pool->server) > 0);
@@ -121,17 +313,50 @@ ketama_update(struct server_pool *pool)
               "%"PRIu32" '%.*s'", nlive_server, nserver, pool->idx,
               pool->name.len, pool->name.data);
 
+    /*
+     * Cache the points of live servers, and count the points that are
+     * removed from and added to the continuum
+     */
+    patch = (pool->continuum != NULL);
+    ntotal = 0;
+    nadd = 0;
+    nremove = 0;
+    for (server_index = 0; server_index < nserver; server_index++) {
+        struct server *server = array_get(&pool->server, server_index);
+
+        if (pool->auto_eject_hosts && server->next_retry > now) {
+            nremove += server->ncontinuum;
+            continue;
+        }
+
+        npoint = ketama_npoint(server, total_weight, nlive_server);
+        status = ketama_point_cache(server, npoint);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        if (npoint > server->ncontinuum) {
+            nadd += npoint - server->ncontinuum;
+        } else {
+            nremove += server->ncontinuum - npoint;
+        }
+        ntotal += npoint;
+    }
+
     continuum_addition = KETAMA_CONTINUUM_ADDITION;
     points_per_server = KETAMA_POINTS_PER_SERVER;
     /*
      * Allocate the continuum for the pool, the first time, and every time we
      * add a new server to the pool
      */
-    if (nlive_server > pool->nserver_continuum) {
+    if (nlive_server > pool->nserver_continuum ||
+        ntotal > pool->nserver_continuum * points_per_server) {
         struct continuum *continuum;
         uint32_t nserver_continuum = nlive_server + continuum_addition;
         uint32_t ncontinuum = nserver_continuum * points_per_server;
 
+        ASSERT(ntotal <= ncontinuum);
+
         continuum = nc_realloc(pool->continuum, sizeof(*continuum) * ncontinuum);
         if (continuum == NULL) {
             return NC_ENOMEM;
@@ -142,75 +367,28 @@ ketama_update(struct server_pool *pool)
         /* pool->ncontinuum is initialized later as it could be <= ncontinuum */
     }
 
-    /*
-     * Build a continuum with the servers that are live and points from
-     * these servers that are proportial to their weight
-     */
-    continuum_index = 0;
-    pointer_counter = 0;
-    for (server_index = 0; server_index < nserver; server_index++) {
-        struct server *server;
-        float pct;
-
-        server = array_get(&pool->server, server_index);
-
-        if (pool->auto_eject_hosts && server->next_retry > now) {
-            continue;
-        }
-
-        pct = (float)server->weight / (float)total_weight;
-        pointer_per_server = (uint32_t) ((floorf((float) (pct * KETAMA_POINTS_PER_SERVER / 4 * (float)nlive_server + 0.0000000001))) * 4);
-        pointer_per_hash = 4;
-
-        log_debug(LOG_VERB, "%.*s weight %"PRIu32" of %"PRIu32" "
-                  "pct %0.5f points per server %"PRIu32"",
-                  server->name.len, server->name.data, server->weight,
-                  total_weight, pct, pointer_per_server);
-
-        for (pointer_index = 1;
-             pointer_index <= pointer_per_server / pointer_per_hash;
-             pointer_index++) {
-
-            char host[KETAMA_MAX_HOSTLEN]= "";
-            size_t hostlen;
-            uint32_t x;
-
-            hostlen = snprintf(host, KETAMA_MAX_HOSTLEN, "%.*s-%u",
-                               server->name.len, server->name.data,
-                               pointer_index - 1);
-            if (hostlen > KETAMA_MAX_HOSTLEN) {
-                hostlen = KETAMA_MAX_HOSTLEN;
-            }
-
-            for (x = 0; x < pointer_per_hash; x++) {
-                value = ketama_hash(host, hostlen, x);
-                pool->continuum[continuum_index].index = server_index;
-                pool->continuum[continuum_index++].value = value;
-            }
+    if (patch) {
+        status = ketama_patch(pool, total_weight, now, nadd);
+        if (status != NC_OK) {
+            return status;
         }
-        pointer_counter += pointer_per_server;
+    } else {
+        ketama_rebuild(pool, total_weight, now);
     }
+    ASSERT(pool->ncontinuum == ntotal);
 
-    pool->ncontinuum = pointer_counter;
-    qsort(pool->continuum, pool->ncontinuum, sizeof(*pool->continuum),
-          ketama_item_cmp);
-
-    for (pointer_index = 0;
-         pointer_index < ((nlive_server * KETAMA_POINTS_PER_SERVER) - 1);
+    for (pointer_index = 0; pointer_index + 1 < pool->ncontinuum;
          pointer_index++) {
-        if (pointer_index + 1 >= pointer_counter) {
-            break;
-        }
-        ASSERT(pool->continuum[pointer_index].value <=
-               pool->continuum[pointer_index + 1].value);
+        ASSERT(ketama_item_cmp(&pool->continuum[pointer_index],
+                               &pool->continuum[pointer_index + 1]) <= 0);
     }
 
-    log_debug(LOG_VERB, "updated pool %"PRIu32" '%.*s' with %"PRIu32" of "
-              "%"PRIu32" servers live in %"PRIu32" slots and %"PRIu32" "
-              "active points in %"PRIu32" slots", pool->idx,
-              pool->name.len, pool->name.data, nlive_server, nserver,
-              pool->nserver_continuum, pool->ncontinuum,
-              (pool->nserver_continuum + continuum_addition) * points_per_server);
+    log_debug(LOG_VERB, "%s pool %"PRIu32" '%.*s' with %"PRIu32" of "
+              "%"PRIu32" servers live, %"PRIu32" points removed and "
+              "%"PRIu32" added, %"PRIu32" active points in %"PRIu32" slots",
+              patch ? "patched" : "rebuilt", pool->idx, pool->name.len,
+              pool->name.data, nlive_server, nserver, nremove, nadd,
+              pool->ncontinuum, pool->nserver_continuum * points_per_server);
 
     return NC_OK;
 }
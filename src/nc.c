@@ -29,6 +29,7 @@
 #include <nc_conf.h>
 #include <nc_signal.h>
 #include <nc_process.h>
+#include <nc_upgrade.h>
 
 #define NC_CONF_PATH        "conf/nutcracker.yml"
 
@@ -62,6 +63,7 @@ struct command_signal {
 static struct command_signal command_signals[] = {
     { "reload",    SIGHUP  },
     { "reopen",    SIGUSR1 },
+    { "upgrade",   SIGUSR2 },
     { "stop",      SIGTERM },
     { "shutdown",  SIGTERM }
 };
@@ -221,7 +223,7 @@ nc_show_usage(void)
         "Usage: nutcracker [-?hVdDt] [-v verbosity level] [-o output file]" CRLF
         "                  [-c conf file] [-s stats port] [-a stats addr]" CRLF
         "                  [-i stats interval] [-p pid file] [-m mbuf size]" CRLF
-        "                  [-k signal(shudown,stop,reload,reopen)]" CRLF
+        "                  [-k signal(shudown,stop,reload,reopen,upgrade)]" CRLF
         "");
     log_stderr(
         "Options:" CRLF
@@ -625,6 +627,7 @@ main(int argc, char **argv)
     nci.id = -1;
     nci.role = ROLE_MASTER;
     nci.chan = NULL;
+    nci.handoff = NULL;
     nci.workers.nelem = 0;
     master_nci = &nci;
 
@@ -663,6 +666,8 @@ main(int argc, char **argv)
         exit(0);
     }
 
+    upgrade_init(argv);
+
     status = nc_pre_run(&nci);
     if (status != NC_OK) {
         nc_post_run(&nci);
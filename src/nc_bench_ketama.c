@@ -0,0 +1,274 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the ketama continuum updates done inside the event loop
+ * when a server is ejected or readmitted with auto_eject_hosts.
+ *
+ *   $ make -C src nc_bench_ketama
+ *   $ ./src/nc_bench_ketama [nserver ...]
+ *
+ * For every pool size (100 and 1000 servers by default) it reports the
+ * time of a rebuild from scratch, which is what every eject and readmit
+ * used to cost, and the time of an in place eject and readmit. The time
+ * of an update is the time the event loop stalls. Build without
+ * --enable-debug, as debug builds check the whole continuum on update.
+ * It exits with 1 if a patched continuum differs from a rebuilt one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+#include <nc_process.h>
+
+#define BENCH_NROUND    50
+#define BENCH_NLOOKUP   100000
+
+/* nc_log tags every line with the role of the process */
+char pm_myrole = ROLE_MASTER;
+
+struct bench_result {
+    int64_t total;  /* total nsec */
+    int64_t max;    /* max nsec */
+};
+
+static int64_t
+bench_nsec_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+bench_record(struct bench_result *r, int64_t start)
+{
+    int64_t elapsed = bench_nsec_now() - start;
+
+    r->total += elapsed;
+    if (elapsed > r->max) {
+        r->max = elapsed;
+    }
+}
+
+static void
+bench_report(const char *what, uint32_t nserver, struct bench_result *r)
+{
+    printf("%5"PRIu32" servers %-10s avg %8.1f usec  max %8.1f usec\n",
+           nserver, what, (double)r->total / BENCH_NROUND / 1000.0,
+           (double)r->max / 1000.0);
+}
+
+static void
+bench_update(struct server_pool *pool)
+{
+    if (ketama_update(pool) != NC_OK) {
+        fprintf(stderr, "ketama update failed\n");
+        exit(1);
+    }
+}
+
+/* drop the continuum and the cached points, as before a first update */
+static void
+bench_reset(struct server_pool *pool)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        struct server *server = array_get(&pool->server, i);
+
+        if (server->point != NULL) {
+            nc_free(server->point);
+            server->point = NULL;
+        }
+        server->npoint = 0;
+        server->ncontinuum = 0;
+    }
+
+    if (pool->continuum != NULL) {
+        nc_free(pool->continuum);
+        pool->continuum = NULL;
+    }
+    pool->ncontinuum = 0;
+    pool->nserver_continuum = 0;
+}
+
+/* count lookups that land on another server than in the reference */
+static uint32_t
+bench_mismatch(struct server_pool *pool, struct continuum *ref, uint32_t nref)
+{
+    uint32_t i, hash, nmismatch;
+
+    nmismatch = 0;
+    for (i = 0; i < BENCH_NLOOKUP; i++) {
+        hash = (uint32_t)random() ^ ((uint32_t)random() << 16);
+        if (ketama_dispatch(pool->continuum, pool->ncontinuum, hash) !=
+            ketama_dispatch(ref, nref, hash)) {
+            nmismatch++;
+        }
+    }
+
+    return nmismatch;
+}
+
+/* is the continuum of pool point by point the same as the reference? */
+static bool
+bench_same(struct server_pool *pool, struct continuum *ref, uint32_t nref)
+{
+    return pool->ncontinuum == nref &&
+           memcmp(pool->continuum, ref, sizeof(*ref) * nref) == 0;
+}
+
+/*
+ * Returns the number of lookups, and continuums, that differ from a
+ * rebuild
+ */
+static uint32_t
+bench_run(uint32_t nserver)
+{
+    struct server_pool pool;
+    struct bench_result cold, eject, readmit;
+    struct server *server;
+    struct continuum *ref;
+    char *names;
+    uint32_t i, nref, nmismatch, ndiffer;
+    int64_t start;
+
+    memset(&pool, 0, sizeof(pool));
+    string_set_text(&pool.name, "bench");
+    pool.auto_eject_hosts = 1;
+    if (array_init(&pool.server, nserver, sizeof(struct server)) != NC_OK) {
+        exit(1);
+    }
+
+    names = nc_alloc((size_t)nserver * 32);
+    if (names == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; i < nserver; i++) {
+        char *name = names + (size_t)i * 32;
+
+        server = array_push(&pool.server);
+        memset(server, 0, sizeof(*server));
+        server->idx = i;
+        server->owner = &pool;
+        server->weight = 1;
+        server->name.len = (uint32_t)snprintf(name, 32, "10.0.%u.%u:11211",
+                                              i / 256, i % 256);
+        server->name.data = (uint8_t *)name;
+    }
+
+    memset(&cold, 0, sizeof(cold));
+    for (i = 0; i < BENCH_NROUND; i++) {
+        bench_reset(&pool);
+        start = bench_nsec_now();
+        bench_update(&pool);
+        bench_record(&cold, start);
+    }
+
+    nref = pool.ncontinuum;
+    ref = nc_alloc(sizeof(*ref) * nref);
+    if (ref == NULL) {
+        exit(1);
+    }
+    memcpy(ref, pool.continuum, sizeof(*ref) * nref);
+
+    memset(&eject, 0, sizeof(eject));
+    memset(&readmit, 0, sizeof(readmit));
+    for (i = 0; i < BENCH_NROUND; i++) {
+        server = array_get(&pool.server, (uint32_t)random() % nserver);
+
+        server->next_retry = nc_usec_now() + 60000000LL;
+        start = bench_nsec_now();
+        bench_update(&pool);
+        bench_record(&eject, start);
+
+        server->next_retry = 1LL;
+        start = bench_nsec_now();
+        bench_update(&pool);
+        bench_record(&readmit, start);
+    }
+
+    nmismatch = bench_mismatch(&pool, ref, nref);
+    ndiffer = bench_same(&pool, ref, nref) ? 0 : 1;
+
+    /* an in place eject must give the continuum of a rebuild */
+    server = array_get(&pool.server, 0);
+    server->next_retry = nc_usec_now() + 60000000LL;
+    bench_update(&pool);
+    nc_free(ref);
+    nref = pool.ncontinuum;
+    ref = nc_alloc(sizeof(*ref) * nref);
+    if (ref == NULL) {
+        exit(1);
+    }
+    memcpy(ref, pool.continuum, sizeof(*ref) * nref);
+    bench_reset(&pool);
+    bench_update(&pool);
+    nmismatch += bench_mismatch(&pool, ref, nref);
+    ndiffer += bench_same(&pool, ref, nref) ? 0 : 1;
+
+    bench_report("rebuild", nserver, &cold);
+    bench_report("eject", nserver, &eject);
+    bench_report("readmit", nserver, &readmit);
+    printf("%5"PRIu32" servers %"PRIu32" of %d lookups and %"PRIu32" of 2 "
+           "continuums differ from a rebuild\n", nserver, nmismatch,
+           2 * BENCH_NLOOKUP, ndiffer);
+
+    bench_reset(&pool);
+    nc_free(ref);
+    nc_free(names);
+    while (array_n(&pool.server) > 0) {
+        array_pop(&pool.server);
+    }
+    array_deinit(&pool.server);
+
+    return nmismatch + ndiffer;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t nmismatch;
+    int i;
+
+    log_init(LOG_WARN, NULL);
+
+    nmismatch = 0;
+    if (argc < 2) {
+        nmismatch += bench_run(100);
+        nmismatch += bench_run(1000);
+    }
+
+    for (i = 1; i < argc; i++) {
+        nmismatch += bench_run((uint32_t)atoi(argv[i]));
+    }
+
+    if (nmismatch != 0) {
+        fprintf(stderr, "patched continuum differs from a rebuild\n");
+        return 1;
+    }
+
+    return 0;
+}
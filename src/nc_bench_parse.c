@@ -0,0 +1,241 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the memcache request parsers, ASCII against binary.
+ *
+ *   $ make -C src nc_bench_parse
+ *   $ ./src/nc_bench_parse [nmsg]
+ *
+ * An mbuf is filled with copies of one request, which are then parsed
+ * one msg at a time, as the proxy does on a client connection. The
+ * requests are a ten key get (get k1 .. k10 against a run of nine getkq
+ * ended by a getk) and a set of a 100 byte value. It reports the time
+ * per request and the bytes parsed per second. Build without
+ * --enable-debug, as debug builds log and assert in the parsers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <nc.h>
+#include <nc_core.h>
+#include <nc_proto.h>
+
+#define BENCH_NMSG      1000000
+#define BENCH_NKEY      10
+#define BENCH_VLEN      100
+
+/* nc_signal refers to it, which is otherwise defined next to main in nc.c */
+void
+nc_post_run(struct instance *nci)
+{
+}
+
+struct bench_req {
+    const char *name;   /* request name */
+    bool       binary;  /* binary protocol? */
+    uint8_t    *data;   /* request bytes */
+    size_t     len;     /* request length */
+};
+
+static int64_t
+bench_nsec_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t
+bench_bin_header(uint8_t *p, uint8_t opcode, size_t keylen, size_t extlen,
+                 size_t vlen)
+{
+    uint32_t bodylen = (uint32_t)(extlen + keylen + vlen);
+
+    memset(p, 0, 24);
+    p[0] = 0x80;
+    p[1] = opcode;
+    p[2] = (uint8_t)(keylen >> 8);
+    p[3] = (uint8_t)keylen;
+    p[4] = (uint8_t)extlen;
+    p[8] = (uint8_t)(bodylen >> 24);
+    p[9] = (uint8_t)(bodylen >> 16);
+    p[10] = (uint8_t)(bodylen >> 8);
+    p[11] = (uint8_t)bodylen;
+
+    return 24 + bodylen;
+}
+
+static void
+bench_ascii_get(struct bench_req *req)
+{
+    uint8_t *p;
+    int i;
+
+    p = req->data = nc_zalloc(1024);
+    p += sprintf((char *)p, "get");
+    for (i = 0; i < BENCH_NKEY; i++) {
+        p += sprintf((char *)p, " bench:key:%d", i);
+    }
+    p += sprintf((char *)p, "\r\n");
+
+    req->name = "ascii get";
+    req->binary = false;
+    req->len = (size_t)(p - req->data);
+}
+
+static void
+bench_ascii_set(struct bench_req *req)
+{
+    uint8_t *p;
+
+    p = req->data = nc_zalloc(1024);
+    p += sprintf((char *)p, "set bench:key:0 0 0 %d\r\n", BENCH_VLEN);
+    memset(p, 'v', BENCH_VLEN);
+    p += BENCH_VLEN;
+    p += sprintf((char *)p, "\r\n");
+
+    req->name = "ascii set";
+    req->binary = false;
+    req->len = (size_t)(p - req->data);
+}
+
+static void
+bench_bin_get(struct bench_req *req)
+{
+    uint8_t *p;
+    size_t keylen;
+    int i;
+
+    p = req->data = nc_zalloc(1024);
+    for (i = 0; i < BENCH_NKEY; i++) {
+        keylen = (size_t)sprintf((char *)p + 24, "bench:key:%d", i);
+        /* getkq for all but the last key, which is a getk */
+        p += bench_bin_header(p, i < BENCH_NKEY - 1 ? 0x0d : 0x0c, keylen,
+                              0, 0);
+    }
+
+    req->name = "binary get";
+    req->binary = true;
+    req->len = (size_t)(p - req->data);
+}
+
+static void
+bench_bin_set(struct bench_req *req)
+{
+    uint8_t *p;
+    size_t keylen;
+
+    p = req->data = nc_zalloc(1024);
+    keylen = (size_t)sprintf((char *)p + 24 + 8, "bench:key:0");
+    memset(p + 24 + 8 + keylen, 'v', BENCH_VLEN);
+    p += bench_bin_header(p, 0x01, keylen, 8, BENCH_VLEN);
+
+    req->name = "binary set";
+    req->binary = true;
+    req->len = (size_t)(p - req->data);
+}
+
+static void
+bench_run(struct bench_req *req, uint32_t nmsg)
+{
+    struct conn conn;
+    struct mbuf *mbuf;
+    struct msg *msg;
+    uint8_t *pos;
+    uint32_t i, nreq;
+    int64_t start, elapsed;
+
+    memset(&conn, 0, sizeof(conn));
+    conn.client = 1;
+    conn.binary = req->binary ? 1 : 0;
+
+    mbuf = mbuf_get();
+    if (mbuf == NULL) {
+        exit(1);
+    }
+
+    for (nreq = 0; mbuf_size(mbuf) >= req->len; nreq++) {
+        mbuf_copy(mbuf, req->data, req->len);
+    }
+
+    pos = mbuf->pos;
+    start = bench_nsec_now();
+    for (i = 0; i < nmsg; i++) {
+        if (pos == mbuf->last) {
+            pos = mbuf->pos;
+        }
+
+        msg = msg_get(&conn, true, false);
+        if (msg == NULL) {
+            exit(1);
+        }
+        mbuf_insert(&msg->mhdr, mbuf);
+        msg->pos = pos;
+
+        msg->parser(msg);
+        if (msg->result != MSG_PARSE_OK || msg->pos != pos + req->len) {
+            fprintf(stderr, "%s: parse failed\n", req->name);
+            exit(1);
+        }
+        pos = msg->pos;
+
+        mbuf_remove(&msg->mhdr, mbuf);
+        msg_put(msg);
+    }
+    elapsed = bench_nsec_now() - start;
+
+    printf("%-10s %4zu bytes %3"PRIu32" per mbuf %8.1f nsec/req "
+           "%8.1f MB/s\n", req->name, req->len, nreq,
+           (double)elapsed / nmsg,
+           (double)req->len * nmsg * 1000.0 / (double)elapsed);
+
+    mbuf_put(mbuf);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct instance nci;
+    struct bench_req req[4];
+    uint32_t i, nmsg;
+
+    nmsg = argc > 1 ? (uint32_t)atoi(argv[1]) : BENCH_NMSG;
+
+    log_init(LOG_WARN, NULL);
+
+    memset(&nci, 0, sizeof(nci));
+    nci.mbuf_chunk_size = MBUF_SIZE;
+    mbuf_init(&nci);
+    msg_init();
+
+    bench_ascii_get(&req[0]);
+    bench_bin_get(&req[1]);
+    bench_ascii_set(&req[2]);
+    bench_bin_set(&req[3]);
+
+    for (i = 0; i < NELEMS(req); i++) {
+        bench_run(&req[i], nmsg);
+        nc_free(req[i].data);
+    }
+
+    return 0;
+}
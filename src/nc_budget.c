@@ -0,0 +1,315 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_budget.h>
+
+/* budget of each server of pool, never below one connection per worker */
+static uint32_t
+budget_total(struct server_pool *pool, uint32_t nworker)
+{
+    return MAX((uint32_t)pool->server_connections_total, nworker);
+}
+
+/* connections a worker wants, at least one and at most server_connections */
+static uint32_t
+budget_want(struct server_pool *pool, struct budget_slot *slot)
+{
+    return MIN(MAX(slot->demand, 1U), pool->server_connections);
+}
+
+/*
+ * Map a connection budget for nworker workers, for the servers of the
+ * pools in server_pool that set server_connections_total, and split it
+ * evenly among the first nactive until the workers tell their wants. The
+ * budget is NULL when no pool sets one.
+ */
+rstatus_t
+budget_create(struct array *server_pool, uint32_t nworker, uint32_t nactive,
+              struct budget **budget)
+{
+    struct budget *b;
+    struct server_pool *sp;
+    uint32_t i, j, w, k, nserver, share;
+    size_t size;
+
+    ASSERT(nactive > 0 && nactive <= nworker);
+
+    *budget = NULL;
+
+    nserver = 0;
+    for (i = 0; i < array_n(server_pool); i++) {
+        sp = array_get(server_pool, i);
+        if (sp->server_connections_total > 0) {
+            nserver += array_n(&sp->server);
+        }
+    }
+
+    if (nserver == 0) {
+        return NC_OK;
+    }
+
+    size = sizeof(*b) + sizeof(b->slot[0]) * (nserver * nworker - 1);
+    b = nc_shared_mem_alloc(size);
+    if (b == NULL) {
+        log_error("map of connection budget of %zu bytes failed: %s", size,
+                  strerror(errno));
+        return NC_ENOMEM;
+    }
+
+    b->lock = 0;
+    b->nworker = nworker;
+    b->nactive = nactive;
+    b->nserver = nserver;
+    b->size = size;
+
+    for (i = 0, k = 0; i < array_n(server_pool); i++) {
+        sp = array_get(server_pool, i);
+        if (sp->server_connections_total == 0) {
+            continue;
+        }
+
+        share = MIN(sp->server_connections,
+                    budget_total(sp, nactive) / nactive);
+
+        for (j = 0; j < array_n(&sp->server); j++, k++) {
+            for (w = 0; w < nworker; w++) {
+                b->slot[k * nworker + w].used = 0;
+                b->slot[k * nworker + w].demand = 0;
+                b->slot[k * nworker + w].share = share;
+            }
+        }
+    }
+
+    log_debug(LOG_INFO, "connection budget for %"PRIu32" servers and %"PRIu32
+              " of %"PRIu32" workers", nserver, nactive, nworker);
+
+    *budget = b;
+
+    return NC_OK;
+}
+
+/*
+ * Point the servers of ctx, the context of worker idx, at their slots in
+ * budget. Servers are laid out in pool order, as in budget_create.
+ */
+void
+budget_attach(struct context *ctx, struct budget *budget, uint32_t idx)
+{
+    struct server_pool *sp;
+    struct server *server;
+    uint32_t i, j, k;
+
+    ctx->budget = budget;
+    ctx->budget_idx = idx;
+
+    if (budget == NULL) {
+        return;
+    }
+
+    ASSERT(idx < budget->nworker);
+
+    for (i = 0, k = 0; i < array_n(&ctx->pool); i++) {
+        sp = array_get(&ctx->pool, i);
+        if (sp->server_connections_total == 0) {
+            continue;
+        }
+
+        for (j = 0; j < array_n(&sp->server); j++, k++) {
+            server = array_get(&sp->server, j);
+            server->budget = &budget->slot[k * budget->nworker + idx];
+        }
+    }
+
+    ASSERT(k == budget->nserver);
+}
+
+/*
+ * Take the servers of ctx out of the budget, for a worker that drains its
+ * clients before it exits. Its slots are left to the worker that may
+ * later be spawned in its place.
+ */
+void
+budget_detach(struct context *ctx)
+{
+    struct server_pool *sp;
+    struct server *server;
+    uint32_t i, j;
+
+    if (ctx->budget == NULL) {
+        return;
+    }
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        sp = array_get(&ctx->pool, i);
+        for (j = 0; j < array_n(&sp->server); j++) {
+            server = array_get(&sp->server, j);
+            server->budget = NULL;
+        }
+    }
+
+    /* the mapping goes away on exit */
+    ctx->budget = NULL;
+}
+
+/*
+ * Split the budget among the first nactive workers from the next
+ * rebalance on, as the master spawns or retires workers
+ */
+void
+budget_resize(struct budget *budget, uint32_t nactive)
+{
+    if (budget == NULL) {
+        return;
+    }
+
+    ASSERT(nactive > 0 && nactive <= budget->nworker);
+
+    budget->nactive = nactive;
+}
+
+/*
+ * The budget is shared by the contexts of all workers, and is unmapped
+ * with the context of the first one
+ */
+void
+budget_destroy(struct context *ctx)
+{
+    struct budget *budget = ctx->budget;
+
+    if (budget == NULL) {
+        return;
+    }
+
+    ctx->budget = NULL;
+
+    if (ctx->budget_idx == 0) {
+        nc_shared_mem_free(budget, budget->size);
+    }
+}
+
+/*
+ * Clear the slots of the worker of ctx after it died, and the lock if it
+ * died holding it. Called by the master when it reaps the worker, from
+ * the signal handler.
+ */
+void
+budget_reset(struct context *ctx)
+{
+    struct budget *budget = ctx->budget;
+    struct budget_slot *slot;
+    uint32_t k;
+
+    if (budget == NULL) {
+        return;
+    }
+
+    for (k = 0; k < budget->nserver; k++) {
+        slot = &budget->slot[k * budget->nworker + ctx->budget_idx];
+        slot->used = 0;
+        slot->demand = 0;
+    }
+
+    (void)__sync_bool_compare_and_swap(&budget->lock, ctx->budget_idx + 1, 0);
+}
+
+/*
+ * Publish the wants of this worker for the servers of pool, and split
+ * the budget of each server among the workers. A worker gets what it
+ * wants while the wants fit the budget, plus an even part of what is
+ * left over. Otherwise every worker gets one connection and the rest of
+ * the budget is split in proportion to what each wants beyond that,
+ * rounding down and handing out the remainder in worker order.
+ * Shares never add up to more than the budget.
+ */
+void
+budget_rebalance(struct context *ctx, struct server_pool *pool)
+{
+    struct budget *budget = ctx->budget;
+    struct budget_slot *row;
+    struct server *server;
+    uint32_t i, w, nworker, total, sum, spare, extra, share;
+
+    if (budget == NULL || pool->server_connections_total == 0) {
+        return;
+    }
+
+    nworker = budget->nactive;
+    total = budget_total(pool, nworker);
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        server = array_get(&pool->server, i);
+        server->budget->demand = MIN(server->nqueue_peak,
+                                     pool->server_connections);
+        server->nqueue_peak = server->nqueue;
+    }
+
+    /* on a busy lock, the worker holding it sees the wants just published */
+    if (__sync_val_compare_and_swap(&budget->lock, 0,
+                                    ctx->budget_idx + 1) == 0) {
+        for (i = 0; i < array_n(&pool->server); i++) {
+            server = array_get(&pool->server, i);
+            row = server->budget - ctx->budget_idx;
+
+            for (w = 0, sum = 0; w < nworker; w++) {
+                sum += budget_want(pool, &row[w]);
+            }
+
+            if (sum <= total) {
+                spare = (total - sum) / nworker;
+                for (w = 0; w < nworker; w++) {
+                    row[w].share = MIN(budget_want(pool, &row[w]) + spare,
+                                       pool->server_connections);
+                }
+                continue;
+            }
+
+            extra = total - nworker;
+            for (w = 0, spare = total; w < nworker; w++) {
+                row[w].share = 1 + (uint32_t)((uint64_t)extra *
+                                              (budget_want(pool, &row[w]) - 1) /
+                                              (sum - nworker));
+                spare -= row[w].share;
+            }
+
+            /* what rounding down left over, one connection at a time */
+            for (w = 0; w < nworker && spare > 0; w++) {
+                if (row[w].share < budget_want(pool, &row[w])) {
+                    row[w].share++;
+                    spare--;
+                }
+            }
+        }
+
+        __sync_lock_release(&budget->lock);
+    }
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        server = array_get(&pool->server, i);
+        share = server->budget->share;
+
+        if (share > server->conn_share) {
+            stats_server_incr_by(ctx, server, server_conn_share,
+                                 share - server->conn_share);
+        } else if (share < server->conn_share) {
+            stats_server_decr_by(ctx, server, server_conn_share,
+                                 server->conn_share - share);
+        }
+        server->conn_share = share;
+    }
+}
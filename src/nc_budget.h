@@ -0,0 +1,59 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_BUDGET_H_
+#define _NC_BUDGET_H_
+
+#include <nc_core.h>
+
+/*
+ * The connection budget caps the connections all workers together open
+ * to a server, at server_connections_total of its pool. The master maps
+ * it in shared memory before it forks the workers. Every worker keeps
+ * its slot of each server up to date with the connections it has open
+ * and the connections it wants, and on its pool maintenance tick splits
+ * the budget of the pool's servers into per-worker shares from the
+ * wants of all workers (see budget_rebalance). A worker opens
+ * connections to a server only within its share, and closes connections
+ * above it. With worker_processes_max, the budget has a slot for every
+ * worker there may be, and is split among the first nactive ones. The
+ * master shows the slots of each worker in its stats.
+ */
+struct budget_slot {
+    volatile uint32_t used;     /* # connections open */
+    volatile uint32_t demand;   /* # connections wanted */
+    volatile uint32_t share;    /* # connections allowed */
+};
+
+struct budget {
+    volatile uint32_t  lock;    /* 0, or index + 1 of the worker rebalancing */
+    uint32_t           nworker; /* # workers */
+    volatile uint32_t  nactive; /* # workers running, the first ones */
+    uint32_t           nserver; /* # servers under a budget */
+    size_t             size;    /* size of the mapping */
+    struct budget_slot slot[1]; /* slot[server * nworker + worker] */
+};
+
+rstatus_t budget_create(struct array *server_pool, uint32_t nworker, uint32_t nactive, struct budget **budget);
+void budget_attach(struct context *ctx, struct budget *budget, uint32_t idx);
+void budget_detach(struct context *ctx);
+void budget_resize(struct budget *budget, uint32_t nactive);
+void budget_destroy(struct context *ctx);
+void budget_reset(struct context *ctx);
+void budget_rebalance(struct context *ctx, struct server_pool *pool);
+
+#endif
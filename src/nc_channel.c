@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <nc_core.h>
 #include <nc_process.h>
+#include <nc_proxy.h>
 
 struct channel*
 nc_alloc_channel(void)
@@ -29,8 +30,12 @@ nc_alloc_channel(void)
 void
 nc_close_channel(struct channel *ch)
 {
-    close(ch->fds[0]);
-    close(ch->fds[1]);
+    if (ch->fds[0] >= 0) {
+        close(ch->fds[0]);
+    }
+    if (ch->fds[1] >= 0) {
+        close(ch->fds[1]);
+    }
 }
 
 void
@@ -43,13 +48,13 @@ nc_dealloc_channel(struct channel *ch)
 static rstatus_t
 channel_recv(void *evb, void *priv)
 {
-    int fd;
+    int fd, sd;
     int n;
     struct chan_msg msg;
 
     fd = (int) priv;
     for (;;) {
-        n = nc_read_channel(fd, &msg);
+        n = nc_read_channel_fd(fd, &msg, &sd);
         if (n == NC_ERROR) {
             event_del(evb, fd, EVENT_READ|EVENT_WRITE);
             return NC_ERROR;
@@ -58,6 +63,17 @@ channel_recv(void *evb, void *priv)
             return NC_EAGAIN;
         }
         switch (msg.command) {
+            case NC_CMD_HANDOFF:
+                if (sd < 0) {
+                    break;
+                }
+                if (pm_handoff >= 0) {
+                    close(pm_handoff);
+                }
+                pm_handoff = sd;
+                sd = -1;
+                log_warn("handoff channel was received");
+                break;
             case NC_CMD_TERMINATE:
                 pm_terminate = true;
                 log_warn("terminate signal was received");
@@ -76,10 +92,52 @@ channel_recv(void *evb, void *priv)
                 log_level_down();
                 break;
         }
+        if (sd >= 0) {
+            close(sd);
+        }
     }
     return NC_OK;
 }
 
+/*
+ * Take over the clients the worker replaced on reload hands over, until
+ * it closes its end of the handoff channel
+ */
+static rstatus_t
+channel_adopt(void *evb, void *priv, uint32_t events)
+{
+    struct instance *nci = priv;
+    struct string addr;
+    struct chan_msg msg;
+    int fd, sd, n;
+
+    fd = nci->handoff->fds[1];
+    for (;;) {
+        n = nc_read_channel_fd(fd, &msg, &sd);
+        if (n == NC_EAGAIN) {
+            return NC_OK;
+        }
+        if (n == NC_ERROR) {
+            log_warn("handoff channel was closed");
+            event_del(evb, fd, EVENT_READ);
+            nc_dealloc_channel(nci->handoff);
+            nci->handoff = NULL;
+            return NC_OK;
+        }
+        if (msg.command != NC_CMD_CLIENT || sd < 0 ||
+            msg.len > NC_CHAN_DATA_LEN) {
+            if (sd >= 0) {
+                close(sd);
+            }
+            continue;
+        }
+
+        addr.len = msg.len;
+        addr.data = msg.data;
+        proxy_adopt(nci->ctx, sd, &addr);
+    }
+}
+
 static rstatus_t
 channel_send(void  *evb, void *priv)
 {
@@ -117,12 +175,37 @@ nc_add_channel_event(struct event_base *evb, int fd)
     return event_add(evb, fd, EVENT_WRITE|EVENT_READ, channel_event_cb, (void *)(long)fd);
 }
 
+int
+nc_add_handoff_event(struct instance *nci)
+{
+    return event_add(nci->ctx->evb, nci->handoff->fds[1], EVENT_READ,
+                     channel_adopt, nci);
+}
+
 int
 nc_write_channel(int fd, struct chan_msg *chmsg)
+{
+    return nc_write_channel_fd(fd, chmsg, -1);
+}
+
+int
+nc_read_channel(int fd, struct chan_msg *chmsg)
+{
+    return nc_read_channel_fd(fd, chmsg, NULL);
+}
+
+/* write chmsg, passing descriptor sendfd along with it unless it is -1 */
+int
+nc_write_channel_fd(int fd, struct chan_msg *chmsg, int sendfd)
 {
     ssize_t n;
     struct iovec iov[1];
     struct msghdr msg;
+    struct cmsghdr *cm;
+    union {
+        struct cmsghdr cm;
+        char           space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
 
     iov[0].iov_base = (char *) chmsg;
     iov[0].iov_len  = sizeof(*chmsg);
@@ -133,6 +216,19 @@ nc_write_channel(int fd, struct chan_msg *chmsg)
     msg.msg_iovlen = 1;
     msg.msg_control = NULL;
     msg.msg_controllen = 0;
+    msg.msg_flags = 0;
+
+    if (sendfd >= 0) {
+        memset(&cmsg, 0, sizeof(cmsg));
+        msg.msg_control = &cmsg;
+        msg.msg_controllen = sizeof(cmsg);
+
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        nc_memcpy(CMSG_DATA(cm), &sendfd, sizeof(int));
+    }
 
     n = sendmsg(fd, &msg, 0);
     if (n == -1) {
@@ -144,12 +240,22 @@ nc_write_channel(int fd, struct chan_msg *chmsg)
     return (int)n;
 }
 
+/*
+ * Read chmsg, and the descriptor passed along with it into recvfd, or -1
+ * if there is none. A descriptor is closed when recvfd is NULL.
+ */
 int
-nc_read_channel(int fd, struct chan_msg *chmsg)
+nc_read_channel_fd(int fd, struct chan_msg *chmsg, int *recvfd)
 {
     ssize_t n;
     struct iovec iov[1];
     struct msghdr msg;
+    struct cmsghdr *cm;
+    union {
+        struct cmsghdr cm;
+        char           space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+    int sd;
 
     iov[0].iov_base = (char *) chmsg;
     iov[0].iov_len = sizeof(*chmsg);
@@ -158,6 +264,13 @@ nc_read_channel(int fd, struct chan_msg *chmsg)
     msg.msg_namelen = 0;
     msg.msg_iov = iov;
     msg.msg_iovlen = 1;
+    msg.msg_control = &cmsg;
+    msg.msg_controllen = sizeof(cmsg);
+    msg.msg_flags = 0;
+
+    if (recvfd != NULL) {
+        *recvfd = -1;
+    }
 
     n = recvmsg(fd, &msg, 0);
     if (n == -1) {
@@ -166,6 +279,24 @@ nc_read_channel(int fd, struct chan_msg *chmsg)
         }
         return NC_ERROR;
     }
+
+    sd = -1;
+    cm = CMSG_FIRSTHDR(&msg);
+    if (cm != NULL && cm->cmsg_level == SOL_SOCKET &&
+        cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(int))) {
+        nc_memcpy(&sd, CMSG_DATA(cm), sizeof(int));
+    }
+
+    if (n < (int)sizeof(*chmsg) || recvfd == NULL) {
+        if (sd >= 0) {
+            close(sd);
+        }
+        sd = -1;
+    }
+    if (recvfd != NULL) {
+        *recvfd = sd;
+    }
+
     if (n == 0) {
         return NC_ERROR;
     }
@@ -5,8 +5,12 @@ struct channel {
     int fds[2];
 };
 
+#define NC_CHAN_DATA_LEN 256
+
 struct chan_msg {
-    int command;
+    int      command;
+    uint32_t len;                     /* # bytes of data */
+    uint8_t  data[NC_CHAN_DATA_LEN];  /* argument of the command */
 };
 
 struct channel *nc_alloc_channel(void);
@@ -14,5 +18,8 @@ void nc_dealloc_channel(struct channel *ch);
 void nc_close_channel(struct channel *ch);
 int nc_read_channel(int fd, struct chan_msg *chmsg);
 int nc_write_channel(int fd, struct chan_msg *chmsg);
+int nc_read_channel_fd(int fd, struct chan_msg *chmsg, int *recvfd);
+int nc_write_channel_fd(int fd, struct chan_msg *chmsg, int sendfd);
 int nc_add_channel_event(struct event_base  *evb, int fd);
+int nc_add_handoff_event(struct instance *nci);
 #endif
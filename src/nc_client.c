@@ -18,6 +18,7 @@
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_client.h>
+#include <nc_process.h>
 
 void
 client_ref(struct conn *conn, void *owner)
@@ -42,6 +43,11 @@ client_ref(struct conn *conn, void *owner)
     /* owner of the client connection is the server pool */
     conn->owner = owner;
 
+    token_bucket_init(&conn->rate_requests, pool->client_rate_limit);
+    token_bucket_init(&conn->rate_bytes, pool->client_rate_limit_bytes);
+
+    client_touch(conn);
+
     log_debug(LOG_VVERB, "ref conn %p owner %p into pool '%.*s'", conn, pool,
               pool->name.len, pool->name.data);
 }
@@ -92,6 +98,171 @@ client_active(struct conn *conn)
     return false;
 }
 
+/*
+ * Return the time in msec at which the idle timer of client conn is next
+ * due, or 0 if there is nothing to check until its next read
+ */
+static int64_t
+client_idle_next(struct conn *conn, int64_t now)
+{
+    struct server_pool *pool = conn->owner;
+    int64_t next, then;
+
+    next = 0;
+
+    if (conn->rmsg != NULL && now < conn->used_ts + CLIENT_RELEASE_DELAY) {
+        next = conn->used_ts + CLIENT_RELEASE_DELAY;
+    }
+
+    if (pool->client_idle_timeout > 0) {
+        then = conn->used_ts + pool->client_idle_timeout;
+        if (then <= now) {
+            /* busy past the timeout, check again a timeout later */
+            then = now + pool->client_idle_timeout;
+        }
+        next = next == 0 ? then : MIN(next, then);
+    }
+
+    return next;
+}
+
+/*
+ * Record a read on client conn. The idle timer is not moved on every
+ * read, only started if it is not running; client_idle pushes it back
+ * when it expires early.
+ */
+void
+client_touch(struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+    int delay;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    conn->used_ts = nc_msec_now();
+
+    if (conn->idle_rbe.data != NULL) {
+        return;
+    }
+
+    delay = CLIENT_RELEASE_DELAY;
+    if (pool->client_idle_timeout > 0) {
+        delay = MIN(delay, pool->client_idle_timeout);
+    }
+
+    conn_idle_insert(conn, conn->used_ts + delay);
+}
+
+/*
+ * Give the receive buffer of client conn back to the mbuf pool, so that
+ * mostly idle clients don't each hold on to a chunk. A short partial
+ * request is parked in an allocation of its own and parsed again from
+ * the start once more of it is read (see client_unpark). Longer ones,
+ * and ones the parser already rewrote in place, stay in their mbufs.
+ */
+static void
+client_release(struct context *ctx, struct conn *conn)
+{
+    struct msg *msg = conn->rmsg;
+    struct mbuf *mbuf;
+    uint8_t *p;
+
+    if (msg == NULL || msg->mlen > CLIENT_PARK_MAX_LEN || msg->quiet) {
+        return;
+    }
+
+    ASSERT(conn->parked == NULL);
+
+    if (msg->mlen != 0) {
+        p = nc_alloc(msg->mlen);
+        if (p == NULL) {
+            return;
+        }
+
+        conn->parked = p;
+        conn->nparked = msg->mlen;
+        STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+            nc_memcpy(p, mbuf->pos, mbuf_length(mbuf));
+            p += mbuf_length(mbuf);
+        }
+        ASSERT(p == conn->parked + conn->nparked);
+    }
+
+    conn->rmsg = NULL;
+    req_put(msg);
+
+    stats_pool_incr(ctx, conn->owner, client_buffer_releases);
+
+    log_debug(LOG_VERB, "c %d released its receive buffer, parked %"PRIu32
+              " bytes", conn->sd, conn->nparked);
+}
+
+/*
+ * Move the parked partial request of client conn into the new receive
+ * msg, to be parsed from the start
+ */
+rstatus_t
+client_unpark(struct conn *conn, struct msg *msg)
+{
+    struct mbuf *mbuf;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(conn->parked != NULL);
+    ASSERT(STAILQ_EMPTY(&msg->mhdr) && msg->mlen == 0);
+
+    mbuf = mbuf_get();
+    if (mbuf == NULL) {
+        return NC_ENOMEM;
+    }
+
+    mbuf_copy(mbuf, conn->parked, conn->nparked);
+    mbuf_insert(&msg->mhdr, mbuf);
+    msg->pos = mbuf->pos;
+    msg->mlen = conn->nparked;
+
+    nc_free(conn->parked);
+    conn->parked = NULL;
+    conn->nparked = 0;
+
+    return NC_OK;
+}
+
+/*
+ * Called once the idle timer of client conn is due, at time now in msec.
+ * Releases the receive buffer of a client quiet for CLIENT_RELEASE_DELAY
+ * and returns true, if the client has neither sent nor waited on a
+ * request for client_idle_timeout and is to be closed.
+ */
+bool
+client_idle(struct context *ctx, struct conn *conn, int64_t now)
+{
+    struct server_pool *pool = conn->owner;
+    int64_t next;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(conn->idle_rbe.data == NULL);
+
+    if (now - conn->used_ts >= CLIENT_RELEASE_DELAY) {
+        client_release(ctx, conn);
+    }
+
+    if (pool->client_idle_timeout > 0 &&
+        now - conn->used_ts >= pool->client_idle_timeout &&
+        TAILQ_EMPTY(&conn->omsg_q) && conn->smsg == NULL) {
+        log_debug(LOG_INFO, "c %d idle for %"PRId64" msec", conn->sd,
+                  now - conn->used_ts);
+        stats_pool_incr(ctx, pool, client_idle_timeouts);
+        return true;
+    }
+
+    next = client_idle_next(conn, now);
+    if (next != 0) {
+        conn_idle_insert(conn, next);
+    }
+
+    return false;
+}
+
 static void
 client_close_stats(struct context *ctx, struct server_pool *pool, err_t err,
                    unsigned eof)
@@ -129,6 +300,15 @@ client_close(struct context *ctx, struct conn *conn)
 
     client_close_stats(ctx, conn->owner, conn->err, conn->eof);
 
+    conn_throttle_delete(conn);
+    conn_idle_delete(conn);
+
+    if (conn->parked != NULL) {
+        nc_free(conn->parked);
+        conn->parked = NULL;
+        conn->nparked = 0;
+    }
+
     if (conn->sd < 0) {
         conn->unref(conn);
         conn_put(conn);
@@ -158,14 +338,17 @@ client_close(struct context *ctx, struct conn *conn)
         /* dequeue the message (request) from client outq */
         conn->dequeue_outq(ctx, conn, msg);
 
-        if (msg->done) {
+        if (msg->done || msg->deferred) {
             log_debug(LOG_INFO, "close c %d discarding %s req %"PRIu64" len "
                       "%"PRIu32" type %d", conn->sd,
-                      msg->error ? "error": "completed", msg->id, msg->mlen,
-                      msg->type);
+                      msg->done ? (msg->error ? "error": "completed") :
+                      "deferred", msg->id, msg->mlen, msg->type);
             req_put(msg);
         } else {
             msg->swallow = 1;
+            if (msg->hedge != NULL) {
+                msg->hedge->swallow = 1;
+            }
 
             ASSERT(msg->request);
             ASSERT(msg->peer == NULL);
@@ -187,3 +370,90 @@ client_close(struct context *ctx, struct conn *conn)
 
     conn_put(conn);
 }
+
+/*
+ * Can the client ever be handed over? Clients of pools with redis_auth
+ * cannot, as the next worker would not know them to be authenticated,
+ * nor can those of a pool whose listen address does not fit in a channel
+ * message. They are closed once done on terminate.
+ */
+bool
+client_handoff_allowed(struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+
+    return !pool->require_auth && pool->addrstr.len <= NC_CHAN_DATA_LEN;
+}
+
+/*
+ * A client can be handed over when nothing of it is held here: no
+ * request in flight or partly read, and no rate limit pause.
+ */
+static bool
+client_handoff_ready(struct conn *conn)
+{
+    if (conn->eof || conn->done || conn->err != 0 ||
+        !client_handoff_allowed(conn)) {
+        return false;
+    }
+
+    if (conn->smsg != NULL || !TAILQ_EMPTY(&conn->omsg_q)) {
+        return false;
+    }
+
+    if (conn->rmsg != NULL && conn->rmsg->mlen != 0) {
+        return false;
+    }
+
+    return conn->nparked == 0 && conn->throttle_rbe.data == NULL;
+}
+
+/*
+ * Hand the clients of a terminating worker over on the handoff channel
+ * sd to the worker replacing it on reload, each as its socket and the
+ * listen address of its pool, and close them here. Busy clients are
+ * handed over once they are done. Returns NC_EAGAIN when sd is full.
+ */
+rstatus_t
+client_handoff(struct context *ctx, int sd)
+{
+    struct server_pool *pool;
+    struct conn *conn, *nconn; /* current and next connection */
+    struct chan_msg msg;
+    uint32_t i;
+    int n;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+
+        for (conn = TAILQ_FIRST(&pool->c_conn_q); conn != NULL;
+             conn = nconn) {
+            nconn = TAILQ_NEXT(conn, conn_tqe);
+
+            if (!client_handoff_ready(conn)) {
+                continue;
+            }
+
+            msg.command = NC_CMD_CLIENT;
+            msg.len = pool->addrstr.len;
+            nc_memcpy(msg.data, pool->addrstr.data, pool->addrstr.len);
+
+            n = nc_write_channel_fd(sd, &msg, conn->sd);
+            if (n == NC_EAGAIN) {
+                return NC_EAGAIN;
+            }
+            if (n < (int)sizeof(msg)) {
+                return NC_ERROR;
+            }
+
+            log_debug(LOG_INFO, "c %d handed over to the next worker",
+                      conn->sd);
+            stats_pool_incr(ctx, pool, client_handoffs);
+
+            event_del_conn(ctx->evb, conn);
+            conn->close(ctx, conn);
+        }
+    }
+
+    return NC_OK;
+}
@@ -20,9 +20,17 @@
 
 #include <nc_core.h>
 
+#define CLIENT_RELEASE_DELAY    1000    /* quiet msec before a client receive buffer is released */
+#define CLIENT_PARK_MAX_LEN     1024    /* max length of a partial request parked off its mbufs */
+
 bool client_active(struct conn *conn);
 void client_ref(struct conn *conn, void *owner);
 void client_unref(struct conn *conn);
 void client_close(struct context *ctx, struct conn *conn);
+void client_touch(struct conn *conn);
+bool client_idle(struct context *ctx, struct conn *conn, int64_t now);
+rstatus_t client_unpark(struct conn *conn, struct msg *msg);
+bool client_handoff_allowed(struct conn *conn);
+rstatus_t client_handoff(struct context *ctx, int sd);
 
 #endif
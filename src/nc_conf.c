@@ -15,6 +15,7 @@
  * limitations under the License.
  */
 
+#include <ctype.h>
 #include <unistd.h>
 #include <grp.h>
 #include <pwd.h>
@@ -49,6 +50,20 @@ static struct string dist_strings[] = {
 };
 #undef DEFINE_ACTION
 
+#define DEFINE_ACTION(_balance, _name) string(#_name),
+static struct string balance_strings[] = {
+    BALANCE_CODEC( DEFINE_ACTION )
+    null_string
+};
+#undef DEFINE_ACTION
+
+#define DEFINE_ACTION(_mirror, _name) string(#_name),
+static struct string mirror_strings[] = {
+    MIRROR_CODEC( DEFINE_ACTION )
+    null_string
+};
+#undef DEFINE_ACTION
+
 static struct command conf_pool_commands[] = {
     { string("listen"),
       conf_set_listen,
@@ -78,10 +93,18 @@ static struct command conf_pool_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, client_connections) },
 
+    { string("client_idle_timeout"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_idle_timeout) },
+
     { string("redis"),
       conf_set_bool,
       offsetof(struct conf_pool, redis) },
 
+    { string("memcache_binary"),
+      conf_set_bool,
+      offsetof(struct conf_pool, memcache_binary) },
+
     { string("tcpkeepalive"),
       conf_set_bool,
       offsetof(struct conf_pool, tcpkeepalive) },
@@ -94,6 +117,14 @@ static struct command conf_pool_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, redis_db) },
 
+    { string("redis_sentinel"),
+      conf_set_listen,
+      offsetof(struct conf_pool, redis_sentinel) },
+
+    { string("redis_sentinel_master"),
+      conf_set_string,
+      offsetof(struct conf_pool, redis_sentinel_master) },
+
     { string("preconnect"),
       conf_set_bool,
       offsetof(struct conf_pool, preconnect) },
@@ -106,6 +137,30 @@ static struct command conf_pool_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, server_connections) },
 
+    { string("server_connection_balance"),
+      conf_set_balance,
+      offsetof(struct conf_pool, server_connection_balance) },
+
+    { string("server_connections_min"),
+      conf_set_num,
+      offsetof(struct conf_pool, server_connections_min) },
+
+    { string("server_connections_total"),
+      conf_set_num,
+      offsetof(struct conf_pool, server_connections_total) },
+
+    { string("server_idle_timeout"),
+      conf_set_num,
+      offsetof(struct conf_pool, server_idle_timeout) },
+
+    { string("server_connection_lifetime"),
+      conf_set_num,
+      offsetof(struct conf_pool, server_connection_lifetime) },
+
+    { string("server_resolve_ttl"),
+      conf_set_num,
+      offsetof(struct conf_pool, server_resolve_ttl) },
+
     { string("server_retry_timeout"),
       conf_set_num,
       offsetof(struct conf_pool, server_retry_timeout) },
@@ -114,6 +169,94 @@ static struct command conf_pool_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, server_failure_limit) },
 
+    { string("admission_latency"),
+      conf_set_num,
+      offsetof(struct conf_pool, admission_latency) },
+
+    { string("rate_limit"),
+      conf_set_num,
+      offsetof(struct conf_pool, rate_limit) },
+
+    { string("rate_limit_bytes"),
+      conf_set_num,
+      offsetof(struct conf_pool, rate_limit_bytes) },
+
+    { string("client_rate_limit"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_rate_limit) },
+
+    { string("client_rate_limit_bytes"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_rate_limit_bytes) },
+
+    { string("hedge_delay"),
+      conf_set_num,
+      offsetof(struct conf_pool, hedge_delay) },
+
+    { string("hedge_adaptive"),
+      conf_set_bool,
+      offsetof(struct conf_pool, hedge_adaptive) },
+
+    { string("hedge_budget"),
+      conf_set_num,
+      offsetof(struct conf_pool, hedge_budget) },
+
+    { string("read_retries"),
+      conf_set_num,
+      offsetof(struct conf_pool, read_retries) },
+
+    { string("read_retry_budget"),
+      conf_set_num,
+      offsetof(struct conf_pool, read_retry_budget) },
+
+    { string("mirror"),
+      conf_set_string,
+      offsetof(struct conf_pool, mirror) },
+
+    { string("mirror_commands"),
+      conf_set_mirror_commands,
+      offsetof(struct conf_pool, mirror_commands) },
+
+    { string("mirror_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, mirror_rate) },
+
+    { string("mirror_max_bytes"),
+      conf_set_num,
+      offsetof(struct conf_pool, mirror_max_bytes) },
+
+    { string("migrate_from"),
+      conf_set_string,
+      offsetof(struct conf_pool, migrate_from) },
+
+    { string("migrate_writeback"),
+      conf_set_bool,
+      offsetof(struct conf_pool, migrate_writeback) },
+
+    { string("migrate_writeback_ttl"),
+      conf_set_num,
+      offsetof(struct conf_pool, migrate_writeback_ttl) },
+
+    { string("mget_stream"),
+      conf_set_bool,
+      offsetof(struct conf_pool, mget_stream) },
+
+    { string("mget_batch"),
+      conf_set_num,
+      offsetof(struct conf_pool, mget_batch) },
+
+    { string("get_batch"),
+      conf_set_num,
+      offsetof(struct conf_pool, get_batch) },
+
+    { string("command_timeouts"),
+      conf_add_command_timeout,
+      offsetof(struct conf_pool, command_timeout) },
+
+    { string("routes"),
+      conf_add_route,
+      offsetof(struct conf_pool, route) },
+
     { string("servers"),
       conf_add_server,
       offsetof(struct conf_pool, server) },
@@ -128,6 +271,12 @@ static struct command conf_global_commands[] = {
         offsetof(struct conf_global, worker_processes)
     },
 
+    {
+        string("worker_processes_max"),
+        conf_set_worker_processes,
+        offsetof(struct conf_global, worker_processes_max)
+    },
+
     {
         string("max_openfiles"),
         conf_set_num,
@@ -196,13 +345,25 @@ conf_server_each_transform(void *elem, void *data)
     s->idx = array_idx(server, s);
     s->owner = NULL;
 
-    s->pname = cs->pname;
+    string_init(&s->pname);
     s->name = cs->name;
-    s->addrstr = cs->addrstr;
+    string_init(&s->addrstr);
     s->port = (uint16_t)cs->port;
     s->weight = (uint32_t)cs->weight;
 
-    nc_memcpy(&s->info, &cs->info, sizeof(cs->info));
+    /*
+     * Looked up once here, ahead of the event loop, and from then on by
+     * the resolver, which also retries a name that doesn't resolve yet
+     */
+    if (nc_resolve(&cs->addrstr, s->port, &s->info) != NC_OK) {
+        memset(&s->info, 0, sizeof(s->info));
+    }
+    s->next_resolve = 0LL;
+    s->resolving = 0;
+
+    s->budget = NULL;
+    s->conn_share = 0;
+    s->nqueue_peak = 0;
 
     s->ns_conn_q = 0;
     TAILQ_INIT(&s->s_conn_q);
@@ -210,6 +371,24 @@ conf_server_each_transform(void *elem, void *data)
     s->next_retry = 0LL;
     s->failure_count = 0;
 
+    s->point = NULL;
+    s->npoint = 0;
+    s->ncontinuum = 0;
+
+    s->nlatency = 0;
+    s->latency_p95 = 0;
+
+    s->nqueue = 0;
+    s->admit_limit = 0;
+    s->admit_credit = 0;
+    s->admit_hold = 0;
+
+    /* owned, as a sentinel failover points the server elsewhere */
+    if (string_duplicate(&s->pname, &cs->pname) != NC_OK ||
+        string_duplicate(&s->addrstr, &cs->addrstr) != NC_OK) {
+        return NC_ENOMEM;
+    }
+
     log_debug(LOG_VERB, "transform to server %"PRIu32" '%.*s'",
               s->idx, s->pname.len, s->pname.data);
 
@@ -230,6 +409,15 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     memset(&cp->listen.info, 0, sizeof(cp->listen.info));
     cp->listen.valid = 0;
 
+    string_init(&cp->redis_sentinel.pname);
+    string_init(&cp->redis_sentinel.name);
+    string_init(&cp->redis_sentinel_master);
+    string_init(&cp->mirror);
+    string_init(&cp->migrate_from);
+    cp->redis_sentinel.port = 0;
+    memset(&cp->redis_sentinel.info, 0, sizeof(cp->redis_sentinel.info));
+    cp->redis_sentinel.valid = 0;
+
     cp->hash = CONF_UNSET_HASH;
     string_init(&cp->hash_tag);
     cp->distribution = CONF_UNSET_DIST;
@@ -238,16 +426,46 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     cp->backlog = CONF_UNSET_NUM;
 
     cp->client_connections = CONF_UNSET_NUM;
+    cp->client_idle_timeout = CONF_UNSET_NUM;
 
     cp->redis = CONF_UNSET_NUM;
+    cp->memcache_binary = CONF_UNSET_NUM;
     cp->tcpkeepalive = CONF_UNSET_NUM;
     cp->redis_db = CONF_UNSET_NUM;
     cp->preconnect = CONF_UNSET_NUM;
     cp->auto_eject_hosts = CONF_UNSET_NUM;
     cp->server_connections = CONF_UNSET_NUM;
+    cp->server_connection_balance = CONF_UNSET_BALANCE;
+    cp->server_connections_min = CONF_UNSET_NUM;
+    cp->server_connections_total = CONF_UNSET_NUM;
+    cp->server_idle_timeout = CONF_UNSET_NUM;
+    cp->server_connection_lifetime = CONF_UNSET_NUM;
+    cp->server_resolve_ttl = CONF_UNSET_NUM;
     cp->server_retry_timeout = CONF_UNSET_NUM;
     cp->server_failure_limit = CONF_UNSET_NUM;
-
+    cp->admission_latency = CONF_UNSET_NUM;
+    cp->rate_limit = CONF_UNSET_NUM;
+    cp->rate_limit_bytes = CONF_UNSET_NUM;
+    cp->client_rate_limit = CONF_UNSET_NUM;
+    cp->client_rate_limit_bytes = CONF_UNSET_NUM;
+    cp->hedge_delay = CONF_UNSET_NUM;
+    cp->hedge_adaptive = CONF_UNSET_NUM;
+    cp->hedge_budget = CONF_UNSET_NUM;
+    cp->read_retries = CONF_UNSET_NUM;
+    cp->read_retry_budget = CONF_UNSET_NUM;
+    cp->mirror_idx = 0;
+    cp->mirror_commands = CONF_UNSET_MIRROR;
+    cp->mirror_rate = CONF_UNSET_NUM;
+    cp->mirror_max_bytes = CONF_UNSET_NUM;
+    cp->migrate_idx = 0;
+    cp->migrate_writeback = CONF_UNSET_NUM;
+    cp->migrate_writeback_ttl = CONF_UNSET_NUM;
+    cp->mget_stream = CONF_UNSET_NUM;
+    cp->mget_batch = CONF_UNSET_NUM;
+    cp->get_batch = CONF_UNSET_NUM;
+
+    array_null(&cp->command_timeout);
+    array_null(&cp->route);
     array_null(&cp->server);
 
     cp->valid = 0;
@@ -269,6 +487,22 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
         string_deinit(&cp->name);
         return status;
     }
+    status = array_init(&cp->command_timeout, 1,
+                        sizeof(struct conf_command_timeout));
+    if (status != NC_OK) {
+        array_deinit(&cp->redis_master);
+        array_deinit(&cp->server);
+        string_deinit(&cp->name);
+        return status;
+    }
+    status = array_init(&cp->route, 1, sizeof(struct conf_route));
+    if (status != NC_OK) {
+        array_deinit(&cp->command_timeout);
+        array_deinit(&cp->redis_master);
+        array_deinit(&cp->server);
+        string_deinit(&cp->name);
+        return status;
+    }
 
     log_debug(LOG_VVERB, "init conf pool %p, '%.*s'", cp, name->len, name->data);
 
@@ -287,11 +521,30 @@ conf_pool_deinit(struct conf_pool *cp)
         string_deinit(&cp->redis_auth);
     }
 
+    string_deinit(&cp->redis_sentinel.pname);
+    string_deinit(&cp->redis_sentinel.name);
+    string_deinit(&cp->redis_sentinel_master);
+    string_deinit(&cp->mirror);
+    string_deinit(&cp->migrate_from);
+
     while (array_n(&cp->server) != 0) {
         conf_server_deinit(array_pop(&cp->server));
     }
     array_deinit(&cp->server);
 
+    while (array_n(&cp->command_timeout) != 0) {
+        struct conf_command_timeout *ct = array_pop(&cp->command_timeout);
+        string_deinit(&ct->name);
+    }
+    array_deinit(&cp->command_timeout);
+
+    while (array_n(&cp->route) != 0) {
+        struct conf_route *cr = array_pop(&cp->route);
+        string_deinit(&cr->prefix);
+        string_deinit(&cr->pool);
+    }
+    array_deinit(&cp->route);
+
     log_debug(LOG_VVERB, "deinit conf pool %p", cp);
 }
 
@@ -319,6 +572,8 @@ conf_pool_each_transform(void *elem, void *data)
 
     array_null(&sp->server);
     array_null(&sp->redis_master);
+    array_null(&sp->route_node);
+    array_null(&sp->route_edge);
     sp->ncontinuum = 0;
     sp->nserver_continuum = 0;
     sp->continuum = NULL;
@@ -340,6 +595,7 @@ conf_pool_each_transform(void *elem, void *data)
     sp->tcpkeepalive = cp->tcpkeepalive ? 1 : 0;
 
     sp->redis = cp->redis ? 1 : 0;
+    sp->memcache_binary = cp->memcache_binary ? 1 : 0;
     sp->timeout = cp->timeout;
     sp->backlog = cp->backlog;
     sp->redis_db = cp->redis_db;
@@ -347,17 +603,67 @@ conf_pool_each_transform(void *elem, void *data)
     sp->redis_auth = cp->redis_auth;
     sp->require_auth = cp->redis_auth.len > 0 ? 1 : 0;
 
+    sp->sentinel_addrstr = cp->redis_sentinel.pname;
+    nc_memcpy(&sp->sentinel_info, &cp->redis_sentinel.info,
+              sizeof(cp->redis_sentinel.info));
+    sp->sentinel_master = cp->redis_sentinel_master;
+    sp->sentinel = NULL;
+
     sp->client_connections = (uint32_t)cp->client_connections;
+    sp->client_idle_timeout = cp->client_idle_timeout;
     sp->server_connections = (uint32_t)cp->server_connections;
+    sp->balance_type = cp->server_connection_balance;
+    sp->server_connections_min = (uint32_t)cp->server_connections_min;
+    sp->server_connections_total = (uint32_t)cp->server_connections_total;
+    sp->server_idle_timeout = cp->server_idle_timeout;
+    sp->server_connection_lifetime = cp->server_connection_lifetime;
+    sp->server_resolve_ttl = cp->server_resolve_ttl;
+    sp->next_maintain = 0LL;
     sp->server_retry_timeout = (int64_t)cp->server_retry_timeout * 1000LL;
     sp->server_failure_limit = (uint32_t)cp->server_failure_limit;
+    sp->admission_latency = cp->admission_latency;
+    token_bucket_init(&sp->rate_requests, cp->rate_limit);
+    token_bucket_init(&sp->rate_bytes, cp->rate_limit_bytes);
+    sp->client_rate_limit = cp->client_rate_limit;
+    sp->client_rate_limit_bytes = cp->client_rate_limit_bytes;
+    sp->hedge_delay = cp->hedge_delay;
+    sp->hedge_adaptive = cp->hedge_adaptive ? 1 : 0;
+    sp->hedge_budget = (uint32_t)cp->hedge_budget;
+    sp->hedge_credit = 0;
+    sp->read_retries = (uint32_t)cp->read_retries;
+    sp->read_retry_budget = (int64_t)cp->read_retry_budget * 1000LL;
+    sp->mirror = NULL;
+    sp->mirror_type = cp->mirror_commands;
+    sp->mirror_rate = (uint32_t)cp->mirror_rate;
+    sp->mirror_credit = 0;
+    sp->mirror_max_bytes = (size_t)cp->mirror_max_bytes;
+    sp->mirror_bytes = 0;
+    sp->migrate = NULL;
+    sp->migrate_writeback = cp->migrate_writeback ? 1 : 0;
+    sp->migrate_writeback_ttl = cp->migrate_writeback_ttl;
+    sp->mget_stream = cp->mget_stream ? 1 : 0;
+    sp->mget_batch = (uint32_t)cp->mget_batch;
+    sp->get_batch = (uint32_t)cp->get_batch;
     sp->auto_eject_hosts = cp->auto_eject_hosts ? 1 : 0;
     sp->preconnect = cp->preconnect ? 1 : 0;
 
+    for (i = 0; i < MSG_SENTINEL; i++) {
+        sp->command_timeout[i] = cp->timeout;
+    }
+    for (i = 0; i < array_n(&cp->command_timeout); i++) {
+        struct conf_command_timeout *ct = array_get(&cp->command_timeout, i);
+        sp->command_timeout[ct->type] = ct->timeout;
+    }
+
     status = server_init(&sp->server, &cp->server, sp);
     if (status != NC_OK) {
         return status;
     }
+
+    status = route_init(sp, &cp->route);
+    if (status != NC_OK) {
+        return status;
+    }
     if (array_n(&cp->redis_master) > 0) {
         status = server_init(&sp->redis_master, &cp->redis_master, sp);
         if (status != NC_OK) {
@@ -405,15 +711,72 @@ conf_dump(struct conf *cf)
         log_debug(LOG_VVERB, "  distribution: %d", cp->distribution);
         log_debug(LOG_VVERB, "  client_connections: %d",
                   cp->client_connections);
+        log_debug(LOG_VVERB, "  client_idle_timeout: %d",
+                  cp->client_idle_timeout);
         log_debug(LOG_VVERB, "  redis: %d", cp->redis);
+        log_debug(LOG_VVERB, "  memcache_binary: %d", cp->memcache_binary);
+        log_debug(LOG_VVERB, "  redis_sentinel: %.*s",
+                  cp->redis_sentinel.pname.len, cp->redis_sentinel.pname.data);
+        log_debug(LOG_VVERB, "  redis_sentinel_master: %.*s",
+                  cp->redis_sentinel_master.len,
+                  cp->redis_sentinel_master.data);
         log_debug(LOG_VVERB, "  preconnect: %d", cp->preconnect);
         log_debug(LOG_VVERB, "  auto_eject_hosts: %d", cp->auto_eject_hosts);
         log_debug(LOG_VVERB, "  server_connections: %d",
                   cp->server_connections);
+        log_debug(LOG_VVERB, "  server_connection_balance: %d",
+                  cp->server_connection_balance);
+        log_debug(LOG_VVERB, "  server_connections_min: %d",
+                  cp->server_connections_min);
+        log_debug(LOG_VVERB, "  server_connections_total: %d",
+                  cp->server_connections_total);
+        log_debug(LOG_VVERB, "  server_idle_timeout: %d",
+                  cp->server_idle_timeout);
+        log_debug(LOG_VVERB, "  server_connection_lifetime: %d",
+                  cp->server_connection_lifetime);
+        log_debug(LOG_VVERB, "  server_resolve_ttl: %d",
+                  cp->server_resolve_ttl);
         log_debug(LOG_VVERB, "  server_retry_timeout: %d",
                   cp->server_retry_timeout);
         log_debug(LOG_VVERB, "  server_failure_limit: %d",
                   cp->server_failure_limit);
+        log_debug(LOG_VVERB, "  admission_latency: %d", cp->admission_latency);
+        log_debug(LOG_VVERB, "  rate_limit: %d", cp->rate_limit);
+        log_debug(LOG_VVERB, "  rate_limit_bytes: %d", cp->rate_limit_bytes);
+        log_debug(LOG_VVERB, "  client_rate_limit: %d", cp->client_rate_limit);
+        log_debug(LOG_VVERB, "  client_rate_limit_bytes: %d",
+                  cp->client_rate_limit_bytes);
+        log_debug(LOG_VVERB, "  hedge_delay: %d", cp->hedge_delay);
+        log_debug(LOG_VVERB, "  hedge_adaptive: %d", cp->hedge_adaptive);
+        log_debug(LOG_VVERB, "  hedge_budget: %d", cp->hedge_budget);
+        log_debug(LOG_VVERB, "  read_retries: %d", cp->read_retries);
+        log_debug(LOG_VVERB, "  read_retry_budget: %d", cp->read_retry_budget);
+        log_debug(LOG_VVERB, "  mirror: %.*s", cp->mirror.len, cp->mirror.data);
+        log_debug(LOG_VVERB, "  mirror_commands: %d", cp->mirror_commands);
+        log_debug(LOG_VVERB, "  mirror_rate: %d", cp->mirror_rate);
+        log_debug(LOG_VVERB, "  mirror_max_bytes: %d", cp->mirror_max_bytes);
+        log_debug(LOG_VVERB, "  migrate_from: %.*s", cp->migrate_from.len,
+                  cp->migrate_from.data);
+        log_debug(LOG_VVERB, "  migrate_writeback: %d", cp->migrate_writeback);
+        log_debug(LOG_VVERB, "  migrate_writeback_ttl: %d",
+                  cp->migrate_writeback_ttl);
+        log_debug(LOG_VVERB, "  mget_stream: %d", cp->mget_stream);
+        log_debug(LOG_VVERB, "  mget_batch: %d", cp->mget_batch);
+        log_debug(LOG_VVERB, "  get_batch: %d", cp->get_batch);
+
+#ifdef NC_DEBUG_LOG
+        for (j = 0; j < array_n(&cp->route); j++) {
+            struct conf_route *cr = array_get(&cp->route, j);
+            log_debug(LOG_VVERB, "  route: %.*s %.*s", cr->prefix.len,
+                      cr->prefix.data, cr->pool.len, cr->pool.data);
+        }
+
+        for (j = 0; j < array_n(&cp->command_timeout); j++) {
+            struct conf_command_timeout *ct = array_get(&cp->command_timeout, j);
+            log_debug(LOG_VVERB, "  command_timeout: %.*s %d", ct->name.len,
+                      ct->name.data, ct->timeout);
+        }
+#endif
 
         nserver = array_n(&cp->server);
         log_debug(LOG_VVERB, "  servers: %"PRIu32"", nserver);
@@ -838,6 +1201,7 @@ conf_parse_global_section(struct conf *cf)
 
     // init global conf
     cf->global.worker_processes = CONF_UNSET_NUM;
+    cf->global.worker_processes_max = CONF_UNSET_NUM;
     cf->global.max_openfiles = CONF_UNSET_NUM;
     cf->global.worker_shutdown_timeout = CONF_UNSET_NUM;
     string_init(&cf->global.user);
@@ -920,6 +1284,14 @@ conf_parse(struct conf *cf)
     if (cf->global.worker_shutdown_timeout == CONF_UNSET_NUM) {
         cf->global.worker_shutdown_timeout = CONF_DEFAULT_WORKER_SHUTDOWN_TIMEOUT;
     }
+    if (cf->global.worker_processes_max == CONF_UNSET_NUM ||
+        cf->global.worker_processes < 1) {
+        cf->global.worker_processes_max = cf->global.worker_processes;
+    } else if (cf->global.worker_processes_max < cf->global.worker_processes) {
+        log_error("conf: worker_processes_max %d is less than worker_processes %d",
+                  cf->global.worker_processes_max, cf->global.worker_processes);
+        return NC_ERROR;
+    }
     if (cf->global.max_openfiles == CONF_UNSET_NUM) {
         cf->global.max_openfiles= CONF_DEFAULT_MAX_OPENFILES;
     }
@@ -1177,7 +1549,7 @@ conf_validate_structure(struct conf *cf)
     rstatus_t status;
     int type, depth;
     uint32_t i, count[CONF_POOL_MAX_DEPTH + 1];
-    bool done, error, seq;
+    bool done, error, seq, inseq;
     bool pools_section = false;
     bool global_section = false;
 
@@ -1189,6 +1561,7 @@ conf_validate_structure(struct conf *cf)
     done = false;
     error = false;
     seq = false;
+    inseq = false;
     depth = 0;
     for (i = 0; i < CONF_POOL_MAX_DEPTH + 1; i++) {
         count[i] = 0;
@@ -1273,9 +1646,9 @@ conf_validate_structure(struct conf *cf)
             break;
 
         case YAML_SEQUENCE_START_EVENT:
-            if (seq) {
+            if (inseq) {
                 error = true;
-                log_error("conf: '%s' has more than one sequence directive",
+                log_error("conf: '%s' has a nested sequence directive",
                           cf->fname);
             } else if (depth != CONF_POOL_MAX_DEPTH) {
                 error = true;
@@ -1287,11 +1660,13 @@ conf_validate_structure(struct conf *cf)
                           cf->fname, depth);
             }
             seq = true;
+            inseq = true;
             break;
 
         case YAML_SEQUENCE_END_EVENT:
             ASSERT(depth == CONF_POOL_MAX_DEPTH);
             count[depth] = 0;
+            inseq = false;
             break;
 
         case YAML_SCALAR_EVENT:
@@ -1378,6 +1753,176 @@ conf_pool_name_cmp(const void *t1, const void *t2)
     return string_compare(&p1->name, &p2->name);
 }
 
+static int
+conf_route_prefix_cmp(const void *t1, const void *t2)
+{
+    const struct conf_route *r1 = t1, *r2 = t2;
+    int rv;
+
+    rv = memcmp(r1->prefix.data, r2->prefix.data,
+                MIN(r1->prefix.len, r2->prefix.len));
+    if (rv != 0) {
+        return rv;
+    }
+
+    return (int)r1->prefix.len - (int)r2->prefix.len;
+}
+
+/*
+ * Resolve the pool names of routes: and sort the routes by prefix for
+ * route_init. Pools must be in their final order in cf->pool.
+ */
+static rstatus_t
+conf_validate_route(struct conf *cf, struct conf_pool *cp)
+{
+    uint32_t i, j, nroute;
+    struct conf_route *cr, *prev;
+    struct conf_pool *target;
+
+    nroute = array_n(&cp->route);
+    if (nroute == 0) {
+        return NC_OK;
+    }
+
+    for (i = 0; i < nroute; i++) {
+        cr = array_get(&cp->route, i);
+
+        for (j = 0; j < array_n(&cf->pool); j++) {
+            target = array_get(&cf->pool, j);
+            if (string_compare(&target->name, &cr->pool) == 0) {
+                break;
+            }
+        }
+
+        if (j == array_n(&cf->pool)) {
+            log_error("conf: pool '%.*s' routes '%.*s' to unknown pool '%.*s'",
+                      cp->name.len, cp->name.data, cr->prefix.len,
+                      cr->prefix.data, cr->pool.len, cr->pool.data);
+            return NC_ERROR;
+        }
+
+        if (target->redis != cp->redis ||
+            target->memcache_binary != cp->memcache_binary) {
+            log_error("conf: pool '%.*s' routes '%.*s' to pool '%.*s' of "
+                      "another protocol", cp->name.len, cp->name.data,
+                      cr->prefix.len, cr->prefix.data, cr->pool.len,
+                      cr->pool.data);
+            return NC_ERROR;
+        }
+
+        cr->pool_idx = j;
+    }
+
+    array_sort(&cp->route, conf_route_prefix_cmp);
+    for (i = 1; i < nroute; i++) {
+        prev = array_get(&cp->route, i - 1);
+        cr = array_get(&cp->route, i);
+
+        if (conf_route_prefix_cmp(prev, cr) == 0) {
+            log_error("conf: pool '%.*s' has duplicate route '%.*s'",
+                      cp->name.len, cp->name.data, cr->prefix.len,
+                      cr->prefix.data);
+            return NC_ERROR;
+        }
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_mirror(struct conf *cf, struct conf_pool *cp)
+{
+    uint32_t i;
+    struct conf_pool *target;
+
+    if (cp->mirror.len == 0) {
+        return NC_OK;
+    }
+
+    for (i = 0; i < array_n(&cf->pool); i++) {
+        target = array_get(&cf->pool, i);
+        if (string_compare(&target->name, &cp->mirror) == 0) {
+            break;
+        }
+    }
+
+    if (i == array_n(&cf->pool)) {
+        log_error("conf: pool '%.*s' mirrors to unknown pool '%.*s'",
+                  cp->name.len, cp->name.data, cp->mirror.len,
+                  cp->mirror.data);
+        return NC_ERROR;
+    }
+
+    if (target == cp) {
+        log_error("conf: pool '%.*s' cannot mirror to itself", cp->name.len,
+                  cp->name.data);
+        return NC_ERROR;
+    }
+
+    if (target->redis != cp->redis ||
+        target->memcache_binary != cp->memcache_binary) {
+        log_error("conf: pool '%.*s' mirrors to pool '%.*s' of another "
+                  "protocol", cp->name.len, cp->name.data, cp->mirror.len,
+                  cp->mirror.data);
+        return NC_ERROR;
+    }
+
+    cp->mirror_idx = i;
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_migrate(struct conf *cf, struct conf_pool *cp)
+{
+    uint32_t i;
+    struct conf_pool *target;
+
+    if (cp->migrate_from.len == 0) {
+        return NC_OK;
+    }
+
+    for (i = 0; i < array_n(&cf->pool); i++) {
+        target = array_get(&cf->pool, i);
+        if (string_compare(&target->name, &cp->migrate_from) == 0) {
+            break;
+        }
+    }
+
+    if (i == array_n(&cf->pool)) {
+        log_error("conf: pool '%.*s' migrates from unknown pool '%.*s'",
+                  cp->name.len, cp->name.data, cp->migrate_from.len,
+                  cp->migrate_from.data);
+        return NC_ERROR;
+    }
+
+    if (target == cp) {
+        log_error("conf: pool '%.*s' cannot migrate from itself",
+                  cp->name.len, cp->name.data);
+        return NC_ERROR;
+    }
+
+    /* the fallback get and the writeback are only done in ascii and redis */
+    if (cp->memcache_binary) {
+        log_error("conf: pool '%.*s' speaks the memcache binary protocol, "
+                  "which cannot migrate_from another pool", cp->name.len,
+                  cp->name.data);
+        return NC_ERROR;
+    }
+
+    if (target->redis != cp->redis ||
+        target->memcache_binary != cp->memcache_binary) {
+        log_error("conf: pool '%.*s' migrates from pool '%.*s' of another "
+                  "protocol", cp->name.len, cp->name.data,
+                  cp->migrate_from.len, cp->migrate_from.data);
+        return NC_ERROR;
+    }
+
+    cp->migrate_idx = i;
+
+    return NC_OK;
+}
+
 static int
 conf_pool_listen_cmp(const void *t1, const void *t2)
 {
@@ -1427,6 +1972,46 @@ conf_validate_server(struct conf *cf, struct conf_pool *cp)
     return NC_OK;
 }
 
+/*
+ * Resolve the command names of command_timeouts: to request message types
+ * of the pool protocol, like "get" to REQ_REDIS_GET in a redis pool
+ */
+static rstatus_t
+conf_validate_command_timeout(struct conf *cf, struct conf_pool *cp)
+{
+    uint32_t i, j;
+    struct conf_command_timeout *ct;
+    struct string type_str;
+    uint8_t buf[64];
+    int n;
+
+    for (i = 0; i < array_n(&cp->command_timeout); i++) {
+        ct = array_get(&cp->command_timeout, i);
+
+        n = nc_snprintf(buf, sizeof(buf), "REQ_%s_%.*s",
+                        cp->redis ? "REDIS" : "MC", ct->name.len,
+                        ct->name.data);
+        if (n > 0 && n < (int)sizeof(buf)) {
+            for (j = 0; j < (uint32_t)n; j++) {
+                buf[j] = (uint8_t)toupper(buf[j]);
+            }
+            type_str.data = buf;
+            type_str.len = (uint32_t)n;
+
+            ct->type = msg_type_lookup(&type_str);
+        }
+
+        if (ct->type == MSG_UNKNOWN) {
+            log_error("conf: pool '%.*s' has an unknown command '%.*s' in "
+                      "\"command_timeouts:\"", cp->name.len, cp->name.data,
+                      ct->name.len, ct->name.data);
+            return NC_ERROR;
+        }
+    }
+
+    return NC_OK;
+}
+
 static rstatus_t
 conf_validate_pool(struct conf *cf, struct conf_pool *cp)
 {
@@ -1465,10 +2050,18 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         return NC_ERROR;
     }
 
+    if (cp->client_idle_timeout == CONF_UNSET_NUM) {
+        cp->client_idle_timeout = CONF_DEFAULT_CLIENT_IDLE_TIMEOUT;
+    }
+
     if (cp->redis == CONF_UNSET_NUM) {
         cp->redis = CONF_DEFAULT_REDIS;
     }
 
+    if (cp->memcache_binary == CONF_UNSET_NUM) {
+        cp->memcache_binary = CONF_DEFAULT_MEMCACHE_BINARY;
+    }
+
     if (cp->tcpkeepalive == CONF_UNSET_NUM) {
         cp->tcpkeepalive = CONF_DEFAULT_TCPKEEPALIVE;
     }
@@ -1492,6 +2085,34 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         return NC_ERROR;
     }
 
+    if (cp->server_connection_balance == CONF_UNSET_BALANCE) {
+        cp->server_connection_balance = CONF_DEFAULT_SERVER_CONNECTION_BALANCE;
+    }
+
+    if (cp->server_connections_min == CONF_UNSET_NUM) {
+        cp->server_connections_min = CONF_DEFAULT_SERVER_CONNECTIONS_MIN;
+    } else if (cp->server_connections_min > cp->server_connections) {
+        log_error("conf: directive \"server_connections_min:\" cannot be "
+                  "more than \"server_connections:\"");
+        return NC_ERROR;
+    }
+
+    if (cp->server_connections_total == CONF_UNSET_NUM) {
+        cp->server_connections_total = CONF_DEFAULT_SERVER_CONNECTIONS_TOTAL;
+    }
+
+    if (cp->server_idle_timeout == CONF_UNSET_NUM) {
+        cp->server_idle_timeout = CONF_DEFAULT_SERVER_IDLE_TIMEOUT;
+    }
+
+    if (cp->server_connection_lifetime == CONF_UNSET_NUM) {
+        cp->server_connection_lifetime = CONF_DEFAULT_SERVER_CONNECTION_LIFETIME;
+    }
+
+    if (cp->server_resolve_ttl == CONF_UNSET_NUM) {
+        cp->server_resolve_ttl = CONF_DEFAULT_SERVER_RESOLVE_TTL;
+    }
+
     if (cp->server_retry_timeout == CONF_UNSET_NUM) {
         cp->server_retry_timeout = CONF_DEFAULT_SERVER_RETRY_TIMEOUT;
     }
@@ -1500,6 +2121,11 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         cp->server_failure_limit = CONF_DEFAULT_SERVER_FAILURE_LIMIT;
     }
 
+    if (cp->redis && cp->memcache_binary) {
+        log_error("conf: directive \"memcache_binary:\" is only valid for a memcache pool");
+        return NC_ERROR;
+    }
+
     if (!cp->redis && cp->redis_auth.len > 0) {
         log_error("conf: directive \"redis_auth:\" is only valid for a redis pool");
         return NC_ERROR;
@@ -1510,11 +2136,115 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         return NC_ERROR;
     }
 
+    if (cp->redis_sentinel.valid) {
+        if (!cp->redis || array_n(&cp->redis_master) == 0) {
+            log_error("conf: directive \"redis_sentinel:\" is only valid for a redis pool with a master server");
+            return NC_ERROR;
+        }
+
+        if (string_empty(&cp->redis_sentinel_master)) {
+            status = string_duplicate(&cp->redis_sentinel_master, &cp->name);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    } else if (!string_empty(&cp->redis_sentinel_master)) {
+        log_error("conf: directive \"redis_sentinel_master:\" requires \"redis_sentinel:\"");
+        return NC_ERROR;
+    }
+
+    if (cp->admission_latency == CONF_UNSET_NUM) {
+        cp->admission_latency = CONF_DEFAULT_ADMISSION_LATENCY;
+    }
+
+    if (cp->rate_limit == CONF_UNSET_NUM) {
+        cp->rate_limit = CONF_DEFAULT_RATE_LIMIT;
+    }
+
+    if (cp->rate_limit_bytes == CONF_UNSET_NUM) {
+        cp->rate_limit_bytes = CONF_DEFAULT_RATE_LIMIT;
+    }
+
+    if (cp->client_rate_limit == CONF_UNSET_NUM) {
+        cp->client_rate_limit = CONF_DEFAULT_RATE_LIMIT;
+    }
+
+    if (cp->client_rate_limit_bytes == CONF_UNSET_NUM) {
+        cp->client_rate_limit_bytes = CONF_DEFAULT_RATE_LIMIT;
+    }
+
+    if (cp->hedge_delay == CONF_UNSET_NUM) {
+        cp->hedge_delay = CONF_DEFAULT_HEDGE_DELAY;
+    } else if (cp->hedge_delay > 0 &&
+               (!cp->redis || array_n(&cp->redis_master) == 0)) {
+        log_error("conf: directive \"hedge_delay:\" is only valid for a redis pool with a master server");
+        return NC_ERROR;
+    }
+
+    if (cp->hedge_adaptive == CONF_UNSET_NUM) {
+        cp->hedge_adaptive = CONF_DEFAULT_HEDGE_ADAPTIVE;
+    }
+
+    if (cp->hedge_budget == CONF_UNSET_NUM) {
+        cp->hedge_budget = CONF_DEFAULT_HEDGE_BUDGET;
+    } else if (cp->hedge_budget > 100) {
+        log_error("conf: directive \"hedge_budget:\" cannot be more than 100");
+        return NC_ERROR;
+    }
+
+    if (cp->read_retries == CONF_UNSET_NUM) {
+        cp->read_retries = CONF_DEFAULT_READ_RETRIES;
+    }
+
+    if (cp->read_retry_budget == CONF_UNSET_NUM) {
+        cp->read_retry_budget = CONF_DEFAULT_READ_RETRY_BUDGET;
+    }
+
+    if (cp->mirror_commands == CONF_UNSET_MIRROR) {
+        cp->mirror_commands = CONF_DEFAULT_MIRROR_COMMANDS;
+    }
+
+    if (cp->mirror_rate == CONF_UNSET_NUM) {
+        cp->mirror_rate = CONF_DEFAULT_MIRROR_RATE;
+    } else if (cp->mirror_rate > 100) {
+        log_error("conf: directive \"mirror_rate:\" cannot be more than 100");
+        return NC_ERROR;
+    }
+
+    if (cp->mirror_max_bytes == CONF_UNSET_NUM) {
+        cp->mirror_max_bytes = CONF_DEFAULT_MIRROR_MAX_BYTES;
+    }
+
+    if (cp->migrate_writeback == CONF_UNSET_NUM) {
+        cp->migrate_writeback = CONF_DEFAULT_MIGRATE_WRITEBACK;
+    }
+
+    if (cp->migrate_writeback_ttl == CONF_UNSET_NUM) {
+        cp->migrate_writeback_ttl = CONF_DEFAULT_MIGRATE_WRITEBACK_TTL;
+    }
+
+    if (cp->mget_stream == CONF_UNSET_NUM) {
+        cp->mget_stream = CONF_DEFAULT_MGET_STREAM;
+    }
+
+    if (cp->mget_batch == CONF_UNSET_NUM) {
+        cp->mget_batch = CONF_DEFAULT_MGET_BATCH;
+    }
+
+    if (cp->get_batch == CONF_UNSET_NUM) {
+        cp->get_batch = CONF_DEFAULT_GET_BATCH;
+    }
+
     status = conf_validate_server(cf, cp);
     if (status != NC_OK) {
         return status;
     }
 
+    status = conf_validate_command_timeout(cf, cp);
+    if (status != NC_OK) {
+        return status;
+    }
+
     cp->valid = 1;
 
     return NC_OK;
@@ -1586,6 +2316,25 @@ conf_post_validate(struct conf *cf)
         return NC_ERROR;
     }
 
+    for (i = 0; i < npool; i++) {
+        struct conf_pool *cp = array_get(&cf->pool, i);
+
+        status = conf_validate_route(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_mirror(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_migrate(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
     return NC_OK;
 }
 
@@ -1915,6 +2664,106 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
     return CONF_OK;
 }
 
+/*
+ * Parse a "prefix pool" entry of routes:, which sends requests for keys
+ * starting with prefix to another pool
+ */
+char *
+conf_add_route(struct conf *cf, struct command *cmd, void *conf)
+{
+    rstatus_t status;
+    struct array *a;
+    struct string *value;
+    struct conf_route *field;
+    uint8_t *p, *q;
+
+    p = conf;
+    a = (struct array *)(p + cmd->offset);
+
+    value = array_top(&cf->arg);
+
+    p = value->data + value->len - 1;
+    q = nc_strrchr(p, value->data, ' ');
+    if (q == NULL || q == value->data || q == p) {
+        return "has an invalid \"prefix pool\" format string";
+    }
+
+    field = array_push(a);
+    if (field == NULL) {
+        return CONF_ERROR;
+    }
+
+    string_init(&field->prefix);
+    string_init(&field->pool);
+    field->pool_idx = 0;
+
+    status = string_copy(&field->prefix, value->data,
+                         (uint32_t)(q - value->data));
+    if (status != NC_OK) {
+        array_pop(a);
+        return CONF_ERROR;
+    }
+
+    status = string_copy(&field->pool, q + 1, (uint32_t)(p - q));
+    if (status != NC_OK) {
+        string_deinit(&field->prefix);
+        array_pop(a);
+        return CONF_ERROR;
+    }
+
+    return CONF_OK;
+}
+
+/*
+ * Parse a "command timeout" entry of command_timeouts:, which overrides
+ * the pool timeout: for requests of a single command
+ */
+char *
+conf_add_command_timeout(struct conf *cf, struct command *cmd, void *conf)
+{
+    rstatus_t status;
+    struct array *a;
+    struct string *value;
+    struct conf_command_timeout *field;
+    uint8_t *p, *q;
+    uint32_t namelen;
+    int timeout;
+
+    p = conf;
+    a = (struct array *)(p + cmd->offset);
+
+    value = array_top(&cf->arg);
+
+    p = value->data + value->len - 1;
+    q = nc_strrchr(p, value->data, ' ');
+    if (q == NULL || q == value->data || q == p) {
+        return "has an invalid \"command timeout\" format string";
+    }
+
+    namelen = (uint32_t)(q - value->data);
+    timeout = nc_atoi(q + 1, (p - q));
+    if (timeout < 0) {
+        return "has an invalid timeout in \"command timeout\" format string";
+    }
+
+    field = array_push(a);
+    if (field == NULL) {
+        return CONF_ERROR;
+    }
+
+    string_init(&field->name);
+    field->type = MSG_UNKNOWN;
+    field->timeout = timeout;
+
+    status = string_copy(&field->name, value->data, namelen);
+    if (status != NC_OK) {
+        array_pop(a);
+        return CONF_ERROR;
+    }
+
+    return CONF_OK;
+}
+
 char *
 conf_set_worker_processes(struct conf *cf, struct command *cmd, void *conf)
 {
@@ -2059,6 +2908,64 @@ conf_set_distribution(struct conf *cf, struct command *cmd, void *conf)
     return "is not a valid distribution";
 }
 
+char *
+conf_set_balance(struct conf *cf, struct command *cmd, void *conf)
+{
+    uint8_t *p;
+    balance_type_t *bp;
+    struct string *value, *balance;
+
+    p = conf;
+    bp = (balance_type_t *)(p + cmd->offset);
+
+    if (*bp != CONF_UNSET_BALANCE) {
+        return "is a duplicate";
+    }
+
+    value = array_top(&cf->arg);
+
+    for (balance = balance_strings; balance->len != 0; balance++) {
+        if (string_compare(value, balance) != 0) {
+            continue;
+        }
+
+        *bp = (balance_type_t)(balance - balance_strings);
+
+        return CONF_OK;
+    }
+
+    return "is not a valid balance";
+}
+
+char *
+conf_set_mirror_commands(struct conf *cf, struct command *cmd, void *conf)
+{
+    uint8_t *p;
+    mirror_type_t *mp;
+    struct string *value, *mirror;
+
+    p = conf;
+    mp = (mirror_type_t *)(p + cmd->offset);
+
+    if (*mp != CONF_UNSET_MIRROR) {
+        return "is a duplicate";
+    }
+
+    value = array_top(&cf->arg);
+
+    for (mirror = mirror_strings; mirror->len != 0; mirror++) {
+        if (string_compare(value, mirror) != 0) {
+            continue;
+        }
+
+        *mp = (mirror_type_t)(mirror - mirror_strings);
+
+        return CONF_OK;
+    }
+
+    return "is not a valid mirror type";
+}
+
 char *
 conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf)
 {
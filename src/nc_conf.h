@@ -41,19 +41,44 @@
 #define CONF_UNSET_PTR  NULL
 #define CONF_UNSET_HASH (hash_type_t) -1
 #define CONF_UNSET_DIST (dist_type_t) -1
+#define CONF_UNSET_BALANCE (balance_type_t) -1
+#define CONF_UNSET_MIRROR (mirror_type_t) -1
 
 #define CONF_DEFAULT_HASH                    HASH_FNV1A_64
 #define CONF_DEFAULT_DIST                    DIST_KETAMA
 #define CONF_DEFAULT_TIMEOUT                 -1
 #define CONF_DEFAULT_LISTEN_BACKLOG          512
 #define CONF_DEFAULT_CLIENT_CONNECTIONS      2048
+#define CONF_DEFAULT_CLIENT_IDLE_TIMEOUT     0              /* in msec, 0 = never */
 #define CONF_DEFAULT_REDIS                   false
+#define CONF_DEFAULT_MEMCACHE_BINARY         false
 #define CONF_DEFAULT_REDIS_DB                0
 #define CONF_DEFAULT_PRECONNECT              false
 #define CONF_DEFAULT_AUTO_EJECT_HOSTS        false
 #define CONF_DEFAULT_SERVER_RETRY_TIMEOUT    30 * 1000      /* in msec */
 #define CONF_DEFAULT_SERVER_FAILURE_LIMIT    2
 #define CONF_DEFAULT_SERVER_CONNECTIONS      1
+#define CONF_DEFAULT_SERVER_CONNECTION_BALANCE BALANCE_ROUND_ROBIN
+#define CONF_DEFAULT_SERVER_CONNECTIONS_MIN  0
+#define CONF_DEFAULT_SERVER_CONNECTIONS_TOTAL 0             /* 0 = no budget */
+#define CONF_DEFAULT_SERVER_IDLE_TIMEOUT     0              /* in msec, 0 = never */
+#define CONF_DEFAULT_SERVER_CONNECTION_LIFETIME 0           /* in msec, 0 = unlimited */
+#define CONF_DEFAULT_SERVER_RESOLVE_TTL      0              /* in msec, 0 = until a failure */
+#define CONF_DEFAULT_ADMISSION_LATENCY       0              /* in msec, 0 = disabled */
+#define CONF_DEFAULT_RATE_LIMIT              0              /* per sec, 0 = unlimited */
+#define CONF_DEFAULT_HEDGE_DELAY             0              /* in msec, 0 = disabled */
+#define CONF_DEFAULT_HEDGE_ADAPTIVE          false
+#define CONF_DEFAULT_HEDGE_BUDGET            10             /* in percent */
+#define CONF_DEFAULT_READ_RETRIES            0
+#define CONF_DEFAULT_READ_RETRY_BUDGET       0              /* in msec, 0 = unlimited */
+#define CONF_DEFAULT_MIRROR_COMMANDS         MIRROR_ALL
+#define CONF_DEFAULT_MIRROR_RATE             100            /* in percent */
+#define CONF_DEFAULT_MIRROR_MAX_BYTES        64 * 1024 * 1024
+#define CONF_DEFAULT_MIGRATE_WRITEBACK       false
+#define CONF_DEFAULT_MIGRATE_WRITEBACK_TTL   0              /* in sec, 0 = none */
+#define CONF_DEFAULT_MGET_STREAM             false
+#define CONF_DEFAULT_MGET_BATCH              0              /* in keys, 0 = unbounded */
+#define CONF_DEFAULT_GET_BATCH               0              /* in requests, 0 = off */
 #define CONF_DEFAULT_KETAMA_PORT             11211
 #define CONF_DEFAULT_TCPKEEPALIVE            false
 #define CONF_DEFAULT_WORKER_PROCESSES        4
@@ -81,6 +106,18 @@ struct conf_server {
     unsigned        valid:1;    /* valid? */
 };
 
+struct conf_command_timeout {
+    struct string   name;       /* command name */
+    msg_type_t      type;       /* command message type */
+    int             timeout;    /* timeout in msec */
+};
+
+struct conf_route {
+    struct string   prefix;     /* key prefix */
+    struct string   pool;       /* name of the pool routed to */
+    uint32_t        pool_idx;   /* index of the pool routed to */
+};
+
 struct conf_pool {
     struct string      name;                  /* pool name (root node) */
     struct conf_listen listen;                /* listen: */
@@ -92,20 +129,55 @@ struct conf_pool {
     int                client_connections;    /* client_connections: */
     int                tcpkeepalive;          /* tcpkeepalive: */
     int                redis;                 /* redis: */
+    int                memcache_binary;       /* memcache_binary: */
     struct string      redis_auth;            /* redis_auth: redis auth password (matches requirepass on redis) */
     struct array       redis_master;          /* redis master */
+    struct conf_listen redis_sentinel;        /* redis_sentinel: */
+    struct string      redis_sentinel_master; /* redis_sentinel_master: */
     int                redis_db;              /* redis_db: redis db */
     int                preconnect;            /* preconnect: */
     int                auto_eject_hosts;      /* auto_eject_hosts: */
     int                server_connections;    /* server_connections: */
+    balance_type_t     server_connection_balance; /* server_connection_balance: */
+    int                server_connections_min; /* server_connections_min: */
+    int                server_connections_total; /* server_connections_total: */
+    int                server_idle_timeout;   /* server_idle_timeout: in msec */
+    int                server_connection_lifetime; /* server_connection_lifetime: in msec */
+    int                server_resolve_ttl;    /* server_resolve_ttl: in msec */
     int                server_retry_timeout;  /* server_retry_timeout: in msec */
     int                server_failure_limit;  /* server_failure_limit: */
+    int                admission_latency;     /* admission_latency: in msec */
+    int                rate_limit;            /* rate_limit: requests per sec */
+    int                rate_limit_bytes;      /* rate_limit_bytes: bytes per sec */
+    int                client_idle_timeout;   /* client_idle_timeout: in msec */
+    int                client_rate_limit;     /* client_rate_limit: requests per sec */
+    int                client_rate_limit_bytes; /* client_rate_limit_bytes: bytes per sec */
+    int                hedge_delay;           /* hedge_delay: in msec */
+    int                hedge_adaptive;        /* hedge_adaptive: */
+    int                hedge_budget;          /* hedge_budget: in percent */
+    int                read_retries;          /* read_retries: */
+    int                read_retry_budget;     /* read_retry_budget: in msec */
+    struct string      mirror;                /* mirror: pool name */
+    uint32_t           mirror_idx;            /* index of the mirror pool */
+    mirror_type_t      mirror_commands;       /* mirror_commands: */
+    int                mirror_rate;           /* mirror_rate: in percent */
+    int                mirror_max_bytes;      /* mirror_max_bytes: */
+    struct string      migrate_from;          /* migrate_from: pool name */
+    uint32_t           migrate_idx;           /* index of the pool migrated from */
+    int                migrate_writeback;     /* migrate_writeback: */
+    int                migrate_writeback_ttl; /* migrate_writeback_ttl: in sec */
+    int                mget_stream;           /* mget_stream: */
+    int                mget_batch;            /* mget_batch: in keys */
+    int                get_batch;             /* get_batch: in requests */
+    struct array       command_timeout;       /* command_timeouts: conf_command_timeout[] */
+    struct array       route;                 /* routes: conf_route[] */
     struct array       server;                /* servers: conf_server[] */
     unsigned           valid:1;               /* valid? */
 };
 
 struct conf_global {
     int           worker_processes; // number of worker processes
+    int           worker_processes_max; // number of worker processes the master may scale up to
     int           worker_shutdown_timeout; // number of seconds that worker would be quit after signal terminate was received
     int           max_openfiles; // max number of open files
     struct string user;
@@ -144,11 +216,15 @@ struct command {
 char *conf_set_string(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_listen(struct conf *cf, struct command *cmd, void *conf);
 char *conf_add_server(struct conf *cf, struct command *cmd, void *conf);
+char *conf_add_command_timeout(struct conf *cf, struct command *cmd, void *conf);
+char *conf_add_route(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_num(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_worker_processes(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_bool(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hash(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_distribution(struct conf *cf, struct command *cmd, void *conf);
+char *conf_set_balance(struct conf *cf, struct command *cmd, void *conf);
+char *conf_set_mirror_commands(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_master(struct conf *cf, struct command *cmd, void *conf);
 
@@ -86,6 +86,10 @@ static struct conn_tqh free_connq; /* free conn q */
 static uint64_t ntotal_conn;       /* total # connections counter from start */
 static uint32_t ncurr_conn;        /* current # connections */
 static uint32_t ncurr_cconn;       /* current # client connections */
+static struct rbtree throttle_rbt; /* throttled client connection rbtree */
+static struct rbnode throttle_rbs; /* throttle rbtree sentinel */
+static struct rbtree idle_rbt;     /* idle client connection rbtree */
+static struct rbnode idle_rbs;     /* idle rbtree sentinel */
 
 /*
  * Return the context associated with this connection.
@@ -141,6 +145,19 @@ _conn_get(void)
 
     conn->send_bytes = 0;
     conn->recv_bytes = 0;
+    conn->nqueue = 0;
+    conn->nqueue_bytes = 0;
+
+    token_bucket_init(&conn->rate_requests, 0);
+    token_bucket_init(&conn->rate_bytes, 0);
+    rbtree_node_init(&conn->throttle_rbe);
+    rbtree_node_init(&conn->idle_rbe);
+
+    conn->parked = NULL;
+    conn->nparked = 0;
+
+    conn->open_ts = 0LL;
+    conn->used_ts = 0LL;
 
     conn->events = 0;
     conn->err = 0;
@@ -156,7 +173,10 @@ _conn_get(void)
     conn->eof = 0;
     conn->done = 0;
     conn->redis = 0;
+    conn->binary = 0;
     conn->authenticated = 0;
+    conn->draining = 0;
+    conn->reaped = 0;
 
     ntotal_conn++;
     ncurr_conn++;
@@ -184,6 +204,8 @@ conn_get(void *owner, bool client, bool redis)
          * client receives a request, possibly parsing it, and sends a
          * response downstream.
          */
+        conn->binary = ((struct server_pool *)owner)->memcache_binary;
+
         conn->recv = msg_recv;
         conn->recv_next = req_recv_next;
         conn->recv_done = req_recv_done;
@@ -211,6 +233,8 @@ conn_get(void *owner, bool client, bool redis)
          * server receives a response, possibly parsing it, and sends a
          * request upstream.
          */
+        conn->binary = ((struct server *)owner)->owner->memcache_binary;
+
         conn->recv = msg_recv;
         conn->recv_next = rsp_recv_next;
         conn->recv_done = rsp_recv_done;
@@ -256,6 +280,7 @@ conn_get_proxy(void *owner)
     }
 
     conn->redis = pool->redis;
+    conn->binary = pool->memcache_binary;
 
     conn->proxy = 1;
 
@@ -315,6 +340,8 @@ conn_init(void)
     log_debug(LOG_DEBUG, "conn size %d", sizeof(struct conn));
     nfree_connq = 0;
     TAILQ_INIT(&free_connq);
+    rbtree_init(&throttle_rbt, &throttle_rbs);
+    rbtree_init(&idle_rbt, &idle_rbs);
 }
 
 void
@@ -471,3 +498,103 @@ conn_authenticated(struct conn *conn)
 
     return true;
 }
+
+/*
+ * Client connections whose reads are paused by a rate limit are kept in
+ * the throttle rbtree, keyed by the time in msec at which reads resume
+ */
+struct conn *
+conn_throttle_min(void)
+{
+    struct rbnode *node;
+
+    node = rbtree_min(&throttle_rbt);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return node->data;
+}
+
+void
+conn_throttle_insert(struct conn *conn, int delay)
+{
+    struct rbnode *node;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    node = &conn->throttle_rbe;
+    node->key = nc_msec_now() + delay;
+    node->data = conn;
+
+    rbtree_insert(&throttle_rbt, node);
+
+    log_debug(LOG_VERB, "pause reads on c %d for %d msec", conn->sd, delay);
+}
+
+void
+conn_throttle_delete(struct conn *conn)
+{
+    struct rbnode *node;
+
+    node = &conn->throttle_rbe;
+
+    /* already deleted */
+
+    if (node->data == NULL) {
+        return;
+    }
+
+    rbtree_delete(&throttle_rbt, node);
+
+    log_debug(LOG_VERB, "resume reads on c %d", conn->sd);
+}
+
+/*
+ * Client connections are kept in the idle rbtree, keyed by the time in
+ * msec at which their idle timers are next checked (see client_idle)
+ */
+struct conn *
+conn_idle_min(void)
+{
+    struct rbnode *node;
+
+    node = rbtree_min(&idle_rbt);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return node->data;
+}
+
+void
+conn_idle_insert(struct conn *conn, int64_t when)
+{
+    struct rbnode *node;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    node = &conn->idle_rbe;
+    ASSERT(node->data == NULL);
+
+    node->key = when;
+    node->data = conn;
+
+    rbtree_insert(&idle_rbt, node);
+}
+
+void
+conn_idle_delete(struct conn *conn)
+{
+    struct rbnode *node;
+
+    node = &conn->idle_rbe;
+
+    /* already deleted */
+
+    if (node->data == NULL) {
+        return;
+    }
+
+    rbtree_delete(&idle_rbt, node);
+}
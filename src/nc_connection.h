@@ -73,6 +73,19 @@ struct conn {
 
     size_t              recv_bytes;      /* received (read) bytes */
     size_t              send_bytes;      /* sent (written) bytes */
+    uint32_t            nqueue;          /* # requests in imsg_q and omsg_q */
+    size_t              nqueue_bytes;    /* request bytes in imsg_q and omsg_q */
+
+    struct token_bucket rate_requests;   /* client request rate limit */
+    struct token_bucket rate_bytes;      /* client request byte rate limit */
+    struct rbnode       throttle_rbe;    /* entry in throttle rbtree, while reads are paused */
+    struct rbnode       idle_rbe;        /* entry in idle rbtree, of client connections */
+
+    uint8_t             *parked;         /* partial request of a quiet client (owned) */
+    uint32_t            nparked;         /* parked length */
+
+    int64_t             open_ts;         /* time in msec a server connection was opened */
+    int64_t             used_ts;         /* time in msec a server connection was last picked, or a client last read */
 
     uint32_t            events;          /* connection io events */
     err_t               err;             /* connection errno */
@@ -88,7 +101,10 @@ struct conn {
     unsigned            eof:1;           /* eof? aka passive close? */
     unsigned            done:1;          /* done? aka close? */
     unsigned            redis:1;         /* redis? */
+    unsigned            binary:1;        /* memcache binary protocol? */
     unsigned            authenticated:1; /* authenticated? */
+    unsigned            draining:1;      /* draining? detached from server */
+    unsigned            reaped:1;        /* reaped? closed while idle or past its lifetime */
 };
 
 TAILQ_HEAD(conn_tqh, conn);
@@ -105,5 +121,11 @@ uint32_t conn_ncurr_conn(void);
 uint64_t conn_ntotal_conn(void);
 uint32_t conn_ncurr_cconn(void);
 bool conn_authenticated(struct conn *conn);
+struct conn *conn_throttle_min(void);
+void conn_throttle_insert(struct conn *conn, int delay);
+void conn_throttle_delete(struct conn *conn);
+struct conn *conn_idle_min(void);
+void conn_idle_insert(struct conn *conn, int64_t when);
+void conn_idle_delete(struct conn *conn);
 
 #endif
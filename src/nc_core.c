@@ -17,9 +17,11 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <nc_core.h>
 #include <nc_conf.h>
 #include <nc_server.h>
+#include <nc_client.h>
 #include <nc_proxy.h>
 #include <nc_process.h>
 
@@ -87,7 +89,14 @@ core_ctx_create(struct instance *nci) {
     ctx->max_nfd = 0;
     ctx->max_ncconn = 0;
     ctx->max_nsconn = 0;
-    ctx->shared_mem = NULL;
+    ctx->shared_stats = NULL;
+    ctx->resolver = NULL;
+    ctx->budget = NULL;
+    ctx->budget_idx = 0;
+    ctx->load = NULL;
+    ctx->load_wake = 0;
+    ctx->load_cpu = 0;
+    ctx->load_cpu_at = 0;
 
     /* parse and create configuration */
     ctx->cf = conf_create(nci->conf_filename);
@@ -143,14 +152,13 @@ core_init_stats(struct instance *nci)
     loop = get_loop_callback(nci->role, nci->ctx->cf->global.worker_processes);
     /* create stats per server pool */
     ctx->stats = stats_create(nci->stats_port, nci->stats_addr, nci->stats_interval,
-                              nci->hostname, &ctx->pool, loop);
+                              nci->hostname, &ctx->pool, loop, ctx);
     if (ctx->stats == NULL) {
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
         nc_free(ctx);
         return NC_ERROR;
     }
-    ctx->stats->owner = ctx;
 
     return NC_OK;
 }
@@ -211,6 +219,18 @@ core_init_instance(struct instance *nci){
         return status;
     }
 
+    /* subscribe to sentinels of server pools */
+    status = sentinel_init(ctx);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    /* look up server hostnames off the event loop from now on */
+    status = resolver_init(ctx);
+    if (status != NC_OK) {
+        return status;
+    }
+
     return NC_OK;
 }
 
@@ -219,12 +239,18 @@ core_ctx_destroy(struct context *ctx)
 {
     log_debug(LOG_VVERB, "destroy ctx %p id %"PRIu32"", ctx, ctx->id);
     proxy_deinit(ctx);
+    sentinel_deinit(ctx);
+    resolver_deinit(ctx);
     server_pool_disconnect(ctx);
+    budget_destroy(ctx);
     server_pool_deinit(&ctx->pool);
     conf_destroy(ctx->cf);
     stats_destroy(ctx->stats);
-    if (ctx->shared_mem != NULL) {
-        nc_shared_mem_free(ctx->shared_mem, SHARED_MEMORY_SIZE);
+    if (ctx->shared_stats != NULL) {
+        stats_shared_destroy(ctx->shared_stats);
+    }
+    if (ctx->load != NULL) {
+        nc_shared_mem_free(ctx->load, sizeof(*ctx->load));
     }
     event_base_destroy(ctx->evb);
     nc_free(ctx);
@@ -385,10 +411,113 @@ core_timeout(struct context *ctx)
         msg_tmo_delete(msg);
         conn->err = ETIMEDOUT;
 
+        /* a timeout is as slow a response as it gets */
+        server_admit_update(ctx, conn->owner, server_timeout(conn));
+
         core_close(ctx, conn);
     }
 }
 
+static void
+core_hedge(struct context *ctx)
+{
+    for (;;) {
+        struct msg *msg;
+        struct server *server;
+        int64_t now, then;
+
+        msg = msg_hedge_min();
+        if (msg == NULL) {
+            return;
+        }
+
+        server = msg->hedge_rbe.data;
+        then = msg->hedge_rbe.key;
+
+        now = nc_msec_now();
+        if (now < then) {
+            int delta = (int)(then - now);
+            ctx->timeout = MIN(delta, ctx->timeout);
+            return;
+        }
+
+        msg_hedge_delete(msg);
+
+        req_hedge(ctx, msg, server);
+    }
+}
+
+/*
+ * Resume reads on client connections that were paused by a rate limit
+ */
+static void
+core_throttle(struct context *ctx)
+{
+    for (;;) {
+        rstatus_t status;
+        struct conn *conn;
+        int64_t now, then;
+
+        conn = conn_throttle_min();
+        if (conn == NULL) {
+            return;
+        }
+
+        then = conn->throttle_rbe.key;
+
+        now = nc_msec_now();
+        if (now < then) {
+            int delta = (int)(then - now);
+            ctx->timeout = MIN(delta, ctx->timeout);
+            return;
+        }
+
+        conn_throttle_delete(conn);
+
+        status = core_recv(ctx, conn);
+        if (status != NC_OK || conn->done || conn->err) {
+            core_close(ctx, conn);
+        }
+    }
+}
+
+/*
+ * Run the idle timers of client connections that are due
+ */
+static void
+core_idle(struct context *ctx)
+{
+    int64_t now;
+
+    now = nc_msec_now();
+    if (now < 0) {
+        return;
+    }
+
+    for (;;) {
+        struct conn *conn;
+        int64_t then;
+
+        conn = conn_idle_min();
+        if (conn == NULL) {
+            return;
+        }
+
+        then = conn->idle_rbe.key;
+        if (now < then) {
+            int delta = (int)(then - now);
+            ctx->timeout = MIN(delta, ctx->timeout);
+            return;
+        }
+
+        conn_idle_delete(conn);
+
+        if (client_idle(ctx, conn, now)) {
+            core_close(ctx, conn);
+        }
+    }
+}
+
 rstatus_t
 core_core(void *evb, void *arg, uint32_t events)
 {
@@ -403,6 +532,10 @@ core_core(void *evb, void *arg, uint32_t events)
 
     ctx = conn_to_ctx(conn);
 
+    if (ctx->load != NULL && ctx->load_wake == 0) {
+        ctx->load_wake = nc_usec_now();
+    }
+
     log_debug(LOG_VVERB, "event %04"PRIX32" on %c %d", events,
               conn->client ? 'c' : (conn->proxy ? 'p' : 's'), conn->sd);
 
@@ -435,6 +568,41 @@ core_core(void *evb, void *arg, uint32_t events)
     return NC_OK;
 }
 
+/*
+ * Add the time since the first event of this loop to the load of the
+ * worker, and at most once a second the cpu time used since the last read
+ */
+static void
+core_load(struct context *ctx)
+{
+    struct core_load *load = ctx->load;
+    struct rusage ru;
+    int64_t now, cpu;
+
+    if (load == NULL) {
+        return;
+    }
+
+    now = nc_usec_now();
+    if (ctx->load_wake != 0) {
+        load->busy += now - ctx->load_wake;
+        ctx->load_wake = 0;
+    }
+
+    if (now - ctx->load_cpu_at < CORE_LOAD_CPU_INTERVAL) {
+        return;
+    }
+    ctx->load_cpu_at = now;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0) {
+        return;
+    }
+    cpu = (int64_t)ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec +
+          (int64_t)ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+    load->cpu += cpu - ctx->load_cpu;
+    ctx->load_cpu = cpu;
+}
+
 rstatus_t
 core_loop(struct context *ctx)
 {
@@ -447,7 +615,22 @@ core_loop(struct context *ctx)
 
     core_timeout(ctx);
 
+    core_hedge(ctx);
+
+    core_throttle(ctx);
+
+    core_idle(ctx);
+
+    sentinel_retry(ctx);
+
+    /* a terminating worker only drains, it has no use for warm connections */
+    if (!pm_terminate) {
+        server_pool_maintain(ctx);
+    }
+
     stats_swap(ctx->stats);
 
+    core_load(ctx);
+
     return NC_OK;
 }
@@ -87,8 +87,13 @@ struct mbuf;
 struct mhdr;
 struct conf;
 struct stats;
+struct stats_shared;
 struct instance;
 struct event_base;
+struct sentinel;
+struct resolver;
+struct budget;
+struct budget_slot;
 
 #include <stddef.h>
 #include <stdint.h>
@@ -123,6 +128,25 @@ struct event_base;
 #include <nc_connection.h>
 #include <nc_server.h>
 #include <nc_channel.h>
+#include <nc_sentinel.h>
+#include <nc_resolver.h>
+#include <nc_budget.h>
+#include <nc_route.h>
+
+/*
+ * Load of a worker, kept in memory shared with the master, which samples
+ * it to spawn and retire workers (see worker_processes_max). The worker
+ * only adds to the counters and the master only writes what it has seen
+ * of them, so they survive a respawn of the worker.
+ */
+#define CORE_LOAD_CPU_INTERVAL  1000000LL   /* usec between reads of the cpu time */
+
+struct core_load {
+    volatile int64_t   busy;        /* usec the event loop spent on events */
+    volatile int64_t   cpu;         /* usec of cpu time used */
+    int64_t            busy_seen;   /* busy at the last sample */
+    int64_t            cpu_seen;    /* cpu at the last sample */
+};
 
 struct context {
     int                id;          /* unique context id */
@@ -134,7 +158,14 @@ struct context {
     int                max_timeout; /* max timeout in msec */
     int                timeout;     /* timeout in msec */
 
-    char               *shared_mem; /* shared memory for current worker for stats */
+    struct stats_shared *shared_stats; /* stats of the worker, read by the master */
+    struct resolver    *resolver;   /* server hostname resolver */
+    struct budget      *budget;     /* server connection budget of all workers */
+    uint32_t           budget_idx;  /* index of this worker in the budget */
+    struct core_load   *load;       /* load of this worker, read by the master */
+    int64_t            load_wake;   /* usec the event loop woke up on events */
+    int64_t            load_cpu;    /* usec of cpu time added to load */
+    int64_t            load_cpu_at; /* usec cpu time was last read */
 
     uint32_t           max_nfd;     /* max # files */
     uint32_t           max_ncconn;  /* max # client connections */
@@ -159,6 +190,7 @@ struct instance {
     char             role;                        // ROLE_MASTER / ROLE_WORKER
     struct array     workers;                     // WORKERS if role == ROLE_MASTER
     struct channel*  chan;
+    struct channel*  handoff;                     // takes over clients of the worker replaced on reload
 };
 
 struct context *core_ctx_create(struct instance *nci);
@@ -23,6 +23,9 @@
 static uint32_t nfree_mbufq;   /* # free mbuf */
 static struct mhdr free_mbufq; /* free mbuf q */
 
+static uint32_t nfree_sliceq;   /* # free slice */
+static struct mhdr free_sliceq; /* free slice q */
+
 static size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
 static size_t mbuf_offset;     /* mbuf offset in chunk (const) */
 
@@ -96,6 +99,10 @@ mbuf_get(void)
     mbuf->pos = mbuf->start;
     mbuf->last = mbuf->start;
 
+    mbuf->ref = NULL;
+    mbuf->nref = 0;
+    mbuf->released = 0;
+
     log_debug(LOG_VVERB, "get mbuf %p", mbuf);
 
     return mbuf;
@@ -115,10 +122,46 @@ mbuf_free(struct mbuf *mbuf)
     nc_free(buf);
 }
 
+static void
+mbuf_slice_put(struct mbuf *slice)
+{
+    struct mbuf *mbuf = slice->ref;
+
+    ASSERT(mbuf->nref > 0);
+
+    slice->ref = NULL;
+    if (nfree_sliceq >= MBUF_RESERVED) {
+        nc_free(slice);
+    } else {
+        nfree_sliceq++;
+        STAILQ_INSERT_HEAD(&free_sliceq, slice, next);
+    }
+
+    mbuf->nref--;
+    if (mbuf->nref == 0 && mbuf->released) {
+        mbuf->released = 0;
+        mbuf_put(mbuf);
+    }
+}
+
 void
 mbuf_put(struct mbuf *mbuf)
 {
     log_debug(LOG_VVERB, "put mbuf %p len %d", mbuf, mbuf->last - mbuf->pos);
+
+    if (mbuf->ref != NULL) {
+        ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
+        mbuf_slice_put(mbuf);
+        return;
+    }
+
+    if (mbuf->nref > 0) {
+        /* the last slice of the data puts the mbuf */
+        ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
+        mbuf->released = 1;
+        return;
+    }
+
     if (nfree_mbufq >= MBUF_RESERVED) {
         mbuf_free(mbuf);
         return;
@@ -263,12 +306,62 @@ mbuf_split(struct mhdr *h, uint8_t *pos, mbuf_copy_t cb, void *cbarg)
     return nbuf;
 }
 
+/*
+ * Return a slice that refers to the data [pos, last) of mbuf instead of
+ * copying it. The data of mbuf outlives a put of mbuf for as long as any
+ * of its slices is not put. Nothing can be written to a slice.
+ */
+struct mbuf *
+mbuf_slice(struct mbuf *mbuf, uint8_t *pos, uint8_t *last)
+{
+    struct mbuf *slice;
+
+    ASSERT(pos >= mbuf->start && pos <= last && last <= mbuf->last);
+
+    if (mbuf->ref != NULL) {
+        mbuf = mbuf->ref;
+    }
+
+    if (!STAILQ_EMPTY(&free_sliceq)) {
+        ASSERT(nfree_sliceq > 0);
+
+        slice = STAILQ_FIRST(&free_sliceq);
+        nfree_sliceq--;
+        STAILQ_REMOVE_HEAD(&free_sliceq, next);
+    } else {
+        slice = nc_alloc(sizeof(*slice));
+        if (slice == NULL) {
+            return NULL;
+        }
+        slice->magic = MBUF_MAGIC;
+    }
+
+    STAILQ_NEXT(slice, next) = NULL;
+    slice->start = pos;
+    slice->pos = pos;
+    slice->last = last;
+    slice->end = last;
+    slice->ref = mbuf;
+    slice->nref = 0;
+    slice->released = 0;
+
+    mbuf->nref++;
+
+    log_debug(LOG_VVERB, "slice mbuf %p len %"PRIu32" from mbuf %p", slice,
+              mbuf_length(slice), mbuf);
+
+    return slice;
+}
+
 void
 mbuf_init(struct instance *nci)
 {
     nfree_mbufq = 0;
     STAILQ_INIT(&free_mbufq);
 
+    nfree_sliceq = 0;
+    STAILQ_INIT(&free_sliceq);
+
     mbuf_chunk_size = nci->mbuf_chunk_size;
     mbuf_offset = mbuf_chunk_size - MBUF_HSIZE;
 
@@ -286,4 +379,12 @@ mbuf_deinit(void)
         nfree_mbufq--;
     }
     ASSERT(nfree_mbufq == 0);
+
+    while (!STAILQ_EMPTY(&free_sliceq)) {
+        struct mbuf *slice = STAILQ_FIRST(&free_sliceq);
+        mbuf_remove(&free_sliceq, slice);
+        nc_free(slice);
+        nfree_sliceq--;
+    }
+    ASSERT(nfree_sliceq == 0);
 }
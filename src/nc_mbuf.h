@@ -29,6 +29,9 @@ struct mbuf {
     uint8_t            *last;   /* write marker */
     uint8_t            *start;  /* start of buffer (const) */
     uint8_t            *end;    /* end of buffer (const) */
+    struct mbuf        *ref;    /* mbuf holding the data of a slice */
+    uint32_t           nref;    /* # slices referring to the data */
+    unsigned           released:1; /* put while slices refer to the data? */
 };
 
 STAILQ_HEAD(mhdr, mbuf);
@@ -39,6 +42,7 @@ STAILQ_HEAD(mhdr, mbuf);
 #define MBUF_SIZE       16384
 #define MBUF_HSIZE      sizeof(struct mbuf)
 #define MBUF_RESERVED   4096 /* # reserved mbuf number */
+#define MBUF_SLICE_MIN  1024 /* min # bytes worth a slice over a copy */
 
 static inline bool
 mbuf_empty(struct mbuf *mbuf)
@@ -64,5 +68,6 @@ void mbuf_insert(struct mhdr *mhdr, struct mbuf *mbuf);
 void mbuf_remove(struct mhdr *mhdr, struct mbuf *mbuf);
 void mbuf_copy(struct mbuf *mbuf, uint8_t *pos, size_t n);
 struct mbuf *mbuf_split(struct mhdr *h, uint8_t *pos, mbuf_copy_t cb, void *cbarg);
+struct mbuf *mbuf_slice(struct mbuf *mbuf, uint8_t *pos, uint8_t *last);
 
 #endif
@@ -115,6 +115,8 @@ static uint32_t nfree_msgq;      /* # free msg q */
 static struct msg_tqh free_msgq; /* free msg q */
 static struct rbtree tmo_rbt;    /* timeout rbtree */
 static struct rbnode tmo_rbs;    /* timeout rbtree sentinel */
+static struct rbtree hedge_rbt;  /* hedge rbtree */
+static struct rbnode hedge_rbs;  /* hedge rbtree sentinel */
 
 #define DEFINE_ACTION(_name) string(#_name),
 static struct string msg_type_strings[] = {
@@ -190,6 +192,60 @@ msg_tmo_delete(struct msg *msg)
     log_debug(LOG_VERB, "delete msg %"PRIu64" from tmo rbt", msg->id);
 }
 
+struct msg *
+msg_hedge_min(void)
+{
+    struct rbnode *node;
+
+    node = rbtree_min(&hedge_rbt);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return (struct msg *)((char *)node - offsetof(struct msg, hedge_rbe));
+}
+
+/*
+ * Arm the hedge timer of a read request forwarded to server; once it
+ * expires without a response, a copy of the request is sent to another
+ * server (see req_hedge)
+ */
+void
+msg_hedge_insert(struct msg *msg, struct server *server, int delay)
+{
+    struct rbnode *node;
+
+    ASSERT(msg->request && !msg->noreply);
+    ASSERT(delay > 0);
+
+    node = &msg->hedge_rbe;
+    node->key = nc_msec_now() + delay;
+    node->data = server;
+
+    rbtree_insert(&hedge_rbt, node);
+
+    log_debug(LOG_VERB, "insert msg %"PRIu64" into hedge rbt with expiry of "
+              "%d msec", msg->id, delay);
+}
+
+void
+msg_hedge_delete(struct msg *msg)
+{
+    struct rbnode *node;
+
+    node = &msg->hedge_rbe;
+
+    /* already deleted */
+
+    if (node->data == NULL) {
+        return;
+    }
+
+    rbtree_delete(&hedge_rbt, node);
+
+    log_debug(LOG_VERB, "delete msg %"PRIu64" from hedge rbt", msg->id);
+}
+
 static struct msg *
 _msg_get(void)
 {
@@ -216,11 +272,16 @@ done:
     msg->owner = NULL;
 
     rbtree_node_init(&msg->tmo_rbe);
+    rbtree_node_init(&msg->hedge_rbe);
+    msg->hedge = NULL;
+    msg->nretry = 0;
+    msg->mirror = NULL;
 
     STAILQ_INIT(&msg->mhdr);
     msg->mlen = 0;
     msg->start_ts = 0;
     msg->forward_start_ts = 0;
+    msg->deadline = 0;
 
     msg->state = 0;
     msg->pos = NULL;
@@ -251,6 +312,11 @@ done:
     msg->nfrag = 0;
     msg->nfrag_done = 0;
     msg->frag_id = 0;
+    msg->frag_next = 0;
+    msg->frag_fwd = 0;
+
+    msg->batch_seq = NULL;
+    msg->nbatch = 0;
 
     msg->narg_start = NULL;
     msg->narg_end = NULL;
@@ -264,12 +330,17 @@ done:
     msg->ferror = 0;
     msg->request = 0;
     msg->quit = 0;
+    msg->quiet = 0;
     msg->noreply = 0;
     msg->noforward = 0;
     msg->done = 0;
     msg->fdone = 0;
     msg->swallow = 0;
     msg->redis = 0;
+    msg->hedged = 0;
+    msg->migrating = 0;
+    msg->stream = 0;
+    msg->deferred = 0;
 
     return msg;
 }
@@ -300,6 +371,18 @@ msg_get(struct conn *conn, bool request, bool redis)
         msg->failure = redis_failure;
         msg->pre_coalesce = redis_pre_coalesce;
         msg->post_coalesce = redis_post_coalesce;
+    } else if (conn->binary) {
+        if (request) {
+            msg->parser = memcache_bin_parse_req;
+        } else {
+            msg->parser = memcache_bin_parse_rsp;
+        }
+        msg->add_auth = memcache_add_auth;
+        msg->fragment = memcache_bin_fragment;
+        msg->reply = memcache_bin_reply;
+        msg->failure = memcache_failure;
+        msg->pre_coalesce = memcache_bin_pre_coalesce;
+        msg->post_coalesce = memcache_bin_post_coalesce;
     } else {
         if (request) {
             msg->parser = memcache_parse_req;
@@ -308,6 +391,7 @@ msg_get(struct conn *conn, bool request, bool redis)
         }
         msg->add_auth = memcache_add_auth;
         msg->fragment = memcache_fragment;
+        msg->reply = memcache_reply;
         msg->failure = memcache_failure;
         msg->pre_coalesce = memcache_pre_coalesce;
         msg->post_coalesce = memcache_post_coalesce;
@@ -383,6 +467,11 @@ msg_put(struct msg *msg)
         msg->frag_seq = NULL;
     }
 
+    if (msg->batch_seq) {
+        nc_free(msg->batch_seq);
+        msg->batch_seq = NULL;
+    }
+
     if (msg->keys) {
         msg->keys->nelem = 0; /* a hack here */
         array_destroy(msg->keys);
@@ -427,6 +516,7 @@ msg_init(void)
     nfree_msgq = 0;
     TAILQ_INIT(&free_msgq);
     rbtree_init(&tmo_rbt, &tmo_rbs);
+    rbtree_init(&hedge_rbt, &hedge_rbs);
 }
 
 void
@@ -449,6 +539,24 @@ msg_type_string(msg_type_t type)
     return &msg_type_strings[type];
 }
 
+/*
+ * Return the message type named name, like "REQ_REDIS_GET", or
+ * MSG_UNKNOWN if there is no such type
+ */
+msg_type_t
+msg_type_lookup(struct string *name)
+{
+    msg_type_t type;
+
+    for (type = MSG_UNKNOWN; type < MSG_SENTINEL; type++) {
+        if (string_compare(&msg_type_strings[type], name) == 0) {
+            return type;
+        }
+    }
+
+    return MSG_UNKNOWN;
+}
+
 bool
 msg_empty(struct msg *msg)
 {
@@ -461,7 +569,13 @@ msg_backend_idx(struct msg *msg, uint8_t *key, uint32_t keylen)
     struct conn *conn = msg->owner;
     struct server_pool *pool = conn->owner;
 
-    return server_pool_idx(pool, key, keylen);
+    if (array_n(&pool->route_node) == 0) {
+        return server_pool_idx(pool, key, keylen);
+    }
+
+    pool = route_pool(pool, key, keylen);
+
+    return pool->backend_base + server_pool_idx(pool, key, keylen);
 }
 
 struct mbuf *
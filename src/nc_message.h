@@ -49,6 +49,24 @@ typedef enum msg_parse_result {
     ACTION( REQ_MC_DECR )                                                                           \
     ACTION( REQ_MC_TOUCH )                     /* memcache touch request */                         \
     ACTION( REQ_MC_QUIT )                      /* memcache quit request */                          \
+    ACTION( REQ_MC_MG )                        /* memcache meta requests */                         \
+    ACTION( REQ_MC_MS )                                                                             \
+    ACTION( REQ_MC_MD )                                                                             \
+    ACTION( REQ_MC_MA )                                                                             \
+    ACTION( REQ_MC_MN )                                                                             \
+    ACTION( REQ_MCB_GET )                      /* memcache binary retrieval request */              \
+    ACTION( REQ_MCB_SET )                      /* memcache binary storage requests */               \
+    ACTION( REQ_MCB_ADD )                                                                           \
+    ACTION( REQ_MCB_REPLACE )                                                                       \
+    ACTION( REQ_MCB_APPEND )                                                                        \
+    ACTION( REQ_MCB_PREPEND )                                                                       \
+    ACTION( REQ_MCB_DELETE )                   /* memcache binary delete request */                 \
+    ACTION( REQ_MCB_INCR )                     /* memcache binary arithmetic requests */            \
+    ACTION( REQ_MCB_DECR )                                                                          \
+    ACTION( REQ_MCB_TOUCH )                    /* memcache binary touch requests */                 \
+    ACTION( REQ_MCB_GAT )                                                                           \
+    ACTION( REQ_MCB_NOOP )                     /* memcache binary misc requests */                  \
+    ACTION( REQ_MCB_QUIT )                                                                          \
     ACTION( RSP_MC_NUM )                       /* memcache arithmetic response */                   \
     ACTION( RSP_MC_STORED )                    /* memcache cas and storage response */              \
     ACTION( RSP_MC_NOT_STORED )                                                                     \
@@ -58,9 +76,21 @@ typedef enum msg_parse_result {
     ACTION( RSP_MC_VALUE )                                                                          \
     ACTION( RSP_MC_DELETED )                   /* memcache delete response */                       \
     ACTION( RSP_MC_TOUCHED )                   /* memcache touch response */                        \
+    ACTION( RSP_MC_VA )                        /* memcache meta responses */                        \
+    ACTION( RSP_MC_HD )                                                                             \
+    ACTION( RSP_MC_EN )                                                                             \
+    ACTION( RSP_MC_NS )                                                                             \
+    ACTION( RSP_MC_EX )                                                                             \
+    ACTION( RSP_MC_NF )                                                                             \
+    ACTION( RSP_MC_MN )                                                                             \
     ACTION( RSP_MC_ERROR )                     /* memcache error responses */                       \
     ACTION( RSP_MC_CLIENT_ERROR )                                                                   \
     ACTION( RSP_MC_SERVER_ERROR )                                                                   \
+    ACTION( RSP_MCB_OK )                       /* memcache binary responses, by status */           \
+    ACTION( RSP_MCB_NOT_FOUND )                                                                     \
+    ACTION( RSP_MCB_EXISTS )                                                                        \
+    ACTION( RSP_MCB_NOT_STORED )                                                                    \
+    ACTION( RSP_MCB_ERROR )                                                                         \
     ACTION( REQ_REDIS_DEL )                    /* redis commands - keys */                          \
     ACTION( REQ_REDIS_EXISTS )                                                                      \
     ACTION( REQ_REDIS_EXPIRE )                                                                      \
@@ -73,8 +103,10 @@ typedef enum msg_parse_result {
     ACTION( REQ_REDIS_RENAMENX )                                                                    \
     ACTION( REQ_REDIS_SCAN )                                                                        \
     ACTION( REQ_REDIS_SORT )                                                                        \
+    ACTION( REQ_REDIS_TOUCH )                                                                       \
     ACTION( REQ_REDIS_TTL )                                                                         \
     ACTION( REQ_REDIS_TYPE )                                                                        \
+    ACTION( REQ_REDIS_UNLINK )                                                                      \
     ACTION( REQ_REDIS_APPEND )                 /* redis requests - string */                        \
     ACTION( REQ_REDIS_BITCOUNT )                                                                    \
     ACTION( REQ_REDIS_BITOP )                                                                       \
@@ -214,11 +246,16 @@ struct msg {
     struct conn          *owner;          /* message owner - client | server */
 
     struct rbnode        tmo_rbe;         /* entry in rbtree */
+    struct rbnode        hedge_rbe;       /* entry in hedge rbtree */
+    struct msg           *hedge;          /* twin of a hedged read request */
+    uint32_t             nretry;          /* # times re-dispatched after a server failure */
+    struct server_pool   *mirror;         /* pool a mirror copy was made for */
 
     struct mhdr          mhdr;            /* message mbuf header */
     uint32_t             mlen;            /* message length */
     int64_t              start_ts;        /* request start timestamp in usec */
     int64_t              forward_start_ts;/* request forward timestamp in msec */
+    int64_t              deadline;        /* request deadline in msec (0 = none) */
 
     int                  state;           /* current parser state */
     uint8_t              *pos;            /* parser position marker */
@@ -254,18 +291,28 @@ struct msg {
     uint32_t             nfrag_done;      /* # fragment done */
     uint64_t             frag_id;         /* id of fragmented message */
     struct msg           **frag_seq;      /* sequence of fragment message, map from keys to fragments*/
+    uint32_t             frag_next;       /* # keys coalesced into a streamed reply */
+    uint32_t             frag_fwd;        /* # keys whose fragments were forwarded */
+
+    struct msg           **batch_seq;     /* gets merged into this request, in order */
+    uint32_t             nbatch;          /* # gets merged into this request */
 
     err_t                err;             /* errno on error? */
     unsigned             error:1;         /* error? */
     unsigned             ferror:1;        /* one or more fragments are in error? */
     unsigned             request:1;       /* request? or response? */
     unsigned             quit:1;          /* quit request? */
+    unsigned             quiet:1;         /* quiet request, answered by the server? */
     unsigned             noreply:1;       /* noreply? */
     unsigned             noforward:1;     /* not need forward (example: ping) */
     unsigned             done:1;          /* done? */
     unsigned             fdone:1;         /* all fragments are done? */
     unsigned             swallow:1;       /* swallow response? */
     unsigned             redis:1;         /* redis? */
+    unsigned             hedged:1;        /* hedge copy of a request? */
+    unsigned             migrating:1;     /* re-sent to the old owner after a miss? */
+    unsigned             stream:1;        /* reply streamed as fragments complete? */
+    unsigned             deferred:1;      /* fragment held back by the stream window? */
 };
 
 TAILQ_HEAD(msg_tqh, msg);
@@ -273,10 +320,14 @@ TAILQ_HEAD(msg_tqh, msg);
 struct msg *msg_tmo_min(void);
 void msg_tmo_insert(struct msg *msg, struct conn *conn);
 void msg_tmo_delete(struct msg *msg);
+struct msg *msg_hedge_min(void);
+void msg_hedge_insert(struct msg *msg, struct server *server, int delay);
+void msg_hedge_delete(struct msg *msg);
 
 void msg_init(void);
 void msg_deinit(void);
 struct string *msg_type_string(msg_type_t type);
+msg_type_t msg_type_lookup(struct string *name);
 struct msg *msg_get(struct conn *conn, bool request, bool redis);
 void msg_put(struct msg *msg);
 struct msg *msg_get_error(bool redis, err_t err);
@@ -295,6 +346,9 @@ struct msg *req_get(struct conn *conn);
 void req_put(struct msg *msg);
 bool req_done(struct conn *conn, struct msg *msg);
 bool req_error(struct conn *conn, struct msg *msg);
+uint32_t req_stream_window(struct server_pool *pool);
+bool req_stream_ready(struct msg *msg);
+void req_stream(struct context *ctx, struct conn *conn, struct msg *msg);
 void req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg);
 void req_server_enqueue_imsgq_head(struct context *ctx, struct conn *conn, struct msg *msg);
 void req_server_dequeue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg);
@@ -306,6 +360,11 @@ struct msg *req_recv_next(struct context *ctx, struct conn *conn, bool alloc);
 void req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg, struct msg *nmsg);
 struct msg *req_send_next(struct context *ctx, struct conn *conn);
 void req_send_done(struct context *ctx, struct conn *conn, struct msg *msg);
+void req_hedge(struct context *ctx, struct msg *msg, struct server *server);
+void req_hedge_promote(struct msg *msg);
+bool req_retryable(struct server *server, struct msg *msg);
+bool req_retry(struct context *ctx, struct server *server, struct msg *msg);
+bool req_migrate(struct context *ctx, struct conn *s_conn, struct msg *msg, struct msg *rsp);
 
 struct msg *rsp_get(struct conn *conn);
 void rsp_put(struct msg *msg);
@@ -2,11 +2,14 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/select.h>
 #include <grp.h>
 
 #include <nc_conf.h>
 #include <nc_process.h>
 #include <nc_proxy.h>
+#include <nc_client.h>
+#include <nc_upgrade.h>
 
 
 static rstatus_t nc_migrate_proxies(struct context *dst, struct context *src);
@@ -14,13 +17,24 @@ static rstatus_t nc_setup_listener_for_workers(struct instance *parent_nci, bool
 static rstatus_t nc_spawn_workers(struct array *workers);
 static void      nc_worker_process(int worker_id, struct instance *nci);
 static rstatus_t nc_shutdown_workers(struct array *workers);
+static int       nc_scale_workers(struct instance *parent_nci);
 
 // Global process management states.
 bool pm_reload = false;
+bool pm_upgrade = false; // exec the new binary, handing it the listeners
 bool pm_respawn = false;
 char pm_myrole = ROLE_MASTER;
 bool pm_quit = false; // quit right away
 bool pm_terminate= false; // quit after worker_shutdown_timeout
+int pm_handoff = -1; // hand idle clients over to the next worker while terminating
+
+#define HANDOFF_RETRY_INTERVAL 10 // msec to wait on a full handoff channel
+
+#define SCALE_INTERVAL 10000 // msec between samples of the load of the workers
+#define SCALE_UP       750   // spawn a worker above this mean load of the workers, in permille
+#define SCALE_DOWN     500   // retire one if the others would stay below this mean load, in permille
+
+static int64_t nc_scale_sampled = 0; // usec of the last sample of the load of the workers
 
 struct instance *master_nci = NULL;
 
@@ -39,9 +53,15 @@ nc_clone_instance(int worker_id, struct instance *dst, struct instance *src)
         return NC_ERROR;
     }
 
-    new_ctx->shared_mem = nc_shared_mem_alloc(SHARED_MEMORY_SIZE);
-    if (new_ctx->shared_mem == NULL)  {
-        log_error("failed to create shared memory for context");
+    new_ctx->shared_stats = stats_shared_create(&new_ctx->pool);
+    if (new_ctx->shared_stats == NULL)  {
+        log_error("failed to create shared memory for stats of context");
+        return  NC_ERROR;
+    }
+
+    new_ctx->load = nc_shared_mem_alloc(sizeof(struct core_load));
+    if (new_ctx->load == NULL)  {
+        log_error("failed to create shared memory for load of context");
         return  NC_ERROR;
     }
 
@@ -69,6 +89,79 @@ nc_close_other_proxies(struct array *workers, struct instance *self)
     return array_each(workers, nc_each_close_other_proxy, self);
 }
 
+static rstatus_t
+nc_each_close_other_handoff(void *elem, void *data)
+{
+    struct instance *nci = (struct instance *)elem, *self = data;
+
+    if (nci == self || nci->handoff == NULL) {
+        return NC_OK;
+    }
+
+    nc_dealloc_channel(nci->handoff);
+    nci->handoff = NULL;
+    return NC_OK;
+}
+
+// Give each old worker one end of a channel to hand its idle clients over
+// to the new worker of the same id, which gets the other end once spawned.
+static void
+nc_setup_handoff_for_workers(struct array *workers, struct array *old_workers)
+{
+    uint32_t i;
+    struct instance *worker_nci, *old_worker_nci;
+    struct channel *ch;
+    struct chan_msg msg;
+
+    for (i = 0; i < array_n(workers) && i < array_n(old_workers); i++) {
+        worker_nci = array_get(workers, i);
+        old_worker_nci = array_get(old_workers, i);
+
+        ch = nc_alloc_channel();
+        if (ch == NULL) {
+            continue;
+        }
+
+        msg.command = NC_CMD_HANDOFF;
+        msg.len = 0;
+        if (nc_write_channel_fd(old_worker_nci->chan->fds[0], &msg,
+                                ch->fds[0]) <= 0) {
+            log_error("failed to write channel, err %s", strerror(errno));
+            nc_dealloc_channel(ch);
+            continue;
+        }
+
+        close(ch->fds[0]);
+        ch->fds[0] = -1;
+        worker_nci->handoff = ch;
+    }
+}
+
+// Hand the idle clients of a terminating worker over, and quit once none
+// are left.
+static void
+nc_handoff_clients(struct context *ctx)
+{
+    rstatus_t status;
+
+    status = client_handoff(ctx, pm_handoff);
+    if (status == NC_ERROR) {
+        log_warn("failed to hand clients over, err %s", strerror(errno));
+        close(pm_handoff);
+        pm_handoff = -1;
+        return;
+    }
+    if (status == NC_EAGAIN) {
+        ctx->timeout = MIN(ctx->timeout, HANDOFF_RETRY_INTERVAL);
+        return;
+    }
+
+    if (conn_ncurr_cconn() == 0) {
+        log_warn("all clients were handed over");
+        pm_quit = true;
+    }
+}
+
 // Master process's jobs:
 //   1. reload conf
 //   2. diff old listening sockets from new, and close outdated sockets
@@ -81,6 +174,8 @@ nc_multi_processes_cycle(struct instance *parent_nci)
     rstatus_t status;
     struct context *ctx, *prev_ctx;
     sigset_t set;
+    struct timespec ts;
+    int timeout;
 
     status = core_init_stats(parent_nci);
     if (status != NC_OK) {
@@ -93,6 +188,7 @@ nc_multi_processes_cycle(struct instance *parent_nci)
         log_error("[master] failed to setup listeners");
         return status;
     }
+    upgrade_close_unused();
 
     for (;;) {
         if (pm_reload) {
@@ -107,14 +203,21 @@ nc_multi_processes_cycle(struct instance *parent_nci)
             ctx->stats = prev_ctx->stats;
             parent_nci->ctx = ctx;
 
+            // the stats thread reads the stats of the workers
+            stats_master_lock();
             status = nc_setup_listener_for_workers(parent_nci, true);
             if (status != NC_OK) {
                 // skip reloading
+                stats_master_unlock();
                 parent_nci->ctx = prev_ctx;
                 ctx->stats = NULL;
                 core_ctx_destroy(ctx);
                 continue;
             }
+            if (stats_remap(ctx->stats, &ctx->pool) != NC_OK) {
+                log_error("[master] failed to remap stats to the new pools");
+            }
+            stats_master_unlock();
             prev_ctx->stats = NULL;
             core_ctx_destroy(prev_ctx);
             pm_respawn = true; // restart workers
@@ -126,10 +229,24 @@ nc_multi_processes_cycle(struct instance *parent_nci)
             if (status != NC_OK) {
                 break;
             }
+            upgrade_notify();
+        }
+
+        if (pm_upgrade) {
+            pm_upgrade = false;
+            upgrade_exec(parent_nci);
         }
 
         sigemptyset(&set);
-        sigsuspend(&set); // wake when signal arrives.
+        timeout = nc_scale_workers(parent_nci);
+        if (timeout < 0) {
+            sigsuspend(&set); // wake when signal arrives.
+        } else {
+            // wake when signal arrives, or to sample the load of the workers
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (long)(timeout % 1000) * 1000000L;
+            (void)pselect(0, NULL, NULL, NULL, &ts, &set);
+        }
     }
     return status;
 }
@@ -139,16 +256,19 @@ nc_setup_listener_for_workers(struct instance *parent_nci, bool reloading)
 {
     rstatus_t status;
     int i, n = parent_nci->ctx->cf->global.worker_processes;
+    int max = parent_nci->ctx->cf->global.worker_processes_max;
     int old_workers_n = 0;
     struct instance *worker_nci, *old_worker_nci;
     struct array old_workers;
+    struct budget *budget;
 
     if (reloading) {
         old_workers = parent_nci->workers;
         old_workers_n = (int)array_n(&old_workers);
     }
 
-    status = array_init(&parent_nci->workers, (uint32_t)n, sizeof(struct instance));
+    // room for the workers spawned under load, which must not move the others
+    status = array_init(&parent_nci->workers, (uint32_t)max, sizeof(struct instance));
     if (status != NC_OK) {
         log_error("failed to init parent_nci->workers, rollback");
         parent_nci->workers.nelem = 0;
@@ -165,6 +285,17 @@ nc_setup_listener_for_workers(struct instance *parent_nci, bool reloading)
         worker_nci->role = ROLE_WORKER;
     }
 
+    status = budget_create(&parent_nci->ctx->pool, (uint32_t)max, (uint32_t)n, &budget);
+    if (status != NC_OK) {
+        log_error("failed to create connection budget, rollback");
+        goto rollback_step2;
+    }
+
+    for (i = 0; i < n; i++) {
+        worker_nci = array_get(&parent_nci->workers, (uint32_t)i);
+        budget_attach(worker_nci->ctx, budget, (uint32_t)i);
+    }
+
     for (i = 0; i < n; i++) {
         worker_nci = array_get(&parent_nci->workers, (uint32_t)i);
         if (reloading && i < old_workers_n) {
@@ -179,6 +310,7 @@ nc_setup_listener_for_workers(struct instance *parent_nci, bool reloading)
         }
     }
     if (reloading) {
+        nc_setup_handoff_for_workers(&parent_nci->workers, &old_workers);
         nc_shutdown_workers(&old_workers);
     }
 
@@ -223,7 +355,14 @@ nc_spawn_worker(int worker_id, struct instance *worker_nci, struct array *worker
         return NC_ENOMEM;
     }
 
-    switch (pid = fork()) {
+    pid = fork();
+    if (pid != 0 && worker_nci->handoff != NULL) {
+        // only the first worker spawned with this id takes over clients
+        nc_dealloc_channel(worker_nci->handoff);
+        worker_nci->handoff = NULL;
+    }
+
+    switch (pid) {
     case -1:
         return NC_ERROR;
     case 0:
@@ -231,6 +370,7 @@ nc_spawn_worker(int worker_id, struct instance *worker_nci, struct array *worker
         pid = getpid();
         worker_nci->pid = pid;
         nc_close_other_proxies(workers, worker_nci);
+        array_each(workers, nc_each_close_other_handoff, worker_nci);
         nc_worker_process(worker_id, worker_nci);
         NOT_REACHED();
     default:
@@ -327,14 +467,27 @@ nc_worker_process(int worker_id, struct instance *nci)
         return;
     }
 
+    if (nci->handoff != NULL && nc_add_handoff_event(nci) != NC_OK) {
+        log_error("failed to add handoff event, clients are not taken over");
+        nc_dealloc_channel(nci->handoff);
+        nci->handoff = NULL;
+    }
+
     bool terminating = false;
     for (;!pm_quit;) {
         if (pm_terminate && !terminating) {
             // close proxy listen fd, and wait for 30 seconds
             array_each(&nci->ctx->pool, proxy_each_unaccept, NULL);
+            budget_detach(nci->ctx);
             nc_set_timer(nci->ctx->cf->global.worker_shutdown_timeout * 1000, 0);
             terminating = true;
         }
+        if (terminating && pm_handoff >= 0) {
+            nc_handoff_clients(nci->ctx);
+            if (pm_quit) {
+                break;
+            }
+        }
         status = core_loop(nci->ctx);
         if (status != NC_OK) {
             break;
@@ -351,6 +504,7 @@ rstatus_t
 nc_single_process_cycle(struct instance *nci)
 {
     rstatus_t status;
+    struct budget *budget;
 
     status = core_init_stats(nci);
     if (status != NC_OK) {
@@ -361,11 +515,19 @@ nc_single_process_cycle(struct instance *nci)
     if (status != NC_OK) {
         return status;
     }
+    upgrade_close_unused();
+
+    status = budget_create(&nci->ctx->pool, 1, 1, &budget);
+    if (status != NC_OK) {
+        return status;
+    }
+    budget_attach(nci->ctx, budget, 0);
 
     status = core_init_instance(nci);
     if (status != NC_OK) {
         return status;
     }
+    upgrade_notify();
 
     for (;;) {
         status = core_loop(nci->ctx);
@@ -382,6 +544,16 @@ nc_reload_config(void)
     pm_reload = true;
 }
 
+void
+nc_upgrade_binary(void)
+{
+    if (array_n(&master_nci->workers) == 0) {
+        log_warn("binary upgrade needs worker_processes, ignored");
+        return;
+    }
+    pm_upgrade = true;
+}
+
 void
 nc_reap_worker(void)
 {
@@ -412,6 +584,10 @@ nc_reap_worker(void)
             }
         }
 
+        if (upgrade_reaped(pid, status)) {
+            continue;
+        }
+
         if (WIFEXITED(status)) {
             log_warn("worker [%d] exited with status: %d", pid, WEXITSTATUS(status));
             if (WEXITSTATUS(status) == 0) {
@@ -428,6 +604,7 @@ nc_reap_worker(void)
             if (worker_nci->pid == pid) {
                 log_debug(LOG_NOTICE, "respawn worker to replace [%d]", pid);
                 nc_dealloc_channel(worker_nci->chan);
+                budget_reset(worker_nci->ctx);
                 nc_spawn_worker((int)i, worker_nci, &master_nci->workers); // spawn worker use old ctx which is enough
             }
         }
@@ -477,20 +654,155 @@ nc_migrate_proxies(struct context *dst, struct context *src)
     return NC_OK;
 }
 
+static void
+nc_signal_worker(struct instance *worker_nci, int command)
+{
+    struct chan_msg msg;
+
+    msg.command = command;
+    msg.len = 0;
+    if (nc_write_channel(worker_nci->chan->fds[0], &msg) <= 0) {
+        log_error("failed to write channel, err %s", strerror(errno));
+    }
+}
+
 void
 nc_signal_workers(struct array *workers, int command)
 {
     uint32_t i, nelem;
-    void *elem;
-    struct chan_msg msg;
-    struct instance *worker_nci;
 
     for (i = 0, nelem = array_n(workers); i < nelem; i++) {
-        elem = array_get(workers, i);
-        worker_nci = (struct instance *)elem;
-        msg.command = command;
-        if (nc_write_channel(worker_nci->chan->fds[0], &msg) <= 0) {
-            log_error("failed to write channel, err %s", strerror(errno));
+        nc_signal_worker(array_get(workers, i), command);
+    }
+}
+
+// spawn a worker on top of the running ones, with listeners of its own
+static rstatus_t
+nc_add_worker(struct instance *parent_nci)
+{
+    rstatus_t status;
+    struct array *workers = &parent_nci->workers;
+    struct instance *worker_nci;
+    struct budget *budget;
+    uint32_t id = array_n(workers);
+
+    ASSERT(id < workers->nalloc);
+
+    budget = ((struct instance *)array_get(workers, 0))->ctx->budget;
+
+    worker_nci = array_push(workers);
+    status = nc_clone_instance((int)id, worker_nci, parent_nci);
+    if (status != NC_OK) {
+        log_error("failed to clone parent_nci for worker %"PRIu32, id);
+        array_pop(workers);
+        return status;
+    }
+    worker_nci->role = ROLE_WORKER;
+
+    // the slots of the worker last retired with this id may be stale
+    budget_attach(worker_nci->ctx, budget, id);
+    budget_reset(worker_nci->ctx);
+
+    status = proxy_init(worker_nci->ctx);
+    if (status == NC_OK) {
+        status = nc_spawn_worker((int)id, worker_nci, workers);
+    }
+    if (status != NC_OK) {
+        log_error("failed to spawn worker %"PRIu32, id);
+        if (worker_nci->chan != NULL) {
+            nc_dealloc_channel(worker_nci->chan);
         }
+        core_ctx_destroy(worker_nci->ctx);
+        array_pop(workers);
+        return status;
     }
+
+    budget_resize(budget, id + 1);
+
+    return NC_OK;
+}
+
+// retire the last worker, which closes its listeners and drains its clients
+static void
+nc_retire_worker(struct instance *parent_nci)
+{
+    struct array *workers = &parent_nci->workers;
+    struct instance *worker_nci;
+
+    ASSERT(array_n(workers) > 1);
+
+    worker_nci = array_get(workers, 0);
+    budget_resize(worker_nci->ctx->budget, array_n(workers) - 1);
+
+    worker_nci = array_pop(workers);
+    nc_signal_worker(worker_nci, NC_CMD_TERMINATE);
+    nc_dealloc_channel(worker_nci->chan);
+    core_ctx_destroy(worker_nci->ctx);
+}
+
+// Sample the load of the workers once every SCALE_INTERVAL, and spawn or
+// retire a worker by it between worker_processes and worker_processes_max.
+// The load of a worker is the larger of the part of the time its event loop
+// was busy and the part it was on cpu. Returns the msec to the next sample,
+// or -1 if the number of workers is fixed.
+static int
+nc_scale_workers(struct instance *parent_nci)
+{
+    struct conf_global *global = &parent_nci->ctx->cf->global;
+    struct array *workers = &parent_nci->workers;
+    struct instance *worker_nci;
+    struct core_load *load;
+    sigset_t set, oset;
+    uint32_t i, n;
+    int64_t now, elapsed, busy, cpu, sum;
+    bool first;
+
+    if (global->worker_processes_max <= global->worker_processes) {
+        return -1;
+    }
+
+    now = nc_usec_now();
+    elapsed = now - nc_scale_sampled;
+    if (elapsed < SCALE_INTERVAL * 1000LL) {
+        return (int)(SCALE_INTERVAL - elapsed / 1000);
+    }
+    first = nc_scale_sampled == 0;
+    nc_scale_sampled = now;
+
+    sum = 0;
+    for (i = 0, n = array_n(workers); i < n; i++) {
+        worker_nci = array_get(workers, i);
+        load = worker_nci->ctx->load;
+        busy = load->busy - load->busy_seen;
+        cpu = load->cpu - load->cpu_seen;
+        load->busy_seen += busy;
+        load->cpu_seen += cpu;
+        sum += MIN(MAX(busy, cpu) * 1000 / elapsed, 1000);
+    }
+
+    if (first || n == 0) {
+        return SCALE_INTERVAL;
+    }
+
+    // the reaper walks the workers on SIGCHLD
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, &oset);
+    stats_master_lock();
+
+    if (n < (uint32_t)global->worker_processes_max && sum > SCALE_UP * (int64_t)n) {
+        log_warn("load of %"PRIu32" workers at %"PRId64"%%, spawning worker %"PRIu32,
+                 n, sum / n / 10, n);
+        nc_add_worker(parent_nci);
+    } else if (n > (uint32_t)global->worker_processes &&
+               sum < SCALE_DOWN * (int64_t)(n - 1)) {
+        log_warn("load of %"PRIu32" workers at %"PRId64"%%, retiring worker %"PRIu32,
+                 n, sum / n / 10, n - 1);
+        nc_retire_worker(parent_nci);
+    }
+
+    stats_master_unlock();
+    sigprocmask(SIG_SETMASK, &oset, NULL);
+
+    return SCALE_INTERVAL;
 }
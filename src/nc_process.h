@@ -3,8 +3,6 @@
 #ifndef _NC_PROCESS_H
 #define _NC_PROCESS_H
 
-#define SHARED_MEMORY_SIZE 1048576
-
 #define ROLE_MASTER 1
 #define ROLE_WORKER 2
 
@@ -13,17 +11,22 @@
 #define NC_CMD_LOG_REOPEN 3
 #define NC_CMD_LOG_LEVEL_UP 4
 #define NC_CMD_LOG_LEVEL_DOWN 5
+#define NC_CMD_HANDOFF 6 // to a worker replaced on reload, with the socket to hand its clients over
+#define NC_CMD_CLIENT 7  // to the worker replacing it, with a client socket, data is its listen address
 
 extern bool pm_reload;
+extern bool pm_upgrade;
 extern bool pm_respawn;
 extern char pm_myrole;
 extern bool pm_quit;
 extern struct instance *master_nci;
 extern bool pm_terminate;
+extern int pm_handoff;
 
 rstatus_t nc_multi_processes_cycle(struct instance *parent_nci);
 rstatus_t nc_single_process_cycle(struct instance *nci);
 void      nc_reload_config(void);
+void      nc_upgrade_binary(void);
 void      nc_reap_worker(void);
 void      nc_signal_workers(struct array *workers, int command);
 
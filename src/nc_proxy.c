@@ -21,6 +21,7 @@
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_proxy.h>
+#include <nc_upgrade.h>
 
 void
 proxy_ref(struct conn *conn, void *owner)
@@ -143,6 +144,14 @@ proxy_listen(struct context *ctx, struct conn *p)
         return NC_OK;
     }
 
+    /* on a binary upgrade, take over the listener of the old binary */
+    p->sd = upgrade_listener(ctx->id, &pool->addrstr);
+    if (p->sd >= 0) {
+        log_debug(LOG_NOTICE, "p %d on addr '%.*s' inherited", p->sd,
+                  pool->addrstr.len, pool->addrstr.data);
+        goto inherited;
+    }
+
     p->sd = socket(p->family, SOCK_STREAM, 0);
     if (p->sd < 0) {
         log_error("socket failed: %s", strerror(errno));
@@ -174,6 +183,7 @@ proxy_listen(struct context *ctx, struct conn *p)
         }
     }
 
+inherited:
     status = listen(p->sd, pool->backlog);
     if (status < 0) {
         log_error("listen on p %d on addr '%.*s' failed: %s", p->sd,
@@ -349,64 +359,17 @@ proxy_each_unaccept(void *elem, void *data)
     return NC_OK;
 }
 
+/*
+ * Take over client sd, accepted on listener p by this worker or by the
+ * one it replaced on reload
+ */
 static rstatus_t
-proxy_accept(struct context *ctx, struct conn *p)
+proxy_add_client(struct context *ctx, struct conn *p, int sd)
 {
     rstatus_t status;
     struct conn *c;
-    int sd;
     struct server_pool *pool = p->owner;
 
-    ASSERT(p->proxy && !p->client);
-    ASSERT(p->sd > 0);
-    ASSERT(p->recv_active && p->recv_ready);
-
-    for (;;) {
-        sd = accept(p->sd, NULL, NULL);
-        if (sd < 0) {
-            if (errno == EINTR) {
-                log_debug(LOG_VERB, "accept on p %d not ready - eintr", p->sd);
-                continue;
-            }
-
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
-                log_debug(LOG_VERB, "accept on p %d not ready - eagain", p->sd);
-                p->recv_ready = 0;
-                return NC_OK;
-            }
-
-            /*
-             * Workaround of https://github.com/twitter/twemproxy/issues/97
-             *
-             * We should never reach here because the check for conn_ncurr_cconn()
-             * against ctx->max_ncconn should catch this earlier in the cycle.
-             * If we reach here ignore EMFILE/ENFILE, return NC_OK will enable
-             * the server continue to run instead of close the server socket
-             *
-             * The right solution however, is on EMFILE/ENFILE to mask out IN
-             * event on the proxy and mask it back in when some existing
-             * connections gets closed
-             */
-            if (errno == EMFILE || errno == ENFILE) {
-                log_debug(LOG_CRIT, "accept on p %d with max fds %"PRIu32" "
-                          "used connections %"PRIu32" max client connections %"PRIu32" "
-                          "curr client connections %"PRIu32" failed: %s",
-                          p->sd, ctx->max_nfd, conn_ncurr_conn(),
-                          ctx->max_ncconn, conn_ncurr_cconn(), strerror(errno));
-
-                p->recv_ready = 0;
-
-                return NC_OK;
-            }
-
-            log_error("accept on p %d failed: %s", p->sd, strerror(errno));
-
-            return NC_ERROR;
-        }
-
-        break;
-    }
-
     // check total client connection count
     if (conn_ncurr_cconn() >= ctx->max_ncconn) {
         log_warn("client connections %"PRIu32" exceed limit %"PRIu32,
@@ -481,6 +444,96 @@ proxy_accept(struct context *ctx, struct conn *p)
     return NC_OK;
 }
 
+static rstatus_t
+proxy_accept(struct context *ctx, struct conn *p)
+{
+    int sd;
+
+    ASSERT(p->proxy && !p->client);
+    ASSERT(p->sd > 0);
+    ASSERT(p->recv_active && p->recv_ready);
+
+    for (;;) {
+        sd = accept(p->sd, NULL, NULL);
+        if (sd < 0) {
+            if (errno == EINTR) {
+                log_debug(LOG_VERB, "accept on p %d not ready - eintr", p->sd);
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+                log_debug(LOG_VERB, "accept on p %d not ready - eagain", p->sd);
+                p->recv_ready = 0;
+                return NC_OK;
+            }
+
+            /*
+             * Workaround of https://github.com/twitter/twemproxy/issues/97
+             *
+             * We should never reach here because the check for conn_ncurr_cconn()
+             * against ctx->max_ncconn should catch this earlier in the cycle.
+             * If we reach here ignore EMFILE/ENFILE, return NC_OK will enable
+             * the server continue to run instead of close the server socket
+             *
+             * The right solution however, is on EMFILE/ENFILE to mask out IN
+             * event on the proxy and mask it back in when some existing
+             * connections gets closed
+             */
+            if (errno == EMFILE || errno == ENFILE) {
+                log_debug(LOG_CRIT, "accept on p %d with max fds %"PRIu32" "
+                          "used connections %"PRIu32" max client connections %"PRIu32" "
+                          "curr client connections %"PRIu32" failed: %s",
+                          p->sd, ctx->max_nfd, conn_ncurr_conn(),
+                          ctx->max_ncconn, conn_ncurr_cconn(), strerror(errno));
+
+                p->recv_ready = 0;
+
+                return NC_OK;
+            }
+
+            log_error("accept on p %d failed: %s", p->sd, strerror(errno));
+
+            return NC_ERROR;
+        }
+
+        break;
+    }
+
+    return proxy_add_client(ctx, p, sd);
+}
+
+/*
+ * Take over client sd handed over by the worker this one replaced on
+ * reload, in the pool listening on addr. The client is closed when no
+ * pool listens there any more.
+ */
+rstatus_t
+proxy_adopt(struct context *ctx, int sd, struct string *addr)
+{
+    struct server_pool *pool;
+    uint32_t i;
+    rstatus_t status;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+        if (pool->p_conn == NULL || string_compare(&pool->addrstr, addr) != 0) {
+            continue;
+        }
+
+        status = proxy_add_client(ctx, pool->p_conn, sd);
+        if (status == NC_OK) {
+            stats_pool_incr(ctx, pool, client_adoptions);
+        }
+        return status;
+    }
+
+    log_warn("close c %d handed over, no pool listens on '%.*s' any more",
+             sd, addr->len, addr->data);
+    close(sd);
+
+    return NC_OK;
+}
+
 rstatus_t
 proxy_recv(struct context *ctx, struct conn *conn)
 {
@@ -33,5 +33,6 @@ rstatus_t proxy_init(struct context *ctx);
 rstatus_t proxy_post_init(struct context *ctx);
 void proxy_deinit(struct context *ctx);
 rstatus_t proxy_recv(struct context *ctx, struct conn *conn);
+rstatus_t proxy_adopt(struct context *ctx, int sd, struct string *addr);
 
 #endif
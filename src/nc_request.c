@@ -17,6 +17,7 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_client.h>
 #include <proto/nc_proto.h>
 
 struct msg *
@@ -52,6 +53,11 @@ req_log(struct msg *req)
         return;
     }
 
+    /* gets merged by us? */
+    if (req->nbatch != 0) {
+        return;
+    }
+
     /* conn close normally? */
     if (req->mlen == 0) {
         return;
@@ -114,7 +120,33 @@ req_put(struct msg *msg)
         rsp_put(pmsg);
     }
 
+    /*
+     * The hedge copy of a request is only of interest as long as the
+     * original request is waiting for its response
+     */
+    if (msg->hedge != NULL) {
+        ASSERT(msg->hedge->hedge == msg);
+        if (msg->hedge->hedged) {
+            msg->hedge->swallow = 1;
+        }
+        msg->hedge->hedge = NULL;
+        msg->hedge = NULL;
+    }
+
+    /* a mirror copy put before its response arrived has failed */
+    if (msg->mirror != NULL) {
+        struct server_pool *pool = msg->mirror;
+
+        ASSERT(pool->mirror_bytes >= msg->mlen);
+        pool->mirror_bytes -= msg->mlen;
+        if (!msg->done && !msg->noreply) {
+            stats_pool_incr(pool->ctx, pool, mirror_errors);
+        }
+        msg->mirror = NULL;
+    }
+
     msg_tmo_delete(msg);
+    msg_hedge_delete(msg);
 
     msg_put(msg);
 }
@@ -295,6 +327,8 @@ ferror:
 void
 req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
@@ -312,6 +346,13 @@ req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg
 
     TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);
 
+    conn->nqueue++;
+    conn->nqueue_bytes += msg->mlen;
+    server->nqueue++;
+    if (server->nqueue > server->nqueue_peak) {
+        server->nqueue_peak = server->nqueue;
+    }
+
     stats_server_incr(ctx, conn->owner, in_queue);
     stats_server_incr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
 }
@@ -319,6 +360,8 @@ req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg
 void
 req_server_enqueue_imsgq_head(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
@@ -336,6 +379,13 @@ req_server_enqueue_imsgq_head(struct context *ctx, struct conn *conn, struct msg
 
     TAILQ_INSERT_HEAD(&conn->imsg_q, msg, s_tqe);
 
+    conn->nqueue++;
+    conn->nqueue_bytes += msg->mlen;
+    server->nqueue++;
+    if (server->nqueue > server->nqueue_peak) {
+        server->nqueue_peak = server->nqueue;
+    }
+
     stats_server_incr(ctx, conn->owner, in_queue);
     stats_server_incr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
 }
@@ -343,11 +393,17 @@ req_server_enqueue_imsgq_head(struct context *ctx, struct conn *conn, struct msg
 void
 req_server_dequeue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
     TAILQ_REMOVE(&conn->imsg_q, msg, s_tqe);
 
+    conn->nqueue--;
+    conn->nqueue_bytes -= msg->mlen;
+    server->nqueue--;
+
     stats_server_decr(ctx, conn->owner, in_queue);
     stats_server_decr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
 }
@@ -364,11 +420,17 @@ req_client_enqueue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
 void
 req_server_enqueue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
     TAILQ_INSERT_TAIL(&conn->omsg_q, msg, s_tqe);
 
+    conn->nqueue++;
+    conn->nqueue_bytes += msg->mlen;
+    server->nqueue++;
+
     stats_server_incr(ctx, conn->owner, out_queue);
     stats_server_incr_by(ctx, conn->owner, out_queue_bytes, msg->mlen);
 }
@@ -385,6 +447,8 @@ req_client_dequeue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
 void
 req_server_dequeue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
@@ -392,10 +456,49 @@ req_server_dequeue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
 
     TAILQ_REMOVE(&conn->omsg_q, msg, s_tqe);
 
+    conn->nqueue--;
+    conn->nqueue_bytes -= msg->mlen;
+    server->nqueue--;
+
     stats_server_decr(ctx, conn->owner, out_queue);
     stats_server_decr_by(ctx, conn->owner, out_queue_bytes, msg->mlen);
 }
 
+/*
+ * Return true if reads on client conn are paused because it or its pool
+ * ran out of its request or byte rate. The connection is then put into
+ * the throttle rbtree, from where reads are resumed once the buckets are
+ * refilled.
+ */
+static bool
+req_throttled(struct context *ctx, struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+    int64_t now, wait;
+    int delay;
+
+    if (conn->throttle_rbe.data != NULL) {
+        return true;
+    }
+
+    now = nc_usec_now();
+    wait = MAX(token_bucket_wait(&pool->rate_requests, now),
+               token_bucket_wait(&pool->rate_bytes, now));
+    wait = MAX(wait, token_bucket_wait(&conn->rate_requests, now));
+    wait = MAX(wait, token_bucket_wait(&conn->rate_bytes, now));
+    if (wait == 0) {
+        return false;
+    }
+
+    delay = (int)MIN((wait + 999) / 1000, 1000);
+    conn_throttle_insert(conn, delay);
+
+    stats_pool_incr(ctx, pool, client_throttles);
+    stats_pool_incr_by(ctx, pool, client_throttled_msec, delay);
+
+    return true;
+}
+
 struct msg *
 req_recv_next(struct context *ctx, struct conn *conn, bool alloc)
 {
@@ -433,6 +536,13 @@ req_recv_next(struct context *ctx, struct conn *conn, bool alloc)
         return NULL;
     }
 
+    if (alloc) {
+        client_touch(conn);
+        if (req_throttled(ctx, conn)) {
+            return NULL;
+        }
+    }
+
     msg = conn->rmsg;
     if (msg != NULL) {
         ASSERT(msg->request);
@@ -444,10 +554,18 @@ req_recv_next(struct context *ctx, struct conn *conn, bool alloc)
     }
 
     msg = req_get(conn);
-    if (msg != NULL) {
-        conn->rmsg = msg;
+    if (msg == NULL) {
+        return NULL;
+    }
+
+    if (conn->parked != NULL && client_unpark(conn, msg) != NC_OK) {
+        req_put(msg);
+        conn->err = ENOMEM;
+        return NULL;
     }
 
+    conn->rmsg = msg;
+
     return msg;
 }
 
@@ -537,6 +655,10 @@ req_forward_error(struct context *ctx, struct conn *conn, struct msg *msg)
     msg->error = 1;
     msg->err = errno;
 
+    if (msg->frag_owner != NULL && msg->frag_owner != msg) {
+        msg->frag_owner->nfrag_done++;
+    }
+
     /* noreply request don't expect any response */
     if (msg->noreply) {
         req_put(msg);
@@ -560,59 +682,61 @@ req_forward_stats(struct context *ctx, struct server *server, struct msg *msg)
     stats_server_incr_by(ctx, server, request_bytes, msg->mlen);
 }
 
-static void
-req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
+/*
+ * A read request can be hedged, i.e. duplicated to a second server, only
+ * in a redis pool with a master, where every server holds a replica of
+ * the same data. Fragments of a multi-key request are never hedged.
+ */
+static bool
+req_hedgeable(struct server_pool *pool, struct msg *msg)
 {
-    rstatus_t status;
-    struct conn *s_conn;
-    struct server_pool *pool;
-    uint8_t *key;
-    uint32_t keylen;
-    struct keypos *kpos;
+    if (pool->hedge_delay <= 0) {
+        return false;
+    }
 
-    ASSERT(c_conn->client && !c_conn->proxy);
+    if (!pool->redis || array_n(&pool->redis_master) == 0 ||
+        array_n(&pool->server) < 2) {
+        return false;
+    }
 
-    /* enqueue message (request) into client outq, if response is expected */
-    if (!msg->noreply) {
-        c_conn->enqueue_outq(ctx, c_conn, msg);
+    if (msg->noreply || msg->swallow || msg->frag_id != 0 || msg->hedged) {
+        return false;
     }
 
-    pool = c_conn->owner;
+    return redis_readonly(msg);
+}
 
-    ASSERT(array_n(msg->keys) > 0);
-    kpos = array_get(msg->keys, 0);
-    key = kpos->start;
-    keylen = (uint32_t)(kpos->end - kpos->start);
+/*
+ * Enqueue request msg from client c_conn into the inq of server connection
+ * s_conn. On failure s_conn is marked in error and msg is left to the
+ * caller.
+ */
+static rstatus_t
+req_forward_server(struct context *ctx, struct conn *c_conn,
+                   struct conn *s_conn, struct msg *msg)
+{
+    rstatus_t status;
+    struct server_pool *pool;
 
-    if (pool->redis && !redis_readonly(msg) && array_n(&pool->redis_master) > 0) {
-        struct server *master = array_get(&pool->redis_master, 0);
-        /* pick a connection to a given server */
-        s_conn = server_get_conn(ctx, master);
-    } else {
-        s_conn = server_pool_conn(ctx, c_conn->owner, key, keylen);
-    }
-    if (s_conn == NULL) {
-        req_forward_error(ctx, c_conn, msg);
-        return;
-    }
+    ASSERT(c_conn->client && !c_conn->proxy);
     ASSERT(!s_conn->client && !s_conn->proxy);
 
+    pool = ((struct server *)s_conn->owner)->owner;
+
     /* enqueue the message (request) into server inq */
     if (TAILQ_EMPTY(&s_conn->imsg_q)) {
         status = event_add_out(ctx->evb, s_conn);
         if (status != NC_OK) {
-            req_forward_error(ctx, c_conn, msg);
             s_conn->err = errno;
-            return;
+            return status;
         }
     }
 
     if (!conn_authenticated(s_conn)) {
         status = msg->add_auth(ctx, c_conn, s_conn);
         if (status != NC_OK) {
-            req_forward_error(ctx, c_conn, msg);
             s_conn->err = errno;
-            return;
+            return status;
         }
     }
 
@@ -620,144 +744,723 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
 
     req_forward_stats(ctx, s_conn->owner, msg);
 
-    log_debug(LOG_VERB, "forward from c %d to s %d req %"PRIu64" len %"PRIu32
-              " type %d with key '%.*s'", c_conn->sd, s_conn->sd, msg->id,
-              msg->mlen, msg->type, keylen, key);
+    if (req_hedgeable(pool, msg)) {
+        pool->hedge_credit = MIN(pool->hedge_credit + pool->hedge_budget,
+                                 SERVER_HEDGE_MAX_CREDIT);
+        msg_hedge_insert(msg, s_conn->owner, server_hedge_delay(s_conn->owner));
+    }
+
+    return NC_OK;
 }
 
-void
-req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
-              struct msg *nmsg)
+/*
+ * Return a copy of request msg, owned by the same client connection, with
+ * the same bytes and type. Return NULL on failure.
+ */
+static struct msg *
+req_copy(struct msg *msg)
 {
-    rstatus_t status;
-    struct server_pool *pool;
-    struct msg_tqh frag_msgq;
-    struct msg *sub_msg;
-    struct msg *tmsg; 			/* tmp next message */
+    struct msg *cmsg;
+    struct mbuf *mbuf, *nbuf;
 
-    ASSERT(conn->client && !conn->proxy);
-    ASSERT(msg->request);
-    ASSERT(msg->owner == conn);
-    ASSERT(conn->rmsg == msg);
-    ASSERT(nmsg == NULL || nmsg->request);
+    cmsg = msg_get(msg->owner, true, msg->redis);
+    if (cmsg == NULL) {
+        return NULL;
+    }
 
-    /* enqueue next message (request), if any */
-    conn->rmsg = nmsg;
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        nbuf = mbuf_get();
+        if (nbuf == NULL) {
+            req_put(cmsg);
+            return NULL;
+        }
+        mbuf_copy(nbuf, mbuf->start, (size_t)(mbuf->last - mbuf->start));
+        mbuf_insert(&cmsg->mhdr, nbuf);
+    }
+    cmsg->mlen = msg->mlen;
+    cmsg->type = msg->type;
 
-    if (req_filter(ctx, conn, msg)) {
-        return;
+    return cmsg;
+}
+
+/*
+ * Return a connection to the server of pool that request msg with the
+ * given key is sent to: the master for writes in a redis pool with a
+ * master, otherwise the server the key maps to.
+ */
+static struct conn *
+req_server_conn(struct context *ctx, struct server_pool *pool,
+                struct msg *msg, uint8_t *key, uint32_t keylen)
+{
+    if (pool->redis && !redis_readonly(msg) && array_n(&pool->redis_master) > 0) {
+        struct server *master = array_get(&pool->redis_master, 0);
+        /* pick a connection to a given server */
+        return server_get_conn(ctx, master);
     }
 
-    if (msg->noforward) {
-        status = req_make_reply(ctx, conn, msg);
-        if (status != NC_OK) {
-            conn->err = errno;
-            return;
-        }
+    return server_pool_conn(ctx, pool, key, keylen);
+}
 
-        status = msg->reply(msg);
-        if (status != NC_OK) {
-            conn->err = errno;
-            return;
-        }
+/*
+ * Return true if request msg of pool is to be copied to the mirror pool,
+ * as selected by mirror_commands: and sampled at mirror_rate:. Fragments
+ * are not mirrored, as their keys were split by the servers of pool, but
+ * for the one fragment of a single key request, as every memcache get is
+ * fragmented.
+ */
+static bool
+req_mirrorable(struct server_pool *pool, struct msg *msg)
+{
+    bool readonly;
 
-        status = event_add_out(ctx->evb, conn);
-        if (status != NC_OK) {
-            conn->err = errno;
-        }
+    if (pool->mirror == NULL || msg->quit) {
+        return false;
+    }
+
+    if (msg->frag_id != 0 &&
+        (msg->frag_owner->nfrag != 1 || array_n(msg->keys) != 1)) {
+        return false;
+    }
+
+    readonly = msg->redis ? redis_readonly(msg) : memcache_retrieval(msg);
+    if ((pool->mirror_type == MIRROR_READS && !readonly) ||
+        (pool->mirror_type == MIRROR_WRITES && readonly)) {
+        return false;
+    }
+
+    pool->mirror_credit += pool->mirror_rate;
+    if (pool->mirror_credit < 100) {
+        return false;
+    }
+    pool->mirror_credit -= 100;
+
+    return true;
+}
+
+/*
+ * Send a copy of request msg, just forwarded on pool, to the mirror pool.
+ * The response to the copy is swallowed. The copy never holds up msg: it
+ * is dropped when the copies in flight would exceed mirror_max_bytes or
+ * the mirror server cannot take it right away.
+ */
+static void
+req_mirror(struct context *ctx, struct conn *c_conn, struct server_pool *pool,
+           struct msg *msg, uint8_t *key, uint32_t keylen)
+{
+    rstatus_t status;
+    struct server_pool *mpool;
+    struct conn *s_conn;
+    struct msg *mmsg;
+
+    mpool = pool->mirror;
 
+    if (pool->mirror_bytes + msg->mlen > pool->mirror_max_bytes) {
+        stats_pool_incr(ctx, pool, mirror_drops);
         return;
     }
 
-    /* do fragment */
-    pool = conn->owner;
-    TAILQ_INIT(&frag_msgq);
-    status = msg->fragment(msg, pool->ncontinuum, &frag_msgq);
-    if (status != NC_OK) {
-        if (!msg->noreply) {
-            conn->enqueue_outq(ctx, conn, msg);
-        }
-        req_forward_error(ctx, conn, msg);
+    s_conn = req_server_conn(ctx, mpool, msg, key, keylen);
+    if (s_conn == NULL || !server_admit(ctx, s_conn->owner)) {
+        stats_pool_incr(ctx, pool, mirror_drops);
+        return;
     }
 
-    /* if no fragment happened */
-    if (TAILQ_EMPTY(&frag_msgq)) {
-        req_forward(ctx, conn, msg);
+    mmsg = req_copy(msg);
+    if (mmsg == NULL) {
+        stats_pool_incr(ctx, pool, mirror_drops);
         return;
     }
+    mmsg->noreply = msg->noreply;
+    mmsg->swallow = 1;
+    mmsg->start_ts = nc_usec_now();
+    if (mpool->command_timeout[msg->type] > 0) {
+        mmsg->deadline = mmsg->start_ts / 1000LL + mpool->command_timeout[msg->type];
+    }
 
-    status = req_make_reply(ctx, conn, msg);
+    status = req_forward_server(ctx, c_conn, s_conn, mmsg);
     if (status != NC_OK) {
-        if (!msg->noreply) {
-            conn->enqueue_outq(ctx, conn, msg);
-        }
-        req_forward_error(ctx, conn, msg);
+        req_put(mmsg);
+        stats_pool_incr(ctx, pool, mirror_drops);
+        return;
     }
 
-    for (sub_msg = TAILQ_FIRST(&frag_msgq); sub_msg != NULL; sub_msg = tmsg) {
-        tmsg = TAILQ_NEXT(sub_msg, m_tqe);
+    mmsg->mirror = pool;
+    pool->mirror_bytes += mmsg->mlen;
 
-        TAILQ_REMOVE(&frag_msgq, sub_msg, m_tqe);
-        req_forward(ctx, conn, sub_msg);
-    }
+    stats_pool_incr(ctx, pool, mirrors);
 
-    ASSERT(TAILQ_EMPTY(&frag_msgq));
-    return;
+    log_debug(LOG_VERB, "mirror req %"PRIu64" from c %d to s %d as req %"PRIu64,
+              msg->id, c_conn->sd, s_conn->sd, mmsg->id);
 }
 
-struct msg *
-req_send_next(struct context *ctx, struct conn *conn)
+/*
+ * Send a copy of delete request msg, just forwarded on migrating pool, to
+ * the old owner of its key as well. Otherwise a read that misses on the
+ * new owner would find the deleted value on the old one.
+ */
+static void
+req_migrate_delete(struct context *ctx, struct server_pool *pool,
+                   struct msg *msg, uint8_t *key, uint32_t keylen)
 {
     rstatus_t status;
-    struct msg *msg, *nmsg; /* current and next message */
+    struct conn *s_conn;
+    struct msg *dmsg;
 
-    ASSERT(!conn->client && !conn->proxy);
+    switch (msg->type) {
+    case MSG_REQ_MC_DELETE:
+    case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_UNLINK:
+        break;
 
-    if (conn->connecting) {
-        server_connected(ctx, conn);
+    default:
+        return;
     }
 
-    nmsg = TAILQ_FIRST(&conn->imsg_q);
-    if (nmsg == NULL) {
-        /* nothing to send as the server inq is empty */
-        status = event_del_out(ctx->evb, conn);
-        if (status != NC_OK) {
-            conn->err = errno;
-        }
-
-        return NULL;
+    if (array_n(msg->keys) != 1) {
+        return;
     }
 
-    msg = conn->smsg;
-    if (msg != NULL) {
-        ASSERT(msg->request && !msg->done);
-        nmsg = TAILQ_NEXT(msg, s_tqe);
+    s_conn = req_server_conn(ctx, pool->migrate, msg, key, keylen);
+    if (s_conn == NULL || !server_admit(ctx, s_conn->owner)) {
+        return;
     }
 
-    conn->smsg = nmsg;
-
-    if (nmsg == NULL) {
-        return NULL;
+    dmsg = req_copy(msg);
+    if (dmsg == NULL) {
+        return;
     }
+    dmsg->noreply = msg->noreply;
+    dmsg->swallow = 1;
+    dmsg->start_ts = nc_usec_now();
 
-    ASSERT(nmsg->request && !nmsg->done);
-
-    log_debug(LOG_VVERB, "send next req %"PRIu64" len %"PRIu32" type %d on "
-              "s %d", nmsg->id, nmsg->mlen, nmsg->type, conn->sd);
+    status = req_forward_server(ctx, msg->owner, s_conn, dmsg);
+    if (status != NC_OK) {
+        req_put(dmsg);
+        return;
+    }
 
-    return nmsg;
+    log_debug(LOG_VERB, "migrate delete req %"PRIu64" to old owner s %d as "
+              "req %"PRIu64, msg->id, s_conn->sd, dmsg->id);
 }
 
-void
-req_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
+/*
+ * Forward request msg, already in the client outq if it expects a
+ * response, to the server its first key maps to
+ */
+static void
+req_route(struct context *ctx, struct conn *c_conn, struct msg *msg)
 {
-    ASSERT(!conn->client && !conn->proxy);
-    ASSERT(msg != NULL && conn->smsg == NULL);
-    ASSERT(msg->request && !msg->done);
-    ASSERT(msg->owner != conn);
+    rstatus_t status;
+    struct conn *s_conn;
+    struct server_pool *pool;
+    uint8_t *key;
+    uint32_t keylen;
+    struct keypos *kpos;
 
-    log_debug(LOG_VVERB, "send done req %"PRIu64" len %"PRIu32" type %d on "
-              "s %d", msg->id, msg->mlen, msg->type, conn->sd);
+    ASSERT(c_conn->client && !c_conn->proxy);
+    ASSERT(array_n(msg->keys) > 0);
+    kpos = array_get(msg->keys, 0);
+    key = kpos->start;
+    keylen = (uint32_t)(kpos->end - kpos->start);
+
+    pool = route_pool(c_conn->owner, key, keylen);
+
+    if (pool->command_timeout[msg->type] > 0) {
+        msg->deadline = msg->start_ts / 1000LL + pool->command_timeout[msg->type];
+    }
+
+    s_conn = req_server_conn(ctx, pool, msg, key, keylen);
+    if (s_conn == NULL) {
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+
+    /* shed load the server cannot take within the admission latency */
+    if (!server_admit(ctx, s_conn->owner)) {
+        stats_server_incr(ctx, s_conn->owner, requests_shed);
+        errno = EBUSY;
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+
+    status = req_forward_server(ctx, c_conn, s_conn, msg);
+    if (status != NC_OK) {
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+
+    log_debug(LOG_VERB, "forward from c %d to s %d req %"PRIu64" len %"PRIu32
+              " type %d with key '%.*s'", c_conn->sd, s_conn->sd, msg->id,
+              msg->mlen, msg->type, keylen, key);
+
+    if (req_mirrorable(pool, msg)) {
+        req_mirror(ctx, c_conn, pool, msg, key, keylen);
+    }
+
+    if (pool->migrate != NULL) {
+        req_migrate_delete(ctx, pool, msg, key, keylen);
+    }
+}
+
+static void
+req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    /* enqueue message (request) into client outq, if response is expected */
+    if (!msg->noreply) {
+        c_conn->enqueue_outq(ctx, c_conn, msg);
+    }
+
+    /* a fragment held back by the stream window is forwarded by req_stream */
+    if (msg->deferred) {
+        return;
+    }
+
+    req_route(ctx, c_conn, msg);
+}
+
+/*
+ * Return the # keys past the stream position of a streamed mget whose
+ * fragments are kept in flight: about two batches per server, so that a
+ * server has its next batch at hand while the reply to one is coalesced
+ */
+uint32_t
+req_stream_window(struct server_pool *pool)
+{
+    uint64_t window;
+
+    if (pool->mget_batch == 0) {
+        return UINT32_MAX;
+    }
+
+    window = 2ULL * pool->mget_batch * route_nbackend(pool);
+
+    return window > UINT32_MAX ? UINT32_MAX : (uint32_t)window;
+}
+
+/*
+ * Return true if the reply of request msg is streamed and part of it is
+ * ready to be sent, before all of its fragments are done
+ */
+bool
+req_stream_ready(struct msg *msg)
+{
+    struct mbuf *mbuf;
+
+    if (msg == NULL || !msg->stream || msg->peer == NULL) {
+        return false;
+    }
+
+    STAILQ_FOREACH(mbuf, &msg->peer->mhdr, next) {
+        if (!mbuf_empty(mbuf)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Forward the fragments of the streamed request that fragment msg belongs
+ * to, which were held back until the stream got within the window of
+ * their first key. Once the key at the stream position has failed the
+ * whole reply fails, and the fragments still held back are failed too
+ * rather than forwarded.
+ */
+void
+req_stream(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct msg *owner = msg->frag_owner;
+    struct msg *sub_msg, *smsg;
+    struct server_pool *pool;
+    uint32_t nkey, window;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    if (owner == NULL || !owner->stream) {
+        return;
+    }
+
+    pool = conn->owner;
+    nkey = array_n(owner->keys);
+    window = req_stream_window(pool);
+
+    while (owner->frag_fwd < nkey) {
+        smsg = owner->frag_next < nkey ? owner->frag_seq[owner->frag_next] : NULL;
+        if ((smsg == NULL || !smsg->error) &&
+            owner->frag_fwd >= (uint64_t)owner->frag_next + window) {
+            break;
+        }
+
+        sub_msg = owner->frag_seq[owner->frag_fwd++];
+        if (!sub_msg->deferred) {
+            continue;
+        }
+        sub_msg->deferred = 0;
+
+        if (smsg != NULL && smsg->error) {
+            errno = smsg->err;
+            req_forward_error(ctx, conn, sub_msg);
+        } else {
+            req_route(ctx, conn, sub_msg);
+        }
+    }
+}
+
+void
+req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
+              struct msg *nmsg)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct msg_tqh frag_msgq;
+    struct msg *sub_msg;
+    struct msg *tmsg; 			/* tmp next message */
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(msg->request);
+    ASSERT(msg->owner == conn);
+    ASSERT(conn->rmsg == msg);
+    ASSERT(nmsg == NULL || nmsg->request);
+
+    /* enqueue next message (request), if any */
+    conn->rmsg = nmsg;
+
+    pool = conn->owner;
+    token_bucket_take(&pool->rate_requests, 1);
+    token_bucket_take(&pool->rate_bytes, msg->mlen);
+    token_bucket_take(&conn->rate_requests, 1);
+    token_bucket_take(&conn->rate_bytes, msg->mlen);
+
+    if (req_filter(ctx, conn, msg)) {
+        return;
+    }
+
+    if (msg->noforward) {
+        status = req_make_reply(ctx, conn, msg);
+        if (status != NC_OK) {
+            conn->err = errno;
+            return;
+        }
+
+        status = msg->reply(msg);
+        if (status != NC_OK) {
+            conn->err = errno;
+            return;
+        }
+
+        status = event_add_out(ctx->evb, conn);
+        if (status != NC_OK) {
+            conn->err = errno;
+        }
+
+        return;
+    }
+
+    /* do fragment */
+    TAILQ_INIT(&frag_msgq);
+    status = msg->fragment(msg, route_nbackend(pool), &frag_msgq);
+    if (status != NC_OK) {
+        while (!TAILQ_EMPTY(&frag_msgq)) {
+            sub_msg = TAILQ_FIRST(&frag_msgq);
+            TAILQ_REMOVE(&frag_msgq, sub_msg, m_tqe);
+            req_put(sub_msg);
+        }
+        msg->frag_id = 0;
+        msg->stream = 0;
+
+        if (!msg->noreply) {
+            conn->enqueue_outq(ctx, conn, msg);
+        }
+        req_forward_error(ctx, conn, msg);
+        return;
+    }
+
+    /* if no fragment happened */
+    if (TAILQ_EMPTY(&frag_msgq)) {
+        req_forward(ctx, conn, msg);
+        return;
+    }
+
+    status = req_make_reply(ctx, conn, msg);
+    if (status != NC_OK) {
+        if (!msg->noreply) {
+            conn->enqueue_outq(ctx, conn, msg);
+        }
+        req_forward_error(ctx, conn, msg);
+    }
+
+    for (sub_msg = TAILQ_FIRST(&frag_msgq); sub_msg != NULL; sub_msg = tmsg) {
+        tmsg = TAILQ_NEXT(sub_msg, m_tqe);
+
+        TAILQ_REMOVE(&frag_msgq, sub_msg, m_tqe);
+        req_forward(ctx, conn, sub_msg);
+    }
+
+    ASSERT(TAILQ_EMPTY(&frag_msgq));
+
+    /* a fragment failed on forward may fail those held back */
+    req_stream(ctx, conn, msg);
+}
+
+/*
+ * Return true if request msg in a server inq has outlived its deadline
+ * and none of it has been sent yet
+ */
+static bool
+req_expired(struct msg *msg, int64_t now)
+{
+    struct mbuf *mbuf;
+
+    if (msg->deadline == 0 || msg->deadline > now) {
+        return false;
+    }
+
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    return mbuf == NULL || mbuf->pos == mbuf->start;
+}
+
+/*
+ * Drop request msg, whose deadline passed while it was waiting in the inq
+ * of server connection conn, and fail it back to its client. There is no
+ * point in sending a request the client has given up on.
+ */
+static void
+req_expire(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct conn *c_conn;    /* peer client connection */
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(msg->request && !msg->done);
+
+    conn->dequeue_inq(ctx, conn, msg);
+    msg_tmo_delete(msg);
+    msg_hedge_delete(msg);
+
+    stats_server_incr(ctx, conn->owner, requests_expired);
+
+    log_debug(LOG_INFO, "expire req %"PRIu64" len %"PRIu32" type %d on s %d "
+              "after %"PRId64" usec", msg->id, msg->mlen, msg->type, conn->sd,
+              nc_usec_now() - msg->start_ts);
+
+    /* the twin of a hedged request may still make it in time */
+    if (msg->hedge != NULL && !msg->swallow) {
+        if (!msg->hedged) {
+            req_hedge_promote(msg);
+        }
+        req_put(msg);
+        return;
+    }
+
+    if (msg->swallow || msg->noreply) {
+        req_put(msg);
+        return;
+    }
+
+    c_conn = msg->owner;
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    msg->done = 1;
+    msg->error = 1;
+    msg->err = ETIMEDOUT;
+
+    if (msg->frag_owner != NULL) {
+        msg->frag_owner->nfrag_done++;
+        req_stream(ctx, c_conn, msg);
+    }
+
+    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+        if (event_add_out(ctx->evb, c_conn) != NC_OK) {
+            c_conn->err = errno;
+        }
+    }
+}
+
+/*
+ * Return true if request msg in the inq of a server connection of pool
+ * is a single-key get, none of which is sent yet, that can be merged with
+ * the gets next to it. In memcache, where every get is fragmented, this
+ * is a fragment of one key. Gets whose response is swallowed, hedged or looked
+ * at by a key migration are sent on their own.
+ */
+static bool
+req_batchable(struct server_pool *pool, struct msg *msg)
+{
+    struct mbuf *mbuf;
+
+    if (msg->type != (msg->redis ? MSG_REQ_REDIS_GET : MSG_REQ_MC_GET) ||
+        array_n(msg->keys) != 1) {
+        return false;
+    }
+
+    if (msg->noreply || msg->swallow || msg->hedged || msg->hedge != NULL ||
+        msg->hedge_rbe.data != NULL || msg->migrating) {
+        return false;
+    }
+
+    if (pool->migrate != NULL) {
+        return false;
+    }
+
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    return mbuf == NULL || mbuf->pos == mbuf->start;
+}
+
+/*
+ * Merge the gets that follow each other from request msg on in the inq of
+ * server connection conn into one multi-key get, which takes their place
+ * in the inq. The reply is split back in rsp_forward. Return the merged
+ * request, or msg if there is nothing to merge.
+ */
+static struct msg *
+req_batch(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    rstatus_t status;
+    struct server *server = conn->owner;
+    struct server_pool *pool = server->owner;
+    struct msg *bmsg, *tmsg;
+    uint32_t i, n;
+
+    if (pool->get_batch < 2 || !req_batchable(pool, msg)) {
+        return msg;
+    }
+
+    for (n = 1, tmsg = TAILQ_NEXT(msg, s_tqe);
+         n < pool->get_batch && tmsg != NULL && req_batchable(pool, tmsg);
+         n++, tmsg = TAILQ_NEXT(tmsg, s_tqe)) {
+        ;
+    }
+    if (n < 2) {
+        return msg;
+    }
+
+    bmsg = msg_get(conn, true, conn->redis);
+    if (bmsg == NULL) {
+        return msg;
+    }
+
+    bmsg->batch_seq = nc_alloc(n * sizeof(*bmsg->batch_seq));
+    if (bmsg->batch_seq == NULL) {
+        msg_put(bmsg);
+        return msg;
+    }
+
+    for (i = 0, tmsg = msg; i < n; i++, tmsg = TAILQ_NEXT(tmsg, s_tqe)) {
+        bmsg->batch_seq[i] = tmsg;
+    }
+    bmsg->nbatch = n;
+
+    status = conn->redis ? redis_batch(bmsg) : memcache_batch(bmsg);
+    if (status != NC_OK) {
+        msg_put(bmsg);
+        return msg;
+    }
+
+    /*
+     * The merged request belongs to no client and is not logged; the
+     * timeouts of its gets, which stay in the rbtree, cover it
+     */
+    bmsg->owner = NULL;
+    bmsg->start_ts = 0;
+
+    TAILQ_INSERT_BEFORE(msg, bmsg, s_tqe);
+
+    conn->nqueue++;
+    conn->nqueue_bytes += bmsg->mlen;
+    server->nqueue++;
+
+    stats_server_incr(ctx, server, in_queue);
+    stats_server_incr_by(ctx, server, in_queue_bytes, bmsg->mlen);
+
+    for (i = 0; i < n; i++) {
+        conn->dequeue_inq(ctx, conn, bmsg->batch_seq[i]);
+    }
+
+    stats_server_incr(ctx, server, get_batches);
+    stats_server_incr_by(ctx, server, batched_gets, n);
+
+    log_debug(LOG_VERB, "batch %"PRIu32" gets from req %"PRIu64" into req "
+              "%"PRIu64" on s %d", n, msg->id, bmsg->id, conn->sd);
+
+    return bmsg;
+}
+
+struct msg *
+req_send_next(struct context *ctx, struct conn *conn)
+{
+    rstatus_t status;
+    struct msg *msg, *nmsg, *tmsg; /* current, next and tmp message */
+    int64_t now;
+
+    ASSERT(!conn->client && !conn->proxy);
+
+    if (conn->connecting) {
+        server_connected(ctx, conn);
+    }
+
+    nmsg = TAILQ_FIRST(&conn->imsg_q);
+    if (nmsg == NULL) {
+        /* nothing to send as the server inq is empty */
+        status = event_del_out(ctx->evb, conn);
+        if (status != NC_OK) {
+            conn->err = errno;
+        }
+
+        return NULL;
+    }
+
+    msg = conn->smsg;
+    if (msg != NULL) {
+        ASSERT(msg->request && !msg->done);
+        nmsg = TAILQ_NEXT(msg, s_tqe);
+    }
+
+    for (now = 0; nmsg != NULL && nmsg->deadline != 0; nmsg = tmsg) {
+        if (now == 0) {
+            now = nc_msec_now();
+        }
+        if (!req_expired(nmsg, now)) {
+            break;
+        }
+        tmsg = TAILQ_NEXT(nmsg, s_tqe);
+        req_expire(ctx, conn, nmsg);
+    }
+
+    if (nmsg != NULL) {
+        nmsg = req_batch(ctx, conn, nmsg);
+    }
+
+    conn->smsg = nmsg;
+
+    if (nmsg == NULL) {
+        if (TAILQ_EMPTY(&conn->imsg_q)) {
+            status = event_del_out(ctx->evb, conn);
+            if (status != NC_OK) {
+                conn->err = errno;
+            }
+        }
+        return NULL;
+    }
+
+    ASSERT(nmsg->request && !nmsg->done);
+
+    log_debug(LOG_VVERB, "send next req %"PRIu64" len %"PRIu32" type %d on "
+              "s %d", nmsg->id, nmsg->mlen, nmsg->type, conn->sd);
+
+    return nmsg;
+}
+
+void
+req_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(msg != NULL && conn->smsg == NULL);
+    ASSERT(msg->request && !msg->done);
+    ASSERT(msg->owner != conn);
+
+    log_debug(LOG_VVERB, "send done req %"PRIu64" len %"PRIu32" type %d on "
+              "s %d", msg->id, msg->mlen, msg->type, conn->sd);
 
     /* dequeue the message (request) from server inq */
     conn->dequeue_inq(ctx, conn, msg);
@@ -773,3 +1476,431 @@ req_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
         req_put(msg);
     }
 }
+
+/*
+ * Send a copy of read request msg, which is still outstanding on server,
+ * to another server of the pool. Whichever of the two responses arrives
+ * first is forwarded to the client and the other one is swallowed.
+ */
+void
+req_hedge(struct context *ctx, struct msg *msg, struct server *server)
+{
+    rstatus_t status;
+    struct conn *c_conn, *s_conn;
+    struct server_pool *pool;
+    struct server *target;
+    struct msg *hmsg;
+
+    ASSERT(msg->request && !msg->hedged);
+
+    if (msg->done || msg->error || msg->swallow || msg->hedge != NULL) {
+        return;
+    }
+
+    c_conn = msg->owner;
+    ASSERT(c_conn->client && !c_conn->proxy);
+    pool = server->owner;
+
+    if (pool->hedge_credit < 100) {
+        log_debug(LOG_VERB, "skip hedge of req %"PRIu64" as hedge budget is "
+                  "exhausted", msg->id);
+        return;
+    }
+
+    target = server_pool_other_server(pool, server);
+    if (target == NULL || !server_admit(ctx, target)) {
+        return;
+    }
+
+    hmsg = req_copy(msg);
+    if (hmsg == NULL) {
+        return;
+    }
+    hmsg->start_ts = msg->start_ts;
+    hmsg->deadline = msg->deadline;
+    hmsg->hedged = 1;
+
+    s_conn = server_get_conn(ctx, target);
+    if (s_conn == NULL) {
+        req_put(hmsg);
+        return;
+    }
+
+    status = req_forward_server(ctx, c_conn, s_conn, hmsg);
+    if (status != NC_OK) {
+        req_put(hmsg);
+        return;
+    }
+
+    msg->hedge = hmsg;
+    hmsg->hedge = msg;
+    pool->hedge_credit -= 100;
+
+    stats_pool_incr(ctx, pool, hedges);
+
+    log_debug(LOG_VERB, "hedge req %"PRIu64" from c %d to s %d as req %"PRIu64,
+              msg->id, c_conn->sd, s_conn->sd, hmsg->id);
+}
+
+/*
+ * Hand the place of request msg in its client outq over to its hedge copy,
+ * which then completes the request towards the client. The caller owns
+ * msg afterwards and must either swallow or free it.
+ */
+void
+req_hedge_promote(struct msg *msg)
+{
+    struct conn *c_conn;
+    struct msg *hmsg;
+
+    hmsg = msg->hedge;
+    ASSERT(msg->request && !msg->hedged && !msg->done);
+    ASSERT(hmsg != NULL && hmsg->hedged && hmsg->hedge == msg);
+
+    c_conn = msg->owner;
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    TAILQ_INSERT_AFTER(&c_conn->omsg_q, msg, hmsg, c_tqe);
+    TAILQ_REMOVE(&c_conn->omsg_q, msg, c_tqe);
+
+    hmsg->hedged = 0;
+    hmsg->hedge = NULL;
+    msg->hedge = NULL;
+
+    msg_hedge_delete(msg);
+
+    log_debug(LOG_VERB, "promote hedge req %"PRIu64" of req %"PRIu64" on c %d",
+              hmsg->id, msg->id, c_conn->sd);
+}
+
+/*
+ * Return true if read request msg, outstanding on a failed server, can be
+ * re-dispatched to another server instead of failing back to the client.
+ * Reads are retried in a redis pool with a master, where every server has
+ * the same data, or in a pool with auto_eject_hosts, where the key moves
+ * to another server once the failed one is ejected. Reads are the read-only
+ * commands in redis and the retrieval commands in memcache.
+ */
+bool
+req_retryable(struct server *server, struct msg *msg)
+{
+    struct server_pool *pool;
+
+    ASSERT(msg->request);
+
+    if (msg->swallow || msg->noreply || msg->hedged) {
+        return false;
+    }
+
+    pool = server->owner;
+
+    if (msg->nretry >= pool->read_retries) {
+        return false;
+    }
+
+    if (msg->redis ? !redis_readonly(msg) : !memcache_retrieval(msg)) {
+        return false;
+    }
+
+    if (array_n(&pool->redis_master) > 0) {
+        return array_n(&pool->server) > 1;
+    }
+
+    /*
+     * Fragments were split by the server of their keys before the failure,
+     * so only a fragment of a single key can move to another server
+     */
+    return pool->auto_eject_hosts &&
+           (msg->frag_id == 0 || array_n(msg->keys) == 1);
+}
+
+/*
+ * Re-dispatch read request msg, which failed on server, to another server.
+ * Return false if the request could not be re-dispatched, in which case
+ * the caller fails it back to the client.
+ */
+bool
+req_retry(struct context *ctx, struct server *server, struct msg *msg)
+{
+    rstatus_t status;
+    struct conn *c_conn, *s_conn;
+    struct server_pool *pool;
+    struct server *target;
+    struct keypos *kpos;
+    struct mbuf *mbuf;
+    int64_t age;
+
+    ASSERT(req_retryable(server, msg));
+
+    c_conn = msg->owner;
+    pool = server->owner;
+
+    age = nc_usec_now() - msg->start_ts;
+    if (pool->read_retry_budget > 0 && age > pool->read_retry_budget) {
+        log_debug(LOG_INFO, "skip retry of req %"PRIu64" after %"PRId64" usec",
+                  msg->id, age);
+        return false;
+    }
+
+    ASSERT(array_n(msg->keys) > 0);
+    kpos = array_get(msg->keys, 0);
+
+    target = server_pool_retry_server(pool, server, kpos->start,
+                                      (uint32_t)(kpos->end - kpos->start));
+    if (target == NULL) {
+        return false;
+    }
+
+    if (!server_admit(ctx, target)) {
+        stats_server_incr(ctx, target, requests_shed);
+        return false;
+    }
+
+    s_conn = server_get_conn(ctx, target);
+    if (s_conn == NULL) {
+        return false;
+    }
+
+    /* rewind the request, it may have been (partially) sent already */
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        mbuf->pos = mbuf->start;
+    }
+    msg_tmo_delete(msg);
+    msg_hedge_delete(msg);
+
+    status = req_forward_server(ctx, c_conn, s_conn, msg);
+    if (status != NC_OK) {
+        return false;
+    }
+
+    msg->nretry++;
+    stats_pool_incr(ctx, pool, read_retries);
+
+    log_debug(LOG_INFO, "retry req %"PRIu64" len %"PRIu32" type %d from c %d "
+              "on s %d", msg->id, msg->mlen, msg->type, c_conn->sd, s_conn->sd);
+
+    return true;
+}
+
+/*
+ * Return true if request msg is a single-key read that falls back to the
+ * old owner of its key when it misses on a migrating pool
+ */
+static bool
+req_migrate_read(struct msg *msg)
+{
+    if (msg->swallow || msg->hedged || msg->hedge != NULL) {
+        return false;
+    }
+
+    switch (msg->type) {
+    case MSG_REQ_MC_GET:
+    case MSG_REQ_MC_GETS:
+    case MSG_REQ_REDIS_GET:
+        return array_n(msg->keys) == 1;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Add the value in response rsp, which the old owner returned for read
+ * msg, to the new owner of the key in pool. The value is only added if
+ * the new owner has none, so that it never overwrites a newer write.
+ */
+static void
+req_migrate_writeback(struct context *ctx, struct server_pool *pool,
+                      struct msg *msg, struct msg *rsp)
+{
+    rstatus_t status;
+    struct conn *s_conn;
+    struct msg *wmsg;
+    struct mbuf *mbuf, *nbuf;
+    struct keypos *kpos;
+    uint8_t *start, *end, *from, *to, *flags, *p;
+    uint32_t keylen, flagslen;
+    char buf[64], ttl[16];
+    int n;
+
+    kpos = array_get(msg->keys, 0);
+    keylen = (uint32_t)(kpos->end - kpos->start);
+
+    mbuf = STAILQ_FIRST(&rsp->mhdr);
+    start = mbuf->start;
+    end = NULL;
+    flags = NULL;
+    flagslen = 0;
+
+    if (!msg->redis) {
+        /* keep the flags of 'VALUE <key> <flags> <bytes> [<cas>]\r\n' */
+        if (rsp->end == NULL || mbuf->last - start < 6 ||
+            nc_strncmp(start, "VALUE ", 6) != 0) {
+            return;
+        }
+        p = memchr(start, LF, (size_t)(mbuf->last - start));
+        if (p == NULL) {
+            return;
+        }
+        flags = memchr(start + 6, ' ', (size_t)(p - start - 6));
+        if (flags == NULL) {
+            return;
+        }
+        flags++;
+        for (flagslen = 0; isdigit(flags[flagslen]); flagslen++) {
+            /* flags run up to the next space */
+        }
+        start = p + 1;
+        end = rsp->end;
+    } else if (rsp->type != MSG_RSP_REDIS_BULK) {
+        return;
+    }
+
+    wmsg = msg_get(msg->owner, true, msg->redis);
+    if (wmsg == NULL) {
+        return;
+    }
+
+    /* copy the value, which for redis is the whole bulk reply */
+    for (; mbuf != NULL; mbuf = STAILQ_NEXT(mbuf, next)) {
+        from = (mbuf == STAILQ_FIRST(&rsp->mhdr)) ? start : mbuf->start;
+        to = mbuf->last;
+        if (end != NULL && end >= mbuf->start && end <= mbuf->last) {
+            to = end;
+        }
+
+        if (to > from) {
+            nbuf = mbuf_get();
+            if (nbuf == NULL) {
+                req_put(wmsg);
+                return;
+            }
+            mbuf_copy(nbuf, from, (size_t)(to - from));
+            mbuf_insert(&wmsg->mhdr, nbuf);
+            wmsg->mlen += (uint32_t)(to - from);
+        }
+
+        if (to == end) {
+            break;
+        }
+    }
+
+    if (msg->redis) {
+        status = msg_prepend_format(wmsg, "*%d\r\n$3\r\nSET\r\n$%"PRIu32"\r\n"
+                                    "%.*s\r\n", pool->migrate_writeback_ttl > 0 ? 6 : 4,
+                                    keylen, keylen, kpos->start);
+        if (status == NC_OK) {
+            n = nc_scnprintf(buf, sizeof(buf), "$2\r\nNX\r\n");
+            if (pool->migrate_writeback_ttl > 0) {
+                n = nc_scnprintf(ttl, sizeof(ttl), "%d", pool->migrate_writeback_ttl);
+                n = nc_scnprintf(buf, sizeof(buf), "$2\r\nNX\r\n$2\r\nEX\r\n$%d\r\n"
+                                 "%s\r\n", n, ttl);
+            }
+            status = msg_append(wmsg, (uint8_t *)buf, (size_t)n);
+        }
+        wmsg->type = MSG_REQ_REDIS_SET;
+    } else {
+        status = msg_prepend_format(wmsg, "add %.*s %.*s %d %"PRIu32"\r\n",
+                                    keylen, kpos->start, flagslen, flags,
+                                    pool->migrate_writeback_ttl,
+                                    wmsg->mlen - CRLF_LEN);
+        wmsg->type = MSG_REQ_MC_ADD;
+    }
+    if (status != NC_OK) {
+        req_put(wmsg);
+        return;
+    }
+    wmsg->swallow = 1;
+    wmsg->start_ts = nc_usec_now();
+
+    s_conn = req_server_conn(ctx, pool, wmsg, kpos->start, keylen);
+    if (s_conn == NULL || !server_admit(ctx, s_conn->owner)) {
+        req_put(wmsg);
+        return;
+    }
+
+    status = req_forward_server(ctx, msg->owner, s_conn, wmsg);
+    if (status != NC_OK) {
+        req_put(wmsg);
+        return;
+    }
+
+    stats_pool_incr(ctx, pool, migrate_writebacks);
+}
+
+/*
+ * Handle response rsp to request msg from server connection s_conn, for
+ * pools with migrate_from:, whose keys move from the distribution of the
+ * old pool to their own. A single-key read that missed on the new owner
+ * is re-sent to the old owner and true is returned, in which case the
+ * caller discards rsp. The response of the old owner is forwarded to the
+ * client as usual, and a hit is optionally written back to the new owner.
+ */
+bool
+req_migrate(struct context *ctx, struct conn *s_conn, struct msg *msg,
+            struct msg *rsp)
+{
+    rstatus_t status;
+    struct conn *c_conn, *o_conn;
+    struct server_pool *pool;
+    struct keypos *kpos;
+    struct mbuf *mbuf;
+    uint32_t keylen;
+    bool miss;
+
+    ASSERT(msg->request && !rsp->request);
+
+    if (!req_migrate_read(msg)) {
+        return false;
+    }
+
+    c_conn = msg->owner;
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    kpos = array_get(msg->keys, 0);
+    keylen = (uint32_t)(kpos->end - kpos->start);
+    miss = msg->redis ? redis_miss(rsp) : memcache_miss(rsp);
+
+    if (msg->migrating) {
+        /* response of the old owner */
+        pool = route_pool(c_conn->owner, kpos->start, keylen);
+        if (!miss) {
+            stats_pool_incr(ctx, pool, migrate_fallback_hits);
+            if (pool->migrate_writeback) {
+                req_migrate_writeback(ctx, pool, msg, rsp);
+            }
+        }
+        return false;
+    }
+
+    pool = ((struct server *)s_conn->owner)->owner;
+    if (pool->migrate == NULL || !miss) {
+        return false;
+    }
+
+    o_conn = server_pool_conn(ctx, pool->migrate, kpos->start, keylen);
+    if (o_conn == NULL || !server_admit(ctx, o_conn->owner)) {
+        return false;
+    }
+
+    /* rewind the request, it was sent to the new owner already */
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        mbuf->pos = mbuf->start;
+    }
+    msg_tmo_delete(msg);
+
+    status = req_forward_server(ctx, c_conn, o_conn, msg);
+    if (status != NC_OK) {
+        return false;
+    }
+
+    msg->migrating = 1;
+    stats_pool_incr(ctx, pool, migrate_fallbacks);
+
+    log_debug(LOG_VERB, "migrate req %"PRIu64" from c %d missed, fall back to "
+              "old owner s %d", msg->id, c_conn->sd, o_conn->sd);
+
+    return true;
+}
@@ -0,0 +1,284 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <arpa/inet.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_resolver.h>
+
+/*
+ * Is name a unix socket path or a numeric address, which never needs
+ * looking up again?
+ */
+bool
+resolver_static(struct string *name)
+{
+    struct in6_addr addr;
+    char buf[INET6_ADDRSTRLEN];
+
+    if (name->len > 0 && name->data[0] == '/') {
+        return true;
+    }
+
+    if (name->len >= sizeof(buf)) {
+        return false;
+    }
+
+    nc_memcpy(buf, name->data, name->len);
+    buf[name->len] = '\0';
+
+    return inet_pton(AF_INET, buf, &addr) == 1 ||
+           inet_pton(AF_INET6, buf, &addr) == 1;
+}
+
+static void
+resolver_free(struct resolve_tqh *q)
+{
+    struct resolve *r;
+
+    while (!STAILQ_EMPTY(q)) {
+        r = STAILQ_FIRST(q);
+        STAILQ_REMOVE_HEAD(q, next);
+        string_deinit(&r->name);
+        nc_free(r);
+    }
+}
+
+/*
+ * The resolver thread is detached and outlives resolver_deinit, which
+ * only tells it to quit, so that no lookup it is stuck in holds up the
+ * event loop. It frees the resolver itself on its way out.
+ */
+static void *
+resolver_loop(void *arg)
+{
+    struct resolver *rs = arg;
+    struct resolve *r;
+    ssize_t n;
+
+    pthread_mutex_lock(&rs->lock);
+
+    for (;;) {
+        while (!rs->quit && STAILQ_EMPTY(&rs->pending)) {
+            pthread_cond_wait(&rs->cond, &rs->lock);
+        }
+
+        if (rs->quit) {
+            break;
+        }
+
+        r = STAILQ_FIRST(&rs->pending);
+        STAILQ_REMOVE_HEAD(&rs->pending, next);
+
+        pthread_mutex_unlock(&rs->lock);
+
+        r->status = nc_resolve(&r->name, r->port, &r->info);
+
+        pthread_mutex_lock(&rs->lock);
+
+        if (rs->quit) {
+            string_deinit(&r->name);
+            nc_free(r);
+            break;
+        }
+
+        STAILQ_INSERT_TAIL(&rs->done, r, next);
+
+        /* a full pipe already has the event loop on its way */
+        n = write(rs->fds[1], "", 1);
+        if (n < 0 && errno != EAGAIN) {
+            log_error("write on resolver pipe %d failed: %s", rs->fds[1],
+                      strerror(errno));
+        }
+    }
+
+    resolver_free(&rs->pending);
+    resolver_free(&rs->done);
+
+    close(rs->fds[0]);
+    close(rs->fds[1]);
+
+    pthread_mutex_unlock(&rs->lock);
+    pthread_mutex_destroy(&rs->lock);
+    pthread_cond_destroy(&rs->cond);
+
+    nc_free(rs);
+
+    return NULL;
+}
+
+static int
+resolver_event(void *evb, void *priv, uint32_t events)
+{
+    struct resolver *rs = priv;
+    struct resolve_tqh done;
+    struct resolve *r;
+    char buf[64];
+
+    while (read(rs->fds[0], buf, sizeof(buf)) > 0) {
+        /* drain the wake ups */
+    }
+
+    STAILQ_INIT(&done);
+
+    pthread_mutex_lock(&rs->lock);
+    STAILQ_CONCAT(&done, &rs->done);
+    pthread_mutex_unlock(&rs->lock);
+
+    STAILQ_FOREACH(r, &done, next) {
+        server_resolved(rs->ctx, r->server, &r->name, r->port,
+                        r->status == NC_OK ? &r->info : NULL);
+    }
+
+    resolver_free(&done);
+
+    return NC_OK;
+}
+
+rstatus_t
+resolver_init(struct context *ctx)
+{
+    struct resolver *rs;
+    sigset_t set, oset;
+    int status;
+
+    rs = nc_alloc(sizeof(*rs));
+    if (rs == NULL) {
+        return NC_ENOMEM;
+    }
+
+    rs->ctx = ctx;
+    STAILQ_INIT(&rs->pending);
+    STAILQ_INIT(&rs->done);
+    rs->quit = 0;
+
+    status = pipe(rs->fds);
+    if (status < 0) {
+        log_error("pipe for resolver failed: %s", strerror(errno));
+        nc_free(rs);
+        return NC_ERROR;
+    }
+
+    if (nc_set_nonblocking(rs->fds[0]) < 0 ||
+        nc_set_nonblocking(rs->fds[1]) < 0) {
+        log_error("set nonblock on resolver pipe failed: %s",
+                  strerror(errno));
+        goto error;
+    }
+
+    pthread_mutex_init(&rs->lock, NULL);
+    pthread_cond_init(&rs->cond, NULL);
+
+    /* signals are for the event loop, the thread starts with all blocked */
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oset);
+    status = pthread_create(&rs->tid, NULL, resolver_loop, rs);
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    if (status != 0) {
+        log_error("resolver thread create failed: %s", strerror(status));
+        pthread_mutex_destroy(&rs->lock);
+        pthread_cond_destroy(&rs->cond);
+        goto error;
+    }
+    pthread_detach(rs->tid);
+
+    status = event_add(ctx->evb, rs->fds[0], EVENT_READ, resolver_event, rs);
+    if (status < 0) {
+        log_error("event add resolver pipe %d failed: %s", rs->fds[0],
+                  strerror(errno));
+        ctx->resolver = rs;
+        resolver_deinit(ctx);
+        return NC_ERROR;
+    }
+
+    ctx->resolver = rs;
+
+    log_debug(LOG_VERB, "resolver pipe %d thread started", rs->fds[0]);
+
+    return NC_OK;
+
+error:
+    close(rs->fds[0]);
+    close(rs->fds[1]);
+    nc_free(rs);
+    return NC_ERROR;
+}
+
+/*
+ * Tell the resolver thread to quit, without waiting for the lookup it may
+ * be stuck in. The lookups not handed back yet are dropped; the resolver
+ * is freed by the thread (see resolver_loop).
+ */
+void
+resolver_deinit(struct context *ctx)
+{
+    struct resolver *rs = ctx->resolver;
+
+    if (rs == NULL) {
+        return;
+    }
+
+    event_del(ctx->evb, rs->fds[0], EVENT_READ);
+
+    pthread_mutex_lock(&rs->lock);
+    rs->quit = 1;
+    pthread_cond_signal(&rs->cond);
+    pthread_mutex_unlock(&rs->lock);
+
+    ctx->resolver = NULL;
+}
+
+/*
+ * Queue a lookup of the hostname of server, unless one is in flight or
+ * the name is an address already
+ */
+void
+resolver_resolve(struct context *ctx, struct server *server)
+{
+    struct resolver *rs = ctx->resolver;
+    struct resolve *r;
+
+    if (rs == NULL || server->resolving || resolver_static(&server->addrstr)) {
+        return;
+    }
+
+    r = nc_alloc(sizeof(*r));
+    if (r == NULL) {
+        return;
+    }
+
+    string_init(&r->name);
+    if (string_duplicate(&r->name, &server->addrstr) != NC_OK) {
+        nc_free(r);
+        return;
+    }
+    r->server = server;
+    r->port = server->port;
+    r->status = NC_ERROR;
+
+    server->resolving = 1;
+
+    log_debug(LOG_VERB, "resolve server '%.*s'", server->pname.len,
+              server->pname.data);
+
+    pthread_mutex_lock(&rs->lock);
+    STAILQ_INSERT_TAIL(&rs->pending, r, next);
+    pthread_cond_signal(&rs->cond);
+    pthread_mutex_unlock(&rs->lock);
+}
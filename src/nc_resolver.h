@@ -0,0 +1,57 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_RESOLVER_H_
+#define _NC_RESOLVER_H_
+
+#include <nc_core.h>
+
+/*
+ * The resolver looks up server hostnames on a thread of its own, so that
+ * a slow name server never stalls the event loop. Lookups are queued by
+ * the event loop, done with a blocking getaddrinfo on the thread, and
+ * handed back through a pipe watched by the event loop, where the server
+ * picks up its new address (see server_resolved).
+ */
+struct resolve {
+    STAILQ_ENTRY(resolve) next;       /* link in pending or done q */
+    struct server         *server;    /* server looked up */
+    struct string         name;       /* hostname (owned) */
+    int                   port;       /* port */
+    rstatus_t             status;     /* lookup status */
+    struct sockinfo       info;       /* looked up socket info */
+};
+
+STAILQ_HEAD(resolve_tqh, resolve);
+
+struct resolver {
+    struct context        *ctx;       /* owner context */
+    pthread_t             tid;        /* resolver thread */
+    pthread_mutex_t       lock;       /* lock of pending, done and quit */
+    pthread_cond_t        cond;       /* signalled on pending and quit */
+    struct resolve_tqh    pending;    /* lookups to do */
+    struct resolve_tqh    done;       /* lookups done */
+    int                   fds[2];     /* pipe to wake up the event loop */
+    unsigned              quit:1;     /* stop the thread? */
+};
+
+bool resolver_static(struct string *name);
+rstatus_t resolver_init(struct context *ctx);
+void resolver_deinit(struct context *ctx);
+void resolver_resolve(struct context *ctx, struct server *server);
+
+#endif
@@ -17,7 +17,9 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_client.h>
 #include <nc_process.h>
+#include <proto/nc_proto.h>
 
 struct msg *
 rsp_get(struct conn *conn)
@@ -81,6 +83,10 @@ rsp_make_error(struct context *ctx, struct conn *conn, struct msg *msg)
         rsp_put(pmsg);
     }
 
+    if (conn->binary) {
+        return memcache_bin_get_error(msg, err);
+    }
+
     return msg_get_error(conn->redis, err);
 }
 
@@ -207,6 +213,14 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
     if (pmsg->swallow) {
         conn->swallow_msg(conn, pmsg, msg);
 
+        if (pmsg->mirror != NULL) {
+            stats_pool_record_mirror_latency(ctx, pmsg->mirror,
+                                             nc_msec_now() - pmsg->start_ts / 1000);
+            if (msg->redis ? redis_error(msg) : memcache_error(msg)) {
+                stats_pool_incr(ctx, pmsg->mirror, mirror_errors);
+            }
+        }
+
         conn->dequeue_outq(ctx, conn, pmsg);
         pmsg->done = 1;
 
@@ -231,6 +245,83 @@ rsp_forward_stats(struct context *ctx, struct server *server, struct msg *msg, u
     stats_server_incr_by(ctx, server, response_bytes, msgsize);
 }
 
+/*
+ * Return true if the reply to request pmsg can be sent, in full or, for
+ * a streamed reply, the part of it that is ready
+ */
+static bool
+rsp_sendable(struct conn *conn, struct msg *pmsg)
+{
+    return req_done(conn, pmsg) || req_stream_ready(pmsg);
+}
+
+/*
+ * Split response msg to request pmsg, which merged single-key gets in
+ * req_batch, into a response for each get and forward them to their
+ * clients. When the response can not be split, every get fails.
+ */
+static void
+rsp_forward_batch(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+                  struct msg *msg)
+{
+    rstatus_t status;
+    struct msg *req;
+    struct conn *c_conn;
+    uint32_t i;
+
+    ASSERT(pmsg->nbatch != 0 && pmsg->owner == NULL);
+
+    status = msg->redis ? redis_unbatch(pmsg, msg) : memcache_unbatch(pmsg, msg);
+    if (status != NC_OK) {
+        log_debug(LOG_INFO, "split rsp %"PRIu64" len %"PRIu32" type %d of "
+                  "batch req %"PRIu64" on s %d failed", msg->id, msg->mlen,
+                  msg->type, pmsg->id, s_conn->sd);
+    }
+
+    for (i = 0; i < pmsg->nbatch; i++) {
+        req = pmsg->batch_seq[i];
+
+        msg_tmo_delete(req);
+
+        /* client has closed its connection */
+        if (req->swallow) {
+            req_put(req);
+            continue;
+        }
+
+        req->done = 1;
+        if (status == NC_OK) {
+            req->peer->pre_coalesce(req->peer);
+        } else {
+            if (req->peer != NULL) {
+                req->peer->peer = NULL;
+                rsp_put(req->peer);
+                req->peer = NULL;
+            }
+            req->error = 1;
+            req->err = status == NC_ENOMEM ? ENOMEM : EINVAL;
+            if (req->frag_owner != NULL) {
+                req->frag_owner->nfrag_done++;
+            }
+        }
+
+        c_conn = req->owner;
+        ASSERT(c_conn->client && !c_conn->proxy);
+
+        if (req->frag_owner != NULL) {
+            req_stream(ctx, c_conn, req);
+        }
+
+        if (rsp_sendable(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+            if (event_add_out(ctx->evb, c_conn) != NC_OK) {
+                c_conn->err = errno;
+            }
+        }
+    }
+
+    req_put(pmsg);
+}
+
 static void
 rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
 {
@@ -251,8 +342,39 @@ rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
     ASSERT(pmsg->request && !pmsg->done);
 
     s_conn->dequeue_outq(ctx, s_conn, pmsg);
+
+    if (pmsg->nbatch != 0) {
+        rsp_forward_batch(ctx, s_conn, pmsg, msg);
+        rsp_forward_stats(ctx, s_conn->owner, msg, msgsize);
+        rsp_put(msg);
+        return;
+    }
+
+    /* a read that missed on a migrating pool falls back to the old owner */
+    if (req_migrate(ctx, s_conn, pmsg, msg)) {
+        rsp_forward_stats(ctx, s_conn->owner, msg, msgsize);
+        rsp_put(msg);
+        return;
+    }
+
     pmsg->done = 1;
 
+    /* the first response to a hedged read wins, the other is swallowed */
+    msg_hedge_delete(pmsg);
+    if (pmsg->hedge != NULL) {
+        struct msg *hmsg = pmsg->hedge;
+
+        if (pmsg->hedged) {
+            req_hedge_promote(hmsg);
+            hmsg->swallow = 1;
+            stats_pool_incr(ctx, ((struct conn *)pmsg->owner)->owner, hedge_wins);
+        } else {
+            hmsg->swallow = 1;
+            hmsg->hedge = NULL;
+            pmsg->hedge = NULL;
+        }
+    }
+
     /* establish msg <-> pmsg (response <-> request) link */
     pmsg->peer = msg;
     msg->peer = pmsg;
@@ -262,7 +384,11 @@ rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
     c_conn = pmsg->owner;
     ASSERT(c_conn->client && !c_conn->proxy);
 
-    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+    if (pmsg->frag_owner != NULL) {
+        req_stream(ctx, c_conn, pmsg);
+    }
+
+    if (rsp_sendable(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
         status = event_add_out(ctx->evb, c_conn);
         if (status != NC_OK) {
             c_conn->err = errno;
@@ -287,15 +413,22 @@ rsp_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
     pmsg = TAILQ_FIRST(&conn->omsg_q);
     if (pmsg) {
         stats_server_record_latency(ctx, conn->owner, nc_msec_now()-pmsg->forward_start_ts);
+        server_record_latency(conn->owner, nc_msec_now()-pmsg->forward_start_ts);
+        server_admit_update(ctx, conn->owner, nc_msec_now()-pmsg->forward_start_ts);
     }
 
     /* enqueue next message (response), if any */
     conn->rmsg = nmsg;
-    if (rsp_filter(ctx, conn, msg)) {
-        return;
+    if (!rsp_filter(ctx, conn, msg)) {
+        rsp_forward(ctx, conn, msg);
     }
 
-    rsp_forward(ctx, conn, msg);
+    /* close a draining connection once its last response is in */
+    if (conn->draining && TAILQ_EMPTY(&conn->imsg_q) &&
+        TAILQ_EMPTY(&conn->omsg_q)) {
+        log_debug(LOG_INFO, "s %d is drained", conn->sd);
+        conn->done = 1;
+    }
 }
 
 struct msg *
@@ -307,7 +440,7 @@ rsp_send_next(struct context *ctx, struct conn *conn)
     ASSERT(conn->client && !conn->proxy);
 
     pmsg = TAILQ_FIRST(&conn->omsg_q);
-    if (pmsg == NULL || !req_done(conn, pmsg)) {
+    if (pmsg == NULL || !rsp_sendable(conn, pmsg)) {
         /* nothing is outstanding, initiate close? */
         if (pmsg == NULL && conn->eof) {
             conn->done = 1;
@@ -325,17 +458,31 @@ rsp_send_next(struct context *ctx, struct conn *conn)
     msg = conn->smsg;
     if (msg != NULL) {
         ASSERT(!msg->request && msg->peer != NULL);
-        ASSERT(req_done(conn, msg->peer));
+        if (!req_done(conn, msg->peer)) {
+            /* the rest of a streamed reply is still to come */
+            ASSERT(msg->peer->stream);
+            conn->smsg = NULL;
+            return NULL;
+        }
         pmsg = TAILQ_NEXT(msg->peer, c_tqe);
     }
 
-    if (pmsg == NULL || !req_done(conn, pmsg)) {
+    if (pmsg == NULL || !rsp_sendable(conn, pmsg)) {
         conn->smsg = NULL;
         return NULL;
     }
     ASSERT(pmsg->request && !pmsg->swallow);
 
-    if (req_error(conn, pmsg)) {
+    if (!req_done(conn, pmsg)) {
+        msg = pmsg->peer;
+    } else if (pmsg->stream && pmsg->frag_next != 0 && req_error(conn, pmsg)) {
+        /* part of the reply is out, the error can only be told by a close */
+        log_debug(LOG_INFO, "close c %d on failed streamed req %"PRIu64,
+                  conn->sd, pmsg->id);
+        conn->err = EIO;
+        conn->smsg = NULL;
+        return NULL;
+    } else if (req_error(conn, pmsg)) {
         msg = rsp_make_error(ctx, conn, pmsg);
         if (msg == NULL) {
             conn->err = errno;
@@ -373,12 +520,19 @@ rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
     ASSERT(pmsg->peer == msg);
     ASSERT(pmsg->done && !pmsg->swallow);
 
+    /* a streamed reply is done once the last of its keys went out */
+    if (!req_done(conn, pmsg)) {
+        ASSERT(pmsg->stream);
+        return;
+    }
+
     /* dequeue request from client outq */
     conn->dequeue_outq(ctx, conn, pmsg);
 
     req_put(pmsg);
 
-    if (pm_terminate) {
+    /* unless the client is handed over to the next worker once idle */
+    if (pm_terminate && (pm_handoff < 0 || !client_handoff_allowed(conn))) {
         conn->done = 1;
     }
     /* only record the request's latency, and ignore the fragment */
@@ -0,0 +1,210 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_conf.h>
+#include <nc_server.h>
+#include <nc_route.h>
+
+/*
+ * Compile the routes cr[lo..hi), which are sorted by prefix and share
+ * their first depth bytes, into a trie node and return its index in idx
+ */
+static rstatus_t
+route_compile(struct server_pool *pool, struct conf_route *cr, uint32_t lo,
+              uint32_t hi, uint32_t depth, uint32_t *idx)
+{
+    rstatus_t status;
+    struct route_node *node;
+    struct route_edge *edge;
+    uint32_t i, j, k, nidx, child, nedge, base;
+    uint8_t c;
+
+    node = array_push(&pool->route_node);
+    if (node == NULL) {
+        return NC_ENOMEM;
+    }
+    nidx = array_idx(&pool->route_node, node);
+
+    node->pool = -1;
+
+    /* a prefix ending at this depth sorts first */
+    if (lo < hi && cr[lo].prefix.len == depth) {
+        node->pool = (int32_t)cr[lo].pool_idx;
+        lo++;
+    }
+
+    /* reserve one edge per distinct next byte */
+    base = array_n(&pool->route_edge);
+    for (nedge = 0, i = lo; i < hi; i = j, nedge++) {
+        c = cr[i].prefix.data[depth];
+        for (j = i + 1; j < hi && cr[j].prefix.data[depth] == c; j++) {
+            /* skip routes with the same next byte */
+        }
+
+        if (array_push(&pool->route_edge) == NULL) {
+            return NC_ENOMEM;
+        }
+    }
+
+    node->nedge = nedge;
+    node->edge = base;
+
+    for (k = 0, i = lo; i < hi; i = j, k++) {
+        c = cr[i].prefix.data[depth];
+        for (j = i + 1; j < hi && cr[j].prefix.data[depth] == c; j++) {
+            /* skip routes with the same next byte */
+        }
+
+        /* node may move as children are pushed, only use its index now */
+        status = route_compile(pool, cr, i, j, depth + 1, &child);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        edge = array_get(&pool->route_edge, base + k);
+        edge->c = c;
+        edge->node = child;
+    }
+
+    *idx = nidx;
+
+    return NC_OK;
+}
+
+rstatus_t
+route_init(struct server_pool *pool, struct array *conf_route)
+{
+    rstatus_t status;
+    uint32_t nroute, root;
+
+    array_null(&pool->route_node);
+    array_null(&pool->route_edge);
+
+    nroute = array_n(conf_route);
+    if (nroute == 0) {
+        return NC_OK;
+    }
+
+    status = array_init(&pool->route_node, nroute, sizeof(struct route_node));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = array_init(&pool->route_edge, nroute, sizeof(struct route_edge));
+    if (status != NC_OK) {
+        array_deinit(&pool->route_node);
+        return status;
+    }
+
+    status = route_compile(pool, conf_route->elem, 0, nroute, 0, &root);
+    if (status != NC_OK) {
+        route_deinit(pool);
+        return status;
+    }
+    ASSERT(root == 0);
+
+    log_debug(LOG_VERB, "pool '%.*s' routes %"PRIu32" prefixes in %"PRIu32
+              " nodes", pool->name.len, pool->name.data, nroute,
+              array_n(&pool->route_node));
+
+    return NC_OK;
+}
+
+void
+route_deinit(struct server_pool *pool)
+{
+    if (pool->route_node.elem != NULL) {
+        array_deinit(&pool->route_node);
+    }
+    if (pool->route_edge.elem != NULL) {
+        array_deinit(&pool->route_edge);
+    }
+}
+
+/*
+ * Return the pool that the longest route prefix matching key routes to,
+ * or pool itself if no prefix matches
+ */
+struct server_pool *
+route_pool(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    struct route_node *node;
+    struct route_edge *edge;
+    uint32_t i, lo, hi, mid;
+    int32_t match;
+
+    if (array_n(&pool->route_node) == 0) {
+        return pool;
+    }
+
+    match = -1;
+    node = array_get(&pool->route_node, 0);
+    for (i = 0; ; i++) {
+        if (node->pool >= 0) {
+            match = node->pool;
+        }
+
+        if (i == keylen || node->nedge == 0) {
+            break;
+        }
+
+        lo = node->edge;
+        hi = node->edge + node->nedge;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            edge = array_get(&pool->route_edge, mid);
+            if (edge->c < key[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if (lo == node->edge + node->nedge) {
+            break;
+        }
+
+        edge = array_get(&pool->route_edge, lo);
+        if (edge->c != key[i]) {
+            break;
+        }
+
+        node = array_get(&pool->route_node, edge->node);
+    }
+
+    if (match < 0) {
+        return pool;
+    }
+
+    return array_get(&pool->ctx->pool, (uint32_t)match);
+}
+
+/*
+ * Return the number of backends that a multi-key request on pool can be
+ * fragmented into. With routes, fragments are indexed by backend_base of
+ * the routed pool plus the server index within that pool.
+ */
+uint32_t
+route_nbackend(struct server_pool *pool)
+{
+    if (array_n(&pool->route_node) == 0) {
+        return pool->ncontinuum;
+    }
+
+    return pool->nbackend;
+}
@@ -0,0 +1,44 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_ROUTE_H_
+#define _NC_ROUTE_H_
+
+#include <nc_core.h>
+
+/*
+ * The routes: of a pool are compiled into a byte trie. The edges of a node
+ * are stored contiguously and sorted by byte, so that a key is matched
+ * against all prefixes with one binary search per key byte.
+ */
+struct route_node {
+    int32_t  pool;   /* index of the pool routed to, or -1 */
+    uint32_t nedge;  /* # edges */
+    uint32_t edge;   /* index of the first edge */
+};
+
+struct route_edge {
+    uint8_t  c;      /* next key byte */
+    uint32_t node;   /* index of the node reached */
+};
+
+rstatus_t route_init(struct server_pool *pool, struct array *conf_route);
+void route_deinit(struct server_pool *pool);
+struct server_pool *route_pool(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+uint32_t route_nbackend(struct server_pool *pool);
+
+#endif
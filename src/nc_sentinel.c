@@ -0,0 +1,652 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_sentinel.h>
+
+/*
+ * Each worker keeps its own sentinel connection per pool, so that a
+ * failover is applied without going through the master process. The
+ * connection is driven by the worker's event loop like the channel fd and
+ * speaks just enough of the redis protocol to read back the reply to
+ * "sentinel get-master-addr-by-name" and the "+switch-master" messages.
+ */
+
+struct sentinel_reply {
+    uint32_t      narg;                     /* # elements */
+    struct string arg[SENTINEL_MAX_ARGS];   /* elements (ref in rbuf) */
+    unsigned      nil:1;                    /* nil reply? */
+    unsigned      error:1;                  /* error reply? */
+};
+
+static struct string sentinel_message = string("message");
+static struct string sentinel_channel = string("+switch-master");
+
+static void
+sentinel_close(struct context *ctx, struct sentinel *sn)
+{
+    struct server_pool *pool = sn->owner;
+    rstatus_t status;
+
+    if (sn->sd >= 0) {
+        event_del(ctx->evb, sn->sd, EVENT_READ|EVENT_WRITE);
+
+        status = close(sn->sd);
+        if (status < 0) {
+            log_error("close sentinel %d failed, ignored: %s", sn->sd,
+                      strerror(errno));
+        }
+        sn->sd = -1;
+    }
+
+    sn->connecting = 0;
+    sn->connected = 0;
+    sn->nreply = 0;
+    sn->rlen = 0;
+    sn->next_retry = nc_usec_now() + pool->server_retry_timeout;
+}
+
+static rstatus_t
+sentinel_connected(struct context *ctx, struct sentinel *sn)
+{
+    struct server_pool *pool = sn->owner;
+    uint8_t buf[SENTINEL_BUF_SIZE];
+    int len;
+    ssize_t n;
+
+    sn->connecting = 0;
+    sn->connected = 1;
+
+    /*
+     * Ask for the current master first, the address might have moved
+     * while we were not subscribed, and then listen for failovers
+     */
+    len = nc_snprintf(buf, sizeof(buf),
+                      "*3" CRLF "$8" CRLF "sentinel" CRLF
+                      "$23" CRLF "get-master-addr-by-name" CRLF
+                      "$%"PRIu32 CRLF "%.*s" CRLF
+                      "*2" CRLF "$9" CRLF "subscribe" CRLF
+                      "$%"PRIu32 CRLF "%.*s" CRLF,
+                      pool->sentinel_master.len, pool->sentinel_master.len,
+                      pool->sentinel_master.data, sentinel_channel.len,
+                      sentinel_channel.len, sentinel_channel.data);
+    if (len < 0 || len >= (int)sizeof(buf)) {
+        return NC_ERROR;
+    }
+
+    n = nc_write(sn->sd, buf, len);
+    if (n != (ssize_t)len) {
+        log_error("write to sentinel '%.*s' failed: %s",
+                  pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                  n < 0 ? strerror(errno) : "short write");
+        return NC_ERROR;
+    }
+
+    event_del(ctx->evb, sn->sd, EVENT_WRITE);
+
+    log_debug(LOG_NOTICE, "subscribed to sentinel '%.*s' for master '%.*s' "
+              "of pool '%.*s'", pool->sentinel_addrstr.len,
+              pool->sentinel_addrstr.data, pool->sentinel_master.len,
+              pool->sentinel_master.data, pool->name.len, pool->name.data);
+
+    return NC_OK;
+}
+
+/*
+ * Point the master server of the pool at host:port, unless it is already
+ * there.
+ */
+static void
+sentinel_switch(struct context *ctx, struct sentinel *sn, struct string *host,
+                struct string *port)
+{
+    rstatus_t status;
+    struct server_pool *pool = sn->owner;
+    struct server *master;
+    struct string pname, addrstr;
+    uint8_t buf[NC_MAXHOSTNAMELEN + NC_UINT16_MAXLEN + NC_UINT32_MAXLEN];
+    int nport, len;
+
+    nport = nc_atoi(port->data, port->len);
+    if (nport < 0 || !nc_valid_port(nport) || host->len == 0 ||
+        host->len >= NC_MAXHOSTNAMELEN) {
+        log_warn("sentinel '%.*s' sent invalid master address '%.*s:%.*s'",
+                 pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                 host->len, host->data, port->len, port->data);
+        return;
+    }
+
+    master = array_get(&pool->redis_master, 0);
+    if (master->port == (uint16_t)nport &&
+        string_compare(&master->addrstr, host) == 0) {
+        return;
+    }
+
+    len = nc_scnprintf(buf, sizeof(buf), "%.*s:%d:%"PRIu32, host->len,
+                       host->data, nport, master->weight);
+
+    string_init(&pname);
+    string_init(&addrstr);
+
+    status = string_copy(&pname, buf, (uint32_t)len);
+    if (status == NC_OK) {
+        status = string_copy(&addrstr, host->data, host->len);
+    }
+    if (status != NC_OK) {
+        string_deinit(&pname);
+        string_deinit(&addrstr);
+        return;
+    }
+
+    log_warn("switch master of pool '%.*s' from '%.*s' to '%.*s'",
+             pool->name.len, pool->name.data, master->pname.len,
+             master->pname.data, pname.len, pname.data);
+
+    status = server_switch(ctx, master, &pname, &addrstr, (uint16_t)nport);
+    if (status != NC_OK) {
+        log_error("switch master of pool '%.*s' to '%.*s' failed: %s",
+                  pool->name.len, pool->name.data, pname.len, pname.data,
+                  strerror(errno));
+        string_deinit(&pname);
+        string_deinit(&addrstr);
+        return;
+    }
+
+    stats_pool_incr(ctx, pool, master_failovers);
+}
+
+static void
+sentinel_handle(struct context *ctx, struct sentinel *sn,
+                struct sentinel_reply *reply)
+{
+    struct server_pool *pool = sn->owner;
+    struct string token[5];
+    uint8_t *p, *q, *end;
+    uint32_t i;
+
+    if (reply->error) {
+        log_warn("sentinel '%.*s' replied with error '%.*s'",
+                 pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                 reply->arg[0].len, reply->arg[0].data);
+        return;
+    }
+
+    if (sn->nreply == 0) {
+        /* reply to sentinel get-master-addr-by-name */
+        if (reply->nil || reply->narg != 2) {
+            log_warn("sentinel '%.*s' does not know master '%.*s'",
+                     pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                     pool->sentinel_master.len, pool->sentinel_master.data);
+            return;
+        }
+        sentinel_switch(ctx, sn, &reply->arg[0], &reply->arg[1]);
+        return;
+    }
+
+    if (reply->narg != 3 ||
+        string_compare(&reply->arg[0], &sentinel_message) != 0 ||
+        string_compare(&reply->arg[1], &sentinel_channel) != 0) {
+        return;
+    }
+
+    /* <master name> <old ip> <old port> <new ip> <new port> */
+    p = reply->arg[2].data;
+    end = p + reply->arg[2].len;
+    for (i = 0; i < NELEMS(token); i++) {
+        q = nc_strchr(p, end, ' ');
+        if (q == NULL) {
+            q = end;
+        }
+        token[i].data = p;
+        token[i].len = (uint32_t)(q - p);
+        p = q + 1;
+
+        if (q == end) {
+            break;
+        }
+    }
+    if (i != NELEMS(token) - 1) {
+        log_warn("sentinel '%.*s' sent malformed switch '%.*s'",
+                 pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                 reply->arg[2].len, reply->arg[2].data);
+        return;
+    }
+
+    if (string_compare(&token[0], &pool->sentinel_master) != 0) {
+        return;
+    }
+
+    sentinel_switch(ctx, sn, &token[3], &token[4]);
+}
+
+static rstatus_t
+sentinel_parse_line(uint8_t **pos, uint8_t *end, struct string *line)
+{
+    uint8_t *p, *lf;
+
+    p = *pos;
+
+    lf = nc_strchr(p, end, LF);
+    if (lf == NULL) {
+        return NC_EAGAIN;
+    }
+    if (lf == p || *(lf - 1) != CR) {
+        return NC_ERROR;
+    }
+
+    line->data = p;
+    line->len = (uint32_t)(lf - 1 - p);
+    *pos = lf + 1;
+
+    return NC_OK;
+}
+
+static rstatus_t
+sentinel_parse_elem(uint8_t **pos, uint8_t *end, struct string *elem)
+{
+    rstatus_t status;
+    struct string line;
+    uint8_t *p;
+    int len;
+
+    p = *pos;
+
+    status = sentinel_parse_line(&p, end, &line);
+    if (status != NC_OK) {
+        return status;
+    }
+    if (line.len == 0) {
+        return NC_ERROR;
+    }
+
+    switch (line.data[0]) {
+    case '+':
+    case ':':
+        elem->data = line.data + 1;
+        elem->len = line.len - 1;
+        break;
+
+    case '$':
+        if (line.len == 3 && line.data[1] == '-' && line.data[2] == '1') {
+            string_init(elem);
+            break;
+        }
+
+        len = nc_atoi(line.data + 1, line.len - 1);
+        if (len < 0) {
+            return NC_ERROR;
+        }
+        if (end - p < (ssize_t)len + (ssize_t)CRLF_LEN) {
+            return NC_EAGAIN;
+        }
+        if (p[len] != CR || p[len + 1] != LF) {
+            return NC_ERROR;
+        }
+
+        elem->data = p;
+        elem->len = (uint32_t)len;
+        p += (size_t)len + CRLF_LEN;
+        break;
+
+    default:
+        return NC_ERROR;
+    }
+
+    *pos = p;
+
+    return NC_OK;
+}
+
+/*
+ * Parse one reply from [*pos, end). Returns NC_EAGAIN if the reply is not
+ * complete yet, in which case *pos is left untouched.
+ */
+static rstatus_t
+sentinel_parse(uint8_t **pos, uint8_t *end, struct sentinel_reply *reply)
+{
+    rstatus_t status;
+    struct string line;
+    uint8_t *p;
+    uint32_t i;
+    int narg;
+
+    p = *pos;
+
+    reply->narg = 0;
+    reply->nil = 0;
+    reply->error = 0;
+
+    if (p == end) {
+        return NC_EAGAIN;
+    }
+
+    switch (*p) {
+    case '-':
+        status = sentinel_parse_line(&p, end, &line);
+        if (status != NC_OK) {
+            return status;
+        }
+        reply->error = 1;
+        reply->narg = 1;
+        reply->arg[0].data = line.data + 1;
+        reply->arg[0].len = line.len - 1;
+        break;
+
+    case '*':
+        status = sentinel_parse_line(&p, end, &line);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        if (line.len == 3 && line.data[1] == '-' && line.data[2] == '1') {
+            reply->nil = 1;
+            break;
+        }
+
+        narg = nc_atoi(line.data + 1, line.len - 1);
+        if (narg < 0 || narg > SENTINEL_MAX_ARGS) {
+            return NC_ERROR;
+        }
+
+        for (i = 0; i < (uint32_t)narg; i++) {
+            status = sentinel_parse_elem(&p, end, &reply->arg[i]);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+        reply->narg = (uint32_t)narg;
+        break;
+
+    default:
+        status = sentinel_parse_elem(&p, end, &reply->arg[0]);
+        if (status != NC_OK) {
+            return status;
+        }
+        reply->narg = 1;
+        break;
+    }
+
+    *pos = p;
+
+    return NC_OK;
+}
+
+static rstatus_t
+sentinel_process(struct context *ctx, struct sentinel *sn)
+{
+    rstatus_t status;
+    struct sentinel_reply reply;
+    uint8_t *pos, *end;
+
+    pos = sn->rbuf;
+    end = sn->rbuf + sn->rlen;
+
+    for (;;) {
+        status = sentinel_parse(&pos, end, &reply);
+        if (status == NC_EAGAIN) {
+            break;
+        }
+        if (status != NC_OK) {
+            log_error("sentinel '%.*s' sent a malformed reply",
+                      sn->owner->sentinel_addrstr.len,
+                      sn->owner->sentinel_addrstr.data);
+            return NC_ERROR;
+        }
+
+        sentinel_handle(ctx, sn, &reply);
+        sn->nreply++;
+    }
+
+    sn->rlen = (size_t)(end - pos);
+    if (sn->rlen == SENTINEL_BUF_SIZE) {
+        log_error("sentinel '%.*s' sent a reply larger than %d bytes",
+                  sn->owner->sentinel_addrstr.len,
+                  sn->owner->sentinel_addrstr.data, SENTINEL_BUF_SIZE);
+        return NC_ERROR;
+    }
+    nc_memmove(sn->rbuf, pos, sn->rlen);
+
+    return NC_OK;
+}
+
+static rstatus_t
+sentinel_recv(struct context *ctx, struct sentinel *sn)
+{
+    rstatus_t status;
+    ssize_t n;
+
+    for (;;) {
+        n = nc_read(sn->sd, sn->rbuf + sn->rlen, SENTINEL_BUF_SIZE - sn->rlen);
+        if (n > 0) {
+            sn->rlen += (size_t)n;
+            status = sentinel_process(ctx, sn);
+            if (status != NC_OK) {
+                return status;
+            }
+            continue;
+        }
+
+        if (n == 0) {
+            log_warn("sentinel '%.*s' closed the connection",
+                     sn->owner->sentinel_addrstr.len,
+                     sn->owner->sentinel_addrstr.data);
+            return NC_ERROR;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return NC_OK;
+        }
+
+        log_error("recv on sentinel %d failed: %s", sn->sd, strerror(errno));
+        return NC_ERROR;
+    }
+
+    NOT_REACHED();
+
+    return NC_ERROR;
+}
+
+static int
+sentinel_event_cb(void *evb, void *priv, uint32_t events)
+{
+    rstatus_t status;
+    struct sentinel *sn = priv;
+    struct context *ctx = sn->owner->ctx;
+
+    if (events & EVENT_ERR) {
+        nc_get_soerror(sn->sd);
+        log_warn("sentinel '%.*s' failed: %s",
+                 sn->owner->sentinel_addrstr.len,
+                 sn->owner->sentinel_addrstr.data, strerror(errno));
+        sentinel_close(ctx, sn);
+        return NC_ERROR;
+    }
+
+    if ((events & EVENT_WRITE) && sn->connecting) {
+        status = sentinel_connected(ctx, sn);
+        if (status != NC_OK) {
+            sentinel_close(ctx, sn);
+            return status;
+        }
+    }
+
+    if (events & EVENT_READ) {
+        status = sentinel_recv(ctx, sn);
+        if (status != NC_OK) {
+            sentinel_close(ctx, sn);
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+sentinel_connect(struct context *ctx, struct sentinel *sn)
+{
+    rstatus_t status;
+    struct server_pool *pool = sn->owner;
+    struct sockinfo *info = &pool->sentinel_info;
+
+    ASSERT(sn->sd < 0);
+
+    sn->sd = socket(info->family, SOCK_STREAM, 0);
+    if (sn->sd < 0) {
+        log_error("socket for sentinel '%.*s' failed: %s",
+                  pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = nc_set_nonblocking(sn->sd);
+    if (status != NC_OK) {
+        log_error("set nonblock on sentinel %d failed: %s", sn->sd,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = event_add(ctx->evb, sn->sd, EVENT_READ|EVENT_WRITE,
+                       sentinel_event_cb, sn);
+    if (status != NC_OK) {
+        log_error("event add sentinel %d failed: %s", sn->sd, strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = connect(sn->sd, (struct sockaddr *)&info->addr, info->addrlen);
+    if (status != NC_OK) {
+        if (errno == EINPROGRESS) {
+            sn->connecting = 1;
+            return NC_OK;
+        }
+
+        log_error("connect on sentinel %d to '%.*s' failed: %s", sn->sd,
+                  pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    return sentinel_connected(ctx, sn);
+}
+
+static rstatus_t
+sentinel_each_init(void *elem, void *data)
+{
+    rstatus_t status;
+    struct server_pool *pool = elem;
+    struct sentinel *sn;
+
+    if (string_empty(&pool->sentinel_addrstr)) {
+        return NC_OK;
+    }
+
+    sn = nc_alloc(sizeof(*sn));
+    if (sn == NULL) {
+        return NC_ENOMEM;
+    }
+
+    sn->owner = pool;
+    sn->sd = -1;
+    sn->next_retry = 0LL;
+    sn->nreply = 0;
+    sn->rlen = 0;
+    sn->connecting = 0;
+    sn->connected = 0;
+
+    pool->sentinel = sn;
+
+    status = sentinel_connect(pool->ctx, sn);
+    if (status != NC_OK) {
+        log_warn("connect to sentinel '%.*s' failed, ignored: %s",
+                 pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                 strerror(errno));
+        sentinel_close(pool->ctx, sn);
+    }
+
+    return NC_OK;
+}
+
+rstatus_t
+sentinel_init(struct context *ctx)
+{
+    return array_each(&ctx->pool, sentinel_each_init, NULL);
+}
+
+static rstatus_t
+sentinel_each_deinit(void *elem, void *data)
+{
+    struct server_pool *pool = elem;
+    struct sentinel *sn = pool->sentinel;
+
+    if (sn == NULL) {
+        return NC_OK;
+    }
+
+    sentinel_close(pool->ctx, sn);
+    nc_free(sn);
+    pool->sentinel = NULL;
+
+    return NC_OK;
+}
+
+void
+sentinel_deinit(struct context *ctx)
+{
+    array_each(&ctx->pool, sentinel_each_deinit, NULL);
+}
+
+static rstatus_t
+sentinel_each_retry(void *elem, void *data)
+{
+    rstatus_t status;
+    struct server_pool *pool = elem;
+    struct sentinel *sn = pool->sentinel;
+    int64_t *now = data;
+
+    if (sn == NULL || sn->sd >= 0 || *now < sn->next_retry) {
+        return NC_OK;
+    }
+
+    status = sentinel_connect(pool->ctx, sn);
+    if (status != NC_OK) {
+        log_warn("reconnect to sentinel '%.*s' failed, ignored: %s",
+                 pool->sentinel_addrstr.len, pool->sentinel_addrstr.data,
+                 strerror(errno));
+        sentinel_close(pool->ctx, sn);
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Reconnect sentinels whose connection was lost once their retry timeout
+ * has passed. Called on every turn of the event loop.
+ */
+void
+sentinel_retry(struct context *ctx)
+{
+    int64_t now;
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return;
+    }
+
+    array_each(&ctx->pool, sentinel_each_retry, &now);
+}
@@ -0,0 +1,50 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_SENTINEL_H_
+#define _NC_SENTINEL_H_
+
+#include <nc_core.h>
+
+#define SENTINEL_BUF_SIZE   4096
+#define SENTINEL_MAX_ARGS   8
+
+/*
+ * A sentinel tracks the redis master of a server pool through a redis
+ * sentinel. On connect it asks the sentinel for the current master
+ * address and subscribes to the +switch-master channel. Whenever the
+ * master moves, the pool's master server is pointed at the new address
+ * in place (see server_switch).
+ */
+struct sentinel {
+    struct server_pool *owner;        /* owner pool */
+    int                sd;            /* socket descriptor */
+    int64_t            next_retry;    /* next reconnect time in usec */
+    uint32_t           nreply;        /* # replies on current connection */
+
+    size_t             rlen;          /* # bytes in rbuf */
+    uint8_t            rbuf[SENTINEL_BUF_SIZE]; /* read buffer */
+
+    unsigned           connecting:1;  /* connecting? */
+    unsigned           connected:1;   /* connected? */
+};
+
+rstatus_t sentinel_init(struct context *ctx);
+void sentinel_deinit(struct context *ctx);
+void sentinel_retry(struct context *ctx);
+
+#endif
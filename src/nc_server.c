@@ -23,13 +23,15 @@
 #include <nc_conf.h>
 #include <nc_client.h>
 
+/*
+ * The address was looked up when the server pool was created and is
+ * kept fresh off the event loop by the resolver (see server_resolved)
+ */
 static void
 server_resolve(struct server *server, struct conn *conn)
 {
-    rstatus_t status;
-
-    status = nc_resolve(&server->addrstr, server->port, &server->info);
-    if (status != NC_OK) {
+    if (server->info.family == AF_UNSPEC) {
+        /* not resolved yet, the failure queues another lookup */
         conn->err = EHOSTDOWN;
         conn->done = 1;
         return;
@@ -53,6 +55,10 @@ server_ref(struct conn *conn, void *owner)
     server->ns_conn_q++;
     TAILQ_INSERT_TAIL(&server->s_conn_q, conn, conn_tqe);
 
+    if (server->budget != NULL) {
+        server->budget->used++;
+    }
+
     conn->owner = owner;
 
     log_debug(LOG_VVERB, "ref conn %p owner %p into '%.*s", conn, server,
@@ -70,9 +76,20 @@ server_unref(struct conn *conn)
     server = conn->owner;
     conn->owner = NULL;
 
-    ASSERT(server->ns_conn_q != 0);
-    server->ns_conn_q--;
-    TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
+    /* draining connections were already detached in server_switch */
+    if (!conn->draining) {
+        ASSERT(server->ns_conn_q != 0);
+        server->ns_conn_q--;
+        TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
+    }
+
+    /*
+     * A worker draining its clients was already taken out of the budget,
+     * and its slot may have been reset for the worker spawned in its place
+     */
+    if (server->budget != NULL && server->budget->used != 0) {
+        server->budget->used--;
+    }
 
     log_debug(LOG_VVERB, "unref conn %p owner %p from '%.*s'", conn, server,
               server->pname.len, server->pname.data);
@@ -180,63 +197,376 @@ server_deinit(struct array *server)
 
         s = array_pop(server);
         ASSERT(TAILQ_EMPTY(&s->s_conn_q) && s->ns_conn_q == 0);
+        if (s->point != NULL) {
+            nc_free(s->point);
+        }
+        string_deinit(&s->pname);
+        string_deinit(&s->addrstr);
     }
     array_deinit(server);
 }
 
+/*
+ * Connections this worker may open to server: server_connections, or
+ * less when server_connections_total gives it a smaller share
+ */
+static uint32_t
+server_conn_limit(struct server *server)
+{
+    struct server_pool *pool = server->owner;
+
+    if (server->budget == NULL) {
+        return pool->server_connections;
+    }
+
+    return MIN(pool->server_connections, MAX(server->budget->share, 1));
+}
+
+/*
+ * With server_idle_timeout, pick the most recently used connection that
+ * has nothing in flight, so that the connections the load does not need
+ * go idle and are reaped
+ */
+static struct conn *
+server_conn_idle(struct server *server)
+{
+    struct conn *conn;
+
+    TAILQ_FOREACH_REVERSE(conn, &server->s_conn_q, conn_tqh, conn_tqe) {
+        if (conn->connected && conn->nqueue == 0) {
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
 struct conn *
 server_conn(struct server *server)
 {
     struct server_pool *pool;
-    struct conn *conn;
+    struct conn *conn, *c;
 
     pool = server->owner;
 
-    /*
-     * FIXME: handle multiple server connections per server and do load
-     * balancing on it. Support multiple algorithms for
-     * 'server_connections:' > 0 key
-     */
+    if (pool->server_idle_timeout > 0) {
+        conn = server_conn_idle(server);
+        if (conn != NULL) {
+            goto done;
+        }
+    }
 
-    if (server->ns_conn_q < pool->server_connections) {
-        return conn_get(server, false, pool->redis);
+    if (server->ns_conn_q < server_conn_limit(server)) {
+        conn = conn_get(server, false, pool->redis);
+        if (conn != NULL && pool->server_idle_timeout > 0) {
+            conn->used_ts = nc_msec_now();
+        }
+        return conn;
     }
-    ASSERT(server->ns_conn_q == pool->server_connections);
+    ASSERT(server->ns_conn_q != 0);
 
     /*
-     * Pick a server connection from the head of the queue and insert
-     * it back into the tail of queue to maintain the lru order
+     * Pick a server connection starting from the head of the queue, which
+     * holds the least recently used one, so that ties between connections
+     * with equal load are broken in lru order
      */
     conn = TAILQ_FIRST(&server->s_conn_q);
     ASSERT(!conn->client && !conn->proxy);
 
+    switch (pool->balance_type) {
+    case BALANCE_LEAST_REQUESTS:
+        TAILQ_FOREACH(c, &server->s_conn_q, conn_tqe) {
+            if (c->nqueue < conn->nqueue) {
+                conn = c;
+            }
+        }
+        break;
+
+    case BALANCE_LEAST_BYTES:
+        TAILQ_FOREACH(c, &server->s_conn_q, conn_tqe) {
+            if (c->nqueue_bytes < conn->nqueue_bytes) {
+                conn = c;
+            }
+        }
+        break;
+
+    case BALANCE_ROUND_ROBIN:
+    default:
+        break;
+    }
+
+done:
+    /* insert it back into the tail of queue to maintain the lru order */
     TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
     TAILQ_INSERT_TAIL(&server->s_conn_q, conn, conn_tqe);
 
+    if (pool->server_idle_timeout > 0) {
+        conn->used_ts = nc_msec_now();
+    }
+
+    stats_server_incr(pool->ctx, server, server_conn_reuses);
+
     return conn;
 }
 
+static int
+server_latency_cmp(const void *t1, const void *t2)
+{
+    const uint32_t *l1 = t1, *l2 = t2;
+
+    if (*l1 < *l2) {
+        return -1;
+    }
+
+    return *l1 > *l2 ? 1 : 0;
+}
+
+/*
+ * Record the response latency of a request to server. Latencies are kept
+ * in a window of the last SERVER_LATENCY_NSAMPLE responses and the p95 is
+ * recomputed each time the window is full.
+ */
+void
+server_record_latency(struct server *server, int64_t latency)
+{
+    uint32_t sorted[SERVER_LATENCY_NSAMPLE];
+    uint32_t idx;
+
+    if (server->owner->hedge_delay <= 0 || !server->owner->hedge_adaptive) {
+        return;
+    }
+
+    idx = server->nlatency % SERVER_LATENCY_NSAMPLE;
+    server->latency_sample[idx] = (uint32_t)MAX(latency, 0);
+    server->nlatency++;
+
+    if (idx != SERVER_LATENCY_NSAMPLE - 1) {
+        return;
+    }
+
+    nc_memcpy(sorted, server->latency_sample, sizeof(sorted));
+    qsort(sorted, SERVER_LATENCY_NSAMPLE, sizeof(sorted[0]), server_latency_cmp);
+    server->latency_p95 = sorted[SERVER_LATENCY_NSAMPLE * 95 / 100];
+
+    log_debug(LOG_VERB, "server '%.*s' p95 latency %"PRIu32" msec",
+              server->pname.len, server->pname.data, server->latency_p95);
+}
+
+/*
+ * Return the delay in msec after which a read request outstanding on
+ * server is hedged. With hedge_adaptive the delay follows the server p95
+ * latency once a full window of latencies has been recorded.
+ */
+int
+server_hedge_delay(struct server *server)
+{
+    struct server_pool *pool = server->owner;
+
+    if (pool->hedge_adaptive && server->nlatency >= SERVER_LATENCY_NSAMPLE) {
+        return (int)MAX(server->latency_p95, 1);
+    }
+
+    return pool->hedge_delay;
+}
+
+/*
+ * Return true if one more request can be sent to server without going
+ * over its adaptive limit of requests in flight
+ */
+bool
+server_admit(struct context *ctx, struct server *server)
+{
+    struct server_pool *pool = server->owner;
+
+    if (pool->admission_latency <= 0) {
+        return true;
+    }
+
+    if (server->admit_limit == 0) {
+        server->admit_limit = SERVER_ADMIT_INIT_LIMIT;
+        stats_server_incr_by(ctx, server, admission_limit, server->admit_limit);
+    }
+
+    return server->nqueue < server->admit_limit;
+}
+
+/*
+ * Adjust the admission limit of server to the response latency of a
+ * request. The limit grows by one for every limit responses within
+ * admission_latency while the server is at least half busy, and shrinks
+ * by a tenth, at most once per admission_latency, on slower responses.
+ */
+void
+server_admit_update(struct context *ctx, struct server *server, int64_t latency)
+{
+    struct server_pool *pool = server->owner;
+    uint32_t limit;
+    int64_t now;
+
+    if (pool->admission_latency <= 0 || server->admit_limit == 0) {
+        return;
+    }
+
+    limit = server->admit_limit;
+
+    if (latency <= pool->admission_latency) {
+        if (server->nqueue < limit / 2) {
+            return;
+        }
+        if (++server->admit_credit >= limit) {
+            server->admit_credit = 0;
+            limit = MIN(limit + 1, SERVER_ADMIT_MAX_LIMIT);
+        }
+    } else {
+        now = nc_msec_now();
+        if (now < server->admit_hold) {
+            return;
+        }
+        server->admit_hold = now + pool->admission_latency;
+        server->admit_credit = 0;
+        limit = MAX(limit - MAX(limit / 10, 1), SERVER_ADMIT_MIN_LIMIT);
+    }
+
+    if (limit > server->admit_limit) {
+        stats_server_incr_by(ctx, server, admission_limit, limit - server->admit_limit);
+    } else if (limit < server->admit_limit) {
+        stats_server_decr_by(ctx, server, admission_limit, server->admit_limit - limit);
+        log_debug(LOG_VERB, "server '%.*s' admission limit %"PRIu32" after "
+                  "%"PRId64" msec response", server->pname.len,
+                  server->pname.data, limit, latency);
+    }
+    server->admit_limit = limit;
+}
+
+/*
+ * Open connections to server until it has nconn of them
+ */
 static rstatus_t
-server_each_preconnect(void *elem, void *data)
+server_warmup(struct context *ctx, struct server *server, uint32_t nconn)
 {
     rstatus_t status;
-    struct server *server;
     struct server_pool *pool;
     struct conn *conn;
 
+    pool = server->owner;
+
+    nconn = MIN(nconn, server_conn_limit(server));
+
+    while (server->ns_conn_q < nconn) {
+        conn = conn_get(server, false, pool->redis);
+        if (conn == NULL) {
+            return NC_ENOMEM;
+        }
+
+        status = server_connect(ctx, server, conn);
+        if (status != NC_OK) {
+            log_warn("connect to server '%.*s' failed, ignored: %s",
+                     server->pname.len, server->pname.data, strerror(errno));
+            server_close(ctx, conn);
+            break;
+        }
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+server_each_preconnect(void *elem, void *data)
+{
+    struct server *server;
+    struct server_pool *pool;
+
     server = elem;
     pool = server->owner;
 
-    conn = server_conn(server);
-    if (conn == NULL) {
-        return NC_ENOMEM;
+    return server_warmup(pool->ctx, server,
+                         MAX(pool->server_connections_min,
+                             pool->preconnect ? 1U : 0U));
+}
+
+/*
+ * Close server connection conn on behalf of the pool, right away if it
+ * is idle, or else once its outstanding requests are done
+ */
+static void
+server_reap(struct context *ctx, struct server *server, struct conn *conn)
+{
+    conn->reaped = 1;
+
+    if (conn->sd < 0 || !conn->active(conn)) {
+        if (conn->sd >= 0) {
+            event_del_conn(ctx->evb, conn);
+        }
+        conn->close(ctx, conn);
+        return;
     }
 
-    status = server_connect(pool->ctx, server, conn);
-    if (status != NC_OK) {
-        log_warn("connect to server '%.*s' failed, ignored: %s",
-                 server->pname.len, server->pname.data, strerror(errno));
-        server_close(pool->ctx, conn);
+    log_debug(LOG_INFO, "drain s %d of server '%.*s'", conn->sd,
+              server->name.len, server->name.data);
+
+    ASSERT(server->ns_conn_q != 0);
+    server->ns_conn_q--;
+    TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
+    conn->draining = 1;
+}
+
+/*
+ * Reap the connections of server that are older than
+ * server_connection_lifetime, and the ones not picked for
+ * server_idle_timeout beyond server_connections_min, least recently
+ * used first, and the ones over the share of server_connections_total.
+ * Then open connections up to server_connections_min again,
+ * unless the server is ejected.
+ */
+static rstatus_t
+server_each_maintain(void *elem, void *data)
+{
+    struct server *server = elem;
+    struct server_pool *pool = server->owner;
+    struct context *ctx = pool->ctx;
+    struct conn *conn, *nconn; /* current and next connection */
+    int64_t now = *(int64_t *)data;
+
+    for (conn = TAILQ_FIRST(&server->s_conn_q); conn != NULL; conn = nconn) {
+        nconn = TAILQ_NEXT(conn, conn_tqe);
+
+        if (pool->server_connection_lifetime > 0 && conn->open_ts != 0 &&
+            now - conn->open_ts >= pool->server_connection_lifetime) {
+            log_debug(LOG_INFO, "reap s %d of server '%.*s' opened %"PRId64
+                      " msec ago", conn->sd, server->pname.len,
+                      server->pname.data, now - conn->open_ts);
+            server_reap(ctx, server, conn);
+            continue;
+        }
+
+        if (pool->server_idle_timeout > 0 &&
+            server->ns_conn_q > pool->server_connections_min &&
+            now - conn->used_ts >= pool->server_idle_timeout &&
+            conn->connected && !conn->active(conn)) {
+            log_debug(LOG_INFO, "reap s %d of server '%.*s' idle for %"PRId64
+                      " msec", conn->sd, server->pname.len,
+                      server->pname.data, now - conn->used_ts);
+            server_reap(ctx, server, conn);
+        }
+    }
+
+    /* give back connections over the share of a shrunk budget, lru first */
+    while (server->budget != NULL &&
+           server->ns_conn_q > server_conn_limit(server)) {
+        conn = TAILQ_FIRST(&server->s_conn_q);
+        log_debug(LOG_INFO, "reap s %d of server '%.*s' over its share of "
+                  "%"PRIu32, conn->sd, server->pname.len, server->pname.data,
+                  server->budget->share);
+        server_reap(ctx, server, conn);
+    }
+
+    if (pool->server_resolve_ttl > 0 && now >= server->next_resolve) {
+        resolver_resolve(ctx, server);
+    }
+
+    if (server->ns_conn_q < pool->server_connections_min &&
+        server->next_retry <= nc_usec_now()) {
+        return server_warmup(ctx, server, pool->server_connections_min);
     }
 
     return NC_OK;
@@ -272,6 +602,9 @@ server_failure(struct context *ctx, struct server *server)
     int64_t now, next;
     rstatus_t status;
 
+    /* the server may have moved, look its name up again for later connects */
+    resolver_resolve(ctx, server);
+
     if (!pool->auto_eject_hosts) {
         return;
     }
@@ -321,12 +654,17 @@ server_failure(struct context *ctx, struct server *server)
 
 static void
 server_close_stats(struct context *ctx, struct server *server, err_t err,
-                   unsigned eof, unsigned connected)
+                   unsigned eof, unsigned connected, unsigned reaped)
 {
     if (connected) {
         stats_server_decr(ctx, server, server_connections);
     }
 
+    if (reaped) {
+        stats_server_incr(ctx, server, server_conn_reaps);
+        return;
+    }
+
     if (eof) {
         stats_server_incr(ctx, server, server_eof);
         return;
@@ -351,33 +689,133 @@ server_close_stats(struct context *ctx, struct server *server, err_t err,
     }
 }
 
+/*
+ * A hedged read request failing on a server is not an error for the
+ * client as long as its twin is still outstanding on another server
+ */
+static bool
+server_close_hedge(struct conn *conn, struct msg *msg)
+{
+    if (msg->hedge == NULL || msg->swallow) {
+        return false;
+    }
+
+    if (!msg->hedged) {
+        req_hedge_promote(msg);
+    }
+
+    log_debug(LOG_INFO, "close s %d drop hedged req %"PRIu64" len %"PRIu32
+              " type %d", conn->sd, msg->id, msg->mlen, msg->type);
+    req_put(msg);
+
+    return true;
+}
+
+/*
+ * Fail request msg on a closing server connection back to its client
+ */
+static void
+server_close_error(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct conn *c_conn;    /* peer client connection */
+
+    c_conn = msg->owner;
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    msg->done = 1;
+    msg->error = 1;
+    msg->err = conn->err;
+
+    if (msg->frag_owner != NULL) {
+        msg->frag_owner->nfrag_done++;
+        req_stream(ctx, c_conn, msg);
+    }
+
+    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+        event_add_out(ctx->evb, msg->owner);
+    }
+
+    log_debug(LOG_INFO, "close s %d schedule error for req %"PRIu64" "
+              "len %"PRIu32" type %d from c %d%c %s", conn->sd, msg->id,
+              msg->mlen, msg->type, c_conn->sd, conn->err ? ':' : ' ',
+              conn->err ? strerror(conn->err): " ");
+}
+
+/*
+ * Undo the merge of single-key gets into request msg on a closing server
+ * connection; each get is then failed or re-dispatched on its own
+ */
+static void
+server_close_batch(struct context *ctx, struct conn *conn, struct msg *msg,
+                   struct msg_tqh *retry_msgq)
+{
+    struct msg *req;
+    uint32_t i;
+
+    ASSERT(msg->nbatch != 0 && msg->owner == NULL);
+
+    for (i = 0; i < msg->nbatch; i++) {
+        req = msg->batch_seq[i];
+
+        if (req->swallow) {
+            req_put(req);
+        } else if (req_retryable(conn->owner, req)) {
+            TAILQ_INSERT_TAIL(retry_msgq, req, m_tqe);
+        } else {
+            server_close_error(ctx, conn, req);
+        }
+    }
+
+    req_put(msg);
+}
+
 void
 server_close(struct context *ctx, struct conn *conn)
 {
     rstatus_t status;
     struct msg *msg, *nmsg; /* current and next message */
-    struct conn *c_conn;    /* peer client connection */
+    struct server *server;
+    struct msg_tqh retry_msgq;
+    unsigned reaped;
 
     ASSERT(!conn->client && !conn->proxy);
 
+    server = conn->owner;
+
+    /* a connection reaped by the pool is closed without a failure */
+    reaped = conn->reaped && conn->err == 0 && !conn->eof;
+
     server_close_stats(ctx, conn->owner, conn->err, conn->eof,
-                       conn->connected);
+                       conn->connected, reaped);
 
     conn->connected = false;
 
     if (conn->sd < 0) {
-        server_failure(ctx, conn->owner);
+        if (!reaped) {
+            server_failure(ctx, conn->owner);
+        }
         conn->unref(conn);
         conn_put(conn);
         return;
     }
 
+    TAILQ_INIT(&retry_msgq);
+
     for (msg = TAILQ_FIRST(&conn->imsg_q); msg != NULL; msg = nmsg) {
         nmsg = TAILQ_NEXT(msg, s_tqe);
 
         /* dequeue the message (request) from server inq */
         conn->dequeue_inq(ctx, conn, msg);
 
+        if (msg->nbatch != 0) {
+            server_close_batch(ctx, conn, msg, &retry_msgq);
+            continue;
+        }
+
+        if (server_close_hedge(conn, msg)) {
+            continue;
+        }
+
         /*
          * Don't send any error response, if
          * 1. request is tagged as noreply or,
@@ -387,26 +825,10 @@ server_close(struct context *ctx, struct conn *conn)
             log_debug(LOG_INFO, "close s %d swallow req %"PRIu64" len %"PRIu32
                       " type %d", conn->sd, msg->id, msg->mlen, msg->type);
             req_put(msg);
+        } else if (req_retryable(server, msg)) {
+            TAILQ_INSERT_TAIL(&retry_msgq, msg, m_tqe);
         } else {
-            c_conn = msg->owner;
-            ASSERT(c_conn->client && !c_conn->proxy);
-
-            msg->done = 1;
-            msg->error = 1;
-            msg->err = conn->err;
-
-            if (msg->frag_owner != NULL) {
-                msg->frag_owner->nfrag_done++;
-            }
-
-            if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
-                event_add_out(ctx->evb, msg->owner);
-            }
-
-            log_debug(LOG_INFO, "close s %d schedule error for req %"PRIu64" "
-                      "len %"PRIu32" type %d from c %d%c %s", conn->sd, msg->id,
-                      msg->mlen, msg->type, c_conn->sd, conn->err ? ':' : ' ',
-                      conn->err ? strerror(conn->err): " ");
+            server_close_error(ctx, conn, msg);
         }
     }
     ASSERT(TAILQ_EMPTY(&conn->imsg_q));
@@ -417,29 +839,23 @@ server_close(struct context *ctx, struct conn *conn)
         /* dequeue the message (request) from server outq */
         conn->dequeue_outq(ctx, conn, msg);
 
+        if (msg->nbatch != 0) {
+            server_close_batch(ctx, conn, msg, &retry_msgq);
+            continue;
+        }
+
+        if (server_close_hedge(conn, msg)) {
+            continue;
+        }
+
         if (msg->swallow) {
             log_debug(LOG_INFO, "close s %d swallow req %"PRIu64" len %"PRIu32
                       " type %d", conn->sd, msg->id, msg->mlen, msg->type);
             req_put(msg);
+        } else if (req_retryable(server, msg)) {
+            TAILQ_INSERT_TAIL(&retry_msgq, msg, m_tqe);
         } else {
-            c_conn = msg->owner;
-            ASSERT(c_conn->client && !c_conn->proxy);
-
-            msg->done = 1;
-            msg->error = 1;
-            msg->err = conn->err;
-            if (msg->frag_owner != NULL) {
-                msg->frag_owner->nfrag_done++;
-            }
-
-            if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
-                event_add_out(ctx->evb, msg->owner);
-            }
-
-            log_debug(LOG_INFO, "close s %d schedule error for req %"PRIu64" "
-                      "len %"PRIu32" type %d from c %d%c %s", conn->sd, msg->id,
-                      msg->mlen, msg->type, c_conn->sd, conn->err ? ':' : ' ',
-                      conn->err ? strerror(conn->err): " ");
+            server_close_error(ctx, conn, msg);
         }
     }
     ASSERT(TAILQ_EMPTY(&conn->omsg_q));
@@ -459,10 +875,25 @@ server_close(struct context *ctx, struct conn *conn)
 
     ASSERT(conn->smsg == NULL);
 
-    server_failure(ctx, conn->owner);
+    if (!reaped) {
+        server_failure(ctx, conn->owner);
+    }
 
     conn->unref(conn);
 
+    /*
+     * Re-dispatch reads only now that the connection is off the server
+     * and a failure may have ejected the server from the pool
+     */
+    for (msg = TAILQ_FIRST(&retry_msgq); msg != NULL; msg = nmsg) {
+        nmsg = TAILQ_NEXT(msg, m_tqe);
+
+        TAILQ_REMOVE(&retry_msgq, msg, m_tqe);
+        if (!req_retry(ctx, server, msg)) {
+            server_close_error(ctx, conn, msg);
+        }
+    }
+
     status = close(conn->sd);
     if (status < 0) {
         log_error("close s %d failed, ignored: %s", conn->sd, strerror(errno));
@@ -501,6 +932,9 @@ server_connect(struct context *ctx, struct server *server, struct conn *conn)
         goto error;
     }
 
+    conn->open_ts = nc_msec_now();
+    stats_server_incr(ctx, server, server_conn_opens);
+
     status = nc_set_nonblocking(conn->sd);
     if (status != NC_OK) {
         log_error("set nonblock on s %d for server '%.*s' failed: %s",
@@ -546,6 +980,7 @@ server_connect(struct context *ctx, struct server *server, struct conn *conn)
 
     ASSERT(!conn->connecting);
     conn->connected = 1;
+    stats_server_incr(ctx, server, server_connections);
     log_debug(LOG_INFO, "connected on s %d to server '%.*s'", conn->sd,
               server->pname.len, server->pname.data);
 
@@ -592,6 +1027,114 @@ server_ok(struct context *ctx, struct conn *conn)
     }
 }
 
+/*
+ * Detach the connections of server after it moved: idle ones are closed,
+ * busy ones finish their requests in flight and are closed after that
+ */
+static void
+server_drain(struct context *ctx, struct server *server)
+{
+    struct conn *conn, *nconn; /* current and next connection */
+
+    for (conn = TAILQ_FIRST(&server->s_conn_q); conn != NULL; conn = nconn) {
+        nconn = TAILQ_NEXT(conn, conn_tqe);
+        server_reap(ctx, server, conn);
+    }
+}
+
+/*
+ * Point server at a new address in place, e.g. after a redis master
+ * failover. Idle connections to the old address are closed right away,
+ * while busy connections are detached from the server so that no new
+ * requests are routed to them, and are closed once their outstanding
+ * requests are done (see rsp_recv_done). The server takes over pname
+ * and addrstr. A hostname is looked up by the resolver, and connects
+ * fail until it is back.
+ */
+rstatus_t
+server_switch(struct context *ctx, struct server *server, struct string *pname,
+              struct string *addrstr, uint16_t port)
+{
+    rstatus_t status;
+    struct sockinfo info;
+
+    if (resolver_static(addrstr)) {
+        status = nc_resolve(addrstr, port, &info);
+        if (status != NC_OK) {
+            return NC_ERROR;
+        }
+    } else {
+        memset(&info, 0, sizeof(info));
+    }
+
+    string_deinit(&server->pname);
+    string_deinit(&server->addrstr);
+    server->pname = *pname;
+    server->addrstr = *addrstr;
+    server->port = port;
+    nc_memcpy(&server->info, &info, sizeof(info));
+
+    if (info.addrlen == 0) {
+        resolver_resolve(ctx, server);
+    }
+
+    server->failure_count = 0;
+    server->next_retry = 0LL;
+
+    server_drain(ctx, server);
+
+    return NC_OK;
+}
+
+/*
+ * Result of the lookup of hostname name and port of server done by the
+ * resolver, with info NULL if it failed. A failed lookup keeps the last
+ * good address. A new address is taken for the connections opened from
+ * now on, while those to the old one are drained.
+ */
+void
+server_resolved(struct context *ctx, struct server *server,
+                struct string *name, int port, struct sockinfo *info)
+{
+    struct server_pool *pool = server->owner;
+    int64_t now;
+
+    server->resolving = 0;
+
+    /* pointed elsewhere by server_switch while the lookup was in flight */
+    if (port != server->port || string_compare(name, &server->addrstr) != 0) {
+        resolver_resolve(ctx, server);
+        return;
+    }
+
+    now = nc_msec_now();
+    if (pool->server_resolve_ttl > 0 && now > 0) {
+        server->next_resolve = now + pool->server_resolve_ttl;
+    }
+
+    if (info == NULL) {
+        stats_server_incr(ctx, server, server_resolve_errors);
+        return;
+    }
+
+    if (info->family == server->info.family &&
+        info->addrlen == server->info.addrlen &&
+        memcmp(&info->addr, &server->info.addr, info->addrlen) == 0) {
+        return;
+    }
+
+    log_warn("server '%.*s' resolved to %s", server->pname.len,
+             server->pname.data,
+             nc_unresolve_addr((struct sockaddr *)&info->addr, info->addrlen));
+
+    nc_memcpy(&server->info, info, sizeof(*info));
+    server->failure_count = 0;
+
+    stats_server_incr(ctx, server, server_addr_changes);
+
+    server_drain(ctx, server);
+}
+
 static rstatus_t
 server_pool_update(struct server_pool *pool)
 {
@@ -731,6 +1274,8 @@ server_get_conn(struct context *ctx, struct server *srv)
         return NULL;
     }
 
+    stats_server_record_queue_depth(ctx, srv, conn->nqueue);
+
     status = server_connect(ctx, srv, conn);
     if (status != NC_OK) {
         server_close(ctx, conn);
@@ -760,13 +1305,74 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
     return server_get_conn(ctx, server);
 }
 
+/*
+ * Pick a server other than the given one in a pool whose servers replicate
+ * the same data. Servers that are currently ejected are skipped.
+ */
+struct server *
+server_pool_other_server(struct server_pool *pool, struct server *server)
+{
+    struct server *hedge;
+    uint32_t i, nserver, idx;
+    int64_t now;
+
+    nserver = array_n(&pool->server);
+    if (nserver < 2) {
+        return NULL;
+    }
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return NULL;
+    }
+
+    idx = (uint32_t)random() % nserver;
+    for (i = 0; i < nserver; i++) {
+        hedge = array_get(&pool->server, (idx + i) % nserver);
+        if (hedge == server || hedge->next_retry > now) {
+            continue;
+        }
+
+        return hedge;
+    }
+
+    return NULL;
+}
+
+/*
+ * Pick the server to re-dispatch a read request for key to after it failed
+ * on server. In a redis pool with a master any other replica will do;
+ * otherwise the key is mapped again, which only lands on a different
+ * server once the failed one has been ejected.
+ */
+struct server *
+server_pool_retry_server(struct server_pool *pool, struct server *server,
+                         uint8_t *key, uint32_t keylen)
+{
+    rstatus_t status;
+    struct server *target;
+
+    if (pool->redis && array_n(&pool->redis_master) > 0) {
+        return server_pool_other_server(pool, server);
+    }
+
+    status = server_pool_update(pool);
+    if (status != NC_OK) {
+        return NULL;
+    }
+
+    target = server_pool_server(pool, key, keylen);
+
+    return target != server ? target : NULL;
+}
+
 static rstatus_t
 server_pool_each_preconnect(void *elem, void *data)
 {
     rstatus_t status;
     struct server_pool *sp = elem;
 
-    if (!sp->preconnect) {
+    if (!sp->preconnect && sp->server_connections_min == 0) {
         return NC_OK;
     }
 
@@ -797,6 +1403,55 @@ server_pool_preconnect(struct context *ctx)
     return NC_OK;
 }
 
+static rstatus_t
+server_pool_each_maintain(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+    struct context *ctx = sp->ctx;
+    int64_t now = *(int64_t *)data;
+
+    if (sp->server_connections_min == 0 && sp->server_idle_timeout <= 0 &&
+        sp->server_connection_lifetime <= 0 && sp->server_resolve_ttl <= 0 &&
+        sp->server_connections_total == 0) {
+        return NC_OK;
+    }
+
+    if (now < sp->next_maintain) {
+        ctx->timeout = MIN((int)(sp->next_maintain - now), ctx->timeout);
+        return NC_OK;
+    }
+
+    sp->next_maintain = now + SERVER_MAINTAIN_INTERVAL;
+    ctx->timeout = MIN(SERVER_MAINTAIN_INTERVAL, ctx->timeout);
+
+    budget_rebalance(ctx, sp);
+
+    if (array_n(&sp->redis_master) > 0) {
+        array_each(&sp->redis_master, server_each_maintain, &now);
+    }
+    array_each(&sp->server, server_each_maintain, &now);
+
+    return NC_OK;
+}
+
+/*
+ * Reap idle and expired server connections and warm servers back up to
+ * server_connections_min, once every SERVER_MAINTAIN_INTERVAL msec in
+ * the pools that set any of them. Called on every turn of the event loop.
+ */
+void
+server_pool_maintain(struct context *ctx)
+{
+    int64_t now;
+
+    now = nc_msec_now();
+    if (now < 0) {
+        return;
+    }
+
+    array_each(&ctx->pool, server_pool_each_maintain, &now);
+}
+
 static rstatus_t
 server_pool_each_disconnect(void *elem, void *data)
 {
@@ -874,7 +1529,7 @@ server_pool_init(struct array *server_pool, struct array *conf_pool,
                  struct context *ctx)
 {
     rstatus_t status;
-    uint32_t npool;
+    uint32_t i, npool, nbackend;
 
     npool = array_n(conf_pool);
     ASSERT(npool != 0);
@@ -900,6 +1555,26 @@ server_pool_init(struct array *server_pool, struct array *conf_pool,
         return status;
     }
 
+    /* number the servers of all pools, to fragment across routed pools */
+    for (i = 0, nbackend = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        sp->backend_base = nbackend;
+        nbackend += array_n(&sp->server);
+    }
+    for (i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        struct conf_pool *cp = array_get(conf_pool, i);
+
+        sp->nbackend = nbackend;
+        if (cp->mirror.len > 0) {
+            sp->mirror = array_get(server_pool, cp->mirror_idx);
+        }
+        if (cp->migrate_from.len > 0) {
+            sp->migrate = array_get(server_pool, cp->migrate_idx);
+        }
+    }
+
     /* compute max server connections */
     ctx->max_nsconn = 0;
     status = array_each(server_pool, server_pool_each_calc_connections, ctx);
@@ -960,6 +1635,8 @@ server_pool_deinit(struct array *server_pool)
 
         server_deinit(&sp->server);
 
+        route_deinit(sp);
+
         log_debug(LOG_DEBUG, "deinit pool %"PRIu32" '%.*s'", sp->idx,
                   sp->name.len, sp->name.data);
     }
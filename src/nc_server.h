@@ -61,8 +61,50 @@
 
 typedef uint32_t (*hash_t)(const char *, size_t);
 
+#define SERVER_LATENCY_NSAMPLE  64      /* # response latencies per p95 window */
+#define SERVER_HEDGE_MAX_CREDIT 1000    /* hedge credit cap in percent, i.e. a burst of 10 */
+#define SERVER_ADMIT_MIN_LIMIT  4       /* min # requests in flight on a server */
+#define SERVER_ADMIT_INIT_LIMIT 64      /* initial # requests in flight on a server */
+#define SERVER_ADMIT_MAX_LIMIT  65536   /* max # requests in flight on a server */
+#define SERVER_MAINTAIN_INTERVAL 1000   /* server connection reap and warmup interval in msec */
+
+/*
+ * Algorithms to pick one of the 'server_connections:' connections to a
+ * server. round_robin rotates connections in lru order; least_requests
+ * and least_bytes pick the connection with the fewest requests or the
+ * fewest request bytes in flight (in_q + out_q).
+ */
+#define BALANCE_CODEC(ACTION)                           \
+    ACTION( BALANCE_ROUND_ROBIN,    round_robin       ) \
+    ACTION( BALANCE_LEAST_REQUESTS, least_requests    ) \
+    ACTION( BALANCE_LEAST_BYTES,    least_bytes       ) \
+
+#define DEFINE_ACTION(_balance, _name) _balance,
+typedef enum balance_type {
+    BALANCE_CODEC( DEFINE_ACTION )
+    BALANCE_SENTINEL
+} balance_type_t;
+#undef DEFINE_ACTION
+
+/*
+ * Requests of a pool that are copied to its 'mirror:' pool: all of them,
+ * only the ones that modify data or only the read-only ones.
+ */
+#define MIRROR_CODEC(ACTION)                \
+    ACTION( MIRROR_ALL,    all    )         \
+    ACTION( MIRROR_WRITES, writes )         \
+    ACTION( MIRROR_READS,  reads  )         \
+
+#define DEFINE_ACTION(_mirror, _name) _mirror,
+typedef enum mirror_type {
+    MIRROR_CODEC( DEFINE_ACTION )
+    MIRROR_SENTINEL
+} mirror_type_t;
+#undef DEFINE_ACTION
+
 struct continuum {
     uint32_t index;  /* server index */
+    uint32_t pindex; /* index in the points of the server (ketama) */
     uint32_t value;  /* hash value */
 };
 
@@ -70,18 +112,36 @@ struct server {
     uint32_t           idx;           /* server index */
     struct server_pool *owner;        /* owner pool */
 
-    struct string      pname;         /* hostname:port:weight (ref in conf_server) */
+    struct string      pname;         /* hostname:port:weight (owned) */
     struct string      name;          /* hostname:port or [name] (ref in conf_server) */
-    struct string      addrstr;       /* hostname (ref in conf_server) */
+    struct string      addrstr;       /* hostname (owned) */
     uint16_t           port;          /* port */
     uint32_t           weight;        /* weight */
     struct sockinfo    info;          /* server socket info */
+    int64_t            next_resolve;  /* next hostname lookup time in msec */
+    unsigned           resolving:1;   /* hostname lookup in flight? */
 
     uint32_t           ns_conn_q;     /* # server connection */
     struct conn_tqh    s_conn_q;      /* server connection q */
 
     int64_t            next_retry;    /* next retry time in usec */
     uint32_t           failure_count; /* # consecutive failures */
+
+    uint32_t           *point;        /* ketama points in generation order (owned) */
+    uint32_t           npoint;        /* # ketama points cached */
+    uint32_t           ncontinuum;    /* # points on the pool continuum */
+
+    uint32_t           latency_sample[SERVER_LATENCY_NSAMPLE]; /* recent response latencies in msec */
+    uint32_t           nlatency;      /* # response latencies recorded */
+    uint32_t           latency_p95;   /* p95 of the last full latency window in msec */
+
+    uint32_t           nqueue;        /* # requests in flight on all server connections */
+    uint32_t           nqueue_peak;   /* peak nqueue since the last budget rebalance */
+    struct budget_slot *budget;       /* slot of this worker in the connection budget */
+    uint32_t           conn_share;    /* # connections allowed by the budget, as last reported */
+    uint32_t           admit_limit;   /* adaptive limit on nqueue (0 = not yet set) */
+    uint32_t           admit_credit;  /* # fast responses since the limit last grew */
+    int64_t            admit_hold;    /* no limit decrease before this time in msec */
 };
 
 struct server_pool {
@@ -110,18 +170,59 @@ struct server_pool {
     hash_t             key_hash;             /* key hasher */
     struct string      hash_tag;             /* key hash tag (ref in conf_pool) */
     int                timeout;              /* timeout in msec */
+    int                command_timeout[MSG_SENTINEL]; /* request deadline in msec by type */
     int                backlog;              /* listen backlog */
     int                redis_db;             /* redis database to connect to */
     uint32_t           client_connections;   /* maximum # client connection */
+    int                client_idle_timeout;  /* idle client connection timeout in msec (0 = never) */
     uint32_t           server_connections;   /* maximum # server connection */
+    int                balance_type;         /* server connection balance type (balance_type_t) */
+    uint32_t           server_connections_min; /* # server connection kept open */
+    uint32_t           server_connections_total; /* # server connection of all workers (0 = no budget) */
+    int                server_idle_timeout;  /* idle server connection timeout in msec (0 = never) */
+    int                server_connection_lifetime; /* server connection lifetime in msec (0 = unlimited) */
+    int                server_resolve_ttl;   /* server hostname lookup ttl in msec (0 = until a failure) */
+    int64_t            next_maintain;        /* next server connection maintenance time in msec */
     int64_t            server_retry_timeout; /* server retry timeout in usec */
     uint32_t           server_failure_limit; /* server failure limit */
     struct string      redis_auth;           /* redis_auth password (matches requirepass on redis) */
     unsigned           require_auth;         /* require_auth? */
+    int                admission_latency;    /* admission target latency in msec (0 = admit all) */
+    struct token_bucket rate_requests;       /* pool request rate limit */
+    struct token_bucket rate_bytes;          /* pool request byte rate limit */
+    int                client_rate_limit;    /* client requests per sec (0 = unlimited) */
+    int                client_rate_limit_bytes; /* client request bytes per sec (0 = unlimited) */
+    int                hedge_delay;          /* hedge delay in msec (0 = no hedging) */
+    uint32_t           hedge_budget;         /* hedges in percent of hedgeable reads */
+    uint32_t           hedge_credit;         /* accumulated hedge budget in percent */
+    uint32_t           read_retries;         /* max # re-dispatches of a failed read */
+    int64_t            read_retry_budget;    /* max age of a read to re-dispatch in usec */
+    struct server_pool *mirror;              /* pool requests are mirrored to (NULL = none) */
+    int                mirror_type;          /* mirrored requests (mirror_type_t) */
+    uint32_t           mirror_rate;          /* mirrored requests in percent */
+    uint32_t           mirror_credit;        /* accumulated mirror rate in percent */
+    size_t             mirror_max_bytes;     /* max bytes of mirror copies in flight */
+    size_t             mirror_bytes;         /* bytes of mirror copies in flight */
+    struct server_pool *migrate;             /* pool with the old distribution (NULL = none) */
+    int                migrate_writeback_ttl; /* ttl in sec of values written back (0 = none) */
+    uint32_t           mget_batch;           /* max # keys of a mget fragment (0 = unbounded) */
+    uint32_t           get_batch;            /* max # gets merged into one (0 = off) */
+    struct array       route_node;           /* route_node[] trie of routes: */
+    struct array       route_edge;           /* route_edge[] of the route trie */
+    uint32_t           backend_base;         /* index of the first server among all pools */
+    uint32_t           nbackend;             /* # servers of all pools */
+    struct string      sentinel_addrstr;     /* redis sentinel address - hostname:port (ref in conf_pool) */
+    struct sockinfo    sentinel_info;        /* redis sentinel socket info */
+    struct string      sentinel_master;      /* master name monitored by sentinel (ref in conf_pool) */
+    struct sentinel    *sentinel;            /* sentinel subscription */
     unsigned           auto_eject_hosts:1;   /* auto_eject_hosts? */
     unsigned           preconnect:1;         /* preconnect? */
     unsigned           redis:1;              /* redis? */
+    unsigned           memcache_binary:1;    /* memcache binary protocol? */
     unsigned           tcpkeepalive:1;       /* tcpkeepalive? */
+    unsigned           hedge_adaptive:1;     /* hedge after the server p95 latency? */
+    unsigned           migrate_writeback:1;  /* write fallback hits back to the new owner? */
+    unsigned           mget_stream:1;        /* stream mget replies in key order? */
 };
 
 void server_ref(struct conn *conn, void *owner);
@@ -131,16 +232,25 @@ bool server_active(struct conn *conn);
 rstatus_t server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
 void server_deinit(struct array *server);
 struct conn *server_conn(struct server *server);
+void server_record_latency(struct server *server, int64_t latency);
+int server_hedge_delay(struct server *server);
+bool server_admit(struct context *ctx, struct server *server);
+void server_admit_update(struct context *ctx, struct server *server, int64_t latency);
 struct conn *server_get_conn(struct context *ctx, struct server *srv);
 rstatus_t server_connect(struct context *ctx, struct server *server, struct conn *conn);
 void server_close(struct context *ctx, struct conn *conn);
 void server_connected(struct context *ctx, struct conn *conn);
 void server_ok(struct context *ctx, struct conn *conn);
+rstatus_t server_switch(struct context *ctx, struct server *server, struct string *pname, struct string *addrstr, uint16_t port);
+void server_resolved(struct context *ctx, struct server *server, struct string *name, int port, struct sockinfo *info);
 
 uint32_t server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen);
 struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key, uint32_t keylen);
+struct server *server_pool_other_server(struct server_pool *pool, struct server *server);
+struct server *server_pool_retry_server(struct server_pool *pool, struct server *server, uint8_t *key, uint32_t keylen);
 rstatus_t server_pool_run(struct server_pool *pool);
 rstatus_t server_pool_preconnect(struct context *ctx);
+void server_pool_maintain(struct context *ctx);
 void server_pool_disconnect(struct context *ctx);
 rstatus_t server_pool_init(struct array *server_pool, struct array *conf_pool, struct context *ctx);
 void server_pool_deinit(struct array *server_pool);
@@ -99,6 +99,10 @@ signal_handler(int signo)
         break;
 
     case SIGUSR2:
+        if (pm_myrole == ROLE_MASTER) {
+            actionstr = ", upgrading binary";
+            action = nc_upgrade_binary;
+        }
         break;
 
     case SIGTTIN:
@@ -18,23 +18,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_conf.h>
 #include <nc_process.h>
+#include <nc_upgrade.h>
 
 static struct string pools_tag_key = string("pools");
 static struct string servers_tag_key = string("servers");
 static struct string server_latency_key = string("server_latency");
 static struct string req_latency_key = string("request_latency");
+static struct string mirror_latency_key = string("mirror_latency");
+static struct string conn_depth_key = string("conn_queue_depth");
+static struct string workers_key = string("workers");
 static int64_t latency_buckets[] =  {
     1, 10, 20, 50, 100, 200, 500, 1000, 2000, 3000, INT64_MAX
 };
 
 #define NBUCKET (sizeof(latency_buckets)/sizeof(latency_buckets[0]))
+
+/* queue depth histograms share the latency array helpers and bucket count */
+static int64_t depth_buckets[] =  {
+    0, 1, 2, 4, 8, 16, 32, 64, 128, 256, INT64_MAX
+};
 struct stats_desc {
     char *name; /* stats name */
     char *desc; /* stats description */
@@ -222,6 +233,7 @@ server_each_map_to_stats_server(void *elem, void *data)
     rstatus_t status;
 
     sts->name = s->name;
+    sts->nslot = 0;
     array_null(&sts->metric);
 
     status = stats_server_metric_init(sts);
@@ -233,6 +245,12 @@ server_each_map_to_stats_server(void *elem, void *data)
         stats_metric_deinit(&sts->metric);
         return status;
     }
+    status = stats_latency_init(&sts->depth);
+    if (status != NC_OK) {
+        stats_metric_deinit(&sts->metric);
+        stats_latency_deinit(&sts->latency);
+        return status;
+    }
 
     log_debug(LOG_VVVERB, "init stats server '%.*s' with %"PRIu32" metric",
               sts->name.len, sts->name.data, array_n(&sts->metric));
@@ -245,7 +263,7 @@ static rstatus_t
 stats_server_map(struct array *stats_server, struct array *server, struct array *master)
 {
     rstatus_t status;
-    uint32_t nserver, nmaster;
+    uint32_t i, nserver, nmaster;
 
     nserver = array_n(server);
     ASSERT(nserver != 0);
@@ -262,6 +280,16 @@ stats_server_map(struct array *stats_server, struct array *server, struct array
         return status;
     }
 
+    /* the budget has a slot per worker there may be, for the servers only */
+    for (i = 0; i < nserver; i++) {
+        struct server *s = array_get(server, i);
+        struct stats_server *sts = array_get(stats_server, i);
+
+        if (s->owner->server_connections_total != 0) {
+            sts->nslot = (uint32_t)s->owner->ctx->cf->global.worker_processes_max;
+        }
+    }
+
     if (nmaster != 0) {
         status = array_each(master, server_each_map_to_stats_server, stats_server);
         if (status != NC_OK) {
@@ -285,6 +313,7 @@ stats_server_unmap(struct array *stats_server)
         struct stats_server *sts = array_pop(stats_server);
         stats_metric_deinit(&sts->metric);
         stats_latency_deinit(&sts->latency);
+        stats_latency_deinit(&sts->depth);
     }
     array_deinit(stats_server);
 
@@ -300,6 +329,7 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
     array_null(&stp->metric);
     array_null(&stp->server);
     array_null(&stp->latency);
+    array_null(&stp->mirror_latency);
 
     status = stats_pool_metric_init(&stp->metric);
     if (status != NC_OK) {
@@ -310,11 +340,18 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
         stats_metric_deinit(&stp->metric);
         return status;
     }
+    status = stats_latency_init(&stp->mirror_latency);
+    if (status != NC_OK) {
+        stats_metric_deinit(&stp->metric);
+        stats_latency_deinit(&stp->latency);
+        return status;
+    }
 
     status = stats_server_map(&stp->server, &sp->server, &sp->redis_master);
     if (status != NC_OK) {
         stats_metric_deinit(&stp->metric);
         stats_latency_deinit(&stp->latency);
+        stats_latency_deinit(&stp->mirror_latency);
         return status;
     }
 
@@ -338,12 +375,14 @@ stats_pool_reset(struct array *stats_pool)
 
         stats_metric_reset(&stp->metric);
         stats_latency_reset(&stp->latency);
+        stats_latency_reset(&stp->mirror_latency);
 
         nserver = array_n(&stp->server);
         for (j = 0; j < nserver; j++) {
             struct stats_server *sts = array_get(&stp->server, j);
             stats_metric_reset(&sts->metric);
             stats_latency_reset(&sts->latency);
+            stats_latency_reset(&sts->depth);
         }
     }
 }
@@ -388,6 +427,7 @@ stats_pool_unmap(struct array *stats_pool)
         struct stats_pool *stp = array_pop(stats_pool);
         stats_metric_deinit(&stp->metric);
         stats_latency_deinit(&stp->latency);
+        stats_latency_deinit(&stp->mirror_latency);
         stats_server_unmap(&stp->server);
     }
     array_deinit(stats_pool);
@@ -405,6 +445,8 @@ stats_create_buf(struct stats *st)
     uint32_t pools_tag_extra = 14;   /* '"pools": { ' + ' }' */
     uint32_t servers_tag_extra = 16; /* '"servers": { ' + ' }' */
     uint32_t latency_extra = 8;      /* '"latency": [' + '], ' */
+    uint32_t uint32_max_digits = 10; /* UINT32_MAX = 4294967295 */
+    uint32_t slot_extra = 32;        /* '{"used":, "share":, "demand":},' */
     size_t size = 0;
     uint32_t i;
 
@@ -441,6 +483,10 @@ stats_create_buf(struct stats *st)
     size += int64_max_digits;
     size += key_value_extra;
 
+    size += st->nworker_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
     /* server pools */
     size += pools_tag_extra;
     for (i = 0; i < array_n(&st->sum); i++) {
@@ -462,6 +508,10 @@ stats_create_buf(struct stats *st)
         // +1 for comma in array
         size += NBUCKET*(int64_max_digits+1)+latency_extra;
 
+        // mirror copy latency
+        size += mirror_latency_key.len;
+        size += NBUCKET*(int64_max_digits+1)+latency_extra;
+
         /* servers per pool */
         size += servers_tag_extra;
         for (j = 0; j < array_n(&stp->server); j++) {
@@ -481,6 +531,17 @@ stats_create_buf(struct stats *st)
             // server request latency
             // +1 for comma in array
             size += NBUCKET*(int64_max_digits+1)+latency_extra;
+
+            // connection queue depth
+            size += conn_depth_key.len;
+            size += NBUCKET*(int64_max_digits+1)+latency_extra;
+
+            /* the master shows the budget slot of each worker */
+            if (st->loop == stats_master_loop_callback && sts->nslot != 0) {
+                size += workers_key.len;
+                size += sts->nslot * (3 * uint32_max_digits + slot_extra);
+                size += latency_extra;
+            }
         }
     }
 
@@ -508,7 +569,9 @@ stats_destroy_buf(struct stats *st)
     if (st->buf.size != 0) {
         ASSERT(st->buf.data != NULL);
         nc_free(st->buf.data);
+        st->buf.data = NULL;
         st->buf.size = 0;
+        st->buf.len = 0;
     }
 }
 
@@ -540,6 +603,65 @@ stats_add_latency(struct stats *st, struct string *key, struct array *latency)
     return NC_OK;
 }
 
+/*
+ * Add the budget slots of server sidx of pool pidx, one per worker, as the
+ * master sees them in the shared budget. A worker of another config, whose
+ * server is not the same, is left out.
+ */
+static rstatus_t
+stats_add_budget(struct stats *st, uint32_t pidx, uint32_t sidx,
+                 struct string *name)
+{
+    struct stats_buffer *buf;
+    struct array *workers = &master_nci->workers;
+    uint8_t *pos;
+    int n, room;
+    uint32_t w, nslot;
+
+    buf = &st->buf;
+    pos = buf->data + buf->len;
+    room = (int)(buf->size - buf->len - 1);
+    n = nc_snprintf(pos, room, "\"%.*s\": [", workers_key.len,
+                    workers_key.data);
+    for (w = 0, nslot = 0; w < array_n(workers); w++) {
+        struct instance *worker_nci = array_get(workers, w);
+        struct server_pool *sp;
+        struct server *server;
+        struct budget_slot *slot;
+
+        if (pidx >= array_n(&worker_nci->ctx->pool)) {
+            continue;
+        }
+        sp = array_get(&worker_nci->ctx->pool, pidx);
+        if (sidx >= array_n(&sp->server)) {
+            continue;
+        }
+        server = array_get(&sp->server, sidx);
+        slot = server->budget;
+        if (slot == NULL || string_compare(&server->name, name) != 0) {
+            continue;
+        }
+
+        if (n >= room) {
+            return NC_ERROR;
+        }
+        n += nc_snprintf(pos + n, room - n, "%s{\"used\":%"PRIu32", "
+                         "\"share\":%"PRIu32", \"demand\":%"PRIu32"}",
+                         nslot == 0 ? "" : ",", slot->used, slot->share,
+                         slot->demand);
+        nslot++;
+    }
+    if (n >= room) {
+        return NC_ERROR;
+    }
+    n += nc_snprintf(pos + n, room - n, "], ");
+    if (n >= room) {
+        return NC_ERROR;
+    }
+    buf->len += (size_t)n;
+    return NC_OK;
+}
+
 static rstatus_t
 stats_add_string(struct stats *st, struct string *key, struct string *val)
 {
@@ -630,16 +752,24 @@ stats_add_header(struct stats *st)
         return status;
     }
 
-    status = stats_add_num(st, &st->ntotal_conn_str, (int64_t)conn_ntotal_conn());
+    status = stats_add_num(st, &st->ntotal_conn_str, st->ntotal_conn);
     if (status != NC_OK) {
         return status;
     }
 
-    status = stats_add_num(st, &st->ncurr_conn_str, conn_ncurr_conn());
+    status = stats_add_num(st, &st->ncurr_conn_str, st->ncurr_conn);
     if (status != NC_OK) {
         return status;
     }
 
+    /* the master adds up the stats of its workers */
+    if (st->loop == stats_master_loop_callback) {
+        status = stats_add_num(st, &st->nworker_str, st->nworker);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
     return NC_OK;
 }
 
@@ -811,6 +941,7 @@ stats_aggregate(struct stats *st)
         stp2 = array_get(&st->sum, i);
         stats_aggregate_metric(&stp2->metric, &stp1->metric);
         stats_aggregate_latency(&stp2->latency, &stp1->latency);
+        stats_aggregate_latency(&stp2->mirror_latency, &stp1->mirror_latency);
 
         for (j = 0; j < array_n(&stp1->server); j++) {
             struct stats_server *sts1, *sts2;
@@ -819,6 +950,7 @@ stats_aggregate(struct stats *st)
             sts2 = array_get(&stp2->server, j);
             stats_aggregate_metric(&sts2->metric, &sts1->metric);
             stats_aggregate_latency(&sts2->latency, &sts1->latency);
+            stats_aggregate_latency(&sts2->depth, &sts1->depth);
         }
     }
 
@@ -861,6 +993,11 @@ stats_make_rsp(struct stats *st)
             return status;
         }
 
+        status = stats_add_latency(st, &mirror_latency_key, &stp->mirror_latency);
+        if (status != NC_OK) {
+            return status;
+        }
+
         status = stats_begin_nesting(st, &servers_tag_key);
         if (status != NC_OK) {
             return status;
@@ -884,6 +1021,18 @@ stats_make_rsp(struct stats *st)
                 return status;
             }
 
+            status = stats_add_latency(st, &conn_depth_key, &sts->depth);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            if (st->loop == stats_master_loop_callback && sts->nslot != 0) {
+                status = stats_add_budget(st, i, j, &sts->name);
+                if (status != NC_OK) {
+                    return status;
+                }
+            }
+
             status = stats_end_nesting(st);
             if (status != NC_OK) {
                 return status;
@@ -923,6 +1072,9 @@ stats_send_rsp(struct stats *st)
     ssize_t n;
     int sd;
 
+    st->ntotal_conn = (int64_t)conn_ntotal_conn();
+    st->ncurr_conn = conn_ncurr_conn();
+
     status = stats_make_rsp(st);
     if (status != NC_OK) {
         return status;
@@ -965,81 +1117,378 @@ stats_loop_callback(void *arg1, void *arg2)
     stats_send_rsp(st);
 }
 
-static rstatus_t
-stats_each_calc_shared_mem_size(void *elem, void *data)
+static pthread_mutex_t stats_master_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The master holds the lock while it changes its workers, as its stats
+ * thread reads the shared stats of the workers.
+ */
+void
+stats_master_lock(void)
 {
-    char *shared_mem = ((struct instance *)elem)->ctx->shared_mem;
-    size_t *size = data;
-    *size += strlen(shared_mem);
-    /* use "," instead of "\0" */
-    return NC_OK;
+    pthread_mutex_lock(&stats_master_mutex);
+}
+
+void
+stats_master_unlock(void)
+{
+    pthread_mutex_unlock(&stats_master_mutex);
+}
+
+static size_t
+stats_shared_nvalue(uint32_t npool, uint32_t nserver)
+{
+    return (size_t)npool * (STATS_POOL_NFIELD + 2 * NBUCKET) +
+           (size_t)nserver * (STATS_SERVER_NFIELD + 2 * NBUCKET);
 }
 
+/*
+ * Fold a pool or server name into the FNV-1a hash of the names before it.
+ * The name ends in a nul so that "ab", "c" and "a", "bc" differ.
+ */
+static uint32_t
+stats_shared_hash(uint32_t hash, const struct string *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < name->len; i++) {
+        hash ^= name->data[i];
+        hash *= 16777619U;
+    }
+    hash *= 16777619U;
+
+    return hash;
+}
+
+static uint32_t
+stats_shared_hash_servers(uint32_t hash, struct array *server)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(server); i++) {
+        struct server *s = array_get(server, i);
+
+        hash = stats_shared_hash(hash, &s->name);
+    }
+
+    return hash;
+}
+
+struct stats_shared *
+stats_shared_create(struct array *server_pool)
+{
+    struct stats_shared *sh;
+    uint32_t i, npool, nserver, hash;
+    size_t size;
+
+    npool = array_n(server_pool);
+    nserver = 0;
+    hash = 2166136261U;
+    for (i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        nserver += array_n(&sp->server) + array_n(&sp->redis_master);
+        hash = stats_shared_hash(hash, &sp->name);
+        hash = stats_shared_hash_servers(hash, &sp->server);
+        hash = stats_shared_hash_servers(hash, &sp->redis_master);
+    }
+
+    size = sizeof(*sh) +
+           sizeof(sh->value[0]) * (stats_shared_nvalue(npool, nserver) - 1);
+    sh = nc_shared_mem_alloc(size);
+    if (sh == NULL) {
+        log_error("map of shared stats of %zu bytes failed: %s", size,
+                  strerror(errno));
+        return NULL;
+    }
+
+    sh->size = size;
+    sh->npool = npool;
+    sh->nserver = nserver;
+    sh->hash = hash;
+    sh->seq = 0;
+    sh->ntotal_conn = 0;
+    sh->ncurr_conn = 0;
+
+    return sh;
+}
+
+void
+stats_shared_destroy(struct stats_shared *sh)
+{
+    nc_shared_mem_free(sh, sh->size);
+}
+
+static int64_t *
+stats_shared_put_metric(int64_t *value, struct array *metric)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(metric); i++) {
+        struct stats_metric *stm = array_get(metric, i);
+
+        __atomic_store_n(value++, stm->value.counter, __ATOMIC_RELAXED);
+    }
+
+    return value;
+}
+
+static int64_t *
+stats_shared_put_latency(int64_t *value, struct array *latency)
+{
+    uint32_t i;
+
+    for (i = 0; i < NBUCKET; i++) {
+        uint64_t *bucket = array_get(latency, i);
+
+        __atomic_store_n(value++, (int64_t)*bucket, __ATOMIC_RELAXED);
+    }
+
+    return value;
+}
+
+/*
+ * Store the sum (c) of the stats of this worker for the master. The
+ * sequence is odd while the values are stored, so that the master can
+ * tell a torn copy. It is made odd from an odd value as well, in case a
+ * worker before this one died while storing.
+ */
+static void
+stats_shared_write(struct stats *st)
+{
+    struct stats_shared *sh = st->owner->shared_stats;
+    int64_t *value;
+    uint32_t seq, i, j;
+
+    ASSERT(sh->npool == array_n(&st->sum));
+
+    seq = sh->seq;
+    seq += (seq & 1) ? 2 : 1;
+    __atomic_store_n(&sh->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    value = sh->value;
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        value = stats_shared_put_metric(value, &stp->metric);
+        value = stats_shared_put_latency(value, &stp->latency);
+        value = stats_shared_put_latency(value, &stp->mirror_latency);
+
+        for (j = 0; j < array_n(&stp->server); j++) {
+            struct stats_server *sts = array_get(&stp->server, j);
+
+            value = stats_shared_put_metric(value, &sts->metric);
+            value = stats_shared_put_latency(value, &sts->latency);
+            value = stats_shared_put_latency(value, &sts->depth);
+        }
+    }
+    __atomic_store_n(&sh->ntotal_conn, (int64_t)conn_ntotal_conn(),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&sh->ncurr_conn, (int64_t)conn_ncurr_conn(),
+                     __ATOMIC_RELAXED);
+
+    __atomic_store_n(&sh->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy the stats of a worker to value, retrying while the worker stores
+ * them. Returns false if no copy was whole after STATS_SHARED_NRETRY.
+ */
+static bool
+stats_shared_read(struct stats_shared *sh, int64_t *value, size_t nvalue,
+                  int64_t *conn)
+{
+    uint32_t seq, n;
+    size_t i;
+
+    for (n = 0; n < STATS_SHARED_NRETRY; n++) {
+        seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            for (i = 0; i < nvalue; i++) {
+                value[i] = __atomic_load_n(&sh->value[i], __ATOMIC_RELAXED);
+            }
+            conn[0] = __atomic_load_n(&sh->ntotal_conn, __ATOMIC_RELAXED);
+            conn[1] = __atomic_load_n(&sh->ncurr_conn, __ATOMIC_RELAXED);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&sh->seq, __ATOMIC_RELAXED) == seq) {
+                return true;
+            }
+        }
+        sched_yield();
+    }
+
+    return false;
+}
+
+static const int64_t *
+stats_shared_add_metric(struct array *metric, const int64_t *value)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(metric); i++) {
+        struct stats_metric *stm = array_get(metric, i);
+
+        switch (stm->type) {
+        case STATS_COUNTER:
+        case STATS_GAUGE:
+            stm->value.counter += *value;
+            break;
+
+        case STATS_TIMESTAMP:
+            stm->value.timestamp = MAX(stm->value.timestamp, *value);
+            break;
+
+        default:
+            NOT_REACHED();
+        }
+        value++;
+    }
+
+    return value;
+}
+
+static const int64_t *
+stats_shared_add_latency(struct array *latency, const int64_t *value)
+{
+    uint32_t i;
+
+    for (i = 0; i < NBUCKET; i++) {
+        uint64_t *bucket = array_get(latency, i);
+
+        *bucket += (uint64_t)*value++;
+    }
+
+    return value;
+}
+
+static void
+stats_shared_add(struct stats *st, const int64_t *value)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        value = stats_shared_add_metric(&stp->metric, value);
+        value = stats_shared_add_latency(&stp->latency, value);
+        value = stats_shared_add_latency(&stp->mirror_latency, value);
+
+        for (j = 0; j < array_n(&stp->server); j++) {
+            struct stats_server *sts = array_get(&stp->server, j);
+
+            value = stats_shared_add_metric(&sts->metric, value);
+            value = stats_shared_add_latency(&sts->latency, value);
+            value = stats_shared_add_latency(&sts->depth, value);
+        }
+    }
+}
+
+/*
+ * Add up the shared stats of all workers into the sum (c) of the master.
+ * Counters, gauges and latency buckets are summed, and timestamps take the
+ * latest value. A worker of a config other than the one of the master, as
+ * when the config file changed after the last reload, is left out.
+ */
 static rstatus_t
-stats_each_shared_mem_aggregate(void *elem, void *data)
-{
-    char *shared_mem = ((struct instance *)elem)->ctx->shared_mem;
-    struct stats_buffer *buf = data;
-    size_t len = strlen(shared_mem);
-    uint8_t  *pos = buf->data + buf->len;
-    memcpy(pos, shared_mem, len);
-    buf->len += len;
-    pos[len-1] = ',';
+stats_master_aggregate(struct stats *st)
+{
+    struct array *workers = &master_nci->workers;
+    int64_t *value, conn[2];
+    uint32_t i, j, npool, nserver, hash;
+    size_t nvalue;
+
+    npool = array_n(&st->sum);
+    nserver = 0;
+    hash = 2166136261U;
+    for (i = 0; i < npool; i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        nserver += array_n(&stp->server);
+        hash = stats_shared_hash(hash, &stp->name);
+        for (j = 0; j < array_n(&stp->server); j++) {
+            struct stats_server *sts = array_get(&stp->server, j);
+
+            hash = stats_shared_hash(hash, &sts->name);
+        }
+    }
+    nvalue = stats_shared_nvalue(npool, nserver);
+
+    value = nc_alloc(sizeof(*value) * nvalue);
+    if (value == NULL) {
+        return NC_ENOMEM;
+    }
+
+    stats_pool_reset(&st->sum);
+    st->ntotal_conn = 0;
+    st->ncurr_conn = 0;
+    st->nworker = 0;
+
+    for (i = 0; i < array_n(workers); i++) {
+        struct instance *worker_nci = array_get(workers, i);
+        struct stats_shared *sh = worker_nci->ctx->shared_stats;
+
+        if (sh->npool != npool || sh->nserver != nserver ||
+            sh->hash != hash) {
+            log_warn("skip stats of worker %d with %"PRIu32" pools and "
+                     "%"PRIu32" servers of another config", worker_nci->id,
+                     sh->npool, sh->nserver);
+            continue;
+        }
+
+        if (!stats_shared_read(sh, value, nvalue, conn)) {
+            log_warn("skip stats of worker %d being written", worker_nci->id);
+            continue;
+        }
+
+        stats_shared_add(st, value);
+        st->ntotal_conn += conn[0];
+        st->ncurr_conn += conn[1];
+        st->nworker++;
+    }
+
+    nc_free(value);
+
     return NC_OK;
 }
 
 static rstatus_t
-stats_master_send_resp(struct stats *st)
+stats_master_send_rsp(struct stats *st)
 {
     rstatus_t status;
     ssize_t n;
     int sd;
-    struct stats_buffer buf;
-    buf.len=0;
-    buf.size=0;
 
-    status = array_each(&master_nci->workers, stats_each_calc_shared_mem_size, &buf.size);
-    if (status) {
-        return NC_ERROR;
+    stats_master_lock();
+    status = stats_master_aggregate(st);
+    if (status == NC_OK) {
+        status = stats_make_rsp(st);
     }
-    /* delete a "," and add "[","]","\0" */
-    buf.size+=2;
-    buf.data = nc_alloc(buf.size);
-    if (buf.data == NULL) {
-       log_error("new out buf for master to aggregate failed");
-        return NC_ERROR;
+    stats_master_unlock();
+    if (status != NC_OK) {
+        return status;
     }
 
-    buf.data[0] = '[';
-    buf.len = 1;
-    status = array_each(&master_nci->workers, stats_each_shared_mem_aggregate, &buf);
-    if (status) {
+    sd = accept(st->sd, NULL, NULL);
+    if (sd < 0) {
+        log_error("accept on m %d failed: %s", st->sd, strerror(errno));
         return NC_ERROR;
     }
-    buf.data[buf.len-1] = ']';
-    buf.data[buf.len] = 0;
 
-    sd = accept(st->sd, NULL, NULL);
-        if (sd < 0) {
-            log_error("accept on m %d failed: %s", st->sd, strerror(errno));
-            free(buf.data);
-            return NC_ERROR;
-        }
-
-    log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, buf.len);
+    log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, st->buf.len);
 
-    n = nc_sendn(sd, buf.data, buf.len);
+    n = nc_sendn(sd, st->buf.data, st->buf.len);
     if (n < 0) {
         log_error("send stats on sd %d failed: %s", sd, strerror(errno));
         close(sd);
-        free(buf.data);
         return NC_ERROR;
     }
 
     close(sd);
-    free(buf.data);
+
     return NC_OK;
-};
+}
 
 void
 stats_master_loop_callback(void *arg1, void* arg2)
@@ -1051,8 +1500,8 @@ stats_master_loop_callback(void *arg1, void* arg2)
         return;
     }
 
-    /* master aggregate worker buf to collector */
-    stats_master_send_resp(st);
+    /* send the stats of all workers added up to collector */
+    stats_master_send_rsp(st);
 }
 
 static void *
@@ -1066,18 +1515,19 @@ stats_master_loop(void *arg)
 static void *
 stats_worker_loop(void *arg)
 {
-    rstatus_t status;
     struct stats *st = arg;
+    struct timespec ts;
+
+    ts.tv_sec = st->interval / 1000;
+    ts.tv_nsec = (long)(st->interval % 1000) * 1000000L;
+
     for (;;) {
         stats_aggregate(st);
-        status = stats_make_rsp(st);
-        if (status != NC_OK) {
-            return NULL;
-        }
-        memcpy(st->owner->shared_mem, st->buf.data, st->buf.len);
-        st->owner->shared_mem[st->buf.len] = 0;
-        sleep((unsigned int)(st->interval/1000));
+        stats_shared_write(st);
+        nanosleep(&ts, NULL);
     }
+
+    return NULL;
 }
 
 static rstatus_t
@@ -1085,12 +1535,25 @@ stats_listen(struct stats *st)
 {
     rstatus_t status;
     struct sockinfo si;
+    char buf[NC_MAXHOSTNAMELEN + NC_UINTMAX_MAXLEN];
+    struct string name;
 
     status = nc_resolve(&st->addr, st->port, &si);
     if (status < 0) {
         return status;
     }
 
+    /* on a binary upgrade, take over the listener of the old binary */
+    name.data = (uint8_t *)buf;
+    name.len = (uint32_t)nc_snprintf(buf, sizeof(buf), "%.*s:%u",
+                                     st->addr.len, st->addr.data, st->port);
+    st->sd = upgrade_listener(-1, &name);
+    if (st->sd >= 0) {
+        log_debug(LOG_NOTICE, "m %d listening on '%.*s:%u' inherited", st->sd,
+                  st->addr.len, st->addr.data, st->port);
+        return NC_OK;
+    }
+
     st->sd = socket(si.family, SOCK_STREAM, 0);
     if (st->sd < 0) {
         log_error("socket failed: %s", strerror(errno));
@@ -1167,7 +1630,8 @@ stats_stop_aggregator(struct stats *st)
 
 struct stats *
 stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
-             char *source, struct array *server_pool, stats_loop_t loop)
+             char *source, struct array *server_pool, stats_loop_t loop,
+             struct context *owner)
 {
     rstatus_t status;
     struct stats *st;
@@ -1177,6 +1641,9 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
         return NULL;
     }
 
+    /* set ahead of the aggregator thread, which writes to its shared memory */
+    st->owner = owner;
+
     st->port = stats_port;
     st->interval = stats_interval;
     string_set_raw(&st->addr, stats_ip);
@@ -1212,6 +1679,11 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
 
     string_set_text(&st->ntotal_conn_str, "total_connections");
     string_set_text(&st->ncurr_conn_str, "curr_connections");
+    string_set_text(&st->nworker_str, "workers");
+
+    st->ntotal_conn = 0;
+    st->ncurr_conn = 0;
+    st->nworker = 0;
 
     st->updated = 0;
     st->aggregate = 0;
@@ -1233,9 +1705,12 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
         goto error;
     }
 
-    status = stats_create_buf(st);
-    if (status != NC_OK) {
-        goto error;
+    /* a worker hands its stats to the master in binary */
+    if (loop != NULL) {
+        status = stats_create_buf(st);
+        if (status != NC_OK) {
+            goto error;
+        }
     }
 
     status = stats_start_aggregator(st);
@@ -1265,6 +1740,42 @@ stats_destroy(struct stats *st)
     nc_free(st);
 }
 
+/*
+ * Map the stats of the master to the server pools of a reloaded config,
+ * which its workers now have. Called with the master lock held.
+ */
+rstatus_t
+stats_remap(struct stats *st, struct array *server_pool)
+{
+    rstatus_t status;
+
+    stats_pool_unmap(&st->sum);
+    stats_pool_unmap(&st->shadow);
+    stats_pool_unmap(&st->current);
+    stats_destroy_buf(st);
+
+    array_null(&st->current);
+    array_null(&st->shadow);
+    array_null(&st->sum);
+
+    status = stats_pool_map(&st->current, server_pool);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_pool_map(&st->shadow, server_pool);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_pool_map(&st->sum, server_pool);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    return stats_create_buf(st);
+}
+
 void
 stats_swap(struct stats *st)
 {
@@ -1513,6 +2024,22 @@ _stats_pool_record_latency(struct context *ctx, struct server_pool *pool, int64_
     *counter += 1;
 }
 
+void
+_stats_pool_record_mirror_latency(struct context *ctx, struct server_pool *pool,
+                                  int64_t latency)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+    uint32_t ind;
+    uint64_t *counter;
+
+    st = ctx->stats;
+    stp = array_get(&st->current, pool->idx);
+    for (ind = 0; latency > latency_buckets[ind]; ind++);
+    counter = array_get(&stp->mirror_latency, ind);
+    *counter += 1;
+}
+
 void
 _stats_server_record_latency(struct context *ctx, struct server *server, int64_t latency)
 {
@@ -1531,3 +2058,22 @@ _stats_server_record_latency(struct context *ctx, struct server *server, int64_t
     counter = array_get(&sts->latency, ind);
     *counter += 1;
 }
+
+void
+_stats_server_record_queue_depth(struct context *ctx, struct server *server, uint32_t depth)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+    struct stats_server *sts;
+    uint32_t ind, pidx, sidx;
+    uint64_t *counter;
+
+    sidx = server->idx;
+    pidx = server->owner->idx;
+    st = ctx->stats;
+    stp = array_get(&st->current, pidx);
+    sts = array_get(&stp->server, sidx);
+    for (ind = 0; (int64_t)depth > depth_buckets[ind]; ind++);
+    counter = array_get(&sts->depth, ind);
+    *counter += 1;
+}
@@ -25,8 +25,24 @@
     ACTION( client_eof,             STATS_COUNTER,      "# eof on client connections")                              \
     ACTION( client_err,             STATS_COUNTER,      "# errors on client connections")                           \
     ACTION( client_connections,     STATS_GAUGE,        "# active client connections")                              \
+    ACTION( client_throttles,       STATS_COUNTER,      "# times client reads were paused by a rate limit")         \
+    ACTION( client_throttled_msec,  STATS_COUNTER,      "total msec client reads were paused by a rate limit")      \
+    ACTION( client_idle_timeouts,   STATS_COUNTER,      "# client connections closed after client_idle_timeout")    \
+    ACTION( client_buffer_releases, STATS_COUNTER,      "# receive buffers released by quiet clients")              \
+    ACTION( client_handoffs,        STATS_COUNTER,      "# client connections handed over on reload")               \
+    ACTION( client_adoptions,       STATS_COUNTER,      "# client connections taken over on reload")                \
     /* pool behavior */                                                                                             \
     ACTION( server_ejects,          STATS_COUNTER,      "# times backend server was ejected")                       \
+    ACTION( master_failovers,       STATS_COUNTER,      "# times redis master was switched by sentinel")            \
+    ACTION( hedges,                 STATS_COUNTER,      "# hedged read requests sent to a second server")           \
+    ACTION( hedge_wins,             STATS_COUNTER,      "# hedged read requests answered first by the hedge")       \
+    ACTION( read_retries,           STATS_COUNTER,      "# read requests re-dispatched after a server failure")     \
+    ACTION( mirrors,                STATS_COUNTER,      "# requests copied to the mirror pool")                     \
+    ACTION( mirror_drops,           STATS_COUNTER,      "# mirror copies dropped instead of sent")                  \
+    ACTION( mirror_errors,          STATS_COUNTER,      "# mirror copies failed or answered with an error")         \
+    ACTION( migrate_fallbacks,      STATS_COUNTER,      "# reads re-sent to the old owner after a miss")            \
+    ACTION( migrate_fallback_hits,  STATS_COUNTER,      "# reads re-sent to the old owner that found the key")      \
+    ACTION( migrate_writebacks,     STATS_COUNTER,      "# values found on the old owner written to the new")       \
     /* forwarder behavior */                                                                                        \
     ACTION( forward_error,          STATS_COUNTER,      "# times we encountered a forwarding error")                \
     ACTION( fragments,              STATS_COUNTER,      "# fragments created from a multi-vector request")          \
@@ -37,10 +53,21 @@
     ACTION( server_err,             STATS_COUNTER,      "# errors on server connections")                           \
     ACTION( server_timedout,        STATS_COUNTER,      "# timeouts on server connections")                         \
     ACTION( server_connections,     STATS_GAUGE,        "# active server connections")                              \
+    ACTION( server_conn_share,      STATS_GAUGE,        "# server connections allowed by the budget")               \
+    ACTION( server_conn_opens,      STATS_COUNTER,      "# server connections opened")                              \
+    ACTION( server_conn_reaps,      STATS_COUNTER,      "# idle, expired or moved server connections closed")       \
+    ACTION( server_conn_reuses,     STATS_COUNTER,      "# requests and fragments sent on open server connections") \
+    ACTION( server_addr_changes,    STATS_COUNTER,      "# times a server hostname resolved to a new address")      \
+    ACTION( server_resolve_errors,  STATS_COUNTER,      "# failed server hostname lookups")                         \
     ACTION( server_ejected_at,      STATS_TIMESTAMP,    "timestamp when server was ejected in usec since epoch")    \
     /* data behavior */                                                                                             \
     ACTION( requests,               STATS_COUNTER,      "# requests")                                               \
     ACTION( request_bytes,          STATS_COUNTER,      "total request bytes")                                      \
+    ACTION( requests_expired,       STATS_COUNTER,      "# requests dropped past their deadline before being sent") \
+    ACTION( requests_shed,          STATS_COUNTER,      "# requests rejected over the admission limit")             \
+    ACTION( get_batches,            STATS_COUNTER,      "# gets merged into one multi-key get")                     \
+    ACTION( batched_gets,           STATS_COUNTER,      "# gets sent as part of a merged get")                      \
+    ACTION( admission_limit,        STATS_GAUGE,        "current adaptive limit on requests in flight")             \
     ACTION( responses,              STATS_COUNTER,      "# responses")                                              \
     ACTION( response_bytes,         STATS_COUNTER,      "total response bytes")                                     \
     ACTION( in_queue,               STATS_GAUGE,        "# requests in incoming queue")                             \
@@ -52,6 +79,8 @@
 #define STATS_PORT      22222
 #define STATS_INTERVAL  (10 * 1000) /* in msec */
 
+#define STATS_SHARED_NRETRY 1000    /* reads of the stats of a worker being stored */
+
 typedef void (*stats_loop_t)(void *, void *);
 
 typedef enum stats_type {
@@ -75,6 +104,8 @@ struct stats_server {
     struct string name;     /* server name (ref) */
     struct array  metric;   /* stats_metric[] for server codec */
     struct array  latency;  /* lantency[] for server request latency */
+    struct array  depth;    /* depth[] for connection queue depth at pick time */
+    uint32_t      nslot;    /* # worker budget slots, 0 if not budgeted */
 };
 
 struct stats_pool {
@@ -82,6 +113,7 @@ struct stats_pool {
     struct array  metric; /* stats_metric[] for pool codec */
     struct array  server; /* stats_server[] */
     struct array  latency;  /* lantency[] for server request latency */
+    struct array  mirror_latency; /* latency[] for mirror copy latency */
 };
 
 struct stats_buffer {
@@ -90,8 +122,29 @@ struct stats_buffer {
     size_t   size;  /* buffer alloc size */
 };
 
+/*
+ * Stats of a worker in memory shared with the master. Once every interval
+ * the worker stores the sum (c) of its stats here under a sequence lock,
+ * and the master adds up the stats of all workers when asked for them.
+ * The values are in the order of stats_pool[]: for every pool its metrics
+ * and its latency and mirror latency buckets, then for every server of
+ * the pool its metrics and its latency and depth buckets. The hash of the
+ * pool and server names in that order tells the master whether a worker
+ * runs its config.
+ */
+struct stats_shared {
+    size_t              size;            /* mapping size */
+    uint32_t            npool;           /* # pools */
+    uint32_t            nserver;         /* # servers of all pools */
+    uint32_t            hash;            /* hash of pool and server names */
+    uint32_t            seq;             /* sequence, odd while written */
+    int64_t             ntotal_conn;     /* total connections */
+    int64_t             ncurr_conn;      /* curr connections */
+    int64_t             value[1];        /* metric values and buckets */
+};
+
 struct stats {
-    struct context      *owner;
+    struct context      *owner;          /* owner context */
 
     uint16_t            port;            /* stats monitoring port */
     int                 interval;        /* stats aggregation interval */
@@ -119,6 +172,11 @@ struct stats {
     struct string       pid_str;         /* pid string */
     struct string       ntotal_conn_str; /* total connections string */
     struct string       ncurr_conn_str;  /* curr connections string */
+    struct string       nworker_str;     /* workers string */
+
+    int64_t             ntotal_conn;     /* total connections in response */
+    int64_t             ncurr_conn;      /* curr connections in response */
+    uint32_t            nworker;         /* # workers in response */
 
     volatile int        aggregate;       /* shadow (b) aggregate? */
     volatile int        updated;         /* current (a) updated? */
@@ -188,6 +246,14 @@ typedef enum stats_server_field {
      _stats_pool_record_latency(_ctx, _pool, _val);                 \
 } while (0)
 
+#define stats_pool_record_mirror_latency(_ctx, _pool, _val) do {    \
+     _stats_pool_record_mirror_latency(_ctx, _pool, _val);          \
+} while (0)
+
+#define stats_server_record_queue_depth(_ctx, _server, _val) do {       \
+     _stats_server_record_queue_depth(_ctx, _server, _val);             \
+} while (0)
+
 #else
 
 #define stats_pool_incr(_ctx, _pool, _name)
@@ -210,6 +276,10 @@ typedef enum stats_server_field {
 
 #define stats_pool_record_latency(_ctx, _pool, _val)
 
+#define stats_pool_record_mirror_latency(_ctx, _pool, _val)
+
+#define stats_server_record_queue_depth(_ctx, _server, _val)
+
 #endif
 
 #define stats_enabled   NC_STATS
@@ -229,13 +299,19 @@ void _stats_server_decr_by(struct context *ctx, struct server *server, stats_ser
 void _stats_server_set_ts(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 void _stats_server_record_latency(struct context *ctx, struct server *server, int64_t latency);
 void _stats_pool_record_latency(struct context *ctx, struct server_pool *pool, int64_t latency);
+void _stats_pool_record_mirror_latency(struct context *ctx, struct server_pool *pool, int64_t latency);
+void _stats_server_record_queue_depth(struct context *ctx, struct server *server, uint32_t depth);
 
-struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, struct array *server_pool, stats_loop_t loop);
+struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, struct array *server_pool, stats_loop_t loop, struct context *owner);
 void stats_destroy(struct stats *stats);
 void stats_swap(struct stats *stats);
 void stats_loop_callback(void *arg1, void *arg2);
 void stats_master_loop_callback(void *arg1, void *arg2);
-rstatus_t stats_shared_memory_init(struct stats *stats, int processes);
-void stats_shared_memory_deinit(struct stats *stats);
+rstatus_t stats_remap(struct stats *stats, struct array *server_pool);
+void stats_master_lock(void);
+void stats_master_unlock(void);
+
+struct stats_shared *stats_shared_create(struct array *server_pool);
+void stats_shared_destroy(struct stats_shared *shared);
 
 #endif
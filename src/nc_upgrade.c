@@ -0,0 +1,412 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_process.h>
+#include <nc_upgrade.h>
+
+static char **upgrade_argv;                 /* arguments to exec */
+static char upgrade_cwd[PATH_MAX];          /* working directory at start */
+static struct array upgrade_inherited;      /* struct upgrade_listener */
+static pid_t upgrade_old_master;            /* old master to terminate */
+static pid_t upgrade_new_master;            /* new master being started */
+static char *upgrade_pid_filename;          /* pid file before the upgrade */
+static char *upgrade_oldbin;                /* pid file while upgrading */
+
+/*
+ * Parse the listeners left by the old master. This runs before the log
+ * is set up, so a malformed entry is dropped without a word; its
+ * descriptor is closed by upgrade_close_unused as it is never taken.
+ */
+static void
+upgrade_parse(char *value)
+{
+    struct upgrade_listener *l;
+    char *entry, *p, *end;
+    long sd, id;
+
+    for (entry = strtok(value, ";"); entry != NULL; entry = strtok(NULL, ";")) {
+        sd = strtol(entry, &p, 10);
+        if (*p != ',' || sd < 0 || sd > INT_MAX) {
+            continue;
+        }
+
+        id = strtol(p + 1, &end, 10);
+        if (*end != ',' || end == p + 1 || id < -1 || id > INT_MAX) {
+            continue;
+        }
+        end++;
+
+        l = array_push(&upgrade_inherited);
+        if (l == NULL) {
+            return;
+        }
+        l->sd = (int)sd;
+        l->id = (int)id;
+        l->used = 0;
+        string_init(&l->addr);
+        if (string_copy(&l->addr, (uint8_t *)end,
+                        (uint32_t)strlen(end)) != NC_OK) {
+            array_pop(&upgrade_inherited);
+            return;
+        }
+    }
+}
+
+void
+upgrade_init(char **argv)
+{
+    char *value;
+
+    upgrade_argv = argv;
+    if (getcwd(upgrade_cwd, sizeof(upgrade_cwd)) == NULL) {
+        upgrade_cwd[0] = '\0';
+    }
+
+    if (array_init(&upgrade_inherited, 8, sizeof(struct upgrade_listener)) != NC_OK) {
+        array_null(&upgrade_inherited);
+    }
+
+    value = getenv(UPGRADE_ENV_LISTENERS);
+    if (value != NULL && upgrade_inherited.elem != NULL) {
+        value = strdup(value);
+        if (value != NULL) {
+            upgrade_parse(value);
+            free(value);
+        }
+    }
+
+    value = getenv(UPGRADE_ENV_PID);
+    if (value != NULL) {
+        upgrade_old_master = (pid_t)atoi(value);
+    }
+
+    /* our workers and any binary we exec later must not see them */
+    unsetenv(UPGRADE_ENV_LISTENERS);
+    unsetenv(UPGRADE_ENV_PID);
+}
+
+/*
+ * Return the inherited descriptor listening on addr for worker id, or -1
+ * to bind a new one. The listener of the same worker of the old master is
+ * preferred, so each keeps its own SO_REUSEPORT accept queue; then any
+ * listener on the address not taken yet.
+ */
+int
+upgrade_listener(int id, struct string *addr)
+{
+    struct upgrade_listener *l, *found;
+    uint32_t i, nelem;
+
+    found = NULL;
+    for (i = 0, nelem = array_n(&upgrade_inherited); i < nelem; i++) {
+        l = array_get(&upgrade_inherited, i);
+        if (l->used || string_compare(&l->addr, addr) != 0) {
+            continue;
+        }
+        if (l->id == id) {
+            found = l;
+            break;
+        }
+        if (found == NULL) {
+            found = l;
+        }
+    }
+
+    if (found == NULL) {
+        return -1;
+    }
+
+    found->used = 1;
+
+    return found->sd;
+}
+
+/*
+ * Close the inherited listeners nobody took over, as when the new config
+ * has fewer workers or dropped a pool, and forget about all of them.
+ */
+void
+upgrade_close_unused(void)
+{
+    struct upgrade_listener *l;
+    uint32_t nused;
+
+    if (upgrade_inherited.elem == NULL) {
+        return;
+    }
+
+    nused = 0;
+    while (array_n(&upgrade_inherited) > 0) {
+        l = array_pop(&upgrade_inherited);
+        if (l->used) {
+            nused++;
+        } else {
+            log_warn("closing inherited listener %d on '%.*s' not in use",
+                     l->sd, l->addr.len, l->addr.data);
+            close(l->sd);
+        }
+        string_deinit(&l->addr);
+    }
+    array_deinit(&upgrade_inherited);
+    array_null(&upgrade_inherited);
+
+    if (nused > 0) {
+        log_warn("took over %"PRIu32" listeners from the old binary", nused);
+    }
+}
+
+/*
+ * Tell the old master that we are serving, so that it shuts down.
+ */
+void
+upgrade_notify(void)
+{
+    if (upgrade_old_master <= 0) {
+        return;
+    }
+
+    log_warn("terminating the old master [%d]", upgrade_old_master);
+    if (kill(upgrade_old_master, SIGTERM) < 0) {
+        log_error("kill old master [%d] failed: %s", upgrade_old_master,
+                  strerror(errno));
+    }
+    upgrade_old_master = 0;
+}
+
+static size_t
+upgrade_append(char *buf, size_t len, size_t size, int sd, int id,
+               const char *addr, uint32_t addrlen, uint32_t port)
+{
+    int n;
+
+    if (port != 0) {
+        n = nc_snprintf(buf + len, size - len, "%d,%d,%.*s:%"PRIu32";", sd, id,
+                        addrlen, addr, port);
+    } else {
+        n = nc_snprintf(buf + len, size - len, "%d,%d,%.*s;", sd, id,
+                        addrlen, addr);
+    }
+
+    return len + (size_t)n;
+}
+
+/* describe the listeners of all workers and of stats, as upgrade_parse reads them */
+static char *
+upgrade_listeners(struct instance *nci)
+{
+    struct instance *worker_nci;
+    struct server_pool *pool;
+    struct stats *st;
+    uint32_t i, j, nworker, npool;
+    size_t len, size;
+    char *buf;
+
+    size = 64;
+    for (i = 0, nworker = array_n(&nci->workers); i < nworker; i++) {
+        worker_nci = array_get(&nci->workers, i);
+        for (j = 0, npool = array_n(&worker_nci->ctx->pool); j < npool; j++) {
+            pool = array_get(&worker_nci->ctx->pool, j);
+            size += pool->addrstr.len + 2 * NC_UINTMAX_MAXLEN;
+        }
+    }
+    st = nci->ctx->stats;
+    if (st != NULL) {
+        size += st->addr.len + 3 * NC_UINTMAX_MAXLEN;
+    }
+
+    buf = nc_alloc(size);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    len = 0;
+    buf[0] = '\0';
+    for (i = 0; i < nworker; i++) {
+        worker_nci = array_get(&nci->workers, i);
+        for (j = 0, npool = array_n(&worker_nci->ctx->pool); j < npool; j++) {
+            pool = array_get(&worker_nci->ctx->pool, j);
+            if (pool->p_conn == NULL || pool->p_conn->sd < 0) {
+                continue;
+            }
+            len = upgrade_append(buf, len, size, pool->p_conn->sd,
+                                 worker_nci->id, (char *)pool->addrstr.data,
+                                 pool->addrstr.len, 0);
+        }
+    }
+    if (st != NULL && st->sd >= 0) {
+        len = upgrade_append(buf, len, size, st->sd, -1, (char *)st->addr.data,
+                             st->addr.len, st->port);
+    }
+
+    return buf;
+}
+
+static bool
+upgrade_inherits(const char *listeners, int fd)
+{
+    const char *p;
+
+    for (p = listeners; p != NULL && *p != '\0'; p = strchr(p, ';')) {
+        if (*p == ';') {
+            p++;
+        }
+        if (atoi(p) == fd) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* in the child: exec the binary, keeping only stdio and the listeners */
+static void
+upgrade_exec_child(const char *listeners)
+{
+    long fd, maxfd;
+
+    if (upgrade_cwd[0] != '\0' && chdir(upgrade_cwd) < 0) {
+        _exit(1);
+    }
+
+    maxfd = sysconf(_SC_OPEN_MAX);
+    for (fd = STDERR_FILENO + 1; fd < maxfd; fd++) {
+        if (!upgrade_inherits(listeners, (int)fd)) {
+            close((int)fd);
+        }
+    }
+
+    execvp(upgrade_argv[0], upgrade_argv);
+    _exit(1);
+}
+
+/*
+ * Start the new binary. The pid file moves aside to pid_filename.oldbin,
+ * where the new master does not overwrite it, and from where we remove it
+ * on exit; it moves back if the new binary fails to start.
+ */
+void
+upgrade_exec(struct instance *nci)
+{
+    char *listeners, pid[NC_UINTMAX_MAXLEN];
+    size_t len;
+    pid_t new_master;
+
+    if (upgrade_new_master > 0) {
+        log_warn("new binary [%d] is being started, ignored",
+                 upgrade_new_master);
+        return;
+    }
+
+    listeners = upgrade_listeners(nci);
+    if (listeners == NULL) {
+        return;
+    }
+
+    /* the pid file is aside already if a daemonized new master went away */
+    if (nci->pid_filename != NULL && upgrade_pid_filename == NULL) {
+        if (upgrade_oldbin != NULL) {
+            nc_free(upgrade_oldbin);
+        }
+        len = strlen(nci->pid_filename) + sizeof(UPGRADE_PID_SUFFIX);
+        upgrade_oldbin = nc_alloc(len);
+        if (upgrade_oldbin == NULL) {
+            nc_free(listeners);
+            return;
+        }
+        nc_snprintf(upgrade_oldbin, len, "%s%s", nci->pid_filename,
+                    UPGRADE_PID_SUFFIX);
+
+        if (rename(nci->pid_filename, upgrade_oldbin) < 0) {
+            log_error("rename of pid file '%s' to '%s' failed: %s",
+                      nci->pid_filename, upgrade_oldbin, strerror(errno));
+            nc_free(listeners);
+            return;
+        }
+        upgrade_pid_filename = nci->pid_filename;
+        nci->pid_filename = upgrade_oldbin;
+    }
+
+    nc_snprintf(pid, sizeof(pid), "%d", nci->pid);
+    if (setenv(UPGRADE_ENV_LISTENERS, listeners, 1) < 0 ||
+        setenv(UPGRADE_ENV_PID, pid, 1) < 0) {
+        log_error("setenv failed: %s", strerror(errno));
+        new_master = -1;
+    } else {
+        new_master = fork();
+    }
+
+    switch (new_master) {
+    case -1:
+        log_error("binary upgrade failed: %s", strerror(errno));
+        upgrade_reaped(-1, 0);
+        break;
+
+    case 0:
+        upgrade_exec_child(listeners);
+        break;
+
+    default:
+        log_warn("starting new binary '%s' [%d] with listeners '%s'",
+                 upgrade_argv[0], new_master, listeners);
+        upgrade_new_master = new_master;
+        break;
+    }
+
+    unsetenv(UPGRADE_ENV_LISTENERS);
+    unsetenv(UPGRADE_ENV_PID);
+    nc_free(listeners);
+}
+
+/*
+ * Called on every child the master reaps; returns true when it was the
+ * new master. A zero exit status is the new master daemonizing; anything
+ * else means it failed to start, so we move our pid file back and keep
+ * serving. Called with pid -1 when the new master could not be forked.
+ */
+bool
+upgrade_reaped(pid_t pid, int status)
+{
+    if (pid != -1 && (upgrade_new_master <= 0 || pid != upgrade_new_master)) {
+        return false;
+    }
+
+    upgrade_new_master = 0;
+    if (pid != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return true;
+    }
+
+    log_warn("new binary [%d] failed to start, upgrade aborted", pid);
+    if (upgrade_pid_filename != NULL) {
+        if (rename(master_nci->pid_filename, upgrade_pid_filename) < 0) {
+            log_error("rename of pid file '%s' to '%s' failed: %s",
+                      master_nci->pid_filename, upgrade_pid_filename,
+                      strerror(errno));
+        }
+        master_nci->pid_filename = upgrade_pid_filename;
+        upgrade_pid_filename = NULL;
+    }
+
+    return true;
+}
@@ -0,0 +1,53 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_UPGRADE_H_
+#define _NC_UPGRADE_H_
+
+#include <nc_core.h>
+
+#define UPGRADE_ENV_LISTENERS   "NC_INHERIT"        /* listeners handed over */
+#define UPGRADE_ENV_PID         "NC_INHERIT_PID"    /* pid of the old master */
+#define UPGRADE_PID_SUFFIX      ".oldbin"
+
+/*
+ * A binary upgrade replaces a running nutcracker with a new binary,
+ * without closing its listening sockets. On SIGUSR2 the master forks and
+ * execs the binary it was started with (now the new one) with the same
+ * arguments, and leaves it the descriptors of the proxy and stats
+ * listeners, described in the environment as "fd,id,addr;..." where id
+ * is the worker the listener belongs to. The new master takes these over
+ * in place of binding new sockets (see upgrade_listener), so the kernel
+ * accept queues are never closed, and once its workers are spawned it
+ * sends SIGTERM to the old master, which shuts its workers down
+ * gracefully. Until then old and new workers accept side by side.
+ */
+struct upgrade_listener {
+    int           sd;       /* inherited descriptor */
+    int           id;       /* worker id in the old master */
+    struct string addr;     /* listen address (owned) */
+    unsigned      used:1;   /* taken over? */
+};
+
+void upgrade_init(char **argv);
+int upgrade_listener(int id, struct string *addr);
+void upgrade_close_unused(void);
+void upgrade_notify(void);
+void upgrade_exec(struct instance *nci);
+bool upgrade_reaped(pid_t pid, int status);
+
+#endif
@@ -495,6 +495,70 @@ nc_msec_now(void)
     return nc_usec_now() / 1000LL;
 }
 
+void
+token_bucket_init(struct token_bucket *tb, int64_t rate)
+{
+    tb->rate = rate;
+    tb->tokens = rate;
+    tb->last = nc_usec_now();
+}
+
+static void
+token_bucket_refill(struct token_bucket *tb, int64_t now)
+{
+    int64_t elapsed, n;
+
+    elapsed = now - tb->last;
+    if (elapsed >= 1000000LL) {
+        tb->tokens = tb->rate;
+        tb->last = now;
+        return;
+    }
+
+    n = elapsed * tb->rate / 1000000LL;
+    if (n <= 0) {
+        return;
+    }
+
+    if (tb->tokens + n >= tb->rate) {
+        tb->tokens = tb->rate;
+        tb->last = now;
+        return;
+    }
+
+    /* only advance by the time worth the tokens, to not lose fractions */
+    tb->tokens += n;
+    tb->last += n * 1000000LL / tb->rate;
+}
+
+void
+token_bucket_take(struct token_bucket *tb, int64_t n)
+{
+    if (tb->rate > 0) {
+        token_bucket_refill(tb, nc_usec_now());
+        tb->tokens -= n;
+    }
+}
+
+/*
+ * Return the time in usec until the bucket has tokens again, or 0 if it
+ * has tokens now
+ */
+int64_t
+token_bucket_wait(struct token_bucket *tb, int64_t now)
+{
+    if (tb->rate <= 0 || tb->tokens > 0) {
+        return 0;
+    }
+
+    token_bucket_refill(tb, now);
+    if (tb->tokens > 0) {
+        return 0;
+    }
+
+    return MAX((1 - tb->tokens) * 1000000LL / tb->rate - (now - tb->last), 1);
+}
+
 static int
 nc_resolve_inet(struct string *name, int port, struct sockinfo *si)
 {
@@ -197,6 +197,21 @@ int _vscnprintf(char *buf, size_t size, const char *fmt, va_list args);
 int64_t nc_usec_now(void);
 int64_t nc_msec_now(void);
 
+/*
+ * Token bucket refilled at rate tokens per sec and holding at most one
+ * second worth of tokens. A take may overdraw the bucket, leaving it in
+ * debt until enough tokens are refilled.
+ */
+struct token_bucket {
+    int64_t rate;   /* tokens per sec (0 = unlimited) */
+    int64_t tokens; /* available tokens, negative when in debt */
+    int64_t last;   /* last refill time in usec */
+};
+
+void token_bucket_init(struct token_bucket *tb, int64_t rate);
+void token_bucket_take(struct token_bucket *tb, int64_t n);
+int64_t token_bucket_wait(struct token_bucket *tb, int64_t now);
+
 /*
  * Address resolution for internet (ipv4 and ipv6) and unix domain
  * socket address.
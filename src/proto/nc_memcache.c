@@ -73,12 +73,53 @@ memcache_cas(struct msg *r)
  * Return true, if the memcache command is a retrieval command, otherwise
  * return false
  */
-static bool
+bool
 memcache_retrieval(struct msg *r)
 {
     switch (r->type) {
     case MSG_REQ_MC_GET:
     case MSG_REQ_MC_GETS:
+    case MSG_REQ_MCB_GET:
+        return true;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Return true, if the memcache response to a retrieval command found none
+ * of its keys, otherwise return false
+ */
+bool
+memcache_miss(struct msg *r)
+{
+    struct mbuf *mbuf;
+
+    if (r->type != MSG_RSP_MC_END || r->end == NULL) {
+        return false;
+    }
+
+    /* a hit is "VALUE ... END"; a miss carries nothing before END */
+    mbuf = STAILQ_FIRST(&r->mhdr);
+
+    return mbuf != NULL && r->end == mbuf->start;
+}
+
+/*
+ * Return true, if the memcache response is an error response, otherwise
+ * return false
+ */
+bool
+memcache_error(struct msg *r)
+{
+    switch (r->type) {
+    case MSG_RSP_MC_ERROR:
+    case MSG_RSP_MC_CLIENT_ERROR:
+    case MSG_RSP_MC_SERVER_ERROR:
+    case MSG_RSP_MCB_ERROR:
         return true;
 
     default:
@@ -135,6 +176,54 @@ memcache_touch(struct msg *r)
     return false;
 }
 
+/*
+ * Return true, if the memcache command is a meta command on a key, which
+ * is followed by flags, otherwise return false
+ */
+static bool
+memcache_meta(struct msg *r)
+{
+    switch (r->type) {
+    case MSG_REQ_MC_MG:
+    case MSG_REQ_MC_MS:
+    case MSG_REQ_MC_MD:
+    case MSG_REQ_MC_MA:
+        return true;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Return true, if response r is one that the server leaves out for meta
+ * request pr in quiet mode, otherwise return false. Like memcached, a
+ * quiet mg leaves out misses, a quiet md misses and successes and other
+ * quiet meta commands successes.
+ */
+static bool
+memcache_quiet(struct msg *pr, struct msg *r)
+{
+    switch (pr->type) {
+    case MSG_REQ_MC_MG:
+        return r->type == MSG_RSP_MC_EN;
+
+    case MSG_REQ_MC_MD:
+        return r->type == MSG_RSP_MC_HD || r->type == MSG_RSP_MC_NF;
+
+    case MSG_REQ_MC_MS:
+    case MSG_REQ_MC_MA:
+        return r->type == MSG_RSP_MC_HD;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
 void
 memcache_parse_req(struct msg *r)
 {
@@ -163,6 +252,7 @@ memcache_parse_req(struct msg *r)
         SW_CRLF,
         SW_NOREPLY,
         SW_AFTER_NOREPLY,
+        SW_META_FLAGS,
         SW_ALMOST_DONE,
         SW_SENTINEL
     } state;
@@ -210,6 +300,36 @@ memcache_parse_req(struct msg *r)
 
                 switch (p - m) {
 
+                case 2:
+                    if (str2cmp(m, 'm', 'g')) {
+                        r->type = MSG_REQ_MC_MG;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 's')) {
+                        r->type = MSG_REQ_MC_MS;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'd')) {
+                        r->type = MSG_REQ_MC_MD;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'a')) {
+                        r->type = MSG_REQ_MC_MA;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'n')) {
+                        /* ends a pipeline, we answer it in order */
+                        r->type = MSG_REQ_MC_MN;
+                        r->noforward = 1;
+                        break;
+                    }
+
+                    break;
+
                 case 3:
                     if (str4cmp(m, 'g', 'e', 't', ' ')) {
                         r->type = MSG_REQ_MC_GET;
@@ -305,6 +425,10 @@ memcache_parse_req(struct msg *r)
                 case MSG_REQ_MC_INCR:
                 case MSG_REQ_MC_DECR:
                 case MSG_REQ_MC_TOUCH:
+                case MSG_REQ_MC_MG:
+                case MSG_REQ_MC_MS:
+                case MSG_REQ_MC_MD:
+                case MSG_REQ_MC_MA:
                     if (ch == CR) {
                         goto error;
                     }
@@ -312,6 +436,7 @@ memcache_parse_req(struct msg *r)
                     break;
 
                 case MSG_REQ_MC_QUIT:
+                case MSG_REQ_MC_MN:
                     p = p - 1; /* go back by 1 byte */
                     state = SW_CRLF;
                     break;
@@ -367,7 +492,11 @@ memcache_parse_req(struct msg *r)
                 r->token = NULL;
 
                 /* get next state */
-                if (memcache_storage(r)) {
+                if (r->type == MSG_REQ_MC_MS) {
+                    state = SW_SPACES_BEFORE_VLEN;
+                } else if (memcache_meta(r)) {
+                    state = SW_META_FLAGS;
+                } else if (memcache_storage(r)) {
                     state = SW_SPACES_BEFORE_FLAGS;
                 } else if (memcache_arithmetic(r) || memcache_touch(r) ) {
                     state = SW_SPACES_BEFORE_NUM;
@@ -380,7 +509,8 @@ memcache_parse_req(struct msg *r)
                 }
 
                 if (ch == CR) {
-                    if (memcache_storage(r) || memcache_arithmetic(r)) {
+                    if (memcache_storage(r) || memcache_arithmetic(r) ||
+                        r->type == MSG_REQ_MC_MS) {
                         goto error;
                     }
                     p = p - 1; /* go back by 1 byte */
@@ -486,7 +616,7 @@ memcache_parse_req(struct msg *r)
                 /* vlen_end <- p - 1 */
                 p = p - 1; /* go back by 1 byte */
                 r->token = NULL;
-                state = SW_RUNTO_CRLF;
+                state = memcache_meta(r) ? SW_META_FLAGS : SW_RUNTO_CRLF;
             } else {
                 goto error;
             }
@@ -652,6 +782,46 @@ memcache_parse_req(struct msg *r)
 
             break;
 
+        case SW_META_FLAGS:
+            switch (ch) {
+            case ' ':
+            case CR:
+                if (r->token != NULL) {
+                    /* flag_end <- p - 1 */
+                    if ((p - r->token) == 1 && *r->token == 'q') {
+                        /*
+                         * The server answers a quiet request like any
+                         * other, so that responses still pair with
+                         * requests; we drop the responses it would have
+                         * left out instead
+                         */
+                        r->quiet = 1;
+                        *r->token = ' ';
+                    }
+                    r->token = NULL;
+                }
+
+                if (ch == CR) {
+                    if (r->type == MSG_REQ_MC_MS) {
+                        state = SW_RUNTO_VAL;
+                    } else {
+                        state = SW_ALMOST_DONE;
+                    }
+                }
+
+                break;
+
+            default:
+                if (r->token == NULL) {
+                    /* flag_start <- p */
+                    r->token = p;
+                }
+
+                break;
+            }
+
+            break;
+
         case SW_CRLF:
             switch (ch) {
             case ' ':
@@ -835,6 +1005,44 @@ memcache_parse_rsp(struct msg *r)
                 r->type = MSG_UNKNOWN;
 
                 switch (p - m) {
+                case 2:
+                    if (str2cmp(m, 'V', 'A')) {
+                        r->type = MSG_RSP_MC_VA;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'H', 'D')) {
+                        r->type = MSG_RSP_MC_HD;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'E', 'N')) {
+                        r->type = MSG_RSP_MC_EN;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'N', 'S')) {
+                        r->type = MSG_RSP_MC_NS;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'E', 'X')) {
+                        r->type = MSG_RSP_MC_EX;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'N', 'F')) {
+                        r->type = MSG_RSP_MC_NF;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'M', 'N')) {
+                        r->type = MSG_RSP_MC_MN;
+                        break;
+                    }
+
+                    break;
+
                 case 3:
                     if (str4cmp(m, 'E', 'N', 'D', '\r')) {
                         r->type = MSG_RSP_MC_END;
@@ -948,6 +1156,20 @@ memcache_parse_rsp(struct msg *r)
                     state = SW_RUNTO_CRLF;
                     break;
 
+                case MSG_RSP_MC_VA:
+                    state = SW_SPACES_BEFORE_VLEN;
+                    break;
+
+                case MSG_RSP_MC_HD:
+                case MSG_RSP_MC_EN:
+                case MSG_RSP_MC_NS:
+                case MSG_RSP_MC_EX:
+                case MSG_RSP_MC_NF:
+                case MSG_RSP_MC_MN:
+                    /* meta flags run to crlf */
+                    state = SW_RUNTO_CRLF;
+                    break;
+
                 default:
                     NOT_REACHED();
                 }
@@ -1068,6 +1290,10 @@ memcache_parse_rsp(struct msg *r)
         case SW_VAL_LF:
             switch (ch) {
             case LF:
+                if (r->type == MSG_RSP_MC_VA) {
+                    /* a meta value is not followed by END */
+                    goto done;
+                }
                 /* state = SW_END; */
                 state = SW_RSP_STR;
                 break;
@@ -1108,7 +1334,7 @@ memcache_parse_rsp(struct msg *r)
         case SW_RUNTO_CRLF:
             switch (ch) {
             case CR:
-                if (r->type == MSG_RSP_MC_VALUE) {
+                if (r->type == MSG_RSP_MC_VALUE || r->type == MSG_RSP_MC_VA) {
                     state = SW_RUNTO_VAL;
                 } else {
                     state = SW_ALMOST_DONE;
@@ -1356,6 +1582,19 @@ memcache_pre_coalesce(struct msg *r)
     ASSERT(!r->request);
     ASSERT(pr->request);
 
+    if (pr->quiet && memcache_quiet(pr, r)) {
+        /*
+         * The q flag was stripped before forwarding, so the server
+         * answered; drop the response it would have left out
+         */
+        STAILQ_FOREACH(mbuf, &r->mhdr, next) {
+            r->mlen -= mbuf_length(mbuf);
+            mbuf_rewind(mbuf);
+        }
+        ASSERT(r->mlen == 0);
+        return;
+    }
+
     if (pr->frag_id == 0) {
         /* do nothing, if not a response to a fragmented request */
         return;
@@ -1535,6 +1774,163 @@ memcache_post_coalesce(struct msg *request)
     }
 }
 
+/*
+ * Build r into a 'get' of the keys of the single-key gets r->batch_seq,
+ * to send them to their server as one request
+ */
+rstatus_t
+memcache_batch(struct msg *r)
+{
+    struct msg *req;
+    struct keypos *kpos;
+    uint32_t i;
+    rstatus_t status;
+
+    ASSERT(r->request && r->nbatch != 0);
+
+    status = msg_append(r, (uint8_t *)"get ", 4);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < r->nbatch; i++) {
+        req = r->batch_seq[i];
+        ASSERT(req->type == MSG_REQ_MC_GET && array_n(req->keys) == 1);
+
+        kpos = array_get(req->keys, 0);
+        status = memcache_append_key(r, kpos->start,
+                                     (uint32_t)(kpos->end - kpos->start));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    status = msg_append(r, (uint8_t *)CRLF, CRLF_LEN);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    r->type = MSG_REQ_MC_GET;
+
+    return NC_OK;
+}
+
+/*
+ * Return true if the next value in response r is the value of key kpos.
+ * Like memcache_copy_bulk, we rely on the 'VALUE key' header being in
+ * a contiguous region of the first mbuf.
+ */
+static bool
+memcache_value_of(struct msg *r, struct keypos *kpos)
+{
+    struct mbuf *mbuf;
+    uint8_t *p;
+    size_t keylen;
+
+    for (mbuf = STAILQ_FIRST(&r->mhdr);
+         mbuf != NULL && mbuf_empty(mbuf);
+         mbuf = STAILQ_NEXT(mbuf, next)) {
+        ;
+    }
+    if (mbuf == NULL) {
+        return false;
+    }
+
+    p = mbuf->pos;
+    keylen = (size_t)(kpos->end - kpos->start);
+    if ((size_t)(mbuf->last - p) <= sizeof("VALUE ") - 1 + keylen) {
+        return false;
+    }
+
+    return nc_strncmp(p, "VALUE ", sizeof("VALUE ") - 1) == 0 &&
+           memcmp(p + sizeof("VALUE ") - 1, kpos->start, keylen) == 0 &&
+           p[sizeof("VALUE ") - 1 + keylen] == ' ';
+}
+
+/*
+ * Split the reply rsp to the 'get' r built by memcache_batch into the
+ * reply of each of its gets and link them. The values of the keys that
+ * hit come in the order of the keys. An error reply is copied to every
+ * get.
+ */
+rstatus_t
+memcache_unbatch(struct msg *r, struct msg *rsp)
+{
+    struct msg *req, *sub_rsp;
+    struct mbuf *mbuf;
+    uint32_t i;
+    rstatus_t status;
+
+    ASSERT(r->request && r->nbatch != 0);
+    ASSERT(!rsp->request && rsp->peer == NULL);
+
+    if (rsp->type == MSG_RSP_MC_VALUE || rsp->type == MSG_RSP_MC_END) {
+        /* drop the end marker, see memcache_pre_coalesce */
+        ASSERT(rsp->end != NULL);
+
+        for (;;) {
+            mbuf = STAILQ_LAST(&rsp->mhdr, mbuf, next);
+            ASSERT(mbuf != NULL);
+
+            if (rsp->end >= mbuf->pos && rsp->end < mbuf->last) {
+                rsp->mlen -= (uint32_t)(mbuf->last - rsp->end);
+                mbuf->last = rsp->end;
+                break;
+            }
+
+            rsp->mlen -= mbuf_length(mbuf);
+            mbuf_remove(&rsp->mhdr, mbuf);
+            mbuf_put(mbuf);
+        }
+    } else if (!memcache_error(rsp)) {
+        return NC_ERROR;
+    }
+
+    for (i = 0; i < r->nbatch; i++) {
+        req = r->batch_seq[i];
+
+        sub_rsp = msg_get(rsp->owner, false, false);
+        if (sub_rsp == NULL) {
+            return NC_ENOMEM;
+        }
+
+        status = NC_OK;
+        if (memcache_error(rsp)) {
+            sub_rsp->type = rsp->type;
+            STAILQ_FOREACH(mbuf, &rsp->mhdr, next) {
+                status = msg_append(sub_rsp, mbuf->pos, mbuf_length(mbuf));
+                if (status != NC_OK) {
+                    break;
+                }
+            }
+        } else {
+            if (memcache_value_of(rsp, array_get(req->keys, 0))) {
+                sub_rsp->type = MSG_RSP_MC_VALUE;
+                status = memcache_copy_bulk(sub_rsp, rsp);
+            } else {
+                sub_rsp->type = MSG_RSP_MC_END;
+            }
+            if (status == NC_OK) {
+                status = msg_append(sub_rsp, (uint8_t *)"END\r\n", 5);
+            }
+            if (status == NC_OK) {
+                /* end marker, as set by the parser */
+                mbuf = STAILQ_LAST(&sub_rsp->mhdr, mbuf, next);
+                sub_rsp->end = mbuf->last - 5;
+            }
+        }
+        if (status != NC_OK) {
+            msg_put(sub_rsp);
+            return status;
+        }
+
+        req->peer = sub_rsp;
+        sub_rsp->peer = req;
+    }
+
+    return NC_OK;
+}
+
 void
 memcache_post_connect(struct context *ctx, struct conn *conn, struct server *server)
 {
@@ -1555,7 +1951,18 @@ memcache_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
 rstatus_t
 memcache_reply(struct msg *r)
 {
-    NOT_REACHED();
-    return NC_OK;
+    struct msg *response = r->peer;
+
+    ASSERT(response != NULL);
+
+    switch (r->type) {
+    case MSG_REQ_MC_MN:
+        /* every earlier response is sent before this one */
+        return msg_append(response, (uint8_t *)"MN\r\n", 4);
+
+    default:
+        NOT_REACHED();
+        return NC_ERROR;
+    }
 }
 
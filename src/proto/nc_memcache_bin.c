@@ -0,0 +1,875 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_proto.h>
+
+/*
+ * From memcache binary protocol specification:
+ *
+ * Every request and response starts with a 24 byte header, followed by
+ * the extras, the key and the value. The header carries the length of
+ * the extras, of the key and of the whole body, so a packet is framed
+ * without looking at its body.
+ *
+ *   byte 0      magic (0x80 request, 0x81 response)
+ *   byte 1      opcode
+ *   byte 2-3    key length
+ *   byte 4      extras length
+ *   byte 5      data type
+ *   byte 6-7    vbucket id (request) or status (response)
+ *   byte 8-11   total body length
+ *   byte 12-15  opaque, echoed back in the response
+ *   byte 16-23  cas
+ *
+ * All numbers are in network byte order. Quiet commands only respond on
+ * an error, and quiet gets only on a hit, so a client sends a run of
+ * quiet gets ended by a noop or a get to learn that the run is done.
+ */
+#define MEMCACHE_BIN_HEADER_LEN     24
+#define MEMCACHE_BIN_REQ_MAGIC      0x80
+#define MEMCACHE_BIN_RSP_MAGIC      0x81
+#define MEMCACHE_BIN_MAX_KEY_LENGTH 250
+
+#define MEMCACHE_BIN_GET            0x00
+#define MEMCACHE_BIN_SET            0x01
+#define MEMCACHE_BIN_ADD            0x02
+#define MEMCACHE_BIN_REPLACE        0x03
+#define MEMCACHE_BIN_DELETE         0x04
+#define MEMCACHE_BIN_INCR           0x05
+#define MEMCACHE_BIN_DECR           0x06
+#define MEMCACHE_BIN_QUIT           0x07
+#define MEMCACHE_BIN_GETQ           0x09
+#define MEMCACHE_BIN_NOOP           0x0a
+#define MEMCACHE_BIN_GETK           0x0c
+#define MEMCACHE_BIN_GETKQ          0x0d
+#define MEMCACHE_BIN_APPEND         0x0e
+#define MEMCACHE_BIN_PREPEND        0x0f
+#define MEMCACHE_BIN_SETQ           0x11
+#define MEMCACHE_BIN_ADDQ           0x12
+#define MEMCACHE_BIN_REPLACEQ       0x13
+#define MEMCACHE_BIN_DELETEQ        0x14
+#define MEMCACHE_BIN_INCRQ          0x15
+#define MEMCACHE_BIN_DECRQ          0x16
+#define MEMCACHE_BIN_QUITQ          0x17
+#define MEMCACHE_BIN_APPENDQ        0x19
+#define MEMCACHE_BIN_PREPENDQ       0x1a
+#define MEMCACHE_BIN_TOUCH          0x1c
+#define MEMCACHE_BIN_GAT            0x1d
+#define MEMCACHE_BIN_GATQ           0x1e
+#define MEMCACHE_BIN_GATK           0x23
+#define MEMCACHE_BIN_GATKQ          0x24
+
+#define MEMCACHE_BIN_STATUS_OK          0x0000
+#define MEMCACHE_BIN_STATUS_NOT_FOUND   0x0001
+#define MEMCACHE_BIN_STATUS_EXISTS      0x0002
+#define MEMCACHE_BIN_STATUS_NOT_STORED  0x0005
+#define MEMCACHE_BIN_STATUS_ENOMEM      0x0082
+#define MEMCACHE_BIN_STATUS_EINTERNAL   0x0084
+
+struct memcache_bin_command {
+    msg_type_t type;    /* request type */
+    uint8_t    extlen;  /* length of the extras */
+    uint8_t    loud;    /* opcode of the variant that always responds */
+    unsigned   quiet:1; /* responds only on error, or a get on a hit */
+};
+
+/*
+ * Supported commands by opcode; every other opcode is rejected. A quiet
+ * command other than a get is sent as its loud variant, and the response
+ * the client did not ask for is dropped in memcache_bin_pre_coalesce.
+ */
+static const struct memcache_bin_command memcache_bin_commands[256] = {
+    [MEMCACHE_BIN_GET]      = { MSG_REQ_MCB_GET,     0,  MEMCACHE_BIN_GET,     0 },
+    [MEMCACHE_BIN_GETK]     = { MSG_REQ_MCB_GET,     0,  MEMCACHE_BIN_GETK,    0 },
+    [MEMCACHE_BIN_GETQ]     = { MSG_REQ_MCB_GET,     0,  MEMCACHE_BIN_GETQ,    1 },
+    [MEMCACHE_BIN_GETKQ]    = { MSG_REQ_MCB_GET,     0,  MEMCACHE_BIN_GETKQ,   1 },
+    [MEMCACHE_BIN_SET]      = { MSG_REQ_MCB_SET,     8,  MEMCACHE_BIN_SET,     0 },
+    [MEMCACHE_BIN_SETQ]     = { MSG_REQ_MCB_SET,     8,  MEMCACHE_BIN_SET,     1 },
+    [MEMCACHE_BIN_ADD]      = { MSG_REQ_MCB_ADD,     8,  MEMCACHE_BIN_ADD,     0 },
+    [MEMCACHE_BIN_ADDQ]     = { MSG_REQ_MCB_ADD,     8,  MEMCACHE_BIN_ADD,     1 },
+    [MEMCACHE_BIN_REPLACE]  = { MSG_REQ_MCB_REPLACE, 8,  MEMCACHE_BIN_REPLACE, 0 },
+    [MEMCACHE_BIN_REPLACEQ] = { MSG_REQ_MCB_REPLACE, 8,  MEMCACHE_BIN_REPLACE, 1 },
+    [MEMCACHE_BIN_APPEND]   = { MSG_REQ_MCB_APPEND,  0,  MEMCACHE_BIN_APPEND,  0 },
+    [MEMCACHE_BIN_APPENDQ]  = { MSG_REQ_MCB_APPEND,  0,  MEMCACHE_BIN_APPEND,  1 },
+    [MEMCACHE_BIN_PREPEND]  = { MSG_REQ_MCB_PREPEND, 0,  MEMCACHE_BIN_PREPEND, 0 },
+    [MEMCACHE_BIN_PREPENDQ] = { MSG_REQ_MCB_PREPEND, 0,  MEMCACHE_BIN_PREPEND, 1 },
+    [MEMCACHE_BIN_DELETE]   = { MSG_REQ_MCB_DELETE,  0,  MEMCACHE_BIN_DELETE,  0 },
+    [MEMCACHE_BIN_DELETEQ]  = { MSG_REQ_MCB_DELETE,  0,  MEMCACHE_BIN_DELETE,  1 },
+    [MEMCACHE_BIN_INCR]     = { MSG_REQ_MCB_INCR,    20, MEMCACHE_BIN_INCR,    0 },
+    [MEMCACHE_BIN_INCRQ]    = { MSG_REQ_MCB_INCR,    20, MEMCACHE_BIN_INCR,    1 },
+    [MEMCACHE_BIN_DECR]     = { MSG_REQ_MCB_DECR,    20, MEMCACHE_BIN_DECR,    0 },
+    [MEMCACHE_BIN_DECRQ]    = { MSG_REQ_MCB_DECR,    20, MEMCACHE_BIN_DECR,    1 },
+    [MEMCACHE_BIN_TOUCH]    = { MSG_REQ_MCB_TOUCH,   4,  MEMCACHE_BIN_TOUCH,   0 },
+    [MEMCACHE_BIN_GAT]      = { MSG_REQ_MCB_GAT,     4,  MEMCACHE_BIN_GAT,     0 },
+    [MEMCACHE_BIN_GATQ]     = { MSG_REQ_MCB_GAT,     4,  MEMCACHE_BIN_GAT,     1 },
+    [MEMCACHE_BIN_GATK]     = { MSG_REQ_MCB_GAT,     4,  MEMCACHE_BIN_GATK,    0 },
+    [MEMCACHE_BIN_GATKQ]    = { MSG_REQ_MCB_GAT,     4,  MEMCACHE_BIN_GATK,    1 },
+    [MEMCACHE_BIN_NOOP]     = { MSG_REQ_MCB_NOOP,    0,  MEMCACHE_BIN_NOOP,    0 },
+    [MEMCACHE_BIN_QUIT]     = { MSG_REQ_MCB_QUIT,    0,  MEMCACHE_BIN_QUIT,    0 },
+    [MEMCACHE_BIN_QUITQ]    = { MSG_REQ_MCB_QUIT,    0,  MEMCACHE_BIN_QUIT,    1 },
+};
+
+/* noop that ends a fragment of a run of quiet gets */
+static uint8_t memcache_bin_noop[MEMCACHE_BIN_HEADER_LEN] = {
+    MEMCACHE_BIN_REQ_MAGIC, MEMCACHE_BIN_NOOP
+};
+
+static uint32_t
+memcache_bin_read16(uint8_t *p)
+{
+    return ((uint32_t)p[0] << 8) | (uint32_t)p[1];
+}
+
+static uint32_t
+memcache_bin_read32(uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void
+memcache_bin_write16(uint8_t *p, uint32_t n)
+{
+    p[0] = (uint8_t)(n >> 8);
+    p[1] = (uint8_t)n;
+}
+
+static void
+memcache_bin_write32(uint8_t *p, uint32_t n)
+{
+    p[0] = (uint8_t)(n >> 24);
+    p[1] = (uint8_t)(n >> 16);
+    p[2] = (uint8_t)(n >> 8);
+    p[3] = (uint8_t)n;
+}
+
+/*
+ * Return true, if opcode is a get that only responds on a hit, otherwise
+ * return false
+ */
+static bool
+memcache_bin_quiet_get(uint8_t opcode)
+{
+    return opcode == MEMCACHE_BIN_GETQ || opcode == MEMCACHE_BIN_GETKQ;
+}
+
+/*
+ * Return the header of the packet in request r that the client waits the
+ * response of: the packet that ends a run of gets, or the only packet of
+ * any other request
+ */
+static uint8_t *
+memcache_bin_header(struct msg *r)
+{
+    struct keypos *kpos;
+    struct mbuf *mbuf;
+
+    if (r->type == MSG_REQ_MCB_GET) {
+        if (r->end != NULL) {
+            return r->end;
+        }
+        kpos = array_get(r->keys, array_n(r->keys) - 1);
+        return kpos->start - MEMCACHE_BIN_HEADER_LEN;
+    }
+
+    /* a parsed request starts its first non-empty mbuf */
+    STAILQ_FOREACH(mbuf, &r->mhdr, next) {
+        if (mbuf->last > mbuf->start) {
+            return mbuf->start;
+        }
+    }
+
+    NOT_REACHED();
+    return NULL;
+}
+
+/*
+ * A request is one packet, except for a run of quiet gets, which is
+ * parsed as one multi-key get that takes in the gets up to and including
+ * the first get or noop that responds. Telling where a run ends takes a
+ * look at the opcode of the packet after each quiet get.
+ *
+ * The header, the extras and the key of a packet are always parsed from
+ * a contiguous region of an mbuf; the value may span mbufs.
+ */
+void
+memcache_bin_parse_req(struct msg *r)
+{
+    const struct memcache_bin_command *cmd;
+    struct mbuf *b;
+    struct keypos *kpos;
+    uint8_t *p;
+    uint32_t keylen, bodylen, hdrlen;
+    enum {
+        SW_START,
+        SW_VAL,
+        SW_SENTINEL
+    } state;
+
+    state = r->state;
+    b = STAILQ_LAST(&r->mhdr, mbuf, next);
+
+    ASSERT(r->request);
+    ASSERT(!r->redis);
+    ASSERT(state >= SW_START && state < SW_SENTINEL);
+    ASSERT(b != NULL);
+    ASSERT(b->pos <= b->last);
+
+    /* validate the parsing maker */
+    ASSERT(r->pos != NULL);
+    ASSERT(r->pos >= b->pos && r->pos <= b->last);
+
+    p = r->pos;
+
+    for (;;) {
+        switch (state) {
+        case SW_START:
+            if (b->last - p < MEMCACHE_BIN_HEADER_LEN) {
+                goto again;
+            }
+
+            if (p[0] != MEMCACHE_BIN_REQ_MAGIC) {
+                goto error;
+            }
+
+            cmd = &memcache_bin_commands[p[1]];
+            if (r->type == MSG_REQ_MCB_GET && cmd->type != MSG_REQ_MCB_GET &&
+                cmd->type != MSG_REQ_MCB_NOOP) {
+                /* a run of quiet gets not ended by a get or a noop */
+                goto done;
+            }
+
+            if (cmd->type == MSG_UNKNOWN || p[4] != cmd->extlen) {
+                goto error;
+            }
+
+            keylen = memcache_bin_read16(&p[2]);
+            bodylen = memcache_bin_read32(&p[8]);
+            hdrlen = MEMCACHE_BIN_HEADER_LEN + cmd->extlen + keylen;
+
+            if (keylen > MEMCACHE_BIN_MAX_KEY_LENGTH ||
+                bodylen < cmd->extlen + keylen) {
+                goto error;
+            }
+
+            switch (cmd->type) {
+            case MSG_REQ_MCB_NOOP:
+            case MSG_REQ_MCB_QUIT:
+                if (keylen != 0 || bodylen != 0) {
+                    goto error;
+                }
+                break;
+
+            case MSG_REQ_MCB_GET:
+                if (keylen == 0 || bodylen != keylen) {
+                    goto error;
+                }
+                break;
+
+            default:
+                if (keylen == 0) {
+                    goto error;
+                }
+                break;
+            }
+
+            if (b->last - p < hdrlen) {
+                goto again;
+            }
+
+            if (r->type == MSG_REQ_MCB_GET) {
+                /* the noop that ends a run of gets is kept as its end */
+                if (cmd->type == MSG_REQ_MCB_NOOP) {
+                    r->end = p;
+                    p += MEMCACHE_BIN_HEADER_LEN;
+                    goto done;
+                }
+            }
+
+            r->type = cmd->type;
+
+            if (keylen != 0) {
+                kpos = array_push(r->keys);
+                if (kpos == NULL) {
+                    goto enomem;
+                }
+                kpos->start = p + MEMCACHE_BIN_HEADER_LEN + cmd->extlen;
+                kpos->end = kpos->start + keylen;
+            }
+
+            switch (cmd->type) {
+            case MSG_REQ_MCB_GET:
+                p += hdrlen;
+                if (cmd->quiet) {
+                    /* the run goes on */
+                    continue;
+                }
+                goto done;
+
+            case MSG_REQ_MCB_NOOP:
+                r->noforward = 1;
+                p += hdrlen;
+                goto done;
+
+            case MSG_REQ_MCB_QUIT:
+                r->quit = 1;
+                p += hdrlen;
+                goto done;
+
+            default:
+                break;
+            }
+
+            if (cmd->quiet) {
+                /*
+                 * The server answers a quiet request like any other, so
+                 * that responses still pair with requests; we drop the
+                 * response it would have left out instead
+                 */
+                r->quiet = 1;
+                p[1] = cmd->loud;
+            }
+
+            r->vlen = bodylen - cmd->extlen - keylen;
+            p += hdrlen;
+            state = SW_VAL;
+
+            /* fall through */
+
+        case SW_VAL:
+            if ((uint32_t)(b->last - p) < r->vlen) {
+                r->vlen -= (uint32_t)(b->last - p);
+                p = b->last;
+                goto again;
+            }
+            p += r->vlen;
+            goto done;
+
+        default:
+            NOT_REACHED();
+            break;
+        }
+    }
+
+    NOT_REACHED();
+
+again:
+    /*
+     * Parse again once more data is read. A header cut short by the end
+     * of a full mbuf is copied into a new mbuf, to be parsed from a
+     * contiguous region with the rest of it.
+     */
+    r->pos = p;
+    r->state = state;
+
+    if (state == SW_START && p < b->last && b->last == b->end) {
+        r->result = MSG_PARSE_REPAIR;
+    } else {
+        r->result = MSG_PARSE_AGAIN;
+    }
+
+    log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed req %"PRIu64" res %d "
+                "type %d state %d rpos %d of %d", r->id, r->result, r->type,
+                r->state, r->pos - b->pos, b->last - b->pos);
+    return;
+
+done:
+    ASSERT(r->type > MSG_UNKNOWN && r->type < MSG_SENTINEL);
+    r->pos = p;
+    ASSERT(r->pos <= b->last);
+    r->state = SW_START;
+    r->result = MSG_PARSE_OK;
+
+    log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed req %"PRIu64" res %d "
+                "type %d state %d rpos %d of %d", r->id, r->result, r->type,
+                r->state, r->pos - b->pos, b->last - b->pos);
+    return;
+
+enomem:
+    r->result = MSG_PARSE_ERROR;
+    r->state = state;
+
+    log_hexdump(LOG_INFO, b->pos, mbuf_length(b), "out of memory on parse req %"PRIu64" "
+                "res %d type %d state %d", r->id, r->result, r->type, r->state);
+
+    return;
+
+error:
+    r->result = MSG_PARSE_ERROR;
+    r->state = state;
+    errno = EINVAL;
+
+    log_hexdump(LOG_INFO, b->pos, mbuf_length(b), "parsed bad req %"PRIu64" "
+                "res %d type %d state %d", r->id, r->result, r->type,
+                r->state);
+}
+
+static msg_type_t
+memcache_bin_rsp_type(uint32_t status)
+{
+    switch (status) {
+    case MEMCACHE_BIN_STATUS_OK:
+        return MSG_RSP_MCB_OK;
+
+    case MEMCACHE_BIN_STATUS_NOT_FOUND:
+        return MSG_RSP_MCB_NOT_FOUND;
+
+    case MEMCACHE_BIN_STATUS_EXISTS:
+        return MSG_RSP_MCB_EXISTS;
+
+    case MEMCACHE_BIN_STATUS_NOT_STORED:
+        return MSG_RSP_MCB_NOT_STORED;
+
+    default:
+        break;
+    }
+
+    return MSG_RSP_MCB_ERROR;
+}
+
+/*
+ * A response is one packet, except for the responses to a run of quiet
+ * gets, which are parsed with the response that ends the run as one.
+ * r->end marks the header of the last packet.
+ */
+void
+memcache_bin_parse_rsp(struct msg *r)
+{
+    struct mbuf *b;
+    uint8_t *p;
+    uint32_t bodylen;
+    enum {
+        SW_START,
+        SW_VAL,
+        SW_SENTINEL
+    } state;
+
+    state = r->state;
+    b = STAILQ_LAST(&r->mhdr, mbuf, next);
+
+    ASSERT(!r->request);
+    ASSERT(!r->redis);
+    ASSERT(state >= SW_START && state < SW_SENTINEL);
+    ASSERT(b != NULL);
+    ASSERT(b->pos <= b->last);
+
+    /* validate the parsing marker */
+    ASSERT(r->pos != NULL);
+    ASSERT(r->pos >= b->pos && r->pos <= b->last);
+
+    p = r->pos;
+
+    for (;;) {
+        switch (state) {
+        case SW_START:
+            if (b->last - p < MEMCACHE_BIN_HEADER_LEN) {
+                goto again;
+            }
+
+            if (p[0] != MEMCACHE_BIN_RSP_MAGIC) {
+                goto error;
+            }
+
+            bodylen = memcache_bin_read32(&p[8]);
+            if (bodylen < p[4] + memcache_bin_read16(&p[2])) {
+                goto error;
+            }
+
+            r->end = p;
+            r->type = memcache_bin_rsp_type(memcache_bin_read16(&p[6]));
+            r->vlen = bodylen;
+            p += MEMCACHE_BIN_HEADER_LEN;
+            state = SW_VAL;
+
+            /* fall through */
+
+        case SW_VAL:
+            if ((uint32_t)(b->last - p) < r->vlen) {
+                r->vlen -= (uint32_t)(b->last - p);
+                p = b->last;
+                goto again;
+            }
+            p += r->vlen;
+            state = SW_START;
+
+            if (!memcache_bin_quiet_get(r->end[1])) {
+                goto done;
+            }
+
+            break;
+
+        default:
+            NOT_REACHED();
+            break;
+        }
+    }
+
+    NOT_REACHED();
+
+again:
+    r->pos = p;
+    r->state = state;
+
+    if (state == SW_START && p < b->last && b->last == b->end) {
+        r->result = MSG_PARSE_REPAIR;
+    } else {
+        r->result = MSG_PARSE_AGAIN;
+    }
+
+    log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed rsp %"PRIu64" res %d "
+                "type %d state %d rpos %d of %d", r->id, r->result, r->type,
+                r->state, r->pos - b->pos, b->last - b->pos);
+    return;
+
+done:
+    ASSERT(r->type > MSG_UNKNOWN && r->type < MSG_SENTINEL);
+    r->pos = p;
+    ASSERT(r->pos <= b->last);
+    r->state = SW_START;
+    r->result = MSG_PARSE_OK;
+
+    log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed rsp %"PRIu64" res %d "
+                "type %d state %d rpos %d of %d", r->id, r->result, r->type,
+                r->state, r->pos - b->pos, b->last - b->pos);
+    return;
+
+error:
+    r->result = MSG_PARSE_ERROR;
+    r->state = state;
+    errno = EINVAL;
+
+    log_hexdump(LOG_INFO, b->pos, mbuf_length(b), "parsed bad rsp %"PRIu64" "
+                "res %d type %d state %d", r->id, r->result, r->type,
+                r->state);
+}
+
+/*
+ * Append a packet of len bytes at pos to request r. If the packet is a
+ * get, its key becomes a key of r.
+ */
+static rstatus_t
+memcache_bin_append(struct msg *r, uint8_t *pos, uint32_t len)
+{
+    struct mbuf *mbuf;
+    struct keypos *kpos;
+
+    mbuf = msg_ensure_mbuf(r, len);
+    if (mbuf == NULL) {
+        return NC_ENOMEM;
+    }
+
+    if (len > MEMCACHE_BIN_HEADER_LEN) {
+        kpos = array_push(r->keys);
+        if (kpos == NULL) {
+            return NC_ENOMEM;
+        }
+        kpos->start = mbuf->last + MEMCACHE_BIN_HEADER_LEN;
+        kpos->end = mbuf->last + len;
+    }
+
+    mbuf_copy(mbuf, pos, len);
+    r->mlen += len;
+
+    return NC_OK;
+}
+
+/*
+ * Split a run of quiet gets into a run for the server of each key. The
+ * fragment of the server of the last key goes last and ends like the
+ * run of the client, with its get or its noop. Every other fragment ends
+ * with a noop of our own, whose response is dropped, so that each server
+ * sends a response we know to be the last.
+ *
+ * Responses are sent to the client in the order of the fragments: the
+ * hits of a server come together, and the response the client waits for
+ * comes last.
+ */
+rstatus_t
+memcache_bin_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq)
+{
+    struct msg **sub_msgs, *sub_msg, *last;
+    struct keypos *kpos;
+    uint32_t i, nkey, idx, keylen;
+    uint8_t opcode;
+    bool terminated;
+    rstatus_t status;
+
+    if (r->type != MSG_REQ_MCB_GET) {
+        return NC_OK;
+    }
+
+    /* a run ends with a noop or with a get that responds */
+    nkey = array_n(r->keys);
+    kpos = array_get(r->keys, nkey - 1);
+    opcode = (kpos->start - MEMCACHE_BIN_HEADER_LEN)[1];
+    terminated = r->end != NULL || !memcache_bin_quiet_get(opcode);
+    if (nkey == 1 && r->end == NULL && terminated) {
+        /* a lone get is answered like any other request */
+        return NC_OK;
+    }
+
+    sub_msgs = nc_zalloc(ncontinuum * sizeof(*sub_msgs));
+    if (sub_msgs == NULL) {
+        return NC_ENOMEM;
+    }
+
+    r->frag_id = msg_gen_frag_id();
+    r->nfrag = 0;
+    r->frag_owner = r;
+
+    last = NULL;
+    for (i = 0; i < nkey; i++) {        /* for each  key */
+        kpos = array_get(r->keys, i);
+        keylen = (uint32_t)(kpos->end - kpos->start);
+        idx = msg_backend_idx(r, kpos->start, keylen);
+
+        sub_msg = sub_msgs[idx];
+        if (sub_msg == NULL) {
+            sub_msg = msg_get(r->owner, r->request, r->redis);
+            if (sub_msg == NULL) {
+                nc_free(sub_msgs);
+                return NC_ENOMEM;
+            }
+            sub_msg->type = r->type;
+            sub_msg->frag_id = r->frag_id;
+            sub_msg->frag_owner = r->frag_owner;
+
+            TAILQ_INSERT_TAIL(frag_msgq, sub_msg, m_tqe);
+            r->nfrag++;
+            sub_msgs[idx] = sub_msg;
+        }
+        last = sub_msg;
+
+        status = memcache_bin_append(sub_msg, kpos->start - MEMCACHE_BIN_HEADER_LEN,
+                                     MEMCACHE_BIN_HEADER_LEN + keylen);
+        if (status != NC_OK) {
+            nc_free(sub_msgs);
+            return status;
+        }
+    }
+
+    nc_free(sub_msgs);
+
+    TAILQ_REMOVE(frag_msgq, last, m_tqe);
+    TAILQ_INSERT_TAIL(frag_msgq, last, m_tqe);
+
+    TAILQ_FOREACH(sub_msg, frag_msgq, m_tqe) {
+        if (sub_msg == last && terminated) {
+            if (r->end == NULL) {
+                /* ends with the get of the client */
+                continue;
+            }
+            status = memcache_bin_append(sub_msg, r->end, MEMCACHE_BIN_HEADER_LEN);
+        } else {
+            sub_msg->quiet = 1;
+            status = memcache_bin_append(sub_msg, memcache_bin_noop,
+                                         MEMCACHE_BIN_HEADER_LEN);
+        }
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Return the opcode of the quiet variant of opcode
+ */
+static uint8_t
+memcache_bin_quiet_opcode(uint8_t opcode)
+{
+    uint32_t i;
+
+    for (i = 0; i < NELEMS(memcache_bin_commands); i++) {
+        if (memcache_bin_commands[i].quiet &&
+            memcache_bin_commands[i].loud == opcode) {
+            return (uint8_t)i;
+        }
+    }
+
+    NOT_REACHED();
+    return opcode;
+}
+
+/*
+ * Return the opcode of the response the proxy makes itself to request r,
+ * whose packet the client waits the response of starts at req: the quiet
+ * opcode the client sent, which the parser made loud for the server
+ */
+static uint8_t
+memcache_bin_rsp_opcode(struct msg *r, uint8_t *req)
+{
+    if (r->quiet && r->frag_id == 0) {
+        return memcache_bin_quiet_opcode(req[1]);
+    }
+
+    return req[1];
+}
+
+/*
+ * Return true, if response r is one that the server leaves out for quiet
+ * request pr, otherwise return false
+ */
+static bool
+memcache_bin_quiet(struct msg *pr, struct msg *r)
+{
+    if (pr->type == MSG_REQ_MCB_GAT) {
+        return r->type == MSG_RSP_MCB_NOT_FOUND;
+    }
+
+    return r->type == MSG_RSP_MCB_OK;
+}
+
+/*
+ * Pre-coalesce handler drops the responses the client did not ask for:
+ * that of a quiet request, and that of the noop that ends a fragment
+ */
+void
+memcache_bin_pre_coalesce(struct msg *r)
+{
+    struct msg *pr = r->peer; /* peer request */
+    struct mbuf *mbuf;
+
+    ASSERT(!r->request);
+    ASSERT(pr->request);
+
+    if (pr->frag_id == 0) {
+        if (!pr->quiet) {
+            return;
+        }
+
+        if (memcache_bin_quiet(pr, r)) {
+            STAILQ_FOREACH(mbuf, &r->mhdr, next) {
+                r->mlen -= mbuf_length(mbuf);
+                mbuf_rewind(mbuf);
+            }
+            ASSERT(r->mlen == 0);
+        } else {
+            /* answer with the opcode the client sent */
+            r->end[1] = memcache_bin_quiet_opcode(r->end[1]);
+        }
+        return;
+    }
+
+    pr->frag_owner->nfrag_done++;
+
+    if (!pr->quiet) {
+        return;
+    }
+
+    ASSERT(r->end != NULL);
+
+    if (r->end[1] != MEMCACHE_BIN_NOOP) {
+        /* the last response of a fragment is that of its noop */
+        mbuf = STAILQ_FIRST(&r->mhdr);
+        log_hexdump(LOG_ERR, mbuf->pos, mbuf_length(mbuf), "rsp fragment "
+                    "ends with opcode %d", r->end[1]);
+        pr->error = 1;
+        pr->err = EINVAL;
+        return;
+    }
+
+    for (;;) {
+        mbuf = STAILQ_LAST(&r->mhdr, mbuf, next);
+        ASSERT(mbuf != NULL);
+
+        if (r->end >= mbuf->pos && r->end < mbuf->last) {
+            r->mlen -= (uint32_t)(mbuf->last - r->end);
+            mbuf->last = r->end;
+            break;
+        }
+
+        r->mlen -= mbuf_length(mbuf);
+        mbuf_remove(&r->mhdr, mbuf);
+        mbuf_put(mbuf);
+    }
+}
+
+/*
+ * Post-coalesce handler has nothing left to do, as every fragment sends
+ * its own responses, see memcache_bin_fragment
+ */
+void
+memcache_bin_post_coalesce(struct msg *r)
+{
+    ASSERT(r->request && (r->frag_owner == r));
+}
+
+rstatus_t
+memcache_bin_reply(struct msg *r)
+{
+    struct msg *response = r->peer;
+    uint8_t rsp[MEMCACHE_BIN_HEADER_LEN], *req;
+
+    ASSERT(response != NULL);
+    ASSERT(r->type == MSG_REQ_MCB_NOOP);
+
+    req = memcache_bin_header(r);
+
+    memset(rsp, 0, sizeof(rsp));
+    rsp[0] = MEMCACHE_BIN_RSP_MAGIC;
+    rsp[1] = memcache_bin_rsp_opcode(r, req);
+    nc_memcpy(&rsp[12], &req[12], 4);   /* opaque */
+
+    return msg_append(response, rsp, sizeof(rsp));
+}
+
+/*
+ * Make the error response to request r, which failed with err. It has
+ * the opcode and the opaque of the packet the client waits the response
+ * of, and the error string as its value.
+ */
+struct msg *
+memcache_bin_get_error(struct msg *r, err_t err)
+{
+    struct msg *msg;
+    uint8_t rsp[MEMCACHE_BIN_HEADER_LEN], *req;
+    char *errstr = err ? strerror(err) : "unknown";
+    uint32_t len = (uint32_t)strlen(errstr);
+
+    ASSERT(r->request);
+
+    msg = msg_get(r->owner, false, false);
+    if (msg == NULL) {
+        return NULL;
+    }
+
+    req = memcache_bin_header(r);
+
+    memset(rsp, 0, sizeof(rsp));
+    rsp[0] = MEMCACHE_BIN_RSP_MAGIC;
+    rsp[1] = memcache_bin_rsp_opcode(r, req);
+    memcache_bin_write16(&rsp[6], err == ENOMEM ? MEMCACHE_BIN_STATUS_ENOMEM :
+                                                 MEMCACHE_BIN_STATUS_EINTERNAL);
+    memcache_bin_write32(&rsp[8], len);
+    nc_memcpy(&rsp[12], &req[12], 4);   /* opaque */
+
+    msg->type = MSG_RSP_MCB_ERROR;
+
+    if (msg_append(msg, rsp, sizeof(rsp)) != NC_OK ||
+        msg_append(msg, (uint8_t *)errstr, len) != NC_OK) {
+        msg_put(msg);
+        return NULL;
+    }
+
+    log_debug(LOG_VVERB, "get msg %p id %"PRIu64" len %"PRIu32" error '%s'",
+              msg, msg->id, msg->mlen, errstr);
+
+    return msg;
+}
@@ -20,6 +20,9 @@
 
 #include <nc_core.h>
 
+#define str2cmp(m, c0, c1)                                                                  \
+    (m[0] == c0 && m[1] == c1)
+
 #ifdef NC_LITTLE_ENDIAN
 
 #define str4cmp(m, c0, c1, c2, c3)                                                          \
@@ -148,6 +151,19 @@ rstatus_t memcache_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *
 rstatus_t memcache_reply(struct msg *r);
 void memcache_post_connect(struct context *ctx, struct conn *conn, struct server *server);
 void memcache_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
+bool memcache_retrieval(struct msg *r);
+bool memcache_error(struct msg *r);
+bool memcache_miss(struct msg *r);
+rstatus_t memcache_batch(struct msg *r);
+rstatus_t memcache_unbatch(struct msg *r, struct msg *rsp);
+
+void memcache_bin_parse_req(struct msg *r);
+void memcache_bin_parse_rsp(struct msg *r);
+void memcache_bin_pre_coalesce(struct msg *r);
+void memcache_bin_post_coalesce(struct msg *r);
+rstatus_t memcache_bin_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq);
+rstatus_t memcache_bin_reply(struct msg *r);
+struct msg *memcache_bin_get_error(struct msg *r, err_t err);
 
 void redis_parse_req(struct msg *r);
 void redis_parse_rsp(struct msg *r);
@@ -158,6 +174,10 @@ rstatus_t redis_add_auth(struct context *ctx, struct conn *c_conn, struct conn *
 rstatus_t redis_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq);
 rstatus_t redis_reply(struct msg *r);
 bool redis_readonly(struct msg *r);
+bool redis_error(struct msg *r);
+bool redis_miss(struct msg *r);
+rstatus_t redis_batch(struct msg *r);
+rstatus_t redis_unbatch(struct msg *r, struct msg *rsp);
 bool redis_master_slave_only(struct msg *r);
 void redis_post_connect(struct context *ctx, struct conn *conn, struct server *server);
 void redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
@@ -36,6 +36,48 @@
 
 static rstatus_t redis_handle_auth_req(struct msg *request, struct msg *response);
 
+typedef enum redis_merge {
+    REDIS_MERGE_ARRAY,  /* concatenate the array replies in key order */
+    REDIS_MERGE_SUM,    /* add up the integer replies */
+    REDIS_MERGE_OK,     /* reply +OK once every fragment did */
+} redis_merge_t;
+
+struct redis_frag {
+    msg_type_t    type;     /* request type */
+    struct string name;     /* command sent to every fragment */
+    uint32_t      key_step; /* # arguments per key */
+    redis_merge_t merge;    /* merge of the fragment replies */
+};
+
+/*
+ * Multi-key commands that are fragmented across servers, with the layout
+ * of their arguments and how the replies of the fragments are merged.
+ * Fan-out for another multi-key command is an entry here, with the
+ * command parsed as a vector of keys (argx) or key-value pairs (argkvx).
+ */
+static const struct redis_frag redis_frags[] = {
+    { MSG_REQ_REDIS_MGET,   string("mget"),   1, REDIS_MERGE_ARRAY },
+    { MSG_REQ_REDIS_DEL,    string("del"),    1, REDIS_MERGE_SUM },
+    { MSG_REQ_REDIS_UNLINK, string("unlink"), 1, REDIS_MERGE_SUM },
+    { MSG_REQ_REDIS_EXISTS, string("exists"), 1, REDIS_MERGE_SUM },
+    { MSG_REQ_REDIS_TOUCH,  string("touch"),  1, REDIS_MERGE_SUM },
+    { MSG_REQ_REDIS_MSET,   string("mset"),   2, REDIS_MERGE_OK },
+};
+
+static const struct redis_frag *
+redis_frag_lookup(msg_type_t type)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(redis_frags) / sizeof(redis_frags[0]); i++) {
+        if (redis_frags[i].type == type) {
+            return &redis_frags[i];
+        }
+    }
+
+    return NULL;
+}
+
 
 bool
 redis_readonly(struct msg *r)
@@ -51,6 +93,7 @@ redis_readonly(struct msg *r)
     case MSG_REQ_REDIS_DUMP:
     case MSG_REQ_REDIS_STRLEN:
     case MSG_REQ_REDIS_EXISTS:
+    case MSG_REQ_REDIS_TOUCH:
     case MSG_REQ_REDIS_GETRANGE:
 
     /* bit op */
@@ -145,7 +188,6 @@ static bool
 redis_arg0(struct msg *r)
 {
     switch (r->type) {
-    case MSG_REQ_REDIS_EXISTS:
     case MSG_REQ_REDIS_PERSIST:
     case MSG_REQ_REDIS_PTTL:
     case MSG_REQ_REDIS_TTL:
@@ -355,6 +397,9 @@ redis_argx(struct msg *r)
     switch (r->type) {
     case MSG_REQ_REDIS_MGET:
     case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_UNLINK:
+    case MSG_REQ_REDIS_EXISTS:
+    case MSG_REQ_REDIS_TOUCH:
         return true;
 
     default:
@@ -408,7 +453,7 @@ redis_argeval(struct msg *r)
  * Return true, if the redis response is an error response i.e. a simple
  * string whose first character is '-', otherwise return false.
  */
-static bool
+bool
 redis_error(struct msg *r)
 {
     switch (r->type) {
@@ -435,6 +480,25 @@ redis_error(struct msg *r)
     return false;
 }
 
+/*
+ * Return true, if the redis response is a null bulk reply i.e. the reply
+ * to a read of a key that does not exist, otherwise return false.
+ */
+bool
+redis_miss(struct msg *r)
+{
+    struct mbuf *mbuf;
+
+    if (r->type != MSG_RSP_REDIS_BULK) {
+        return false;
+    }
+
+    mbuf = STAILQ_FIRST(&r->mhdr);
+
+    return (mbuf->last - mbuf->start) >= 3 &&
+           nc_strncmp(mbuf->start, "$-1", 3) == 0;
+}
+
 /*
  * Reference: http://redis.io/topics/protocol
  *
@@ -864,6 +928,11 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str5icmp(m, 't', 'o', 'u', 'c', 'h')) {
+                    r->type = MSG_REQ_REDIS_TOUCH;
+                    break;
+                }
+
                 if (str5icmp(m, 'p', 'f', 'a', 'd', 'd')) {
                     r->type = MSG_REQ_REDIS_PFADD;
                     break;
@@ -987,6 +1056,11 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str6icmp(m, 'u', 'n', 'l', 'i', 'n', 'k')) {
+                    r->type = MSG_REQ_REDIS_UNLINK;
+                    break;
+                }
+
                 break;
 
             case 7:
@@ -2407,7 +2481,6 @@ redis_copy_bulk(struct msg *dst, struct msg *src)
     uint8_t *p;
     uint32_t len = 0;
     uint32_t bytes = 0;
-    rstatus_t status;
 
     for (mbuf = STAILQ_FIRST(&src->mhdr);
          mbuf && mbuf_empty(mbuf);
@@ -2451,12 +2524,22 @@ redis_copy_bulk(struct msg *dst, struct msg *src)
             }
             len -= mbuf_length(mbuf);
             mbuf = nbuf;
+        } else if (dst != NULL && len >= MBUF_SLICE_MIN) {
+            /* refer to the rest of the bulk instead of copying it */
+            nbuf = mbuf_slice(mbuf, mbuf->pos, mbuf->pos + len);
+            if (nbuf == NULL) {
+                return NC_ENOMEM;
+            }
+            mbuf_insert(&dst->mhdr, nbuf);
+            mbuf->pos += len;
+            break;
         } else {                             /* split it */
             if (dst != NULL) {
-                status = msg_append(dst, mbuf->pos, len);
-                if (status != NC_OK) {
-                    return status;
+                nbuf = msg_ensure_mbuf(dst, len);
+                if (nbuf == NULL) {
+                    return NC_ENOMEM;
                 }
+                mbuf_copy(nbuf, mbuf->pos, len);
             }
             mbuf->pos += len;
             break;
@@ -2471,15 +2554,65 @@ redis_copy_bulk(struct msg *dst, struct msg *src)
     return NC_OK;
 }
 
+/*
+ * Move the replies of the keys whose fragments have answered, up to the
+ * first key still waiting for its fragment, into the streamed reply of
+ * the mget request. The '*narg' header goes out with the first key.
+ */
+static void
+redis_coalesce_stream(struct msg *request)
+{
+    struct msg *response = request->peer;
+    struct msg *sub_msg;
+    struct mbuf *mbuf;
+    rstatus_t status;
+
+    if (response == NULL) {
+        return;
+    }
+
+    /* release the part of the reply that was sent already */
+    for (mbuf = STAILQ_FIRST(&response->mhdr);
+         mbuf != NULL && mbuf_empty(mbuf);
+         mbuf = STAILQ_FIRST(&response->mhdr)) {
+
+        mbuf_remove(&response->mhdr, mbuf);
+        mbuf_put(mbuf);
+    }
+
+    for (; request->frag_next < array_n(request->keys); request->frag_next++) {
+        sub_msg = request->frag_seq[request->frag_next];
+        if (sub_msg->peer == NULL || sub_msg->error) {
+            return;
+        }
+
+        if (request->frag_next == 0) {
+            status = msg_prepend_format(response, "*%d\r\n",
+                                        request->narg - 1);
+            if (status != NC_OK) {
+                response->owner->err = 1;
+                return;
+            }
+        }
+
+        status = redis_copy_bulk(response, sub_msg->peer);
+        if (status != NC_OK) {
+            response->owner->err = 1;
+            return;
+        }
+    }
+}
+
 /*
  * Pre-coalesce handler is invoked when the message is a response to
- * the fragmented multi vector request - 'mget' or 'del' and all the
+ * the fragmented multi vector request - see redis_frags - and all the
  * responses to the fragmented request vector hasn't been received
  */
 void
 redis_pre_coalesce(struct msg *r)
 {
     struct msg *pr = r->peer; /* peer request */
+    const struct redis_frag *frag;
     struct mbuf *mbuf;
 
     ASSERT(!r->request);
@@ -2491,10 +2624,13 @@ redis_pre_coalesce(struct msg *r)
     }
     pr->frag_owner->nfrag_done++;
 
+    frag = redis_frag_lookup(pr->type);
+    ASSERT(frag != NULL);
+
     switch (r->type) {
     case MSG_RSP_REDIS_INTEGER:
-        /* only redis 'del' fragmented request sends back integer reply */
-        ASSERT(pr->type == MSG_REQ_REDIS_DEL);
+        /* only requests merged by sum send back integer reply */
+        ASSERT(frag->merge == REDIS_MERGE_SUM);
 
         mbuf = STAILQ_FIRST(&r->mhdr);
         /*
@@ -2514,8 +2650,8 @@ redis_pre_coalesce(struct msg *r)
         break;
 
     case MSG_RSP_REDIS_MULTIBULK:
-        /* only redis 'mget' fragmented request sends back multi-bulk reply */
-        ASSERT(pr->type == MSG_REQ_REDIS_MGET);
+        /* only requests merged as array send back multi-bulk reply */
+        ASSERT(frag->merge == REDIS_MERGE_ARRAY);
 
         mbuf = STAILQ_FIRST(&r->mhdr);
         /*
@@ -2531,10 +2667,13 @@ redis_pre_coalesce(struct msg *r)
         r->mlen -= (uint32_t)(r->narg_end - r->narg_start);
         mbuf->pos = r->narg_end;
 
+        if (pr->frag_owner->stream) {
+            redis_coalesce_stream(pr->frag_owner);
+        }
         break;
 
     case MSG_RSP_REDIS_STATUS:
-        if (pr->type == MSG_REQ_REDIS_MSET) {       /* MSET segments */
+        if (frag->merge == REDIS_MERGE_OK) {        /* MSET segments */
             mbuf = STAILQ_FIRST(&r->mhdr);
             r->mlen -= mbuf_length(mbuf);
             mbuf_rewind(mbuf);
@@ -2605,7 +2744,8 @@ redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
  * ncontinuum is the number of backend redis/memcache server
  *
  * the original msg will be fragment into at most ncontinuum fragments.
- * all the keys map to the same backend will group into one fragment.
+ * all the keys map to the same backend will group into one fragment, or
+ * into batches of at most mget_batch keys for a mget.
  *
  * frag_id:
  * a unique fragment id for all fragments of the message vector. including the orig msg.
@@ -2654,14 +2794,16 @@ redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
  */
 static rstatus_t
 redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq,
-                    uint32_t key_step)
+                    const struct redis_frag *frag)
 {
+    struct server_pool *pool = ((struct conn *)r->owner)->owner;
     struct mbuf *mbuf;
     struct msg **sub_msgs;
-    uint32_t i;
+    struct msg *sub_msg;
+    uint32_t i, batch, window;
     rstatus_t status;
 
-    ASSERT(array_n(r->keys) == (r->narg - 1) / key_step);
+    ASSERT(array_n(r->keys) == (r->narg - 1) / frag->key_step);
 
     sub_msgs = nc_zalloc(ncontinuum * sizeof(*sub_msgs));
     if (sub_msgs == NULL) {
@@ -2680,11 +2822,11 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
 
     /*
      * This code is based on the assumption that '*narg\r\n$4\r\nMGET\r\n' is located
-     * in a contiguous location.
+     * in a contiguous location, and likewise for the other commands.
      * This is always true because we have capped our MBUF_MIN_SIZE at 512 and
      * whenever we have multiple messages, we copy the tail message into a new mbuf
      */
-    for (i = 0; i < 3; i++) {                 /* eat *narg\r\n$4\r\nMGET\r\n */
+    for (i = 0; i < 3; i++) {                 /* eat *narg\r\n$<len>\r\n<cmd>\r\n */
         for (; *(mbuf->pos) != '\n';) {
             mbuf->pos++;
         }
@@ -2695,8 +2837,24 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
     r->nfrag = 0;
     r->frag_owner = r;
 
+    /*
+     * A mget is sent in batches of at most mget_batch keys per server.
+     * When streamed, only the batches that start within the stream window
+     * are forwarded; the others are held back until the stream catches
+     * up with them.
+     */
+    batch = 0;
+    window = array_n(r->keys);
+    if (frag->merge == REDIS_MERGE_ARRAY) {
+        batch = pool->mget_batch;
+        r->stream = pool->mget_stream;
+        if (r->stream) {
+            window = MIN(window, req_stream_window(pool));
+        }
+    }
+    r->frag_fwd = window;
+
     for (i = 0; i < array_n(r->keys); i++) {        /* for each key */
-        struct msg *sub_msg;
         struct keypos *kpos = array_get(r->keys, i);
         uint32_t idx = msg_backend_idx(r, kpos->start, kpos->end - kpos->start);
 
@@ -2706,6 +2864,10 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
                 nc_free(sub_msgs);
                 return NC_ENOMEM;
             }
+            sub_msgs[idx]->deferred = i < window ? 0 : 1;
+
+            TAILQ_INSERT_TAIL(frag_msgq, sub_msgs[idx], m_tqe);
+            r->nfrag++;
         }
         r->frag_seq[i] = sub_msg = sub_msgs[idx];
 
@@ -2716,9 +2878,7 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
             return status;
         }
 
-        if (key_step == 1) {                            /* mget,del */
-            continue;
-        } else {                                        /* mset */
+        if (frag->key_step > 1) {                       /* mset */
             status = redis_copy_bulk(NULL, r);          /* eat key */
             if (status != NC_OK) {
                 nc_free(sub_msgs);
@@ -2733,61 +2893,47 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
 
             sub_msg->narg++;
         }
-    }
 
-    for (i = 0; i < ncontinuum; i++) {     /* prepend mget header, and forward it */
-        struct msg *sub_msg = sub_msgs[i];
-        if (sub_msg == NULL) {
-            continue;
+        /* a full batch is done, the next key of this server starts another */
+        if (batch != 0 && sub_msg->narg == batch * frag->key_step) {
+            sub_msgs[idx] = NULL;
         }
+    }
 
-        if (r->type == MSG_REQ_REDIS_MGET) {
-            status = msg_prepend_format(sub_msg, "*%d\r\n$4\r\nmget\r\n",
-                                        sub_msg->narg + 1);
-        } else if (r->type == MSG_REQ_REDIS_DEL) {
-            status = msg_prepend_format(sub_msg, "*%d\r\n$3\r\ndel\r\n",
-                                        sub_msg->narg + 1);
-        } else if (r->type == MSG_REQ_REDIS_MSET) {
-            status = msg_prepend_format(sub_msg, "*%d\r\n$4\r\nmset\r\n",
-                                        sub_msg->narg + 1);
-        } else {
-            NOT_REACHED();
-        }
+    nc_free(sub_msgs);
+
+    /* prepend command header; fragments are in the order of their first key */
+    TAILQ_FOREACH(sub_msg, frag_msgq, m_tqe) {
+        status = msg_prepend_format(sub_msg, "*%d\r\n$%d\r\n%.*s\r\n",
+                                    sub_msg->narg + 1, frag->name.len,
+                                    frag->name.len, frag->name.data);
         if (status != NC_OK) {
-            nc_free(sub_msgs);
             return status;
         }
 
         sub_msg->type = r->type;
         sub_msg->frag_id = r->frag_id;
         sub_msg->frag_owner = r->frag_owner;
-
-        TAILQ_INSERT_TAIL(frag_msgq, sub_msg, m_tqe);
-        r->nfrag++;
     }
 
-    nc_free(sub_msgs);
     return NC_OK;
 }
 
 rstatus_t
 redis_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq)
 {
+    const struct redis_frag *frag;
+
     if (1 == array_n(r->keys)){
         return NC_OK;
     }
 
-    switch (r->type) {
-    case MSG_REQ_REDIS_MGET:
-    case MSG_REQ_REDIS_DEL:
-        return redis_fragment_argx(r, ncontinuum, frag_msgq, 1);
-
-    case MSG_REQ_REDIS_MSET:
-        return redis_fragment_argx(r, ncontinuum, frag_msgq, 2);
-
-    default:
+    frag = redis_frag_lookup(r->type);
+    if (frag == NULL) {
         return NC_OK;
     }
+
+    return redis_fragment_argx(r, ncontinuum, frag_msgq, frag);
 }
 
 rstatus_t
@@ -2833,8 +2979,8 @@ redis_post_coalesce_mset(struct msg *request)
     }
 }
 
-void
-redis_post_coalesce_del(struct msg *request)
+static void
+redis_post_coalesce_sum(struct msg *request)
 {
     struct msg *response = request->peer;
     rstatus_t status;
@@ -2880,7 +3026,7 @@ redis_post_coalesce_mget(struct msg *request)
 
 /*
  * Post-coalesce handler is invoked when the message is a response to
- * the fragmented multi vector request - 'mget' or 'del' and all the
+ * the fragmented multi vector request - see redis_frags - and all the
  * responses to the fragmented request vector has been received and
  * the fragmented request is consider to be done
  */
@@ -2888,6 +3034,7 @@ void
 redis_post_coalesce(struct msg *r)
 {
     struct msg *pr = r->peer; /* peer response */
+    const struct redis_frag *frag;
 
     ASSERT(!pr->request);
     ASSERT(r->request && (r->frag_owner == r));
@@ -2896,14 +3043,21 @@ redis_post_coalesce(struct msg *r)
         return;
     }
 
-    switch (r->type) {
-    case MSG_REQ_REDIS_MGET:
+    frag = redis_frag_lookup(r->type);
+    ASSERT(frag != NULL);
+
+    switch (frag->merge) {
+    case REDIS_MERGE_ARRAY:
+        if (r->stream) {
+            /* keys were coalesced as their fragments answered */
+            return;
+        }
         return redis_post_coalesce_mget(r);
 
-    case MSG_REQ_REDIS_DEL:
-        return redis_post_coalesce_del(r);
+    case REDIS_MERGE_SUM:
+        return redis_post_coalesce_sum(r);
 
-    case MSG_REQ_REDIS_MSET:
+    case REDIS_MERGE_OK:
         return redis_post_coalesce_mset(r);
 
     default:
@@ -2911,6 +3065,108 @@ redis_post_coalesce(struct msg *r)
     }
 }
 
+/*
+ * Build r into a mget of the keys of the single-key gets r->batch_seq,
+ * to send them to their server as one request
+ */
+rstatus_t
+redis_batch(struct msg *r)
+{
+    struct msg *req;
+    struct keypos *kpos;
+    uint32_t i;
+    rstatus_t status;
+
+    ASSERT(r->request && r->nbatch != 0);
+
+    for (i = 0; i < r->nbatch; i++) {
+        req = r->batch_seq[i];
+        ASSERT(req->type == MSG_REQ_REDIS_GET && array_n(req->keys) == 1);
+
+        kpos = array_get(req->keys, 0);
+        status = redis_append_key(r, kpos->start,
+                                  (uint32_t)(kpos->end - kpos->start));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    status = msg_prepend_format(r, "*%d\r\n$4\r\nmget\r\n", r->nbatch + 1);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    r->type = MSG_REQ_REDIS_MGET;
+    r->narg = r->nbatch + 1;
+
+    return NC_OK;
+}
+
+/*
+ * Split the reply rsp to the mget r built by redis_batch into the reply
+ * of each of its gets and link them. An error reply is copied to every
+ * get; any other reply but an array of one bulk per key is an error.
+ */
+rstatus_t
+redis_unbatch(struct msg *r, struct msg *rsp)
+{
+    struct msg *req, *sub_rsp;
+    struct mbuf *mbuf;
+    uint32_t i;
+    rstatus_t status;
+
+    ASSERT(r->request && r->nbatch != 0);
+    ASSERT(!rsp->request && rsp->peer == NULL);
+
+    if (rsp->type == MSG_RSP_REDIS_MULTIBULK) {
+        if (rsp->narg != r->nbatch) {
+            return NC_ERROR;
+        }
+
+        /* skip over the narg token, see redis_pre_coalesce */
+        mbuf = STAILQ_FIRST(&rsp->mhdr);
+        ASSERT(rsp->narg_start == mbuf->pos);
+        ASSERT(rsp->narg_start < rsp->narg_end);
+
+        rsp->mlen -= (uint32_t)(rsp->narg_end + CRLF_LEN - rsp->narg_start);
+        mbuf->pos = rsp->narg_end + CRLF_LEN;
+    } else if (!redis_error(rsp)) {
+        return NC_ERROR;
+    }
+
+    for (i = 0; i < r->nbatch; i++) {
+        req = r->batch_seq[i];
+
+        sub_rsp = msg_get(rsp->owner, false, true);
+        if (sub_rsp == NULL) {
+            return NC_ENOMEM;
+        }
+
+        if (rsp->type == MSG_RSP_REDIS_MULTIBULK) {
+            sub_rsp->type = MSG_RSP_REDIS_BULK;
+            status = redis_copy_bulk(sub_rsp, rsp);
+        } else {
+            sub_rsp->type = rsp->type;
+            status = NC_OK;
+            STAILQ_FOREACH(mbuf, &rsp->mhdr, next) {
+                status = msg_append(sub_rsp, mbuf->pos, mbuf_length(mbuf));
+                if (status != NC_OK) {
+                    break;
+                }
+            }
+        }
+        if (status != NC_OK) {
+            msg_put(sub_rsp);
+            return status;
+        }
+
+        req->peer = sub_rsp;
+        sub_rsp->peer = req;
+    }
+
+    return NC_OK;
+}
+
 static rstatus_t
 redis_handle_auth_req(struct msg *req, struct msg *rsp)
 {
@@ -2964,7 +3220,8 @@ redis_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
     ASSERT(!s_conn->client && !s_conn->proxy);
     ASSERT(!conn_authenticated(s_conn));
 
-    pool = c_conn->owner;
+    /* the server may belong to a routed or mirror pool of the client's */
+    pool = ((struct server *)s_conn->owner)->owner;
 
     msg = msg_get(c_conn, true, c_conn->redis);
     if (msg == NULL) {
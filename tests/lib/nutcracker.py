@@ -0,0 +1,159 @@
+#!/usr/bin/env python
+#coding: utf-8
+#file   : nutcracker.py
+#
+# A nutcracker of a test's own, in front of the stand-ins of standin.py,
+# for the features the shared deployment of conf.py cannot show (server
+# failures, reloads, timeouts). Skips the test if there is no binary.
+
+import grp
+import json
+import os
+import pwd
+import signal
+import socket
+import subprocess
+import time
+import unittest
+
+from standin import free_port, wait_until
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD, '../')
+
+# the global section of a NutCracker conf, run as the user of the tests
+GLOBAL = '''
+global:
+  worker_processes: {workers}
+  user: {user}
+  group: {group}
+'''
+
+def getenv(key, default):
+    if key in os.environ:
+        return os.environ[key]
+    return default
+
+def binary():
+    path = getenv('T_NUTCRACKER', os.path.join(WORKDIR, '_binaries/nutcracker'))
+    if not os.access(path, os.X_OK):
+        raise unittest.SkipTest('no nutcracker binary at %s' % path)
+    return path
+
+class NutCracker(object):
+    '''
+    Runs nutcracker on conf, a yaml string with the listen ports ({port},
+    {port1}...), the fields of GLOBAL and any other fields given filled in.
+    '''
+
+    def __init__(self, conf, args=(), workers=0, **fields):
+        self.port = free_port()
+        self.stats_port = free_port()
+        self.fields = dict(fields, port=self.port, workers=workers,
+                           user=pwd.getpwuid(os.getuid()).pw_name,
+                           group=grp.getgrgid(os.getgid()).gr_name)
+        for i in range(1, 4):
+            self.fields['port%d' % i] = free_port()
+        self.args = list(args)
+        self.name = 'nc-%d' % self.port
+        self.path = os.path.join(WORKDIR, 'log', self.name)
+        self.proc = None
+        self.write(conf)
+
+    def write(self, conf):
+        '''(re)write the conf, as for a reload'''
+        with open(self.path + '.yml', 'w') as f:
+            f.write(conf.format(**self.fields))
+
+    def start(self):
+        cmd = [binary(), '-c', self.path + '.yml', '-s', str(self.stats_port),
+               '-o', self.path + '.log', '-p', self.path + '.pid',
+               '-m', getenv('T_MBUF', '512'), '-v', getenv('T_VERBOSE', '4'),
+               '-i', '1000'] + self.args
+        devnull = open(os.devnull, 'w')
+        self.proc = subprocess.Popen(cmd, stdout=devnull, stderr=devnull,
+                                     close_fds=True, preexec_fn=os.setsid)
+        if not wait_until(lambda: self.listening(self.port)):
+            self.stop()
+            raise AssertionError('nutcracker did not start, see %s.log' % self.path)
+        return self
+
+    def test_conf(self):
+        '''run nutcracker -t on the conf, returns (exit status, output)'''
+        p = subprocess.Popen([binary(), '-t', '-c', self.path + '.yml'],
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                             close_fds=True)
+        out = p.communicate()[0]
+        return p.returncode, out
+
+    def stop(self):
+        if self.proc is None:
+            return
+        try:
+            os.killpg(self.proc.pid, signal.SIGKILL)
+        except OSError:
+            pass
+        self.proc.wait()
+        self.proc = None
+
+    def alive(self):
+        return self.proc is not None and self.proc.poll() is None
+
+    def signal(self, sig):
+        os.kill(self.pid(), sig)
+
+    def pid(self):
+        '''pid of the master, which changes on a binary upgrade'''
+        try:
+            return int(open(self.path + '.pid').read())
+        except (IOError, ValueError):
+            return self.proc.pid
+
+    def workers(self):
+        out = subprocess.Popen(['pgrep', '-P', str(self.pid())],
+                               stdout=subprocess.PIPE).communicate()[0]
+        return sorted(int(p) for p in out.split())
+
+    @staticmethod
+    def listening(port):
+        try:
+            socket.create_connection(('127.0.0.1', port), 1).close()
+            return True
+        except socket.error:
+            return False
+
+    def stats(self):
+        s = socket.create_connection(('127.0.0.1', self.stats_port), 5)
+        buf = ''
+        while True:
+            data = s.recv(65536)
+            if not data:
+                break
+            buf += data
+        s.close()
+        return json.loads(buf)
+
+    def stat(self, pool, name, server=None):
+        '''a pool stat, or a server stat of pool, 0 if not shown yet'''
+        st = self.stats()['pools'].get(pool, {})
+        if server is not None:
+            st = st['servers'].get(server, {})
+        return st.get(name, 0)
+
+    def wait_stat(self, pool, name, value, server=None, timeout=5.0):
+        '''wait for a stat, which nutcracker aggregates every -i msec'''
+        ok = wait_until(lambda: self.stat(pool, name, server) >= value, timeout)
+        assert ok, '%s %s is %s, want %s' % (pool, name,
+                                             self.stat(pool, name, server), value)
+
+    def log(self):
+        try:
+            return open(self.path + '.log').read()
+        except IOError:
+            return ''
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, *exc):
+        self.stop()
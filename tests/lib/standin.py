@@ -0,0 +1,591 @@
+#!/usr/bin/env python
+#coding: utf-8
+#file   : standin.py
+#
+# Stand-in servers for the tests that run a nutcracker of their own (see
+# nutcracker.py): an in-memory redis, a memcached speaking the ASCII, meta
+# and binary protocols, a redis sentinel and a name server. Each records
+# what it was sent, and can be told to answer late or to hang up.
+
+import socket
+import struct
+import threading
+import time
+
+def free_port():
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+def wait_until(cond, timeout=5.0, interval=0.05):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if cond():
+            return True
+        time.sleep(interval)
+    return cond()
+
+class StandIn(object):
+    '''
+    A TCP server with a thread per connection, which feeds what it reads
+    to self.serve(conn, buf) and sends back what that returns.
+    '''
+
+    def __init__(self, host='127.0.0.1', port=0):
+        self.host = host
+        self.port = port
+        self.delay = 0          # sec to wait before each reply
+        self.nconn = 0          # connections accepted
+        self.conns = []         # connections open
+        self.log = []           # requests served, see serve()
+        self.lock = threading.Lock()
+        self.sock = None
+
+    def addr(self):
+        return '%s:%d' % (self.host, self.port)
+
+    def start(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind((self.host, self.port))
+        self.sock.listen(128)
+        self.sock.settimeout(0.1)
+        self.port = self.sock.getsockname()[1]
+        self.thread = threading.Thread(target=self._accept)
+        self.thread.daemon = True
+        self.thread.start()
+        return self
+
+    def stop(self):
+        if self.sock is not None:
+            self.sock = None
+            self.thread.join()
+        self.hangup()
+
+    def hangup(self):
+        '''close all connections open'''
+        with self.lock:
+            conns, self.conns = self.conns, []
+        for c in conns:
+            try:
+                c.shutdown(socket.SHUT_RDWR)
+            except socket.error:
+                pass
+            c.close()
+
+    def nopen(self):
+        with self.lock:
+            return len(self.conns)
+
+    def _accept(self):
+        # polls till stop(), which then waits for the port to be closed
+        sock = self.sock
+        while self.sock is sock:
+            try:
+                c, _ = sock.accept()
+            except socket.timeout:
+                continue
+            c.settimeout(None)
+            with self.lock:
+                self.nconn += 1
+                self.conns.append(c)
+            t = threading.Thread(target=self._handle, args=(c,))
+            t.daemon = True
+            t.start()
+        sock.close()
+
+    def _handle(self, c):
+        buf = ''
+        try:
+            while True:
+                data = c.recv(65536)
+                if not data:
+                    break
+                buf += data
+                out, buf = self.serve(c, buf)
+                if out is None:
+                    break
+                if out:
+                    if self.delay:
+                        time.sleep(self.delay)
+                    c.sendall(out)
+        except socket.error:
+            pass
+        with self.lock:
+            if c in self.conns:
+                self.conns.remove(c)
+        c.close()
+
+    def serve(self, conn, buf):
+        '''returns (reply, rest of buf), with reply None to hang up'''
+        raise NotImplementedError
+
+def resp_encode(*args):
+    out = ['*%d\r\n' % len(args)]
+    for a in args:
+        a = str(a)
+        out.append('$%d\r\n%s\r\n' % (len(a), a))
+    return ''.join(out)
+
+def resp_parse(buf, pos=0):
+    '''returns (reply, end) of the reply at pos, or (None, -1) if partial'''
+    end = buf.find('\r\n', pos)
+    if end < 0:
+        return None, -1
+    kind, line = buf[pos], buf[pos + 1:end]
+    if kind == '+':
+        return line, end + 2
+    if kind == '-':
+        return Exception(line), end + 2
+    if kind == ':':
+        return int(line), end + 2
+    if kind == '$':
+        n = int(line)
+        if n < 0:
+            return None, end + 2
+        if len(buf) < end + 2 + n + 2:
+            return None, -1
+        return buf[end + 2:end + 2 + n], end + 2 + n + 2
+    if kind == '*':
+        n = int(line)
+        if n < 0:
+            return None, end + 2
+        items, pos = [], end + 2
+        for _ in range(n):
+            item, pos = resp_parse(buf, pos)
+            if pos < 0:
+                return None, -1
+            items.append(item)
+        return items, pos
+    raise ValueError('bad reply %r' % buf[pos:pos + 32])
+
+class RedisStandIn(StandIn):
+    '''
+    An in-memory redis of a few commands. fail holds upper case command
+    names on which it hangs up instead of answering; slow maps command
+    names to the sec to wait before answering them.
+    '''
+
+    def __init__(self, host='127.0.0.1', port=0):
+        StandIn.__init__(self, host, port)
+        self.data = {}
+        self.fail = set()
+        self.slow = {}
+        self.readonly = False
+
+    def serve(self, conn, buf):
+        out = []
+        while buf:
+            args, end = resp_parse(buf)
+            if end < 0:
+                break
+            buf = buf[end:]
+            cmd = args[0].upper()
+            with self.lock:
+                self.log.append([cmd] + args[1:])
+            if cmd in self.fail:
+                return None, ''
+            if cmd in self.slow:
+                time.sleep(self.slow[cmd])
+            out.append(self.command(cmd, args[1:]))
+        return ''.join(out), buf
+
+    def command(self, cmd, args):
+        d = self.data
+        if cmd == 'PING':
+            return '+PONG\r\n'
+        if cmd in ('AUTH', 'SELECT', 'QUIT'):
+            return '+OK\r\n'
+        if self.readonly and cmd in ('SET', 'MSET', 'DEL', 'UNLINK'):
+            return "-READONLY You can't write against a read only replica.\r\n"
+        if cmd == 'GET':
+            v = d.get(args[0])
+            return '$-1\r\n' if v is None else '$%d\r\n%s\r\n' % (len(v), v)
+        if cmd == 'SET':
+            if 'NX' in [a.upper() for a in args[2:]] and args[0] in d:
+                return '$-1\r\n'
+            d[args[0]] = args[1]
+            return '+OK\r\n'
+        if cmd == 'MGET':
+            out = ['*%d\r\n' % len(args)]
+            for k in args:
+                v = d.get(k)
+                out.append('$-1\r\n' if v is None else '$%d\r\n%s\r\n' % (len(v), v))
+            return ''.join(out)
+        if cmd == 'MSET':
+            for i in range(0, len(args), 2):
+                d[args[i]] = args[i + 1]
+            return '+OK\r\n'
+        if cmd in ('DEL', 'UNLINK'):
+            return ':%d\r\n' % len([k for k in args if d.pop(k, None) is not None])
+        if cmd in ('EXISTS', 'TOUCH'):
+            return ':%d\r\n' % len([k for k in args if k in d])
+        return "-ERR unknown command '%s'\r\n" % cmd
+
+class SentinelStandIn(StandIn):
+    '''
+    A redis sentinel for one master, which answers the master address and
+    publishes +switch-master to its subscribers on switch().
+    '''
+
+    def __init__(self, name, master, host='127.0.0.1', port=0):
+        StandIn.__init__(self, host, port)
+        self.name = name
+        self.master = master    # (host, port)
+        self.subscribers = []
+
+    def switch(self, host, port):
+        old, self.master = self.master, (host, port)
+        msg = '%s %s %d %s %d' % (self.name, old[0], old[1], host, port)
+        with self.lock:
+            subscribers = list(self.subscribers)
+        for c in subscribers:
+            c.sendall('*3\r\n$7\r\nmessage\r\n$14\r\n+switch-master\r\n'
+                      '$%d\r\n%s\r\n' % (len(msg), msg))
+
+    def serve(self, conn, buf):
+        out = []
+        while buf:
+            args, end = resp_parse(buf)
+            if end < 0:
+                break
+            buf = buf[end:]
+            with self.lock:
+                self.log.append(args)
+            cmd = args[0].upper()
+            if cmd == 'SENTINEL' and args[2] == self.name:
+                host, port = self.master
+                out.append(resp_encode(host, port))
+            elif cmd == 'SENTINEL':
+                out.append('*-1\r\n')
+            elif cmd == 'SUBSCRIBE':
+                with self.lock:
+                    self.subscribers.append(conn)
+                out.append('*3\r\n$9\r\nsubscribe\r\n$%d\r\n%s\r\n:1\r\n' %
+                           (len(args[1]), args[1]))
+            else:
+                out.append('-ERR unknown command\r\n')
+        return ''.join(out), buf
+
+MC_HEADER = '>BBHBBHIIQ'
+
+# quiet binary opcodes and their loud ones
+MC_QUIET = {0x09: 0x00, 0x0d: 0x0c, 0x11: 0x01, 0x12: 0x02, 0x13: 0x03,
+            0x14: 0x04, 0x15: 0x05, 0x16: 0x06, 0x19: 0x0e, 0x1a: 0x0f}
+
+def mc_bin_encode(op, key='', value='', extras='', opaque=0, cas=0,
+                  magic=0x80, status=0):
+    return struct.pack(MC_HEADER, magic, op, len(key), len(extras), 0, status,
+                       len(extras) + len(key) + len(value), opaque, cas) + \
+           extras + key + value
+
+def mc_bin_parse(buf):
+    '''returns (op, status, opaque, extras, key, value, rest), or None'''
+    if len(buf) < 24:
+        return None
+    magic, op, klen, elen, _, status, blen, opaque, cas = \
+        struct.unpack(MC_HEADER, buf[:24])
+    if len(buf) < 24 + blen:
+        return None
+    body = buf[24:24 + blen]
+    return (op, status, opaque, body[:elen], body[elen:elen + klen],
+            body[elen + klen:], buf[24 + blen:])
+
+class MemcacheStandIn(StandIn):
+    '''
+    An in-memory memcached of get, gets, set, add, delete and incr in the
+    ASCII protocol, mg, ms, md, ma and mn in the meta protocol, and the
+    same in the binary protocol. The log holds the ASCII and meta request
+    lines, and (opcode, key) of binary requests.
+    '''
+
+    def __init__(self, host='127.0.0.1', port=0):
+        StandIn.__init__(self, host, port)
+        self.data = {}      # key: (flags, value)
+        self.fail = set()   # commands or opcodes to hang up on
+
+    def serve(self, conn, buf):
+        if buf[:1] == '\x80':
+            return self.serve_binary(buf)
+        out = []
+        while '\r\n' in buf:
+            line, rest = buf.split('\r\n', 1)
+            t = line.split()
+            cmd = t[0] if t else ''
+            if cmd in ('set', 'add'):
+                n = int(t[4])
+                if len(rest) < n + 2:
+                    break
+                value, rest = rest[:n], rest[n + 2:]
+            elif cmd == 'ms':
+                n = int(t[2])
+                if len(rest) < n + 2:
+                    break
+                value, rest = rest[:n], rest[n + 2:]
+            buf = rest
+            with self.lock:
+                self.log.append(line)
+            if cmd in self.fail:
+                return None, ''
+            if cmd in ('get', 'gets'):
+                for k in t[1:]:
+                    if k in self.data:
+                        f, v = self.data[k]
+                        out.append('VALUE %s %d %d%s\r\n%s\r\n' %
+                                   (k, f, len(v), ' 1' if cmd == 'gets' else '', v))
+                out.append('END\r\n')
+            elif cmd in ('set', 'add'):
+                if cmd == 'add' and t[1] in self.data:
+                    out.append('NOT_STORED\r\n')
+                else:
+                    self.data[t[1]] = (int(t[2]), value)
+                    out.append('STORED\r\n')
+            elif cmd == 'delete':
+                found = self.data.pop(t[1], None) is not None
+                out.append('DELETED\r\n' if found else 'NOT_FOUND\r\n')
+            elif cmd == 'incr':
+                if t[1] in self.data:
+                    f, v = self.data[t[1]]
+                    v = str(int(v) + int(t[2]))
+                    self.data[t[1]] = (f, v)
+                    out.append('%s\r\n' % v)
+                else:
+                    out.append('NOT_FOUND\r\n')
+            elif cmd in ('mg', 'ms', 'md', 'ma', 'mn'):
+                out.append(self.meta(cmd, t, value if cmd == 'ms' else None))
+            else:
+                out.append('ERROR\r\n')
+        return ''.join(out), buf
+
+    def meta(self, cmd, t, value):
+        if cmd == 'mn':
+            return 'MN\r\n'
+        key = t[1]
+        flags = t[3:] if cmd == 'ms' else t[2:]
+        ret = ''.join(' ' + f for f in flags if f[0] == 'O')
+        if 'k' in flags:
+            ret += ' k' + key
+        if cmd == 'mg':
+            if key not in self.data:
+                return 'EN\r\n' if 'q' not in flags else ''
+            f, v = self.data[key]
+            if 'v' in flags:
+                return 'VA %d%s\r\n%s\r\n' % (len(v), ret, v)
+            return 'HD%s\r\n' % ret
+        if cmd == 'ms':
+            self.data[key] = (0, value)
+            return '' if 'q' in flags else 'HD%s\r\n' % ret
+        if cmd == 'md':
+            if self.data.pop(key, None) is None:
+                return 'NF%s\r\n' % ret
+            return '' if 'q' in flags else 'HD%s\r\n' % ret
+        if key not in self.data:
+            return 'NF%s\r\n' % ret
+        f, v = self.data[key]
+        self.data[key] = (f, str(int(v) + 1))
+        return 'HD%s\r\n' % ret
+
+    def serve_binary(self, buf):
+        out = []
+        while True:
+            req = mc_bin_parse(buf)
+            if req is None:
+                break
+            op, _, opaque, extras, key, value, buf = req
+            with self.lock:
+                self.log.append((op, key))
+            if op in self.fail:
+                return None, ''
+            out.append(self.binary(op, opaque, extras, key, value))
+        return ''.join(out), buf
+
+    def binary(self, op, opaque, extras, key, value):
+        quiet = op in MC_QUIET
+        lop = MC_QUIET.get(op, op)
+        rsp = lambda status=0, extras='', key='', value='': \
+            mc_bin_encode(op, key, value, extras, opaque, 1, 0x81, status)
+        if lop in (0x00, 0x0c):
+            if key not in self.data:
+                return '' if quiet else rsp(1, key=key if lop == 0x0c else '')
+            f, v = self.data[key]
+            return rsp(0, struct.pack('>I', f), key if lop == 0x0c else '', v)
+        if lop in (0x01, 0x02):
+            if lop == 0x02 and key in self.data:
+                return rsp(2)
+            self.data[key] = (struct.unpack('>I', extras[:4])[0], value)
+            return '' if quiet else rsp()
+        if lop == 0x04:
+            if self.data.pop(key, None) is None:
+                return rsp(1)
+            return '' if quiet else rsp()
+        if lop == 0x0a:
+            return rsp()
+        return rsp(0x81, value='Unknown command')
+
+class DnsStandIn(object):
+    '''
+    A name server on 127.0.0.1:53 that answers A queries from table, after
+    delay sec for the names in slow, and NXDOMAIN for other names. Only of
+    use where the system resolver asks 127.0.0.1 (see usable()).
+    '''
+
+    def __init__(self, table):
+        self.table = dict(table)
+        self.slow = {}
+        self.log = []
+        self.sock = None
+
+    @staticmethod
+    def usable():
+        try:
+            if 'nameserver 127.0.0.1' not in open('/etc/resolv.conf').read():
+                return False
+            s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            s.bind(('127.0.0.1', 53))
+            s.close()
+            return True
+        except (IOError, socket.error):
+            return False
+
+    def start(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(('127.0.0.1', 53))
+        self.sock.settimeout(0.1)
+        self.thread = threading.Thread(target=self._serve)
+        self.thread.daemon = True
+        self.thread.start()
+        return self
+
+    def stop(self):
+        if self.sock is not None:
+            self.sock = None
+            self.thread.join()
+
+    def _serve(self):
+        sock = self.sock
+        while self.sock is sock:
+            try:
+                q, addr = sock.recvfrom(512)
+            except socket.timeout:
+                continue
+            t = threading.Thread(target=self._answer, args=(sock, q, addr))
+            t.daemon = True
+            t.start()
+        sock.close()
+
+    def _answer(self, sock, q, addr):
+        tid = struct.unpack('>H', q[:2])[0]
+        p, labels = 12, []
+        while ord(q[p]):
+            n = ord(q[p])
+            labels.append(q[p + 1:p + 1 + n])
+            p += 1 + n
+        name = '.'.join(labels)
+        qtype = struct.unpack('>H', q[p + 1:p + 3])[0]
+        question = q[12:p + 5]
+        self.log.append((name, qtype))
+        if name in self.slow:
+            time.sleep(self.slow[name])
+        header = lambda rcode, nanswer: \
+            struct.pack('>HHHHHH', tid, 0x8180 | rcode, 1, nanswer, 0, 0)
+        if name not in self.table:
+            r = header(3, 0) + question
+        elif qtype == 1:
+            r = header(0, 1) + question + \
+                struct.pack('>HHHIH', 0xc00c, 1, 1, 1, 4) + \
+                socket.inet_aton(self.table[name])
+        else:
+            r = header(0, 0) + question
+        try:
+            sock.sendto(r, addr)
+        except (socket.error, AttributeError):
+            pass
+
+class RedisClient(object):
+    '''a blocking redis client over a raw socket, see call()'''
+
+    def __init__(self, port, host='127.0.0.1', timeout=5):
+        self.sock = socket.create_connection((host, port), timeout)
+        self.buf = ''
+
+    def close(self):
+        self.sock.close()
+
+    def send(self, *args):
+        self.sock.sendall(resp_encode(*args))
+
+    def reply(self):
+        while True:
+            if self.buf:
+                r, end = resp_parse(self.buf)
+                if end >= 0:
+                    self.buf = self.buf[end:]
+                    return r
+            data = self.sock.recv(65536)
+            if not data:
+                raise socket.error('connection closed')
+            self.buf += data
+
+    def call(self, *args):
+        self.send(*args)
+        return self.reply()
+
+class MemcacheClient(object):
+    '''a blocking memcache client over a raw socket'''
+
+    def __init__(self, port, host='127.0.0.1', timeout=5):
+        self.sock = socket.create_connection((host, port), timeout)
+        self.buf = ''
+
+    def close(self):
+        self.sock.close()
+
+    def recv_until(self, end):
+        while not self.buf.endswith(end):
+            data = self.sock.recv(65536)
+            if not data:
+                raise socket.error('connection closed')
+            self.buf += data
+        r, self.buf = self.buf, ''
+        return r
+
+    def call(self, req, end='\r\n'):
+        '''send req and return the reply up to end'''
+        self.sock.sendall(req)
+        return self.recv_until(end)
+
+    def get(self, *keys):
+        r = self.call('get %s\r\n' % ' '.join(keys), 'END\r\n')
+        lines, kv = r.split('\r\n'), {}
+        for i, line in enumerate(lines):
+            if line.startswith('VALUE '):
+                kv[line.split()[1]] = lines[i + 1]
+        return kv
+
+    def set(self, key, value, flags=0):
+        return self.call('set %s %d 0 %d\r\n%s\r\n' %
+                         (key, flags, len(value), value)) == 'STORED\r\n'
+
+    def delete(self, key):
+        return self.call('delete %s\r\n' % key)
+
+    def binary(self, *reqs):
+        '''send binary requests and return the responses up to the last opaque'''
+        self.sock.sendall(''.join(reqs))
+        last = mc_bin_parse(reqs[-1])[2]
+        rsps = []
+        while True:
+            rsp = mc_bin_parse(self.buf)
+            if rsp is None:
+                data = self.sock.recv(65536)
+                if not data:
+                    raise socket.error('connection closed')
+                self.buf += data
+                continue
+            self.buf = rsp[-1]
+            rsps.append(rsp[:-1])
+            if rsp[2] == last:
+                return rsps
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import struct
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    memcache_binary: true
+    hash: murmur
+    distribution: ketama
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+'''
+
+GET, SET, DELETE, NOOP, GETQ, GETK, GETKQ, SETQ, DELETEQ = \
+    0x00, 0x01, 0x04, 0x0a, 0x09, 0x0c, 0x0d, 0x11, 0x14
+
+def set_req(op, key, value, flags=0, opaque=0):
+    return mc_bin_encode(op, key, value, struct.pack('>II', flags, 0), opaque)
+
+def start():
+    servers = [MemcacheStandIn().start(), MemcacheStandIn().start()]
+    nc = NutCracker(conf, s1=servers[0].port, s2=servers[1].port).start()
+    return nc, servers, MemcacheClient(nc.port)
+
+def stop(nc, servers, c):
+    c.close()
+    nc.stop()
+    for s in servers:
+        s.stop()
+
+def test_get_set_delete():
+    nc, servers, c = start()
+    try:
+        [(op, status, opaque, _, _, _)] = c.binary(set_req(SET, 'k', 'v', 5, 1))
+        assert_equal((SET, 0, 1), (op, status, opaque))
+
+        [(op, status, opaque, extras, key, value)] = c.binary(mc_bin_encode(GET, 'k', opaque=2))
+        assert_equal((GET, 0, 2, 5, '', 'v'),
+                     (op, status, opaque, struct.unpack('>I', extras)[0], key, value))
+
+        [(op, status, _, _, key, value)] = c.binary(mc_bin_encode(GETK, 'k', opaque=3))
+        assert_equal((GETK, 0, 'k', 'v'), (op, status, key, value))
+
+        [(op, status, _, _, _, _)] = c.binary(mc_bin_encode(DELETE, 'k', opaque=4))
+        assert_equal((DELETE, 0), (op, status))
+
+        [(op, status, _, _, _, _)] = c.binary(mc_bin_encode(GET, 'k', opaque=5))
+        assert_equal((GET, 1), (op, status))
+        [(op, status, _, _, _, _)] = c.binary(mc_bin_encode(DELETE, 'k', opaque=6))
+        assert_equal((DELETE, 1), (op, status))
+    finally:
+        stop(nc, servers, c)
+
+def test_quiet():
+    nc, servers, c = start()
+    keys = ['key-%d' % i for i in range(10)]
+    try:
+        # a quiet set that succeeds is not answered
+        reqs = [set_req(SETQ, k, 'v-' + k, opaque=i) for i, k in enumerate(keys)]
+        rsps = c.binary(*(reqs + [mc_bin_encode(NOOP, opaque=100)]))
+        assert_equal([(NOOP, 0, 100)], [r[:3] for r in rsps])
+        assert servers[0].data and servers[1].data, 'keys of one server only'
+
+        # a getkq run is split over the servers, and answered by server,
+        # without the misses, before the noop that ends it
+        reqs = [mc_bin_encode(GETKQ, k, opaque=i) for i, k in enumerate(keys)]
+        reqs.insert(3, mc_bin_encode(GETKQ, 'missing', opaque=50))
+        rsps = c.binary(*(reqs + [mc_bin_encode(NOOP, opaque=100)]))
+        assert_equal((NOOP, 0, 100), rsps[-1][:3])
+        assert_equal([(GETKQ, 0, i, k, 'v-' + k) for i, k in enumerate(keys)],
+                     sorted((r[0], r[1], r[2], r[4], r[5]) for r in rsps[:-1]))
+
+        # a getq run ended by a get, whose miss is answered
+        rsps = c.binary(mc_bin_encode(GETQ, keys[0], opaque=1),
+                        mc_bin_encode(GETQ, keys[1], opaque=2),
+                        mc_bin_encode(GET, 'missing', opaque=3))
+        assert_equal((GET, 1, 3), rsps[-1][:3])
+        assert_equal([(GETQ, 0, 1, 'v-' + keys[0]), (GETQ, 0, 2, 'v-' + keys[1])],
+                     sorted((r[0], r[1], r[2], r[5]) for r in rsps[:-1]))
+
+        # a quiet delete is answered on a miss only
+        rsps = c.binary(mc_bin_encode(DELETEQ, keys[0], opaque=1),
+                        mc_bin_encode(DELETEQ, 'missing', opaque=2),
+                        mc_bin_encode(NOOP, opaque=3))
+        assert_equal([(DELETEQ, 1, 2), (NOOP, 0, 3)], [r[:3] for r in rsps])
+        assert keys[0] not in servers[0].data and keys[0] not in servers[1].data
+    finally:
+        stop(nc, servers, c)
+
+def test_quiet_error():
+    # the proxy answers a quiet set it could not forward with the opcode
+    # the client sent
+    nc = NutCracker(conf, s1=free_port(), s2=free_port()).start()
+    c = MemcacheClient(nc.port)
+    try:
+        rsps = c.binary(set_req(SETQ, 'k', 'v', opaque=7),
+                        mc_bin_encode(NOOP, opaque=8))
+        assert_equal([(SETQ, 7), (NOOP, 8)], [(r[0], r[2]) for r in rsps])
+        assert rsps[0][1] != 0, rsps[0]
+    finally:
+        c.close()
+        nc.stop()
+
+def test_migrate_from_rejected():
+    nc = NutCracker(conf + '''
+  beta:
+    listen: 127.0.0.1:{port1}
+    memcache_binary: true
+    migrate_from: alpha
+    servers:
+     - 127.0.0.1:{s1}:1
+''', s1=free_port(), s2=free_port())
+    status, out = nc.test_conf()
+    assert status != 0
+    assert 'cannot migrate_from' in out, out
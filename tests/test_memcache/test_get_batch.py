@@ -0,0 +1,51 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    get_batch: 4
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+keys = ['key-%d' % i for i in range(10)]
+
+def test_get_batch():
+    # pipelined gets are sent as multi-key gets, and each get has its own reply
+    server = MemcacheStandIn().start()
+    for k in keys[1:]:
+        server.data[k] = (0, 'v-' + k)
+    nc = NutCracker(conf, server=server.port)
+    try:
+        nc.start()
+        c = MemcacheClient(nc.port)
+        c.sock.sendall(''.join('get %s\r\n' % k for k in keys))
+        want = 'END\r\n' + ''.join('VALUE %s 0 %d\r\nv-%s\r\nEND\r\n' %
+                                   (k, len(k) + 2, k) for k in keys[1:])
+        while len(c.buf) < len(want):
+            c.buf += c.sock.recv(65536)
+        assert_equal(want, c.buf)
+        c.close()
+
+        gets = [l.split()[1:] for l in server.log]
+        assert any(len(g) > 1 for g in gets), server.log
+        assert all(len(g) <= 4 for g in gets), server.log
+        assert_equal(keys, [k for g in gets for k in g])
+        nc.wait_stat('alpha', 'get_batches', 1, '127.0.0.1:%d' % server.port)
+    finally:
+        nc.stop()
+        server.stop()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    hash: murmur
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+'''
+
+keys = ['key-%d' % i for i in range(10)]
+
+def run(test):
+    servers = [MemcacheStandIn().start() for i in range(2)]
+    nc = NutCracker(conf, s1=servers[0].port, s2=servers[1].port)
+    try:
+        nc.start()
+        c = MemcacheClient(nc.port)
+        test(c, servers)
+        c.close()
+    finally:
+        nc.stop()
+        for s in servers:
+            s.stop()
+
+def test_meta():
+    def test(c, servers):
+        for k in keys:
+            assert_equal('HD\r\n', c.call('ms %s 2 T0\r\n%s\r\n' % (k, k[-2:])))
+        assert all(s.data for s in servers)
+        assert_equal('VA 2 Oabc kkey-1\r\n-1\r\n',
+                     c.call('mg key-1 v k Oabc\r\n', '-1\r\n'))
+        assert_equal('EN\r\n', c.call('mg nokey v\r\n'))
+        assert_equal('HD\r\n', c.call('ma key-5\r\n'))
+        assert_equal('HD\r\n', c.call('md key-5\r\n'))
+        assert_equal('NF\r\n', c.call('md key-5\r\n'))
+        assert_equal('MN\r\n', c.call('mn\r\n'))
+    run(test)
+
+def test_meta_quiet_pipeline():
+    # quiet misses, stores and deletes are left out, the other replies come
+    # in the order of the requests across servers, and mn after all of them
+    def test(c, servers):
+        c.sock.sendall(''.join('ms %s 1 q\r\nv\r\n' % k for k in keys[::2]) +
+                       ''.join('mg %s v k q\r\n' % k for k in keys) +
+                       'md key-0 q\r\nma nokey q\r\nmn\r\n')
+        want = ''.join('VA 1 k%s\r\nv\r\n' % k for k in keys[::2]) + \
+               'NF\r\nMN\r\n'
+        assert_equal(want, c.recv_until('MN\r\n'))
+        # the proxy does the quiet mode, the servers see every request
+        assert_equal(len(keys) // 2 * 3 + 2,
+                     sum(len(s.log) for s in servers))
+    run(test)
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    hash: murmur
+    distribution: ketama
+    mirror: beta
+    mirror_commands: {commands}
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+  beta:
+    listen: 127.0.0.1:{port1}
+    servers:
+     - 127.0.0.1:{m}:1
+'''
+
+def run(commands, nmirror):
+    servers = [MemcacheStandIn().start() for i in range(2)]
+    mirror = MemcacheStandIn().start()
+    nc = NutCracker(conf, commands=commands, s1=servers[0].port,
+                    s2=servers[1].port, m=mirror.port)
+    c = None
+    try:
+        nc.start()
+        c = MemcacheClient(nc.port)
+        assert c.set('k1', 'v1')
+        assert c.set('k2', 'v2')
+        assert_equal({'k1': 'v1'}, c.get('k1'))
+        assert_equal({'k1': 'v1', 'k2': 'v2'}, c.get('k1', 'k2'))
+        assert_equal('DELETED\r\n', c.delete('k2'))
+        nc.wait_stat('alpha', 'mirrors', nmirror)
+        assert wait_until(lambda: len(mirror.log) == nmirror)
+        return mirror.log
+    finally:
+        if c is not None:
+            c.close()
+        nc.stop()
+        mirror.stop()
+        for s in servers:
+            s.stop()
+
+def test_mirror_reads():
+    # a single key get is mirrored, though every get is split by key
+    log = run('reads', 1)
+    assert_equal(['get k1'], [l.strip() for l in log])
+
+def test_mirror_writes():
+    log = run('writes', 3)
+    assert_equal(['set k1 0 0 2', 'set k2 0 0 2', 'delete k2'], log)
+
+def test_mirror_all():
+    log = run('all', 4)
+    assert_equal(['set k1 0 0 2', 'set k2 0 0 2', 'get k1', 'delete k2'],
+                 [l.strip() for l in log])
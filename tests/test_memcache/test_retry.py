@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import socket
+import sys
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    hash: murmur
+    distribution: ketama
+    auto_eject_hosts: true
+    server_failure_limit: 1
+    server_retry_timeout: 30000
+    read_retries: {retries}
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+'''
+
+keys = ['key-%d' % i for i in range(20)]
+
+def run(retries):
+    '''gets of keys on both servers, one of which hangs up on gets'''
+    servers = [MemcacheStandIn().start() for i in range(2)]
+    for s in servers:
+        for k in keys:
+            s.data[k] = (0, 'v-' + k)
+    servers[0].fail.add('get')
+    nc = NutCracker(conf, retries=retries, s1=servers[0].port,
+                    s2=servers[1].port)
+    try:
+        nc.start()
+        got = {}
+        for k in keys:
+            c = MemcacheClient(nc.port, timeout=1)
+            try:
+                r = c.call('get %s\r\n' % k, '\r\n')
+                if r.startswith('VALUE '):
+                    if not r.endswith('END\r\n'):
+                        r += c.recv_until('END\r\n')
+                    got[k] = r.split('\r\n')[1]
+            except socket.error:
+                pass
+            c.close()
+        return got
+    finally:
+        nc.stop()
+        for s in servers:
+            s.stop()
+
+def test_retry_get():
+    # a get that fails with its server is answered by the next owner
+    got = run(1)
+    assert_equal(dict((k, 'v-' + k) for k in keys), got)
+
+def test_no_retry_get():
+    got = run(0)
+    assert len(got) < len(keys), got
@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    admission_latency: {latency}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def pipeline(latency, n=100):
+    '''replies to n pipelined GETs on a slow server'''
+    server = RedisStandIn().start()
+    server.data['k'] = 'v'
+    server.slow['GET'] = 0.01
+    nc = NutCracker(conf, latency=latency, server=server.port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port, timeout=10)
+        r.sock.sendall(resp_encode('GET', 'k') * n)
+        replies = [r.reply() for i in range(n)]
+        r.close()
+        shed = [x for x in replies if isinstance(x, Exception)]
+        if latency:
+            name = '127.0.0.1:%d' % server.port
+            nc.wait_stat('alpha', 'requests_shed', len(shed), name)
+            limit = nc.stat('alpha', 'admission_limit', name)
+            assert 4 <= limit <= 64, limit
+        return len(shed), str(shed[0]) if shed else None
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_admission_shed():
+    # requests over the initial limit of 64 are rejected right away
+    nshed, err = pipeline(50)
+    assert 0 < nshed <= 36, nshed
+    assert 'busy' in err, err
+
+def test_no_admission():
+    assert_equal((0, None), pipeline(0))
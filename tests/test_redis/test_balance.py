@@ -0,0 +1,56 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import time
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    server_connections: 2
+    server_connection_balance: {balance}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def wait_behind_slow(balance):
+    '''msec a SET waits with a slow GET in flight on one of two connections'''
+    server = RedisStandIn().start()
+    server.slow['GET'] = 1.0
+    nc = NutCracker(conf, balance=balance, server=server.port)
+    try:
+        nc.start()
+        slow, fast = RedisClient(nc.port), RedisClient(nc.port)
+
+        # the slow GET and the first SET open a connection each
+        slow.send('GET', 'k')
+        assert wait_until(lambda: server.nopen() == 1)
+        assert_equal('OK', fast.call('SET', 'k', 'v'))
+        assert_equal(2, server.nopen())
+
+        start = time.time()
+        assert_equal('OK', fast.call('SET', 'k', 'v'))
+        elapsed = time.time() - start
+        slow.reply()
+        slow.close()
+        fast.close()
+        return elapsed * 1000
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_least_requests():
+    # the SET skips the connection with the slow GET in flight
+    assert wait_behind_slow('least_requests') < 500
+
+def test_round_robin():
+    # the SET takes the least recently used connection, with the slow GET
+    assert wait_behind_slow('round_robin') >= 500
+
+def test_least_bytes():
+    assert wait_behind_slow('least_bytes') < 500
@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import socket
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    client_idle_timeout: 500
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def closed(c, timeout):
+    c.sock.settimeout(timeout)
+    try:
+        return c.sock.recv(1) == ''
+    except socket.timeout:
+        return False
+    except socket.error:
+        return True
+
+def test_client_idle_timeout():
+    # a quiet client is closed, one with a request outstanding is not
+    server = RedisStandIn().start()
+    server.slow['GET'] = 1.0
+    nc = NutCracker(conf, server=server.port)
+    try:
+        nc.start()
+        quiet = RedisClient(nc.port)
+        assert_equal('OK', quiet.call('SET', 'k', 'v'))
+        busy = RedisClient(nc.port)
+        busy.send('GET', 'k')
+
+        assert closed(quiet, 3)
+        assert_equal('v', busy.reply())
+        nc.wait_stat('alpha', 'client_idle_timeouts', 1)
+        busy.close()
+    finally:
+        nc.stop()
+        server.stop()
@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import time
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    timeout: 5000
+    command_timeouts:
+     - get 100
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def test_expire_queued_get():
+    # a GET queued behind a large SET the server is slow to read is dropped
+    # once its deadline passed, instead of being sent
+    server = RedisStandIn().start()
+    server.slow['SET'] = 1.0
+    nc = NutCracker(conf, server=server.port)
+    name = '127.0.0.1:%d' % server.port
+    try:
+        nc.start()
+        first, large, get = [RedisClient(nc.port) for i in range(3)]
+        first.send('SET', 'a', 'v')
+        assert wait_until(lambda: server.log)
+        large.send('SET', 'b', 'x' * (16 << 20))
+        time.sleep(0.2)
+        get.send('GET', 'a')
+
+        reply = get.reply()
+        assert isinstance(reply, Exception), reply
+        assert_equal('OK', first.reply())
+        assert_equal('OK', large.reply())
+        nc.wait_stat('alpha', 'requests_expired', 1, name)
+        assert ['GET', 'a'] not in server.log
+        for c in (first, large, get):
+            c.close()
+    finally:
+        nc.stop()
+        server.stop()
@@ -0,0 +1,69 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    distribution: ketama
+    hash: murmur
+    auto_eject_hosts: true
+    server_failure_limit: 1
+    server_retry_timeout: 1000
+    timeout: 500
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+     - 127.0.0.1:{s3}:1
+'''
+
+keys = ['key-%d' % i for i in range(100)]
+
+def owners(servers):
+    return dict((k, i) for i, s in enumerate(servers) for k in s.data)
+
+def test_eject_readmit_keeps_distribution():
+    servers = [RedisStandIn().start() for i in range(3)]
+    nc = NutCracker(conf, s1=servers[0].port, s2=servers[1].port,
+                    s3=servers[2].port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        for k in keys:
+            assert_equal('OK', r.call('SET', k, 'v'))
+        before = owners(servers)
+        assert_equal(len(keys), len(before))
+
+        # the keys of an ejected server go to the others, and only those
+        port = servers[1].port
+        servers[1].stop()
+        assert wait_until(lambda: all(r.call('SET', k, 'v') == 'OK' for k in keys))
+        nc.wait_stat('alpha', 'server_ejects', 1)
+        moved = dict((k, i) for i, s in enumerate(servers) if i != 1
+                     for k in s.data)
+        for k in keys:
+            if before[k] != 1:
+                assert_equal(before[k], moved[k])
+
+        # a readmitted server gets back exactly the keys it had
+        servers[1] = RedisStandIn(port=port).start()
+        for s in servers:
+            s.data.clear()
+        time.sleep(1.5)
+        assert wait_until(lambda: all(r.call('SET', k, 'v') == 'OK' for k in keys)
+                          and servers[1].data)
+        for s in servers:
+            s.data.clear()
+        for k in keys:
+            assert_equal('OK', r.call('SET', k, 'v'))
+        assert_equal(before, owners(servers))
+        r.close()
+    finally:
+        nc.stop()
+        for s in servers:
+            s.stop()
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    get_batch: {batch}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+keys = ['key-%d' % i for i in range(10)]
+
+def pipeline(batch):
+    '''replies to pipelined GETs, and the commands the server saw'''
+    server = RedisStandIn().start()
+    for k in keys[1:]:
+        server.data[k] = 'v-' + k
+    nc = NutCracker(conf, batch=batch, server=server.port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        r.sock.sendall(''.join(resp_encode('GET', k) for k in keys))
+        replies = [r.reply() for k in keys]
+        r.close()
+        if batch:
+            name = '127.0.0.1:%d' % server.port
+            nc.wait_stat('alpha', 'get_batches', 1, name)
+            assert_equal(sum(len(l) - 1 for l in server.log if l[0] == 'MGET'),
+                         nc.stat('alpha', 'batched_gets', name))
+        return replies, server.log
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_get_batch():
+    # pipelined gets are sent as MGETs of up to get_batch keys, and each
+    # get has its own reply
+    replies, log = pipeline(4)
+    assert_equal([None] + ['v-' + k for k in keys[1:]], replies)
+    assert any(l[0] == 'MGET' for l in log), log
+    assert all(len(l) - 1 <= 4 for l in log if l[0] == 'MGET'), log
+    assert_equal(keys, [k for l in log for k in l[1:]])
+
+def test_no_get_batch():
+    replies, log = pipeline(0)
+    assert_equal([None] + ['v-' + k for k in keys[1:]], replies)
+    assert_equal([['GET', k] for k in keys], log)
@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import time
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    hash: murmur
+    hedge_delay: {delay}
+    hedge_budget: 100
+    servers:
+     - 127.0.0.1:{master}:1 master
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+'''
+
+keys = ['key-%d' % i for i in range(10)]
+
+def slowest_read(delay):
+    '''sec of the slowest GET of keys with one of two replicas slow'''
+    master = RedisStandIn().start()
+    replicas = [RedisStandIn().start() for i in range(2)]
+    for s in replicas:
+        for k in keys:
+            s.data[k] = 'v-' + k
+    replicas[0].slow['GET'] = 1.0
+    nc = NutCracker(conf, delay=delay, master=master.port,
+                    s1=replicas[0].port, s2=replicas[1].port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        slowest = 0
+        for k in keys:
+            start = time.time()
+            assert_equal('v-' + k, r.call('GET', k))
+            slowest = max(slowest, time.time() - start)
+        r.close()
+        if delay:
+            nc.wait_stat('alpha', 'hedge_wins', 1)
+            assert nc.stat('alpha', 'hedges') >= nc.stat('alpha', 'hedge_wins')
+        else:
+            assert_equal(0, nc.stat('alpha', 'hedges'))
+        return slowest
+    finally:
+        nc.stop()
+        master.stop()
+        for s in replicas:
+            s.stop()
+
+def test_hedge():
+    # a read stuck on the slow replica is answered by the other one
+    assert slowest_read(100) < 0.6
+
+def test_no_hedge():
+    assert slowest_read(0) >= 1.0
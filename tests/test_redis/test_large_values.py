@@ -0,0 +1,53 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    hash: murmur
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+     - 127.0.0.1:{s3}:1
+'''
+
+def test_mset_mget_large_values():
+    # the values of fragments, sliced or copied, arrive byte for byte
+    servers = [RedisStandIn().start() for i in range(3)]
+    nc = NutCracker(conf, s1=servers[0].port, s2=servers[1].port,
+                    s3=servers[2].port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port, timeout=10)
+        sizes = [10, 500, 1023, 1024, 1500, 16 << 10, 100 << 10, 2 << 20]
+        kv = [('key-%d' % i, os.urandom(n)) for i, n in enumerate(sizes)]
+        args = []
+        for k, v in kv:
+            args += [k, v]
+        assert_equal('OK', r.call('MSET', *args))
+        assert all(s.data for s in servers)
+
+        stored = {}
+        for s in servers:
+            stored.update(s.data)
+        assert_equal(dict(kv), stored)
+        assert_equal([v for k, v in kv], r.call('MGET', *[k for k, v in kv]))
+
+        # and so on a client that goes away with its fragments in flight
+        c = RedisClient(nc.port)
+        c.send('MGET', *[k for k, v in kv])
+        c.close()
+        assert_equal([v for k, v in kv], r.call('MGET', *[k for k, v in kv]))
+        r.close()
+    finally:
+        nc.stop()
+        for s in servers:
+            s.stop()
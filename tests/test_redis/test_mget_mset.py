@@ -191,6 +191,18 @@ def test_multi_delete_normal():
     for i in range(100):
         assert_equal(None, r.get('key-%s'%i) )
 
+def test_multi_exists_touch_unlink():
+    r = get_redis_conn(is_ms=False)
+
+    for i in range(100):
+        r.set('key-%s'%i, 'val-%s'%i)
+
+    keys = ['key-%s'%i for i in range(100)] + ['kkk-%s'%i for i in range(10)]
+    assert_equal(100, r.execute_command('EXISTS', *keys))
+    assert_equal(100, r.execute_command('TOUCH', *keys))
+    assert_equal(100, r.execute_command('UNLINK', *keys))
+    assert_equal(0, r.execute_command('EXISTS', *keys))
+
 #def test_multi_delete_on_readonly():
 #    all_redis[0].slaveof(all_redis[1].args['host'], all_redis[1].args['port'])
 #
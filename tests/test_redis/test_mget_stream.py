@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import socket
+import time
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    hash: murmur
+    mget_stream: {stream}
+    mget_batch: {batch}
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+'''
+
+keys = ['key-%d' % i for i in range(20)]
+
+def setup(stream, batch=0):
+    servers = [RedisStandIn().start() for i in range(2)]
+    nc = NutCracker(conf, stream=stream, batch=batch, s1=servers[0].port,
+                    s2=servers[1].port)
+    nc.start()
+    r = RedisClient(nc.port)
+    args = []
+    for k in keys:
+        args += [k, 'v-' + k]
+    assert_equal('OK', r.call('MSET', *args))
+    r.close()
+    assert all(s.data for s in servers)
+    return nc, servers
+
+def stop(nc, servers):
+    nc.stop()
+    for s in servers:
+        s.stop()
+
+def first_byte(stream):
+    '''sec to the first byte and to the whole reply of a MGET whose last
+    keys are on a slow server'''
+    nc, servers = setup(stream)
+    try:
+        slow = servers[1]
+        order = [k for k in keys if k not in slow.data] + \
+                [k for k in keys if k in slow.data]
+        slow.slow['MGET'] = 1.0
+        r = RedisClient(nc.port)
+        start = time.time()
+        r.send('MGET', *order)
+        r.buf = r.sock.recv(65536)
+        first = time.time() - start
+        assert_equal(['v-' + k for k in order], r.reply())
+        r.close()
+        return first, time.time() - start
+    finally:
+        stop(nc, servers)
+
+def test_mget_stream():
+    # the keys of the fast server are sent before the slow one answers
+    first, total = first_byte('true')
+    assert first < 0.5 <= total, (first, total)
+
+def test_no_mget_stream():
+    first, total = first_byte('false')
+    assert first >= 0.5, first
+
+def test_mget_batch():
+    # a server gets the keys of a MGET in requests of at most mget_batch
+    nc, servers = setup('true', 3)
+    try:
+        for s in servers:
+            del s.log[:]
+        r = RedisClient(nc.port)
+        assert_equal(['v-' + k for k in keys], r.call('MGET', *keys))
+        r.close()
+        mgets = [l for s in servers for l in s.log if l[0] == 'MGET']
+        assert all(len(l) - 1 <= 3 for l in mgets), mgets
+        assert_equal(sorted(keys), sorted(k for l in mgets for k in l[1:]))
+    finally:
+        stop(nc, servers)
+
+def test_mget_stream_server_failure():
+    # a server failing after part of the reply went out closes the client
+    nc, servers = setup('true')
+    try:
+        slow = servers[1]
+        order = [k for k in keys if k not in slow.data] + \
+                [k for k in keys if k in slow.data]
+        slow.slow['MGET'] = 2.0
+        r = RedisClient(nc.port)
+        r.send('MGET', *order)
+        data = r.sock.recv(65536)
+        slow.hangup()
+        try:
+            while True:
+                d = r.sock.recv(65536)
+                if not d:
+                    break
+                data += d
+        except socket.error:
+            pass
+        assert data.startswith('*%d\r\n' % len(keys)), data[:32]
+        assert_equal((None, -1), resp_parse(data))
+        r.close()
+    finally:
+        stop(nc, servers)
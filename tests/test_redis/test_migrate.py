@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    migrate_from: old
+    migrate_writeback: true
+    servers:
+     - 127.0.0.1:{new}:1
+  old:
+    listen: 127.0.0.1:{port1}
+    redis: true
+    servers:
+     - 127.0.0.1:{old}:1
+'''
+
+def test_migrate():
+    new, old = RedisStandIn().start(), RedisStandIn().start()
+    old.data.update({'a': '1', 'b': '2', 'c': '3'})
+    new.data['b'] = 'new'
+    nc = NutCracker(conf, new=new.port, old=old.port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+
+        # a miss falls back to the old pool, and the value is written back
+        assert_equal('1', r.call('GET', 'a'))
+        assert wait_until(lambda: new.data.get('a') == '1')
+        assert_equal('new', r.call('GET', 'b'))
+        assert_equal(None, r.call('GET', 'x'))
+        nc.wait_stat('alpha', 'migrate_writebacks', 1)
+        assert_equal(2, nc.stat('alpha', 'migrate_fallbacks'))
+        assert_equal(1, nc.stat('alpha', 'migrate_fallback_hits'))
+
+        # deletes go to the old pool too, so the value does not come back
+        assert_equal(1, r.call('DEL', 'a'))
+        assert_equal(None, r.call('GET', 'a'))
+        assert_equal(0, r.call('UNLINK', 'c'))
+        assert wait_until(lambda: 'c' not in old.data)
+        assert_equal(None, r.call('GET', 'c'))
+        r.close()
+    finally:
+        nc.stop()
+        new.stop()
+        old.stop()
@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import time
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    {limit}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def run(limit, nclient=1, n=100):
+    '''sec nclient clients take for n GETs each, and the throttles'''
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, limit=limit, server=server.port)
+    try:
+        nc.start()
+        clients = [RedisClient(nc.port) for i in range(nclient)]
+        start = time.time()
+        for i in range(n):
+            for c in clients:
+                assert_equal(None, c.call('GET', 'k'))
+        elapsed = time.time() - start
+        for c in clients:
+            c.close()
+        time.sleep(1.1)
+        return elapsed, nc.stat('alpha', 'client_throttles')
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_client_rate_limit():
+    # a burst of a second's worth, then 50 requests per second
+    elapsed, throttles = run('client_rate_limit: 50')
+    assert 0.7 < elapsed < 2, elapsed
+    assert throttles > 0
+
+def test_client_rate_limit_bytes():
+    # a GET k is 22 bytes, so the same 50 requests per second
+    elapsed, throttles = run('client_rate_limit_bytes: %d' % (50 * 22))
+    assert 0.7 < elapsed < 2, elapsed
+    assert throttles > 0
+
+def test_client_rate_limit_per_client():
+    # each of two clients gets its own budget
+    elapsed, throttles = run('client_rate_limit: 50', nclient=2)
+    assert 0.7 < elapsed < 2, elapsed
+
+def test_rate_limit():
+    # two clients share the budget of the pool
+    elapsed, throttles = run('rate_limit: 50', nclient=2)
+    assert 2.5 < elapsed < 4.5, elapsed
+    assert throttles > 0
+
+def test_no_rate_limit():
+    elapsed, throttles = run('rate_limit: 0')
+    assert elapsed < 0.7, elapsed
@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import threading
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    server_connections: 4
+    server_idle_timeout: {idle}
+    server_connection_lifetime: {lifetime}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def test_idle_timeout():
+    # connections opened under load are closed once idle
+    server = RedisStandIn().start()
+    server.slow['GET'] = 0.2
+    nc = NutCracker(conf, idle=300, lifetime=0, server=server.port)
+    name = '127.0.0.1:%d' % server.port
+    try:
+        nc.start()
+
+        def load():
+            c = RedisClient(nc.port)
+            c.call('GET', 'k')
+            c.close()
+
+        threads = [threading.Thread(target=load) for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        opened = server.nconn
+        assert opened > 1, opened
+
+        assert wait_until(lambda: server.nopen() == 0, 5)
+        nc.wait_stat('alpha', 'server_conn_reaps', opened, name)
+        assert_equal(0, nc.stat('alpha', 'server_err', name))
+
+        # and a later request opens one again
+        r = RedisClient(nc.port)
+        assert_equal('OK', r.call('SET', 'k', 'v'))
+        r.close()
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_connection_lifetime():
+    # a busy connection is closed once it is older than the lifetime
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, idle=0, lifetime=500, server=server.port)
+    name = '127.0.0.1:%d' % server.port
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        assert wait_until(lambda: r.call('SET', 'k', 'v') == 'OK' and
+                          server.nconn > 1, 5)
+        nc.wait_stat('alpha', 'server_conn_reaps', 1, name)
+        assert_equal(0, nc.stat('alpha', 'server_err', name))
+        assert_equal('v', r.call('GET', 'k'))
+        r.close()
+    finally:
+        nc.stop()
+        server.stop()
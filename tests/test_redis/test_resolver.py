@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import signal
+import unittest
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    server_resolve_ttl: 200
+    servers:
+     - {host}:{server}:1
+'''
+
+def need_dns():
+    if not DnsStandIn.usable():
+        raise unittest.SkipTest('no name server stand-in on 127.0.0.1:53')
+
+def test_resolve_ttl():
+    # the address of a hostname follows the name server
+    need_dns()
+    one = RedisStandIn('127.0.0.1').start()
+    two = RedisStandIn('127.0.0.2', one.port).start()
+    dns = DnsStandIn({'redis.test': '127.0.0.1'}).start()
+    nc = NutCracker(conf, host='redis.test', server=one.port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        assert_equal('OK', r.call('SET', 'k', 'v1'))
+        assert_equal('v1', one.data.get('k'))
+
+        dns.table['redis.test'] = '127.0.0.2'
+        nc.wait_stat('alpha', 'server_addr_changes', 1, 'redis.test:%d' % one.port)
+        assert_equal('OK', r.call('SET', 'k', 'v2'))
+        assert_equal('v2', two.data.get('k'))
+        assert_equal('v1', one.data.get('k'))
+        r.close()
+    finally:
+        nc.stop()
+        dns.stop()
+        one.stop()
+        two.stop()
+
+def test_resolve_error_keeps_address():
+    need_dns()
+    one = RedisStandIn().start()
+    dns = DnsStandIn({'redis.test': '127.0.0.1'}).start()
+    nc = NutCracker(conf, host='redis.test', server=one.port)
+    try:
+        nc.start()
+        del dns.table['redis.test']
+        nc.wait_stat('alpha', 'server_resolve_errors', 1, 'redis.test:%d' % one.port)
+
+        r = RedisClient(nc.port)
+        assert_equal('OK', r.call('SET', 'k', 'v'))
+        assert_equal('v', one.data.get('k'))
+        r.close()
+    finally:
+        nc.stop()
+        dns.stop()
+        one.stop()
+
+def test_quit_during_lookup():
+    # a lookup that hangs does not hold up the exit of a worker
+    need_dns()
+    one = RedisStandIn().start()
+    dns = DnsStandIn({'redis.test': '127.0.0.1'}).start()
+    nc = NutCracker(conf, host='redis.test', server=one.port, workers=1)
+    try:
+        nc.start()
+        n = len(dns.log)
+        dns.slow['redis.test'] = 30
+        assert wait_until(lambda: len(dns.log) > n)
+
+        nc.signal(signal.SIGINT)
+        assert wait_until(lambda: not nc.alive(), 3), 'exit waited for the lookup'
+    finally:
+        nc.stop()
+        dns.stop()
+        one.stop()
@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    hash: murmur
+    distribution: ketama
+    auto_eject_hosts: true
+    server_failure_limit: 1
+    server_retry_timeout: 30000
+    read_retries: 1
+    servers:
+     - 127.0.0.1:{s1}:1
+     - 127.0.0.1:{s2}:1
+'''
+
+keys = ['key-%d' % i for i in range(20)]
+
+def test_retry_get():
+    # a GET that fails with its server is answered by the next owner
+    servers = [RedisStandIn().start() for i in range(2)]
+    for s in servers:
+        for k in keys:
+            s.data[k] = 'v-' + k
+    servers[0].fail.add('GET')
+    nc = NutCracker(conf, s1=servers[0].port, s2=servers[1].port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        for k in keys:
+            assert_equal('v-' + k, r.call('GET', k))
+        nc.wait_stat('alpha', 'read_retries', 1)
+        r.close()
+    finally:
+        nc.stop()
+        for s in servers:
+            s.stop()
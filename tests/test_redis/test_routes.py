@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    routes:
+     - "user: beta"
+     - "user:admin: gamma"
+    servers:
+     - 127.0.0.1:{a}:1
+  beta:
+    listen: 127.0.0.1:{port1}
+    redis: true
+    servers:
+     - 127.0.0.1:{b}:1
+  gamma:
+    listen: 127.0.0.1:{port2}
+    {protocol}
+    servers:
+     - 127.0.0.1:{g}:1
+'''
+
+def test_routes():
+    servers = [RedisStandIn().start() for i in range(3)]
+    a, b, g = servers
+    nc = NutCracker(conf, protocol='redis: true', a=a.port, b=b.port,
+                    g=g.port)
+    try:
+        nc.start()
+        r = RedisClient(nc.port)
+        assert_equal('OK', r.call('SET', 'user:1', 'u'))
+        assert_equal('OK', r.call('SET', 'user:admin:1', 'x'))
+        assert_equal('OK', r.call('SET', 'item:1', 'i'))
+
+        # keys go to the pool of their longest prefix, or stay
+        assert_equal({'user:1': 'u'}, b.data)
+        assert_equal({'user:admin:1': 'x'}, g.data)
+        assert_equal({'item:1': 'i'}, a.data)
+
+        # a multi-key request is split across the pools of its keys
+        assert_equal(['i', 'u', 'x', None],
+                     r.call('MGET', 'item:1', 'user:1', 'user:admin:1', 'user:2'))
+        assert_equal(3, r.call('DEL', 'item:1', 'user:1', 'user:admin:1'))
+        assert_equal({}, b.data)
+        r.close()
+    finally:
+        nc.stop()
+        for s in servers:
+            s.stop()
+
+def test_routes_other_protocol():
+    # a route to a pool of another protocol is a conf error
+    nc = NutCracker(conf, protocol='redis: false', a=1, b=2, g=3)
+    rc, out = nc.test_conf()
+    assert rc != 0
+    assert 'gamma' in out, out
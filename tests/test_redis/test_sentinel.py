@@ -0,0 +1,102 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import unittest
+
+from common import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    redis_sentinel: 127.0.0.1:{sentinel}
+    redis_sentinel_master: mymaster
+    servers:
+     - 127.0.0.1:{master}:1 master
+     - 127.0.0.1:{slave}:1
+'''
+
+def test_sentinel_switch_master():
+    old, new, slave = RedisStandIn().start(), RedisStandIn().start(), RedisStandIn().start()
+    sentinel = SentinelStandIn('mymaster', ('127.0.0.1', old.port)).start()
+    nc = NutCracker(conf, sentinel=sentinel.port, master=old.port, slave=slave.port)
+    try:
+        nc.start()
+        assert wait_until(lambda: sentinel.subscribers)
+
+        r = RedisClient(nc.port)
+        assert_equal('OK', r.call('SET', 'k', 'v1'))
+        assert_equal('v1', old.data.get('k'))
+
+        sentinel.switch('127.0.0.1', new.port)
+        nc.wait_stat('alpha', 'master_failovers', 1)
+
+        # the same client goes on, and its writes go to the new master
+        assert_equal('OK', r.call('SET', 'k', 'v2'))
+        assert_equal('v2', new.data.get('k'))
+        assert_equal('v1', old.data.get('k'))
+
+        # and so do the writes of a new client
+        r2 = RedisClient(nc.port)
+        assert_equal('OK', r2.call('SET', 'k2', 'v'))
+        assert_equal('v', new.data.get('k2'))
+        assert_equal(None, old.data.get('k2'))
+
+        # the connections to the old master are closed once drained
+        assert wait_until(lambda: old.nopen() == 0)
+        r.close()
+        r2.close()
+        assert nc.alive()
+    finally:
+        nc.stop()
+        for s in (old, new, slave, sentinel):
+            s.stop()
+
+def test_sentinel_unknown_master():
+    # a failover of a master name the pool does not know is ignored
+    old, new, slave = RedisStandIn().start(), RedisStandIn().start(), RedisStandIn().start()
+    sentinel = SentinelStandIn('other', ('127.0.0.1', old.port)).start()
+    nc = NutCracker(conf, sentinel=sentinel.port, master=old.port, slave=slave.port)
+    try:
+        nc.start()
+        assert wait_until(lambda: sentinel.subscribers)
+        sentinel.switch('127.0.0.1', new.port)
+
+        r = RedisClient(nc.port)
+        assert_equal('OK', r.call('SET', 'k', 'v'))
+        assert_equal('v', old.data.get('k'))
+        assert_equal(0, nc.stat('alpha', 'master_failovers'))
+        r.close()
+    finally:
+        nc.stop()
+        for s in (old, new, slave, sentinel):
+            s.stop()
+
+def test_sentinel_switch_master_hostname():
+    # a master by hostname is looked up off the event loop
+    if not DnsStandIn.usable():
+        raise unittest.SkipTest('no name server stand-in on 127.0.0.1:53')
+    old, new, slave = RedisStandIn().start(), RedisStandIn().start(), RedisStandIn().start()
+    sentinel = SentinelStandIn('mymaster', ('127.0.0.1', old.port)).start()
+    dns = DnsStandIn({'master.test': '127.0.0.1'}).start()
+    nc = NutCracker(conf, sentinel=sentinel.port, master=old.port, slave=slave.port)
+    try:
+        nc.start()
+        assert wait_until(lambda: sentinel.subscribers)
+
+        sentinel.switch('master.test', new.port)
+        nc.wait_stat('alpha', 'master_failovers', 1)
+        assert wait_until(lambda: ('master.test', 1) in dns.log)
+
+        r = RedisClient(nc.port)
+        assert wait_until(lambda: r.call('SET', 'k', 'v') == 'OK')
+        assert_equal('v', new.data.get('k'))
+        r.close()
+    finally:
+        nc.stop()
+        dns.stop()
+        for s in (old, new, slave, sentinel):
+            s.stop()
@@ -0,0 +1,78 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import socket
+import multiprocessing
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+  worker_processes_max: {max}
+  worker_shutdown_timeout: 1
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+PINGS = resp_encode('PING') * 1000
+
+def ping(port, stop):
+    '''pipelined PINGs, which the proxy answers itself, until stop is set'''
+    while not stop.is_set():
+        try:
+            s = socket.create_connection(('127.0.0.1', port), 5)
+            for i in range(100):
+                s.sendall(PINGS)
+                n = 0
+                while n < 7 * 1000:
+                    n += len(s.recv(65536))
+            s.close()
+        except socket.error:
+            pass
+
+def test_autoscale():
+    # a busy worker gets a second one, which is retired once idle again
+    nc = NutCracker(conf, workers=1, max=2, server=free_port())
+    stop = multiprocessing.Event()
+    loaders = [multiprocessing.Process(target=ping, args=(nc.port, stop))
+               for i in range(4)]
+    try:
+        nc.start()
+        assert wait_until(lambda: len(nc.workers()) == 1)
+        for p in loaders:
+            p.start()
+        assert wait_until(lambda: len(nc.workers()) == 2, 35), 'no worker spawned'
+        assert 'spawning worker' in nc.log()
+
+        stop.set()
+        for p in loaders:
+            p.join()
+        assert wait_until(lambda: len(nc.workers()) == 1, 35), 'no worker retired'
+        assert 'retiring worker' in nc.log()
+    finally:
+        stop.set()
+        for p in loaders:
+            if p.is_alive():
+                p.terminate()
+        nc.stop()
+
+def test_autoscale_conf():
+    # worker_processes_max takes auto, and no less than worker_processes
+    nc = NutCracker(conf, workers=1, max='auto', server=1)
+    assert_equal(0, nc.test_conf()[0])
+    nc = NutCracker(conf, workers=2, max=1, server=1)
+    rc, out = nc.test_conf()
+    assert rc != 0
+    assert 'worker_processes_max' in out, out
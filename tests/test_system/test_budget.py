@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import threading
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    server_connections: 4
+    server_connections_total: {total}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def max_open(total):
+    '''the most connections open to a slow server under load from 2 workers'''
+    server = RedisStandIn().start()
+    server.slow['GET'] = 0.1
+    nc = NutCracker(conf, workers=2, total=total, server=server.port)
+    try:
+        nc.start()
+        done = []
+
+        def load():
+            c = RedisClient(nc.port)
+            for i in range(5):
+                c.call('GET', 'k')
+            c.close()
+            done.append(1)
+
+        threads = [threading.Thread(target=load) for i in range(16)]
+        for t in threads:
+            t.daemon = True
+            t.start()
+
+        nopen, conns = 0, 0
+        while len(done) < len(threads):
+            nopen = max(nopen, server.nopen())
+            conns = max(conns, nc.stat('alpha', 'server_connections',
+                                       '127.0.0.1:%d' % server.port))
+            time.sleep(0.05)
+
+        # the server connections stay open, till the next stats interval
+        name = '127.0.0.1:%d' % server.port
+        nc.wait_stat('alpha', 'server_connections', 1, name)
+        return nopen, max(conns, nc.stat('alpha', 'server_connections', name))
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_budget():
+    # the workers together keep to server_connections_total, which the
+    # master adds up in server_connections
+    nopen, conns = max_open(2)
+    assert 0 < nopen <= 2, nopen
+    assert 0 < conns <= 2, conns
+
+def test_no_budget():
+    nopen, conns = max_open(0)
+    assert 2 < nopen <= 8, nopen
+    assert 2 < conns <= 8, conns
+
+def test_budget_per_worker():
+    # the master shows the connections open, the share and the demand of
+    # each worker for a server with a budget
+    server = RedisStandIn().start()
+    server.slow['GET'] = 0.1
+    nc = NutCracker(conf, workers=2, total=2, server=server.port)
+    name = '127.0.0.1:%d' % server.port
+    try:
+        nc.start()
+        done = []
+
+        def load():
+            c = RedisClient(nc.port)
+            for i in range(5):
+                c.call('GET', 'k')
+            c.close()
+            done.append(1)
+
+        threads = [threading.Thread(target=load) for i in range(16)]
+        for t in threads:
+            t.daemon = True
+            t.start()
+
+        used = [0, 0]
+        while len(done) < len(threads):
+            slots = nc.stats()['pools']['alpha']['servers'][name]['workers']
+            assert len(slots) == 2, slots
+            assert sum(s['share'] for s in slots) <= 2, slots
+            assert sum(s['used'] for s in slots) <= 2, slots
+            for w, s in enumerate(slots):
+                used[w] = max(used[w], s['used'])
+            time.sleep(0.05)
+
+        assert sum(used) > 0, used
+    finally:
+        nc.stop()
+        server.stop()
+
+    # a server without a budget has no slots
+    nc = NutCracker(conf, workers=2, total=0, server=server.port)
+    try:
+        nc.start()
+        assert 'workers' not in nc.stats()['pools']['alpha']['servers'][name]
+    finally:
+        nc.stop()
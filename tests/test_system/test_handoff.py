@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import signal
+import socket
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+{auth}
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def reload(nc):
+    '''SIGHUP the master and wait for the old worker to exit'''
+    old = nc.workers()
+    nc.signal(signal.SIGHUP)
+    assert wait_until(lambda: len(nc.workers()) == 1 and nc.workers() != old, 10)
+
+def closed(c, timeout=5):
+    c.sock.settimeout(timeout)
+    try:
+        return c.sock.recv(1) == ''
+    except socket.timeout:
+        return False
+    except socket.error:
+        return True
+
+def test_handoff_idle_client():
+    # an idle client is handed over to the new worker, and stays open
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, workers=1, auth='', server=server.port)
+    try:
+        nc.start()
+        c = RedisClient(nc.port)
+        assert_equal('OK', c.call('SET', 'k', 'v'))
+
+        # the old worker exits once its clients are handed over
+        reload(nc)
+        assert_equal('v', c.call('GET', 'k'))
+        nc.wait_stat('alpha', 'requests', 1, '127.0.0.1:%d' % server.port)
+        c.close()
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_no_handoff_with_auth():
+    # a client of a pool with redis_auth is closed once its request in
+    # flight is answered, as the new worker would not know it to be
+    # authenticated, and not kept open for worker_shutdown_timeout
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, workers=1, auth='    redis_auth: secret',
+                    server=server.port)
+    try:
+        nc.start()
+        c = RedisClient(nc.port)
+        assert_equal('OK', c.call('AUTH', 'secret'))
+        assert_equal('OK', c.call('SET', 'k', 'v'))
+
+        server.slow['GET'] = 1
+        c.send('GET', 'k')
+        time.sleep(0.2)
+        nc.signal(signal.SIGHUP)
+        assert_equal('v', c.reply())
+        assert closed(c), 'client left open'
+        c.close()
+
+        # new clients go to the new worker
+        c = RedisClient(nc.port)
+        assert_equal('OK', c.call('AUTH', 'secret'))
+        assert_equal('v', c.call('GET', 'k'))
+        c.close()
+    finally:
+        nc.stop()
+        server.stop()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import signal
+import sys
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    servers:
+     - 127.0.0.1:{server}:1 {name}
+'''
+
+def load(nc, n):
+    for i in range(n):
+        c = RedisClient(nc.port)
+        assert_equal('OK', c.call('SET', 'k', 'v'))
+        c.close()
+
+def test_merged_stats():
+    # the master adds up the stats of its workers
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, workers=2, server=server.port, name='one')
+    try:
+        nc.start()
+        load(nc, 20)
+        nc.wait_stat('alpha', 'requests', 20, 'one')
+        assert_equal(20, nc.stat('alpha', 'requests', 'one'))
+        assert_equal(2, nc.stats()['workers'])
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_merged_stats_reload():
+    # after a reload to a config of as many pools and servers, the stats
+    # are those of the new workers under the new names
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, workers=2, server=server.port, name='one')
+    try:
+        nc.start()
+        load(nc, 5)
+        nc.wait_stat('alpha', 'requests', 5, 'one')
+
+        nc.fields['name'] = 'two'
+        nc.write(conf)
+        nc.signal(signal.SIGHUP)
+        assert wait_until(lambda: 'two' in nc.stats()['pools']['alpha']['servers'])
+        load(nc, 3)
+        nc.wait_stat('alpha', 'requests', 3, 'two')
+        st = nc.stats()
+        assert_equal(3, st['pools']['alpha']['servers']['two']['requests'])
+        assert 'one' not in st['pools']['alpha']['servers']
+        assert_equal(2, st['workers'])
+    finally:
+        nc.stop()
+        server.stop()
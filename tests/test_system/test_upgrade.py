@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import signal
+import socket
+import threading
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+
+from utils import *
+from standin import *
+from nutcracker import NutCracker, GLOBAL
+
+conf = GLOBAL + '''
+  worker_shutdown_timeout: 2
+pools:
+  alpha:
+    listen: 127.0.0.1:{port}
+    redis: true
+    servers:
+     - 127.0.0.1:{server}:1
+'''
+
+def test_upgrade():
+    # the new binary takes over the listening socket, so no connection is
+    # refused, and the old master exits once the new one runs
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, workers=1, server=server.port)
+    try:
+        nc.start()
+        old = nc.pid()
+        stop, errors = [], []
+
+        def connect():
+            while not stop:
+                try:
+                    c = RedisClient(nc.port)
+                    if c.call('SET', 'k', 'v') != 'OK':
+                        errors.append('SET failed')
+                    c.close()
+                except socket.error as e:
+                    errors.append(e)
+
+        t = threading.Thread(target=connect)
+        t.start()
+        try:
+            nc.signal(signal.SIGUSR2)
+            assert wait_until(lambda: nc.pid() != old, 10)
+            assert wait_until(lambda: not nc.alive(), 10), 'old master runs'
+            assert os.path.exists(nc.path + '.pid')
+            assert not os.path.exists(nc.path + '.pid.oldbin')
+            assert wait_until(lambda: len(nc.workers()) == 1, 10)
+        finally:
+            stop.append(1)
+            t.join()
+        assert_equal([], errors)
+
+        assert_equal('OK', RedisClient(nc.port).call('SET', 'k', 'v'))
+        assert 'pools' in nc.stats()
+    finally:
+        nc.stop()
+        server.stop()
+
+def test_upgrade_failed():
+    # a new binary that does not start leaves the old master serving
+    server = RedisStandIn().start()
+    nc = NutCracker(conf, workers=1, server=server.port)
+    try:
+        nc.start()
+        old = nc.pid()
+        with open(nc.path + '.yml', 'a') as f:
+            f.write('    bad_directive: 1\n')
+        nc.signal(signal.SIGUSR2)
+        assert wait_until(lambda: 'upgrade aborted' in nc.log(), 10)
+        assert nc.alive()
+        assert not os.path.exists(nc.path + '.pid.oldbin')
+        assert_equal(old, nc.pid())
+        assert_equal('OK', RedisClient(nc.port).call('SET', 'k', 'v'))
+    finally:
+        nc.stop()
+        server.stop()